@@ -112,14 +112,19 @@ Address Region::expand(size_t bytes) {
 
 External::External() : prev_(this), next_(this) {}
 
-External::External(Store *store) {
-  store->RegisterExternal(this);
+External::External(Store *store) : prev_(this), next_(this) {
+  if (store != nullptr) store->RegisterExternal(this);
 }
 
 External::~External() {
   Unlink();
 }
 
+void External::Relink(Store *store) {
+  Unlink();
+  if (store != nullptr) store->RegisterExternal(this);
+}
+
 Store::Store() : Store(&kDefaultOptions) {}
 
 Store::Store(const Options *options) : options_(options) {
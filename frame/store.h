@@ -770,9 +770,15 @@ class Root {
 // objects.
 class External {
  public:
+  // Registers external object with store. If the store is null, the object is
+  // not linked to any store.
   explicit External(Store *store);
   virtual ~External();
 
+  // Moves external object to another store, or unlinks it from its current
+  // store if the new store is null.
+  void Relink(Store *store);
+
   // The external object must store the references in a contiguous range between
   // begin and end.
   virtual void GetReferences(Range *range) {
@@ -789,6 +795,7 @@ class External {
   void Unlink() {
     prev_->next_ = next_;
     next_->prev_ = prev_;
+    prev_ = next_ = this;
   }
 
   // External objects are kept in a double-linked circular list.
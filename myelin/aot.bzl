@@ -0,0 +1,53 @@
+# Copyright 2017 Google Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Bazel rule for ahead-of-time compilation of Myelin flows."""
+
+def myelin_aot_library(name, flow, namespace = None, **kwargs):
+  """Compiles a Myelin flow into a C++ library.
+
+  The cells in the flow are compiled with myelin-aot into an object file and a
+  header named <name>.h. For each cell, the header has a function for running
+  the cell computation and the instance size, alignment, and tensor offsets in
+  a namespace named after the cell.
+
+  Args:
+    name: name of the cc_library target.
+    flow: flow file to compile.
+    namespace: C++ namespace and symbol prefix. Defaults to name.
+    **kwargs: extra arguments for the cc_library.
+  """
+  if namespace == None:
+    namespace = name
+  native.genrule(
+    name = name + "_aot",
+    srcs = [flow],
+    outs = [
+      name + ".o",
+      name + ".h",
+    ],
+    tools = ["//myelin:myelin-aot"],
+    cmd = ("$(location //myelin:myelin-aot) --flow=$(location %s) " +
+           "--name=%s --object=$(location %s.o) --header=$(location %s.h)") %
+          (flow, namespace, name, name),
+  )
+  native.cc_library(
+    name = name,
+    srcs = [name + ".o"],
+    hdrs = [name + ".h"],
+    linkopts = [
+      "-lm",
+    ],
+    **kwargs
+  )
@@ -0,0 +1,281 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "myelin/aot.h"
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+
+#include "base/logging.h"
+#include "file/file.h"
+#include "string/printf.h"
+#include "third_party/jit/cpu.h"
+
+namespace sling {
+namespace myelin {
+
+AotWriter::AotWriter(const string &name) : name_(name) {
+  text_ = elf_.AddSection(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                          jit::CPU::CacheLineSize());
+  rodata_ = elf_.AddSection(".rodata", SHT_PROGBITS, SHF_ALLOC,
+                            jit::CPU::CacheLineSize());
+  data_ = elf_.AddSection(".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
+                          jit::CPU::CacheLineSize());
+
+  // Mark the stack as non-executable.
+  elf_.AddSection(".note.GNU-stack", SHT_PROGBITS, 0, 1);
+}
+
+bool AotWriter::AddNetwork(const Network &network) {
+  // Index constants by data address for resolving references from the code.
+  for (Tensor *tensor : network.constants()) {
+    if (tensor->data() != nullptr) constants_[tensor->data()] = tensor;
+  }
+
+  // Add shared code for steps to code section. The shared code has no
+  // absolute addresses, so it does not need to be relocated.
+  const jit::Code &shared = network.shared_code();
+  shared_code_ = nullptr;
+  if (shared.size() > 0) {
+    shared_code_ = &shared;
+    shared_base_ = elf_.AddData(text_, shared.begin(), shared.size(),
+                                jit::CPU::CacheLineSize());
+  }
+
+  for (Cell *cell : network.cells()) {
+    // Only cells running serially on the host are supported.
+    if (cell->num_tasks() > 0) {
+      LOG(ERROR) << "Cell " << cell->name() << " has parallel tasks";
+      return false;
+    }
+    if (cell->device_instance_size() > 0) {
+      LOG(ERROR) << "Cell " << cell->name() << " uses device memory";
+      return false;
+    }
+
+    // Add code for cell to code section. The absolute addresses in the code
+    // are cleared and replaced by relocations.
+    const jit::Code &code = cell->code();
+    uint64 base = elf_.AddData(text_, code.begin(), code.size(),
+                               jit::CPU::CacheLineSize());
+    for (int pos : cell->externs()) {
+      const void *address =
+          *reinterpret_cast<const void * const *>(code.begin() + pos);
+      memset(&text_->content[base + pos], 0, sizeof(void *));
+      if (!AddReloc(base + pos, address, code, base)) return false;
+    }
+
+    // Add symbol for cell function.
+    string symbol = name_ + "_" + Identifier(cell->name());
+    elf_.AddSymbol(symbol, text_, STT_FUNC, STB_GLOBAL, base, code.size());
+    StringAppendF(&declarations_, "void %s(void *instance);\n",
+                  symbol.c_str());
+
+    // Get parameters in instance in offset order.
+    std::vector<Tensor *> params;
+    for (Tensor *t : network.parameters()) {
+      if (t->cell() != cell || !(t->placement() & HOST)) continue;
+      if (t->offset() == -1) continue;
+      params.push_back(t);
+    }
+    std::stable_sort(params.begin(), params.end(), [](Tensor *a, Tensor *b) {
+      return a->offset() < b->offset();
+    });
+
+    // Add definitions for cell.
+    string &h = definitions_;
+    StringAppendF(&h, "// Cell %s.\n", cell->name().c_str());
+    StringAppendF(&h, "namespace %s {\n\n", Identifier(cell->name()).c_str());
+    h.append("// Size and alignment of instance data block. The instance must "
+             "be cleared\n// to zero before the first computation.\n");
+    StringAppendF(&h, "const size_t kInstanceSize = %lu;\n",
+                  cell->instance_size());
+    StringAppendF(&h, "const size_t kInstanceAlignment = %d;\n\n",
+                  cell->instance_alignment());
+    if (cell->dynamic()) {
+      h.append("// Offset of the runtime batch size (int64) in the instance. "
+               "The batch size\n// must be set before each computation.\n");
+      StringAppendF(&h, "const size_t kBatchSizeOffset = %d;\n",
+                    cell->batch_offset());
+      StringAppendF(&h, "const int kMaxBatchSize = %d;\n\n",
+                    cell->max_batch_size());
+    }
+    h.append("// Offsets of tensors in instance data block. Intermediate "
+             "tensors can share\n// space with other tensors that are not "
+             "live at the same time.\n");
+    std::unordered_set<string> names;
+    for (Tensor *t : params) {
+      string id = Identifier(t->name());
+      string unique = id;
+      for (int n = 1; names.count(unique) > 0; ++n) {
+        unique = id + "_" + std::to_string(n);
+      }
+      names.insert(unique);
+      StringAppendF(&h, "const size_t %s = %lu;  // %s%s\n",
+                    unique.c_str(), t->offset(), t->TypeString().c_str(),
+                    t->ref() ? " reference" : "");
+    }
+    h.append("\n// Run cell computation on instance.\n");
+    StringAppendF(&h, "inline void Compute(void *instance) { %s(instance); }\n",
+                  symbol.c_str());
+    StringAppendF(&h, "\n}  // namespace %s\n\n",
+                  Identifier(cell->name()).c_str());
+  }
+
+  return true;
+}
+
+uint64 AotWriter::AddConstant(const Tensor *tensor) {
+  auto f = offsets_.find(tensor);
+  if (f != offsets_.end()) return f->second;
+
+  // Use the same alignment as for constants allocated by the network.
+  int align = tensor->byte_alignment();
+  if (align < kMinDataAlignment) align = kMinDataAlignment;
+  if (align < jit::CPU::CacheLineSize()) align = jit::CPU::CacheLineSize();
+  uint64 offset = elf_.AddData(DataSection(tensor), tensor->data(),
+                               tensor->size(), align);
+  offsets_[tensor] = offset;
+  VLOG(5) << "Constant " << tensor->name() << " at " << offset;
+  return offset;
+}
+
+bool AotWriter::AddReloc(uint64 offset, const void *address,
+                         const jit::Code &code, uint64 base) {
+  const char *addr = static_cast<const char *>(address);
+
+  // Address of code in the cell itself.
+  const char *start = reinterpret_cast<const char *>(code.begin());
+  const char *end = reinterpret_cast<const char *>(code.end());
+  if (addr >= start && addr < end) {
+    Relocate(offset, text_->symbol, base + (addr - start), false);
+    return true;
+  }
+
+  // Address of shared code for steps.
+  if (shared_code_ != nullptr) {
+    const char *start = reinterpret_cast<const char *>(shared_code_->begin());
+    const char *end = reinterpret_cast<const char *>(shared_code_->end());
+    if (addr >= start && addr < end) {
+      Relocate(offset, text_->symbol, shared_base_ + (addr - start), false);
+      return true;
+    }
+  }
+
+  // Address of constant tensor data.
+  auto f = constants_.upper_bound(addr);
+  if (f != constants_.begin()) {
+    --f;
+    const Tensor *tensor = f->second;
+    if (addr < f->first + tensor->size()) {
+      uint64 data = AddConstant(tensor);
+      Relocate(offset, DataSection(tensor)->symbol, data + (addr - f->first),
+               false);
+      return true;
+    }
+  }
+
+  // Address of external function or data that the linker can resolve.
+  Dl_info info;
+  if (dladdr(address, &info) != 0 &&
+      info.dli_sname != nullptr &&
+      info.dli_saddr != nullptr) {
+    Elf::Symbol *symbol = elf_.FindSymbol(info.dli_sname);
+    if (symbol == nullptr) {
+      symbol = elf_.AddSymbol(info.dli_sname, nullptr,
+                              STT_NOTYPE, STB_GLOBAL, 0, 0);
+    }
+    const char *saddr = static_cast<const char *>(info.dli_saddr);
+    Relocate(offset, symbol, addr - saddr, true);
+    return true;
+  }
+
+  LOG(ERROR) << "Cannot resolve address " << address << " in generated code";
+  return false;
+}
+
+void AotWriter::Relocate(uint64 offset, Elf::Symbol *symbol, int64 addend,
+                         bool external) {
+  // Check for a movabs instruction (REX.W B8+r imm64) loading the address.
+  CHECK_GE(offset, 2);
+  uint8 *insn = reinterpret_cast<uint8 *>(&text_->content[offset - 2]);
+  bool movabs = (insn[0] & 0xFE) == 0x48 && (insn[1] & 0xF8) == 0xB8;
+  if (!movabs || (external && addend != 0)) {
+    // Use absolute address.
+    elf_.AddReloc(text_, offset, symbol, addend, R_X86_64_64);
+    return;
+  }
+
+  // Replace the ten byte movabs instruction with a seven byte pc-relative
+  // instruction followed by a three byte nop. Local addresses are computed
+  // with lea, and external addresses are loaded from the global offset table.
+  int reg = insn[1] & 7;
+  int rexb = insn[0] & 1;
+  insn[0] = 0x48 | (rexb << 2);     // REX.W with REX.R for register
+  insn[1] = external ? 0x8B : 0x8D;  // mov or lea
+  insn[2] = 0x05 | (reg << 3);       // modrm for [rip+disp32]
+  memset(insn + 3, 0, 4);            // disp32
+  insn[7] = 0x0F;                    // nop
+  insn[8] = 0x1F;
+  insn[9] = 0x00;
+
+  // The displacement is relative to the end of the instruction, which is four
+  // bytes after the displacement.
+  elf_.AddReloc(text_, offset + 1, symbol, addend - 4,
+                external ? R_X86_64_GOTPCREL : R_X86_64_PC32);
+}
+
+bool AotWriter::WriteObjectFile(const string &filename) {
+  return elf_.Write(filename);
+}
+
+bool AotWriter::WriteHeader(const string &filename) {
+  string guard = Identifier(name_) + "_H_";
+  for (char &c : guard) c = toupper(c);
+
+  string h;
+  h.append("// Generated by ahead-of-time compilation of Myelin flow. "
+           "Do not edit.\n\n");
+  StringAppendF(&h, "#ifndef %s\n#define %s\n\n", guard.c_str(),
+                guard.c_str());
+  h.append("#include <stddef.h>\n\n");
+  h.append("extern \"C\" {\n");
+  h.append(declarations_);
+  h.append("}\n\n");
+  StringAppendF(&h, "namespace %s {\n\n", name_.c_str());
+  h.append(definitions_);
+  StringAppendF(&h, "}  // namespace %s\n\n", name_.c_str());
+  StringAppendF(&h, "#endif  // %s\n", guard.c_str());
+
+  Status st = File::WriteContents(filename, h);
+  if (!st.ok()) {
+    LOG(ERROR) << "Cannot write header " << filename << ": " << st.ToString();
+    return false;
+  }
+  return true;
+}
+
+string AotWriter::Identifier(const string &name) {
+  string id;
+  for (char c : name) id.push_back(isalnum(c) ? c : '_');
+  if (id.empty() || isdigit(id[0])) id.insert(0, "_");
+  return id;
+}
+
+}  // namespace myelin
+}  // namespace sling
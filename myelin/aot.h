@@ -0,0 +1,113 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MYELIN_AOT_H_
+#define MYELIN_AOT_H_
+
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "base/types.h"
+#include "myelin/compute.h"
+#include "myelin/elf-writer.h"
+
+namespace sling {
+namespace myelin {
+
+// Ahead-of-time compilation of networks. The code generated for the cells in
+// a compiled network is written to an ELF object file together with the
+// constants used by the code. A C++ header declares the entry points for the
+// cells and the layout of the instance data blocks. Programs linking the object
+// file can run the cells without compiling the flow at startup, and the code
+// and constants are in read-only pages that are shared between processes.
+//
+// The generated code is specific to the CPU features of the machine where the
+// network was compiled. Only cells running serially on the host are supported,
+// i.e. the network must be compiled with the default runtime. References to
+// functions outside the generated code, e.g. math library functions, are
+// resolved through the dynamic symbol table, so the compiler program must be
+// linked with -rdynamic.
+class AotWriter {
+ public:
+  // Initialize writer. The name is used as the C++ namespace in the header and
+  // as prefix for the symbols in the object file.
+  explicit AotWriter(const string &name);
+
+  // Add cells in compiled network to object file. Returns false if the network
+  // cannot be compiled ahead-of-time.
+  bool AddNetwork(const Network &network);
+
+  // Write object file.
+  bool WriteObjectFile(const string &filename);
+
+  // Write C++ header with declarations for the cells in the object file.
+  bool WriteHeader(const string &filename);
+
+ private:
+  // Add global tensor to object file and return its offset in its data
+  // section (see DataSection()).
+  uint64 AddConstant(const Tensor *tensor);
+
+  // Return the data section for global tensor. Learnable tensors are updated
+  // by gradient and optimizer cells, so they are placed in the writable data
+  // section. All other constants are placed in the read-only data section.
+  Elf::Section *DataSection(const Tensor *tensor) const {
+    return tensor->learnable() ? data_ : rodata_;
+  }
+
+  // Add relocation for absolute address at offset in the code section. The
+  // code block for the cell is at base in the code section. Returns false if
+  // the address cannot be resolved.
+  bool AddReloc(uint64 offset, const void *address,
+                const jit::Code &code, uint64 base);
+
+  // Add relocation for address loaded by the instruction at offset in the code
+  // section. Loads of 64-bit immediate addresses are rewritten to pc-relative
+  // loads, so the code section does not need to be modified when the program
+  // is loaded.
+  void Relocate(uint64 offset, Elf::Symbol *symbol, int64 addend,
+                bool external);
+
+  // Convert name to C++ identifier.
+  static string Identifier(const string &name);
+
+  // Name used for namespace and symbol prefix.
+  string name_;
+
+  // Object file with code, read-only data, and writable data sections.
+  Elf elf_;
+  Elf::Section *text_;
+  Elf::Section *rodata_;
+  Elf::Section *data_;
+
+  // Constant tensors in network indexed by data address.
+  std::map<const char *, const Tensor *> constants_;
+
+  // Shared code for steps in network and its offset in the code section.
+  const jit::Code *shared_code_ = nullptr;
+  uint64 shared_base_ = 0;
+
+  // Offsets of constants added to the data sections.
+  std::unordered_map<const Tensor *, uint64> offsets_;
+
+  // Generated header declarations.
+  string declarations_;
+  string definitions_;
+};
+
+}  // namespace myelin
+}  // namespace sling
+
+#endif  // MYELIN_AOT_H_
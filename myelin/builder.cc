@@ -30,6 +30,20 @@ Flow::Variable *Builder::Op(const string &op,
   return result;
 }
 
+Flow::Variable *Builder::Op(const string &op,
+                            const std::vector<Flow::Variable *> &args,
+                            Type type, const Shape &shape) {
+  string name = OpName(op);
+  Variable *result = Var(name + ":0", type, shape);
+  flow_->AddOperation(func_, name, op, args, {result});
+  return result;
+}
+
+Flow::Operation *Builder::RawOp(const string &op,
+                                const std::vector<Flow::Variable *> &args) {
+  return flow_->AddOperation(func_, OpName(op), op, args, {});
+}
+
 Flow::Variable *Builder::Constant(const void *data, Type type,
                                   const Shape &shape) {
   Variable *var = Var(OpName("const"), type, shape);
@@ -40,6 +54,17 @@ Flow::Variable *Builder::Constant(const void *data, Type type,
   return var;
 }
 
+Flow::Variable *Builder::Learnable(const string &name, Type type,
+                                   const Shape &shape) {
+  Variable *var = Var(name, type, shape);
+  var->learnable = true;
+  var->size = TypeTraits::of(type).size() * shape.elements();
+  char *buffer = flow_->AllocateMemory(var->size);
+  memset(buffer, 0, var->size);
+  var->data = buffer;
+  return var;
+}
+
 string Builder::OpName(const string &op) {
   string name = func_->name;
   name.push_back('/');
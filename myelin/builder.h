@@ -52,6 +52,13 @@ class Builder {
   // Add operation to function and return output variable.
   Variable *Op(const string &op, const std::vector<Variable *> &args);
 
+  // Add operation to function and return output variable with type and shape.
+  Variable *Op(const string &op, const std::vector<Variable *> &args,
+               Type type, const Shape &shape);
+
+  // Add operation without outputs to function, e.g. for updating variables.
+  Operation *RawOp(const string &op, const std::vector<Variable *> &args);
+
   // Add constant to flow.
   Variable *Constant(const void *data, Type type, const Shape &shape);
   Variable *Constant(float value) { return Constant(&value, DT_FLOAT, {}); }
@@ -65,6 +72,9 @@ class Builder {
     return Constant(value.data(), DT_INT32, {size});
   }
 
+  // Add learnable variable to flow. The variable is initialized to zero.
+  Variable *Learnable(const string &name, Type type, const Shape &shape);
+
   // Builder methods for common operations.
   Variable *Add(Variable *x, Variable *y) { return Op("Add", {x, y}); }
   Variable *Sub(Variable *x, Variable *y) { return Op("Sub", {x, y}); }
@@ -78,6 +88,10 @@ class Builder {
   Variable *Tanh(Variable *x) { return Op("Tanh", {x}); }
   Variable *Sigmoid(Variable *x) { return Op("Sigmoid", {x}); }
   Variable *Relu(Variable *x) { return Op("Relu", {x}); }
+  Variable *Negate(Variable *x) { return Op("Negate", {x}); }
+  Variable *Square(Variable *x) { return Op("Square", {x}); }
+  Variable *Reciprocal(Variable *x) { return Op("Reciprocal", {x}); }
+  Variable *Sqrt(Variable *x) { return Op("Sqrt", {x}); }
 
   Variable *Reshape(Variable *x, Variable *shape) {
     return Op("Reshape", {x, shape});
@@ -86,7 +100,8 @@ class Builder {
   // Return unique name for operation.
   string OpName(const string &op);
 
-  // Return function for builder.
+  // Return flow and function for builder.
+  Flow *flow() const { return flow_; }
   Flow::Function *func() const { return func_; }
 
  private:
@@ -14,16 +14,25 @@
 
 #include "myelin/compute.h"
 
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <algorithm>
 #include <list>
+#include <map>
+#include <queue>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "base/logging.h"
 #include "base/types.h"
 #include "file/file.h"
 #include "myelin/macro-assembler.h"
+#include "myelin/perf-symbols.h"
 
 namespace sling {
 namespace myelin {
@@ -81,6 +90,43 @@ static void MemFree(char *data) {
   free(data);
 }
 
+// Memory policy for preferred allocation on NUMA node (see mbind(2)).
+static const int kMemPolicyPreferred = 1;
+
+// Return number of NUMA nodes on host.
+static int NumaNodes() {
+  // The online nodes are listed as ranges, e.g. "0-1", so the last number is
+  // the highest node number.
+  string online;
+  if (!File::ReadContents("/sys/devices/system/node/online", &online).ok()) {
+    return 1;
+  }
+  size_t pos = online.find_last_of("-,");
+  int last = atoi(online.c_str() + (pos == string::npos ? 0 : pos + 1));
+  return last + 1;
+}
+
+// Return NUMA node for CPU running the current thread.
+static int CurrentNumaNode() {
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+  return node;
+}
+
+// Allocate memory with pages placed on NUMA node. The placement is only a
+// preference, so pages are allocated on other nodes if the node is full.
+static char *MemAllocOnNode(size_t size, int node) {
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK(data != MAP_FAILED) << "Cannot allocate memory, size: " << size;
+  uint64 mask = 1ULL << node;
+  if (syscall(SYS_mbind, data, size, kMemPolicyPreferred, &mask,
+              sizeof(mask) * 8 + 1, 0) != 0) {
+    LOG(WARNING) << "Cannot place memory on NUMA node " << node;
+  }
+  return static_cast<char *>(data);
+}
+
 // Basic runtime for serial execution of cells on a single CPU thread.
 class BasicRuntime : public Runtime {
  public:
@@ -145,11 +191,12 @@ class InstanceAllocator {
       if (placement_ == HOST) {
         CHECK(var->shared_->offset_ != -1)
             << var->name() << " " << var->shared_->name();
-        var->offset_ = var->shared_->offset_;
+        var->offset_ = var->shared_->offset_ + var->shared_offset_;
       } else {
         CHECK(var->shared_->device_offset_ != -1)
             << var->name() << " " << var->shared_->name();
-        var->device_offset_ = var->shared_->device_offset_;
+        var->device_offset_ = var->shared_->device_offset_ +
+                              var->shared_offset_;
       }
       return;
     }
@@ -343,6 +390,137 @@ class InstanceAllocator {
   std::list<std::pair<size_t, size_t>> freelist_;
 };
 
+// An instance planner assigns offsets in the instance data block to variables
+// based on their live ranges. The live ranges form an interval graph and the
+// planner colors the graph with offsets using a best-fit strategy: the largest
+// and longest-lived variables are placed first, and each variable is placed in
+// the smallest gap between the variables it overlaps with. Unlike the instance
+// allocator, this does not depend on the order in which variables are produced
+// and released, and it usually results in smaller instance blocks.
+class InstancePlanner {
+ public:
+  // Initialize instance planner for cell and placement.
+  InstancePlanner(Cell *cell, Placement placement) : placement_(placement) {
+    if (placement == HOST) {
+      instance_size_ = &cell->instance_size_;
+      instance_alignment_ = &cell->instance_alignment_;
+    } else {
+      instance_size_ = &cell->device_instance_size_;
+      instance_alignment_ = &cell->device_instance_alignment_;
+    }
+  }
+
+  // Add variable to plan.
+  void Add(Tensor *var) {
+    if (var->shared_ != nullptr) {
+      shared_.push_back(var);
+    } else {
+      vars_.push_back(var);
+    }
+  }
+
+  // Assign offsets to all the variables in the plan.
+  void Plan() {
+    // Place large variables with long live ranges first.
+    std::sort(vars_.begin(), vars_.end(), [](Tensor *a, Tensor *b) {
+      if (a->space() != b->space()) return a->space() > b->space();
+      int alen = End(a) - a->first_;
+      int blen = End(b) - b->first_;
+      if (alen != blen) return alen > blen;
+      return a->first_ < b->first_;
+    });
+
+    size_t base = *instance_size_;
+    std::vector<Tensor *> placed;
+    std::vector<Tensor *> overlap;
+    for (Tensor *var : vars_) {
+      size_t size = var->space();
+      int align = var->ref_ ? kMinDataAlignment : var->byte_alignment_;
+
+      // Find placed variables with overlapping live ranges in offset order.
+      overlap.clear();
+      for (Tensor *other : placed) {
+        if (var->first_ <= End(other) && other->first_ <= End(var)) {
+          overlap.push_back(other);
+        }
+      }
+      std::sort(overlap.begin(), overlap.end(), [this](Tensor *a, Tensor *b) {
+        return Offset(a) < Offset(b);
+      });
+
+      // Find the smallest gap that can hold the variable. If there is none,
+      // the variable is placed after all the overlapping variables.
+      size_t best = -1;
+      size_t best_gap = -1;
+      size_t start = base;
+      for (Tensor *other : overlap) {
+        size_t aligned = Align(start, align);
+        size_t end = Offset(other);
+        if (aligned + size <= end && end - start < best_gap) {
+          best = aligned;
+          best_gap = end - start;
+        }
+        start = std::max(start, Offset(other) + other->space());
+      }
+      size_t offset = best != -1 ? best : Align(start, align);
+      SetOffset(var, offset);
+      placed.push_back(var);
+
+      // Update instance size and alignment.
+      if (offset + size > *instance_size_) *instance_size_ = offset + size;
+      if (var->byte_alignment_ > *instance_alignment_) {
+        *instance_alignment_ = var->byte_alignment_;
+      }
+    }
+
+    // Shared variables use the offset of the variable they are shared with.
+    for (Tensor *var : shared_) {
+      Tensor *root = var;
+      size_t offset = 0;
+      while (root->shared_ != nullptr) {
+        offset += root->shared_offset_;
+        root = root->shared_;
+      }
+      CHECK(Offset(root) != -1) << var->name() << " " << root->name();
+      SetOffset(var, Offset(root) + offset);
+    }
+  }
+
+ private:
+  // Return the last step where the variable is live.
+  static int End(Tensor *var) {
+    return var->last_ == -1 ? INT_MAX : var->last_;
+  }
+
+  // Get and set variable offset for placement.
+  size_t Offset(Tensor *var) const {
+    return placement_ == HOST ? var->offset_ : var->device_offset_;
+  }
+  void SetOffset(Tensor *var, size_t offset) {
+    if (placement_ == HOST) {
+      var->offset_ = offset;
+    } else {
+      var->device_offset_ = offset;
+    }
+  }
+
+  // Variables are placed in either the host instance data block or the
+  // device instance data block.
+  Placement placement_;
+
+  // Instance size.
+  size_t *instance_size_;
+
+  // Maximum instance alignment.
+  int *instance_alignment_;
+
+  // Variables to place in the instance block.
+  std::vector<Tensor *> vars_;
+
+  // Variables that share space with other variables.
+  std::vector<Tensor *> shared_;
+};
+
 Library::~Library() {
   if (owns_kernels_) {
     for (auto o : kernels_) {
@@ -481,6 +659,16 @@ void Tensor::SetRequiredOrder(Order order) {
   required_order_ = combined_order[required_order_][order];
 }
 
+void Tensor::RequestPacking(TensorPacker *packer) {
+  if (packer_ == nullptr) {
+    packer_ = packer;
+  } else {
+    if (packer_->Layout() != packer->Layout()) packing_conflict_ = true;
+    delete packer;
+  }
+  packing_requests_++;
+}
+
 void Tensor::SetMiniumAlignment(int alignment) {
   byte_alignment_ = LeastCommonMultiple(byte_alignment_, alignment);
 }
@@ -537,9 +725,8 @@ void Channel::resize(int n) {
 }
 
 void Channel::reserve(int n) {
-  // Never remove any existing elements.
-  if (n < size_) return;
-  if (n == capacity_) return;
+  // Keep the existing space if it is big enough.
+  if (n <= capacity_) return;
 
   // Allocate new data buffer.
   char *buffer = MemAlloc(n * connector_->size(), connector_->alignment());
@@ -552,10 +739,13 @@ void Channel::reserve(int n) {
 
   // Set new data buffer.
   data_ = buffer;
+  capacity_ = n;
 }
 
 Instance::Instance(const Cell *cell) : cell_(cell) {
   cell_->runtime()->AllocateInstance(this);
+  set_node(cell_->replicated() ? CurrentNumaNode() : 0);
+  if (cell_->dynamic()) set_batch_size(cell_->max_batch_size());
 }
 
 Instance::~Instance() {
@@ -564,6 +754,190 @@ Instance::~Instance() {
 
 void Instance::Clear() {
   cell_->runtime()->ClearInstance(this);
+  if (cell_->dynamic()) set_batch_size(cell_->max_batch_size());
+}
+
+void Instance::set_node(int node) {
+  node_ = node;
+  code_ = &cell_->code(node);
+}
+
+InstanceBinding::InstanceBinding(const Cell *cell) : cell_(cell) {
+  // Find the host parameters that are not produced by the cell computation.
+  // These are the inputs to the cell, including the profiling counters, and
+  // the memory of these need to be cleared before each computation since the
+  // instance planner can place intermediates from the previous computation in
+  // the same memory.
+  std::vector<std::pair<size_t, size_t>> ranges;
+  for (Tensor *t : cell->network()->parameters()) {
+    if (t->cell() != cell || t->IsConstant() || t->ref()) continue;
+    if (t->producer() != nullptr || !(t->placement() & HOST)) continue;
+    if (t->offset() == -1 || t->space() == 0) continue;
+    ranges.emplace_back(t->offset(), t->offset() + t->space());
+  }
+
+  // Merge overlapping and adjacent ranges.
+  std::sort(ranges.begin(), ranges.end());
+  for (auto &r : ranges) {
+    if (!clear_.empty() && r.first <= clear_.back().second) {
+      clear_.back().second = std::max(clear_.back().second, r.second);
+    } else {
+      clear_.push_back(r);
+    }
+  }
+}
+
+int InstanceBinding::Link(Tensor *param, Channel *channel, int stride) {
+  CHECK(param->ref()) << param->name();
+  CHECK(param->cell() == cell_) << param->name();
+  LinkInfo link;
+  link.offset = param->offset();
+  link.channel = channel;
+  link.stride = stride;
+  link.index = 0;
+  links_.push_back(link);
+  return links_.size() - 1;
+}
+
+void InstanceBinding::Reset(Instance *instance) const {
+  DCHECK(instance->cell() == cell_);
+  char *data = instance->data();
+  for (auto &r : clear_) memset(data + r.first, 0, r.second - r.first);
+  if (cell_->dynamic()) instance->set_batch_size(cell_->max_batch_size());
+}
+
+void InstanceBinding::CheckLinks() {
+  std::unordered_set<size_t> linked;
+  for (const LinkInfo &link : links_) linked.insert(link.offset);
+  for (Tensor *t : cell_->network()->parameters()) {
+    if (t->cell() != cell_ || !t->ref() || t->offset() == -1) continue;
+    CHECK(linked.count(t->offset()) > 0)
+        << "Reference parameter not linked in binding: " << t->name();
+  }
+  checked_ = true;
+}
+
+void InstanceBinding::Bind(Instance *instance, const int *indices) {
+  DCHECK(instance->cell() == cell_);
+  if (!checked_) CheckLinks();
+  for (LinkInfo &link : links_) {
+    link.index = *indices++;
+    Set(instance, link);
+  }
+}
+
+void InstanceBinding::Advance(Instance *instance) {
+  DCHECK(instance->cell() == cell_);
+  for (LinkInfo &link : links_) {
+    link.index += link.stride;
+    Set(instance, link);
+  }
+}
+
+// Copy elements between tensors with the same shape except for the leading
+// dimension, starting from dimension d.
+static void CopyElements(const Tensor *dt, char *dst,
+                         const Tensor *st, const char *src, int d) {
+  int element_size = dt->element_size();
+  if (d == dt->rank()) {
+    memcpy(dst, src, element_size);
+  } else if (d == dt->rank() - 1 &&
+             dt->stride(d) == element_size &&
+             st->stride(d) == element_size) {
+    memcpy(dst, src, dt->dim(d) * element_size);
+  } else {
+    for (int i = 0; i < dt->dim(d); ++i) {
+      CopyElements(dt, dst + i * dt->stride(d),
+                   st, src + i * st->stride(d), d + 1);
+    }
+  }
+}
+
+BatchInstance::BatchInstance(const Cell *batched, const Cell *cell)
+    : batch_(batched) {
+  // Get batch size from the parameters of the batched cell.
+  int batch_size = 0;
+  string prefix = batched->name() + "/";
+  Network *network = batched->network();
+  for (Tensor *t : network->parameters()) {
+    if (t->cell() != batched) continue;
+    if (t->name().compare(0, prefix.size(), prefix) != 0) continue;
+    Tensor *param = network->GetParameter(t->name().substr(prefix.size()));
+    if (param == nullptr || param->cell() != cell) continue;
+
+    // Batched parameters have the batch size as the leading dimension.
+    CHECK_EQ(t->rank(), param->rank()) << t->name();
+    CHECK_EQ(param->dim(0), 1) << param->name();
+    CHECK(t->placement() & HOST) << t->name();
+    CHECK(!t->ref()) << t->name();
+    if (batch_size == 0) batch_size = t->dim(0);
+    CHECK_EQ(t->dim(0), batch_size) << t->name();
+
+    if (param->in()) inputs_.push_back({t, param});
+    if (param->out()) outputs_.push_back({t, param});
+  }
+  elements_.resize(batch_size);
+}
+
+void BatchInstance::Clear() {
+  for (auto &e : elements_) e = nullptr;
+}
+
+void BatchInstance::Compute() {
+  // Find the bound batch elements.
+  int size = 0;
+  int bound = 0;
+  for (int b = 0; b < elements_.size(); ++b) {
+    if (elements_[b] != nullptr) {
+      size = b + 1;
+      bound++;
+    }
+  }
+  if (bound == 0) return;
+
+  // A single instance is computed directly by the original cell, which avoids
+  // copying the inputs and outputs.
+  if (bound == 1) {
+    elements_[size - 1]->Compute();
+    return;
+  }
+
+  // Only compute the batch up to the last bound element if the batch size is
+  // dynamic.
+  if (batch_.cell()->dynamic()) {
+    batch_.set_batch_size(size);
+  } else {
+    size = elements_.size();
+  }
+
+  // Copy inputs from bound instances into batch.
+  for (int b = 0; b < size; ++b) {
+    Instance *instance = elements_[b];
+    if (instance == nullptr) continue;
+    for (const Binding &binding : inputs_) {
+      char *src = instance->data() + binding.param->offset();
+      if (binding.param->ref()) src = *reinterpret_cast<char **>(src);
+      char *dst = batch_.data() + binding.batched->offset() +
+                  b * binding.batched->stride(0);
+      CopyElements(binding.batched, dst, binding.param, src, 1);
+    }
+  }
+
+  // Compute batch.
+  batch_.Compute();
+
+  // Copy outputs from batch to bound instances.
+  for (int b = 0; b < size; ++b) {
+    Instance *instance = elements_[b];
+    if (instance == nullptr) continue;
+    for (const Binding &binding : outputs_) {
+      char *src = batch_.data() + binding.batched->offset() +
+                  b * binding.batched->stride(0);
+      char *dst = instance->data() + binding.param->offset();
+      if (binding.param->ref()) dst = *reinterpret_cast<char **>(dst);
+      CopyElements(binding.param, dst, binding.batched, src, 1);
+    }
+  }
 }
 
 string Instance::ToString(Tensor *param) const {
@@ -666,6 +1040,54 @@ bool Step::AllowInPlace(int input, int output, bool preserved) {
   return true;
 }
 
+bool Step::AllowInputSlice(int input, int output, int axis, int start) {
+  DCHECK_GE(input, 0);
+  DCHECK_LT(input, inputs_.size());
+  DCHECK_GE(output, 0);
+  DCHECK_LT(output, outputs_.size());
+  Tensor *in = inputs_[input];
+  Tensor *out = outputs_[output];
+
+  // The input is overwritten if the output is modified in place later. If the
+  // input is itself stored in place in another tensor, e.g. the input of an
+  // element-wise producer, that tensor is stored in the slice instead.
+  for (;;) {
+    if (in->consumers().size() != 1 || in->out()) return false;
+    if (in->shared_ == nullptr) break;
+    if (in->shared_->shape() != in->shape()) return false;
+    in = in->shared_;
+  }
+  return RequestSlice(in, out, axis, start);
+}
+
+bool Step::AllowOutputSlice(int output, int input, int axis, int start) {
+  DCHECK_GE(input, 0);
+  DCHECK_LT(input, inputs_.size());
+  DCHECK_GE(output, 0);
+  DCHECK_LT(output, outputs_.size());
+  Tensor *in = inputs_[input];
+  Tensor *out = outputs_[output];
+
+  // The input is overwritten if the output is modified in place later.
+  if (in->consumers().size() != 1 || in->out()) return false;
+  return RequestSlice(out, in, axis, start);
+}
+
+bool Step::RequestSlice(Tensor *slice, Tensor *whole, int axis, int start) {
+  if (slice->IsConstant() || whole->IsConstant()) return false;
+  if (slice->ref() || whole->ref()) return false;
+  if (slice->type() != whole->type()) return false;
+  if (slice->rank() != whole->rank()) return false;
+  if (axis < 0 || axis >= whole->rank()) return false;
+  if (start < 0 || start + slice->dim(axis) > whole->dim(axis)) return false;
+  if (slice->shared_ != nullptr || slice->slice_of_ != nullptr) return false;
+
+  slice->slice_of_ = whole;
+  slice->slice_axis_ = axis;
+  slice->slice_start_ = start;
+  return true;
+}
+
 bool Step::NeedsSynchronization() {
   // Only steps running on the host need synchronization.
   if (placement() != HOST) return false;
@@ -697,6 +1119,7 @@ Network::Network() {
 
 Network::~Network() {
   for (auto *m : memory_) MemFree(m);
+  for (auto &r : replicas_) munmap(r.first, r.second);
   for (auto *t : parameters_) delete t;
   for (auto *t : constants_) {
     if (t->shared() == nullptr) {
@@ -722,12 +1145,35 @@ char *Network::AllocateMemory(size_t size, int alignment) {
   return data;
 }
 
+// Log memory usage for cell instance.
+static void LogMemoryUsage(const Cell *cell) {
+  if (!VLOG_IS_ON(3)) return;
+  Cell::MemoryUsage usage = cell->GetMemoryUsage();
+  VLOG(3) << "Cell " << cell->name() << " instance " << usage.instance
+          << " bytes, peak " << usage.peak << " bytes, total "
+          << usage.total << " bytes";
+}
+
+// Log code size for cell.
+static void LogCodeUsage(const Cell *cell) {
+  if (!VLOG_IS_ON(3)) return;
+  Cell::CodeUsage usage = cell->GetCodeUsage();
+  VLOG(3) << "Cell " << cell->name() << " code " << usage.code
+          << " bytes, shared " << usage.shared << " bytes in "
+          << usage.calls << " calls, " << usage.inlined
+          << " bytes without sharing";
+}
+
 static bool CompareUsage(const std::pair<int, Tensor *> &a,
                          const std::pair<int, Tensor *> &b) {
   if (a.first == b.first) {
-    // Inputs are sorted before outputs.
+    // Tensors are sorted before the tensors sharing storage with them.
     Tensor *va = a.second;
     Tensor *vb = b.second;
+    if (vb->shared() == va) return true;
+    if (va->shared() == vb) return false;
+
+    // Inputs are sorted before outputs.
     for (auto *op : va->consumers()) {
       if (op == vb->producer()) return true;
     }
@@ -738,10 +1184,64 @@ static bool CompareUsage(const std::pair<int, Tensor *> &a,
   return a.first < b.first;
 }
 
+// Check if tensor can be stored as a slice of another tensor starting at a
+// position along an axis. The slice must be a contiguous block of the other
+// tensor on the host with no padding, and both tensors must be in the same
+// standard layout.
+static bool Sliceable(const Tensor *slice, const Tensor *whole,
+                      int axis, int start,
+                      const std::vector<Tensor *> &tensors) {
+  if (slice->shared() != nullptr) return false;
+  if (slice->cell() != whole->cell()) return false;
+  if (slice->placement() != HOST || whole->placement() != HOST) return false;
+  if (slice->dynamic() || whole->dynamic()) return false;
+  if (slice->order() != ROW_MAJOR || whole->order() != ROW_MAJOR) return false;
+  if (slice->packer() != nullptr || whole->packer() != nullptr) return false;
+
+  // The dimensions before the axis must be singular, and the dimensions after
+  // the axis must have the same layout in both tensors.
+  if (slice->shape().outer(axis) != 1) return false;
+  if (whole->shape().outer(axis) != 1) return false;
+  for (int d = axis; d < whole->rank(); ++d) {
+    if (d > axis && slice->dim(d) != whole->dim(d)) return false;
+    if (slice->stride(d) != whole->stride(d)) return false;
+  }
+
+  // The slice and all the tensors stored in it must fit in the slice and be
+  // aligned in the other tensor.
+  size_t offset = start * whole->stride(axis);
+  size_t limit = slice->dim(axis) * slice->stride(axis);
+  for (Tensor *t : tensors) {
+    size_t end = t->size();
+    const Tensor *s = t;
+    while (s != slice && s->shared() != nullptr) {
+      end += s->shared_offset();
+      s = s->shared();
+    }
+    if (s != slice) continue;
+    if (end > limit) return false;
+    if (offset % t->byte_alignment() != 0) return false;
+    if (t->rank() != slice->rank()) return false;
+    for (int d = axis; d < slice->rank(); ++d) {
+      if (t->stride(d) != slice->stride(d)) return false;
+    }
+  }
+
+  // The other tensor must not already be stored in the slice.
+  for (Tensor *t = whole->shared(); t != nullptr; t = t->shared()) {
+    if (t == slice) return false;
+  }
+  return true;
+}
+
 bool Network::Compile(const Flow &flow, const Library &library) {
   // Fetch information about the CPU we are running on.
   jit::CPU::Probe();
 
+  // Keep reference to memory-mapped flow file, so constants can use the
+  // data in the mapping directly.
+  mapping_ = flow.mapping();
+
   // Create tensors for all the variables (parameters and constants).
   std::unordered_map<void *, Tensor *> tensors;
   for (Flow::Variable *var : flow.vars()) {
@@ -750,6 +1250,13 @@ bool Network::Compile(const Flow &flow, const Library &library) {
     if (var->data != nullptr) {
       constants_.push_back(tensor);
       tensor->data_ = var->data;
+
+      // Learnable tensors are updated element-wise by the optimizer, so they
+      // are kept dense and in the same order as the parameters.
+      if (var->learnable) {
+        tensor->required_order_ = parameter_element_order_;
+        tensor->require_dense_ = true;
+      }
     } else {
       parameters_.push_back(tensor);
       tensor->required_order_ = parameter_element_order_;
@@ -761,6 +1268,7 @@ bool Network::Compile(const Flow &flow, const Library &library) {
     }
     tensor->type_ = var->type;
     tensor->ref_ = var->ref;
+    tensor->learnable_ = var->learnable;
     tensor->shape_ = var->shape;
     tensor->aligned_ = var->shape;
     tensor->minalign_.fill(var->rank(), 1);
@@ -777,6 +1285,8 @@ bool Network::Compile(const Flow &flow, const Library &library) {
     // Output variables must be available on the host after the computation.
     tensor->out_ = var->out;
     if (var->out) tensor->placement_ = HOST;
+
+    tensor->dynamic_ = var->dynamic;
   }
 
   // Create connectors between variables.
@@ -930,6 +1440,38 @@ bool Network::Compile(const Flow &flow, const Library &library) {
             << step->kernel_->Name();
   }
 
+  // Get the maximum size of the dynamic leading dimension for each cell. All
+  // the variables in a cell with a dynamic dimension have the batch size as
+  // the leading dimension, so variables added by the flow transformations are
+  // also made dynamic.
+  for (Tensor *tensor : parameters_) {
+    if (!tensor->dynamic_ || tensor->cell_ == nullptr) continue;
+    Cell *cell = tensor->cell_;
+    CHECK_GE(tensor->rank(), 1) << tensor->name();
+    if (cell->max_batch_size_ == 0) cell->max_batch_size_ = tensor->dim(0);
+    CHECK_EQ(tensor->dim(0), cell->max_batch_size_) << tensor->name();
+  }
+  for (Tensor *tensor : parameters_) {
+    Cell *cell = tensor->cell_;
+    if (cell == nullptr || cell->max_batch_size_ == 0) continue;
+    if (tensor->rank() == 0 || tensor->ref_) continue;
+    if (tensor->dim(0) == cell->max_batch_size_) tensor->dynamic_ = true;
+  }
+
+  // Let kernels adjust the input and output data alignment requirements.
+  for (Step *step : steps_) {
+    step->kernel_->Adjust(step);
+  }
+
+  // Assign independent steps to parallel tasks. This is done after the kernels
+  // have decided which tensors are shared, and before the profiling tensors
+  // are sized by the number of tasks.
+  if (task_threshold_ > 0 && runtime_->SupportsAsync()) {
+    for (Cell *cell : cells_) {
+      if (cell->tasks_.empty()) ParallelizeCell(cell);
+    }
+  }
+
   // Add tensors for profiling.
   if (profiling_) {
     for (Cell *cell : cells_) {
@@ -955,12 +1497,34 @@ bool Network::Compile(const Flow &flow, const Library &library) {
       parameters_.push_back(profile);
       tensors[profile] = profile;
       cell->profile_ = profile;
-    }
-  }
 
-  // Let kernels adjust the input and output data alignment requirements.
-  for (Step *step : steps_) {
-    step->kernel_->Adjust(step);
+      // Allocate tensor for event ring buffers. There is one ring buffer for
+      // the main computation and one for each task, since these run in
+      // different threads. Each ring buffer has a header with the event
+      // counter followed by the events, all 32 bytes each.
+      if (event_capacity_ > 0) {
+        CHECK_EQ(event_capacity_ & (event_capacity_ - 1), 0)
+            << "Event capacity must be a power of two";
+        size_t rings = 1 + cell->tasks_.size();
+        size_t ring_size = (1 + event_capacity_) * 4;
+        Tensor *events = new Tensor();
+        events->name_ = "events/" + cell->name_;
+        events->cell_ = cell;
+        events->type_ = DT_INT64;
+        events->shape_.assign(rings, ring_size);
+        events->size_ = events->space_ = rings * ring_size * sizeof(int64);
+        events->aligned_ = events->shape_;
+        events->minalign_.assign(1, sizeof(int64));
+        events->stride_.assign(ring_size * sizeof(int64), sizeof(int64));
+        events->placement_ = HOST;
+        events->current_placement_ = HOST;
+        events->in_ = true;
+        events->out_ = true;
+        parameters_.push_back(events);
+        tensors[events] = events;
+        cell->events_ = events;
+      }
+    }
   }
 
   // Propagate alignment between linked tensors.
@@ -1023,6 +1587,35 @@ bool Network::Compile(const Flow &flow, const Library &library) {
     }
   }
 
+  // Negotiate packed layouts for constants. A constant is only packed if all
+  // its consumers have requested the same layout and no other tensors share
+  // storage or alignment with it.
+  std::unordered_set<Tensor *> referenced;
+  for (auto it : tensors) {
+    Tensor *t = it.second;
+    if (t->shared_ != nullptr) referenced.insert(t->shared_);
+    if (t->link_ != nullptr) referenced.insert(t->link_);
+  }
+  for (auto it : tensors) {
+    Tensor *t = it.second;
+    if (t->packer_ == nullptr) continue;
+    bool pack = t->data_ != nullptr &&
+                !t->learnable_ &&
+                !t->packing_conflict_ &&
+                t->packing_requests_ == t->consumers_.size() &&
+                t->shared_ == nullptr &&
+                t->link_ == nullptr &&
+                referenced.count(t) == 0;
+    if (pack) {
+      VLOG(5) << "Pack " << t->name() << " in " << t->packer_->Layout()
+              << " layout";
+    } else {
+      VLOG(5) << "Keep standard layout for " << t->name();
+      delete t->packer_;
+      t->packer_ = nullptr;
+    }
+  }
+
   // Compute tensor sizes.
   for (auto it : tensors) {
     Tensor *tensor = it.second;
@@ -1077,6 +1670,9 @@ bool Network::Compile(const Flow &flow, const Library &library) {
         size *= align;
       }
     }
+    if (tensor->packer_ != nullptr) {
+      size = tensor->packer_->PackedSize(tensor);
+    }
     tensor->size_ = size;
     tensor->space_ = tensor->ref() ? sizeof(void *) : size;
 
@@ -1100,17 +1696,35 @@ bool Network::Compile(const Flow &flow, const Library &library) {
             << " on " << placename[tensor->placement_];
   }
 
+  // Store tensors as slices of other tensors where requested by the kernels.
+  // This is only done if the slice is a contiguous block of the other tensor
+  // with the same layout. Otherwise, the kernel copies the data.
+  for (Tensor *tensor : parameters_) {
+    Tensor *whole = tensor->slice_of_;
+    if (whole == nullptr) continue;
+    tensor->slice_of_ = nullptr;
+    int axis = tensor->slice_axis_;
+    int start = tensor->slice_start_;
+    if (!Sliceable(tensor, whole, axis, start, parameters_)) continue;
+    tensor->shared_ = whole;
+    tensor->shared_offset_ = start * whole->stride(axis);
+    VLOG(5) << "Store " << tensor->name() << " in " << whole->name()
+            << " at offset " << tensor->shared_offset_;
+  }
+
   // Propagate size and alignment for shared tensors.
   for (auto it : tensors) {
     Tensor *tensor = it.second;
     Tensor *next = tensor->shared_;
+    size_t end = tensor->shared_offset_ + tensor->size_;
     while (next != nullptr) {
-      if (next->size_ < tensor->size_) {
-        next->size_ = tensor->size_;
+      if (next->size_ < end) {
+        next->size_ = end;
       }
       if (next->byte_alignment_ < tensor->byte_alignment_) {
         next->byte_alignment_ = tensor->byte_alignment_;
       }
+      end += next->shared_offset_;
       next = next->shared_;
     }
   }
@@ -1143,6 +1757,7 @@ bool Network::Compile(const Flow &flow, const Library &library) {
     if (t->shared_ != nullptr && t->shared_->IsConstant()) {
       // Move variable to constant pool.
       VLOG(5) << "Convert " << t->name() << " to constant";
+      t->learnable_ = t->shared_->learnable_;
       it = parameters_.erase(it);
       constants_.push_back(t);
     } else {
@@ -1177,8 +1792,29 @@ bool Network::Compile(const Flow &flow, const Library &library) {
       cell->instance_size_ += sizeof(Task);
     }
 
+    // Allocate runtime size of dynamic dimension in instance.
+    if (cell->max_batch_size_ > 0) {
+      cell->batch_offset_ = cell->instance_size_;
+      cell->instance_size_ += sizeof(int64);
+    }
+
     // Allocate space for variables in instance data blocks.
     cell->data_start_ = cell->instance_size_;
+    if (memory_planning_) {
+      InstancePlanner host_planner(cell, HOST);
+      InstancePlanner device_planner(cell, DEVICE);
+      for (auto &e : enter) {
+        Tensor *var = e.second;
+        if (var->cell_ == cell) {
+          if (var->placement_ & HOST) host_planner.Add(var);
+          if (var->placement_ & DEVICE) device_planner.Add(var);
+        }
+      }
+      host_planner.Plan();
+      device_planner.Plan();
+      LogMemoryUsage(cell);
+      continue;
+    }
     InstanceAllocator host_allocator(cell, HOST);
     InstanceAllocator device_allocator(cell, DEVICE);
     int e = 0;
@@ -1206,6 +1842,7 @@ bool Network::Compile(const Flow &flow, const Library &library) {
       }
       s++;
     }
+    LogMemoryUsage(cell);
   }
 
   // Copy and align constants.
@@ -1219,6 +1856,18 @@ bool Network::Compile(const Flow &flow, const Library &library) {
         tensor->device_data_ = tensor->shared_->device_data_;
         tensor->AddNewPlace(DEVICE);
       }
+    } else if (UseMappedData(tensor)) {
+      // Use constant data in memory-mapped flow file without copying.
+      VLOG(5) << "Use mapped data for " << tensor->name();
+      tensor->AddNewPlace(HOST);
+
+      // Copy constant to device if needed.
+      if (tensor->placement_ & DEVICE) {
+        VLOG(5) << "Copy tensor " << tensor->name() << " to device";
+        tensor->device_data_ = runtime_->CopyTensorToDevice(tensor);
+        CHECK(tensor->device_data_ != DEVICE_NULL);
+        tensor->AddNewPlace(DEVICE);
+      }
     } else {
       // Allocate aligned tensor and copy data.
       tensor->data_ = AllocateTensor(tensor);
@@ -1235,6 +1884,9 @@ bool Network::Compile(const Flow &flow, const Library &library) {
     }
   }
 
+  // Generate shared code for steps with identical code.
+  if (code_sharing_ > 0 && !profiling_) GenerateSharedCode();
+
   // Compile each cell computation.
   for (Cell *cell : cells_) {
     // Create macro assembler for code generation.
@@ -1247,6 +1899,13 @@ bool Network::Compile(const Flow &flow, const Library &library) {
     // Enable timing measurement instrumentation if profiling is active.
     if (profiling_) masm.set_timing(true);
 
+    // Record timing events for main computation in the first ring buffer.
+    Tensor *events = cell->events();
+    if (events != nullptr) {
+      masm.SetEventRing(events->offset(), event_capacity_,
+                        cell->profile()->offset());
+    }
+
     // Insert break point in the beginning of the generated code in debug mode.
     if (debug_) masm.Breakpoint();
 
@@ -1320,8 +1979,17 @@ bool Network::Compile(const Flow &flow, const Library &library) {
         // Generate code for step.
         auto pc = masm.pc_offset();
         VLOG(8) << step->name() << " @ " << reinterpret_cast<uint64 *>(pc);
-        step->kernel_->Generate(step, &masm);
+        if (step->shared_code_offset_ != -1) {
+          // Call shared code for step.
+          jit::Register addr = masm.rr().alloc();
+          masm.movp(addr, shared_code_.begin() + step->shared_code_offset_);
+          masm.call(addr);
+        } else {
+          step->kernel_->Generate(step, &masm);
+        }
         if (masm.pc_offset() == pc) step->noop_ = true;
+        step->code_offset_ = pc;
+        step->code_size_ = masm.pc_offset() - pc;
 
         // No registers are preserved between steps, so reset register
         // allocation.
@@ -1399,6 +2067,14 @@ bool Network::Compile(const Flow &flow, const Library &library) {
       if (task.state == ACTIVE) {
         masm.WaitForTask(task.offset);
         task.state = COMPLETED;
+
+        // Profile task wait.
+        if (profiling_) {
+          int timing = cell->profile()->offset();
+          int tidx = &task - cell->tasks_.data();
+          int slot = 1 + cell->steps_.size() + tidx * 2 + 1;
+          masm.TimeStep(timing + slot * sizeof(int64));
+        }
       }
     }
     if (sync) {
@@ -1420,6 +2096,12 @@ bool Network::Compile(const Flow &flow, const Library &library) {
       // Set entry for task function.
       masm.bind(&task.entry);
 
+      // Record timing events for task in its own ring buffer.
+      if (events != nullptr) {
+        int ring = events->offset() + (task_index + 1) * events->stride(0);
+        masm.SetEventRing(ring, event_capacity_, cell->profile()->offset());
+      }
+
       // Generate parallel task prologue.
       masm.Prologue();
 
@@ -1432,6 +2114,8 @@ bool Network::Compile(const Flow &flow, const Library &library) {
           VLOG(8) << step->name() << " @ " << reinterpret_cast<uint64 *>(pc);
           step->kernel_->Generate(step, &masm);
           if (masm.pc_offset() == pc) step->noop_ = true;
+          step->code_offset_ = pc;
+          step->code_size_ = masm.pc_offset() - pc;
 
           // No registers are preserved between steps, so reset register
           // allocation.
@@ -1471,19 +2155,174 @@ bool Network::Compile(const Flow &flow, const Library &library) {
 
     // Allocate executable code object for generated code.
     cell->code_.Allocate(&masm);
+    cell->externs_ = masm.externs();
     VLOG(5) << cell->name()
             << " entry address: " << cell->code_.entry()
             << " code size: " << cell->code_.size()
             << " data size: " << cell->instance_size();
+    LogCodeUsage(cell);
+
+    // Write symbols for profiling generated code with perf.
+    if (perf_map_) PerfSymbols::WritePerfMap(cell);
+    if (jitdump_) PerfSymbols::WriteJitDump(cell);
   }
 
+  // Replicate constants on NUMA nodes.
+  if (numa_replication_) ReplicateConstants();
+
   return true;
 }
 
+void Network::GenerateSharedCode() {
+  // Generate code for each step in the main task of the cells and group the
+  // steps by kernel, variant, and generated code. The code is the same if the
+  // steps have the same shapes, layouts, and instance offsets. Code with
+  // absolute addresses, e.g. of constants or functions, is not shared.
+  struct Group {
+    std::vector<Step *> steps;  // steps with identical code
+    int size;                   // size of code without data blocks
+  };
+  std::map<string, Group> groups;
+  for (Cell *cell : cells_) {
+    for (Step *step : cell->steps_) {
+      if (step->task_index_ != -1 || step->placement() != HOST) continue;
+      MacroAssembler masm(nullptr, 0);
+      masm.set_runtime(runtime_);
+      if (!masm.rr().usage(cell->register_usage_)) continue;
+      step->kernel_->Generate(step, &masm);
+      int size = masm.pc_offset();
+      if (size < code_sharing_ || !masm.externs().empty()) continue;
+      masm.GenerateDataBlocks();
+
+      string key = step->kernel_->Name() + ":" + step->variant_ + ":";
+      key.append(reinterpret_cast<const char *>(masm.begin()), masm.size());
+      Group &group = groups[key];
+      group.steps.push_back(step);
+      group.size = size;
+    }
+  }
+
+  // Generate shared code for each group of steps with identical code. The
+  // shared code is generated with the register usage of the first step, but
+  // since the code is identical, it only uses registers that are saved by the
+  // cells of all the steps.
+  MacroAssembler masm(nullptr, 0);
+  masm.set_runtime(runtime_);
+  std::vector<PerfSymbols::Symbol> symbols;
+  for (auto &it : groups) {
+    Group &group = it.second;
+    if (group.steps.size() < 2) continue;
+    Step *first = group.steps[0];
+    masm.rr() = Registers();
+    masm.mm().reset();
+    CHECK(masm.rr().usage(first->cell_->register_usage_));
+    int offset = masm.pc_offset();
+    first->kernel_->Generate(first, &masm);
+    masm.ret(0);
+    for (Step *step : group.steps) {
+      step->shared_code_offset_ = offset;
+      step->shared_code_size_ = group.size;
+    }
+
+    // The shared code is named after the first step using it.
+    string name = "shared:" + first->name() + ":" + first->kernel_->Name();
+    symbols.push_back({name, offset, masm.pc_offset() - offset});
+  }
+  if (symbols.empty()) return;
+  masm.GenerateDataBlocks();
+  shared_code_.Allocate(&masm);
+  VLOG(3) << "Shared code for " << symbols.size() << " kernels ("
+          << shared_code_.size() << " bytes)";
+
+  // Write symbols for profiling shared code with perf.
+  const jit::byte *code = shared_code_.begin();
+  if (perf_map_) PerfSymbols::WritePerfMap(code, symbols);
+  if (jitdump_) PerfSymbols::WriteJitDump(code, symbols);
+}
+
+Cell::CodeUsage Cell::GetCodeUsage() const {
+  CodeUsage usage;
+  usage.code = code_.size();
+  usage.shared = 0;
+  usage.calls = 0;
+  usage.inlined = code_.size();
+
+  // Add the size of the shared code called from the steps. Shared code called
+  // from several steps in the cell is only counted once.
+  std::unordered_set<int> called;
+  for (Step *step : steps_) {
+    if (step->shared_code_offset() == -1) continue;
+    if (called.insert(step->shared_code_offset()).second) {
+      usage.shared += step->shared_code_size();
+    }
+    usage.calls++;
+    usage.inlined += step->shared_code_size() - step->code_size();
+  }
+  return usage;
+}
+
+void Network::ReplicateConstants() {
+  int nodes = NumaNodes();
+  if (nodes <= 1) return;
+  CHECK_LE(nodes, 64) << "Too many NUMA nodes";
+
+  // Get data blocks for constants indexed by address. Shared constants are
+  // only copied once.
+  struct Block {
+    size_t size = 0;    // size of data block
+    int alignment = 1;  // alignment of data block
+    size_t offset = 0;  // offset of copy in replica
+  };
+  std::map<const char *, Block> blocks;
+  for (Tensor *tensor : constants_) {
+    if (tensor->data_ == nullptr || tensor->size_ == 0) continue;
+    if (tensor->learnable_) continue;
+    Block &block = blocks[tensor->data_];
+    int alignment = std::max(tensor->byte_alignment_,
+                             static_cast<int>(jit::CPU::CacheLineSize()));
+    block.size = std::max(block.size, tensor->size_);
+    block.alignment = std::max(block.alignment, alignment);
+  }
+  size_t total = 0;
+  for (auto &b : blocks) {
+    b.second.offset = Align(total, b.second.alignment);
+    total = b.second.offset + b.second.size;
+  }
+  if (total == 0) return;
+  VLOG(3) << "Replicate " << blocks.size() << " constants (" << total
+          << " bytes) on " << nodes << " NUMA nodes";
+
+  for (int node = 0; node < nodes; ++node) {
+    // Copy constants to memory on node. The memory is page aligned, so the
+    // copies have the same alignment as the constants.
+    char *memory = MemAllocOnNode(total, node);
+    replicas_.emplace_back(memory, total);
+    for (auto &b : blocks) {
+      memcpy(memory + b.second.offset, b.first, b.second.size);
+    }
+
+    // Make a copy of the code for each cell with the absolute addresses of
+    // the constants relocated to the copies on the node.
+    for (Cell *cell : cells_) {
+      string code(reinterpret_cast<const char *>(cell->code_.begin()),
+                  cell->code_.size());
+      for (int pos : cell->externs_) {
+        const char **ref = reinterpret_cast<const char **>(&code[pos]);
+        auto f = blocks.upper_bound(*ref);
+        if (f == blocks.begin()) continue;
+        --f;
+        if (*ref >= f->first + f->second.size) continue;
+        *ref = memory + f->second.offset + (*ref - f->first);
+      }
+      cell->replicas_.push_back(new jit::Code(&code[0], code.size()));
+    }
+  }
+}
+
 bool Network::Compile(const string &flowfile, const Library &library) {
-  // Load flow file.
+  // Map flow file into memory.
   Flow flow;
-  if (!flow.Load(flowfile).ok()) {
+  if (!flow.Map(flowfile).ok()) {
     LOG(ERROR) << "Error loading flow file " << flowfile;
     return false;
   }
@@ -1519,13 +2358,242 @@ void Network::ComputeLiveRanges() {
     }
   }
 
+  // Steps in tasks run in parallel with the other steps in the cell, so the
+  // variables used by these steps must be live for the whole cell computation.
+  std::unordered_map<Cell *, std::pair<int, int>> ranges;
+  for (int i = 0; i < steps_.size(); ++i) {
+    Cell *cell = steps_[i]->cell_;
+    auto f = ranges.find(cell);
+    if (f == ranges.end()) {
+      ranges[cell] = std::make_pair(i, i);
+    } else {
+      f->second.second = i;
+    }
+  }
+  for (Step *step : steps_) {
+    if (step->task_index_ == -1) continue;
+    auto &range = ranges[step->cell_];
+    for (Tensor *input : step->inputs_) {
+      if (input->first_ > range.first) input->first_ = range.first;
+      if (!input->out_) input->last_ = std::max(input->last_, range.second);
+    }
+    for (Tensor *output : step->outputs_) {
+      if (output->first_ > range.first) output->first_ = range.first;
+      if (!output->out_) output->last_ = std::max(output->last_, range.second);
+    }
+  }
+
   // Extend live range for all shared variables.
   for (Tensor *t : parameters_) {
-    if (t->shared_ != nullptr) {
-      if (t->first_ < t->shared_->first_) t->shared_->first_ = t->first_;
-      if (t->last_ > t->shared_->last_) t->shared_->last_ = t->last_;
+    for (Tensor *s = t->shared_; s != nullptr; s = s->shared_) {
+      if (t->first_ < s->first_) s->first_ = t->first_;
+      if (t->last_ > s->last_) s->last_ = t->last_;
+    }
+  }
+}
+
+// Return the tensor updated in place by a step, or null if the step only
+// writes to its outputs. Steps with no outputs, like Assign, ScatterAdd, and
+// AssignAddMatMul, update their first input.
+static Tensor *UpdatedTensor(Step *step) {
+  if (!step->outputs().empty() || step->inputs().empty()) return nullptr;
+  return step->input(0);
+}
+
+// Check if step can be run in a parallel task.
+static bool Parallelizable(Step *step, int64 threshold,
+                           const std::unordered_set<Tensor *> &updated) {
+  if (step->kernel()->Location() != HOST) return false;
+  if (step->complexity() < threshold) return false;
+  if (UpdatedTensor(step) != nullptr) return false;
+  for (Tensor *input : step->inputs()) {
+    if (updated.count(input) > 0) return false;
+  }
+  for (Tensor *input : step->inputs()) {
+    if (input->ref()) return false;
+  }
+  for (Tensor *output : step->outputs()) {
+    if (output->ref()) return false;
+  }
+  return true;
+}
+
+void Network::ParallelizeCell(Cell *cell) {
+  std::vector<Step *> &steps = cell->steps_;
+  int n = steps.size();
+  std::unordered_map<Step *, int> index;
+  for (int i = 0; i < n; ++i) index[steps[i]] = i;
+
+  // Find the direct dependencies of each step. Besides the producers of the
+  // inputs, steps that update a tensor in place must stay ordered with all
+  // the other steps using the tensor.
+  std::vector<std::vector<int>> preds(n);
+  std::vector<std::vector<int>> succs(n);
+  auto depend = [&](int i, int p) {
+    if (std::find(preds[i].begin(), preds[i].end(), p) != preds[i].end()) {
+      return;
+    }
+    preds[i].push_back(p);
+    succs[p].push_back(i);
+  };
+  std::unordered_set<Tensor *> updated;
+  for (int i = 0; i < n; ++i) {
+    for (Tensor *input : steps[i]->inputs()) {
+      auto f = index.find(input->producer());
+      if (f != index.end()) depend(i, f->second);
+    }
+    Tensor *t = UpdatedTensor(steps[i]);
+    if (t != nullptr) updated.insert(t);
+  }
+  for (int i = 0; i < n; ++i) {
+    Tensor *t = UpdatedTensor(steps[i]);
+    if (t == nullptr) continue;
+    for (int j = 0; j < n; ++j) {
+      if (j == i) continue;
+      const auto &inputs = steps[j]->inputs();
+      if (std::find(inputs.begin(), inputs.end(), t) == inputs.end()) continue;
+      if (j < i) {
+        depend(i, j);
+      } else {
+        depend(j, i);
+      }
+    }
+  }
+
+  // Compute the steps in the cell that each step depends on.
+  std::vector<std::vector<bool>> ancestors(n, std::vector<bool>(n));
+  for (int i = 0; i < n; ++i) {
+    for (int p : preds[i]) {
+      ancestors[i][p] = true;
+      for (int j = 0; j < p; ++j) {
+        if (ancestors[p][j]) ancestors[i][j] = true;
+      }
+    }
+  }
+
+  // Check if a step depends on the output of a parallel task. Such steps must
+  // run in the main task, since tasks cannot wait for other tasks.
+  auto waits = [&](int i) {
+    for (Tensor *input : steps[i]->inputs()) {
+      Step *producer = input->producer();
+      if (producer != nullptr && producer->task_index_ != -1) return true;
+    }
+    return false;
+  };
+
+  // Collect groups of independent steps that are expensive enough to run in
+  // parallel. All the steps in a group except one are assigned to tasks, and
+  // the remaining step runs in the main task while the others are running.
+  std::vector<int> group;
+  auto flush = [&]() {
+    std::vector<int> parallel;
+    bool main = false;
+    for (int i : group) {
+      if (waits(i)) {
+        main = true;
+      } else {
+        parallel.push_back(i);
+      }
+    }
+    if (!main && !parallel.empty()) parallel.pop_back();
+    for (int i : parallel) {
+      Step *step = steps[i];
+      step->task_index_ = cell->tasks_.size();
+      cell->tasks_.emplace_back(cell->tasks_.size() + 1);
+      cell->tasks_.back().placement = HOST;
+      VLOG(3) << "Run " << step->name() << " in task "
+              << cell->tasks_.back().task << ", complexity "
+              << step->complexity();
+    }
+    group.clear();
+  };
+  for (int i = 0; i < n; ++i) {
+    if (!Parallelizable(steps[i], task_threshold_, updated)) continue;
+    for (int g : group) {
+      if (ancestors[i][g]) {
+        flush();
+        break;
+      }
+    }
+    group.push_back(i);
+  }
+  flush();
+  if (cell->tasks_.empty()) return;
+
+  // Set priority for each step. The steps are scheduled in the following
+  // order to allow for as much parallelism as possible:
+  //   4: steps that parallel tasks depend on.
+  //   3: steps in parallel tasks.
+  //   2: steps with no dependencies on parallel tasks.
+  //   1: steps that depend on parallel tasks.
+  std::vector<int> priority(n, 2);
+  for (int i = 0; i < n; ++i) {
+    if (steps[i]->task_index_ != -1) {
+      priority[i] = 3;
+      for (int j = 0; j < n; ++j) {
+        if (ancestors[i][j] && steps[j]->task_index_ == -1) priority[j] = 4;
+      }
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    if (priority[i] != 2) continue;
+    for (int j = 0; j < i; ++j) {
+      if (ancestors[i][j] && steps[j]->task_index_ != -1) {
+        priority[i] = 1;
+        break;
+      }
     }
   }
+
+  // Reorder the steps in priority order while keeping the dependencies.
+  std::vector<int> missing(n);
+  for (int i = 0; i < n; ++i) missing[i] = preds[i].size();
+  auto order = [&](int a, int b) {
+    if (priority[a] != priority[b]) return priority[a] < priority[b];
+    return a > b;
+  };
+  std::priority_queue<int, std::vector<int>, decltype(order)> ready(order);
+  for (int i = 0; i < n; ++i) {
+    if (missing[i] == 0) ready.push(i);
+  }
+  std::vector<Step *> ordered;
+  while (!ready.empty()) {
+    int i = ready.top();
+    ready.pop();
+    ordered.push_back(steps[i]);
+    for (int c : succs[i]) {
+      if (--missing[c] == 0) ready.push(c);
+    }
+  }
+  CHECK_EQ(ordered.size(), n) << "Cycle in cell " << cell->name();
+
+  // Update the step order in the cell and the network.
+  int next = 0;
+  for (Step *&step : steps_) {
+    if (step->cell_ == cell) step = ordered[next++];
+  }
+  steps = ordered;
+}
+
+bool Network::UseMappedData(const Tensor *tensor) const {
+  // Data must be in the memory-mapped flow file. Learnable tensors are
+  // updated, so these are always copied.
+  if (mapping_ == nullptr) return false;
+  if (tensor->learnable_) return false;
+  if (!mapping_->Contains(tensor->data_, tensor->size_)) return false;
+
+  // Data must be in standard order without padding or custom packing.
+  if (tensor->packer_ != nullptr) return false;
+  if (tensor->rank() > 1 && tensor->order_ != ROW_MAJOR) return false;
+  if (tensor->size_ != tensor->elements() * tensor->element_size()) {
+    return false;
+  }
+
+  // Data must be aligned.
+  int alignment = tensor->byte_alignment_;
+  if (alignment < kMinDataAlignment) alignment = kMinDataAlignment;
+  uint64 address = reinterpret_cast<uint64>(tensor->data_);
+  return address % alignment == 0;
 }
 
 char *Network::AllocateTensor(Tensor *tensor) {
@@ -1541,7 +2609,10 @@ char *Network::AllocateTensor(Tensor *tensor) {
   memset(data, 0, tensor->size_);
 
   // Copy data.
-  if (tensor->rank() == 0 || tensor->rank() == 1) {
+  if (tensor->packer_ != nullptr) {
+    // Pack data into custom layout.
+    tensor->packer_->Pack(tensor, tensor->data_, data);
+  } else if (tensor->rank() == 0 || tensor->rank() == 1) {
     // Vectors and scalars can just be copied regardless of alignment and
     // order.
     memcpy(data, tensor->data_, tensor->size_);
@@ -1602,6 +2673,10 @@ Connector *Network::GetConnector(const string &name) const {
   return nullptr;
 }
 
+Cell::~Cell() {
+  for (auto *r : replicas_) delete r;
+}
+
 Tensor *Cell::GetParameter(const string &name) const {
   return network_->GetParameter(name);
 }
@@ -1618,6 +2693,39 @@ static bool Contains(const std::vector<Tensor *> &v, Tensor *t) {
   return std::find(v.begin(), v.end(), t) != v.end();
 }
 
+Cell::MemoryUsage Cell::GetMemoryUsage() const {
+  MemoryUsage usage;
+  usage.instance = instance_size_;
+  usage.peak = data_start_;
+  usage.total = data_start_;
+
+  // Get variables allocated in host instance data block.
+  std::vector<Tensor *> vars;
+  for (Tensor *t : network_->parameters()) {
+    if (t->cell() != this || t->shared() != nullptr) continue;
+    if (!(t->placement() & HOST) || t->first() == -1) continue;
+    vars.push_back(t);
+    usage.total += t->space();
+  }
+
+  // Find the maximum size of the variables that are live at each step.
+  size_t peak = 0;
+  const std::vector<Step *> &steps = network_->steps();
+  for (int i = 0; i < steps.size(); ++i) {
+    if (steps[i]->cell() != this) continue;
+    size_t live = 0;
+    for (Tensor *t : vars) {
+      if (t->first() <= i && (t->last() == -1 || t->last() >= i)) {
+        live += t->space();
+      }
+    }
+    if (live > peak) peak = live;
+  }
+  usage.peak += peak;
+
+  return usage;
+}
+
 string Cell::ToString() const {
   string str;
   StringAppendF(&str, "cell %s {  // size %lu\n", name_.c_str(), instance_size_);
@@ -15,11 +15,14 @@
 #ifndef MYELIN_COMPUTE_H_
 #define MYELIN_COMPUTE_H_
 
+#include <initializer_list>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "base/types.h"
+#include "myelin/express.h"
 #include "myelin/flow.h"
 #include "string/printf.h"
 #include "third_party/jit/code.h"
@@ -55,6 +58,10 @@ typedef uint64 DevicePtr;
 // Minimum data alignment.
 static const int kMinDataAlignment = sizeof(void *);
 
+// Minimum size of embedding matrices for prefetching rows in lookups. Smaller
+// matrices are likely to stay in the cache.
+static const size_t kPrefetchMinSize = 1 << 20;
+
 // Abstract interface for kernel implementing a code generator for an operation.
 class Kernel {
  public:
@@ -224,10 +231,32 @@ class Runtime {
   virtual InstanceFunc StopProfilerFunc() { return nullptr; }
 };
 
+// A tensor packer rearranges the elements of a constant tensor into a
+// kernel-specific layout, e.g. blocked panels that can be traversed with
+// contiguous aligned loads. The packing is done once when the constant is
+// materialized in the network.
+class TensorPacker {
+ public:
+  virtual ~TensorPacker() = default;
+
+  // Return name of packed layout. Consumers of a tensor must agree on the
+  // layout for the tensor to be packed.
+  virtual string Layout() = 0;
+
+  // Return size in bytes of packed tensor.
+  virtual size_t PackedSize(const Tensor *tensor) = 0;
+
+  // Pack dense row-major tensor data into destination buffer. The destination
+  // buffer is zero-initialized.
+  virtual void Pack(const Tensor *tensor, const char *src, char *dst) = 0;
+};
+
 // A tensor is a multi-dimensional array that can be used for constants and
 // parameters.
 class Tensor {
  public:
+  ~Tensor() { delete packer_; }
+
   // Update minimum alignment constraints for tensor by combining new alignment
   // with existing constraints.
   void MinAlign(const Shape &align);
@@ -263,6 +292,13 @@ class Tensor {
     if (rank() > 1 && dim(0) > 1) SetRequiredOrder(ROW_MAJOR);
   }
 
+  // Request packing of constant tensor into a custom layout. This can be
+  // called from Kernel::Adjust() and the tensor takes ownership of the packer.
+  // The tensor is only packed if all its consumers request the same layout;
+  // otherwise it keeps the standard layout. Kernels must check packed() when
+  // generating code.
+  void RequestPacking(TensorPacker *packer);
+
   // Check if tensor has the same shape as another tensor.
   bool HasSameShape(const Tensor *other) const;
 
@@ -400,17 +436,33 @@ class Tensor {
   Order order() const { return order_; }
   Order required_order() const { return required_order_; }
 
+  // Packer for tensor in custom layout. This returns null if the tensor is
+  // stored in the standard layout.
+  TensorPacker *packer() const { return packer_; }
+
+  // Check if tensor is packed in layout.
+  bool packed(const string &layout) const {
+    return packer_ != nullptr && packer_->Layout() == layout;
+  }
+
   // Other tensor that this tensor shares storage with.
   Tensor *shared() const { return shared_; }
   void set_shared(Tensor *shared) { shared_ = shared; }
 
-  // Check if tensor shares the underlying storage with another tensor.
+  // Check if tensor shares the underlying storage with another tensor, i.e.
+  // both tensors are stored at the same address.
   bool SharedWith(Tensor *other) const {
-    return shared_ == other ||
-           other->shared_ == this ||
-           (shared_ != nullptr && shared_ == other->shared_);
+    return (shared_ == other && shared_offset_ == 0) ||
+           (other->shared_ == this && other->shared_offset_ == 0) ||
+           (shared_ != nullptr && shared_ == other->shared_ &&
+            shared_offset_ == other->shared_offset_);
   }
 
+  // Byte offset of tensor in the storage of the tensor it shares storage with.
+  // This is non-zero for tensors stored as a slice of another tensor, e.g. an
+  // input to a concatenation stored in place in the output.
+  size_t shared_offset() const { return shared_offset_; }
+
   // Other tensor that this tensor shares alignment requirements with.
   Tensor *link() const { return link_; }
   void set_link(Tensor *link) { link_ = link; }
@@ -428,6 +480,17 @@ class Tensor {
   bool in() const { return in_; }
   bool out() const { return out_; }
 
+  // Dynamic tensors have a leading dimension which is bound at runtime for
+  // each instance (see Instance::set_batch_size()). The leading dimension of
+  // the tensor shape is the maximum size. Kernels can either loop over the
+  // runtime extent or compute all the rows.
+  bool dynamic() const { return dynamic_; }
+
+  // Learnable tensors are global tensors with an initial value which is
+  // updated in place by training. The value of a learnable tensor must not be
+  // folded into the generated code or stored in read-only memory.
+  bool learnable() const { return learnable_; }
+
   // Live range for tensor.
   int first() const { return first_; }
   int last() const { return last_; }
@@ -482,9 +545,26 @@ class Tensor {
   Order order_ = ROW_MAJOR;
   Order required_order_ = ANY_ORDER;
 
+  // Packer for custom layout (owned).
+  TensorPacker *packer_ = nullptr;
+
+  // Number of consumers requesting packing and whether the requested layouts
+  // are conflicting.
+  int packing_requests_ = 0;
+  bool packing_conflict_ = false;
+
   // Optional other tensor that this tensor shares storage with.
   Tensor *shared_ = nullptr;
 
+  // Byte offset of tensor in storage of shared tensor.
+  size_t shared_offset_ = 0;
+
+  // Requested position of tensor as a slice of another tensor. The request is
+  // granted when the layouts of the tensors have been determined.
+  Tensor *slice_of_ = nullptr;
+  int slice_axis_ = 0;
+  int slice_start_ = 0;
+
   // Optional other tensor that this tensor shares alignment requirements with.
   Tensor *link_ = nullptr;
 
@@ -508,6 +588,12 @@ class Tensor {
   bool in_ = false;
   bool out_ = false;
 
+  // Tensor has dynamic leading dimension.
+  bool dynamic_ = false;
+
+  // Tensor is a learnable parameter.
+  bool learnable_ = false;
+
   // Live range for tensor, i.e. index of first and last step using the tensor.
   int first_ = -1;
   int last_ = -1;
@@ -522,7 +608,9 @@ class Tensor {
   Placement deferred_placement_ = NOWHERE;
 
   friend class Network;
+  friend class Step;
   friend class InstanceAllocator;
+  friend class InstancePlanner;
 };
 
 // A step represents an operation that is part of a cell.
@@ -597,6 +685,17 @@ class Step {
   // Task index in cell for computing the step.
   int task_index() const { return task_index_; }
 
+  // Offset and size of generated code for step in the cell code block. The
+  // offset is -1 if no code has been generated for the step.
+  int code_offset() const { return code_offset_; }
+  int code_size() const { return code_size_; }
+
+  // Offset and size of the code for step in the shared code block of the
+  // network if the step calls shared code. The offset is -1 if the code for
+  // the step is generated inline in the cell code block.
+  int shared_code_offset() const { return shared_code_offset_; }
+  int shared_code_size() const { return shared_code_size_; }
+
   // Device placement for kernel computation.
   Placement placement() const { return kernel_->Location(); }
 
@@ -611,6 +710,18 @@ class Step {
   // a non-preserved input.
   bool AllowInPlace(int input, int output, bool preserved = false);
 
+  // Allow input to be stored in place as a slice of the output starting at
+  // position 'start' along 'axis', e.g. for concatenation. Returns false if
+  // the slice is not possible, i.e. the operation must be the only consumer of
+  // the input. The input is only shared with the output if the slice is a
+  // contiguous block of the output once the tensor layouts are known, so the
+  // kernel must check the sharing when generating code.
+  bool AllowInputSlice(int input, int output, int axis, int start);
+
+  // Allow output to be stored in place as a slice of the input, e.g. for
+  // splitting. The operation must be the only consumer of the input.
+  bool AllowOutputSlice(int output, int input, int axis, int start);
+
   // A step in the main task that runs on the host but depends on inputs
   // produced on the device needs to be synchronized to ensure that the inputs
   // are ready before executing the task. This method checks if a step needs
@@ -618,6 +729,9 @@ class Step {
   bool NeedsSynchronization();
 
  private:
+  // Request that tensor is stored as a slice of another tensor.
+  static bool RequestSlice(Tensor *slice, Tensor *whole, int axis, int start);
+
    // Step name from flow operation.
    string name_;
 
@@ -652,6 +766,14 @@ class Step {
   // Whether step is a no-op.
   bool noop_ = false;
 
+  // Location of generated code for step in cell code block.
+  int code_offset_ = -1;
+  int code_size_ = 0;
+
+  // Location of code for step in shared code block.
+  int shared_code_offset_ = -1;
+  int shared_code_size_ = 0;
+
   friend class Network;
 };
 
@@ -704,7 +826,7 @@ class Channel {
   // Change size of channel.
   void resize(int n);
 
-  // Reserve space for channel elements.
+  // Reserve space for channel elements. This never shrinks the channel.
   void reserve(int n);
 
   // Return pointer to channel element.
@@ -721,6 +843,9 @@ class Channel {
   // Return the number of elements in the channel.
   int size() const { return size_; }
 
+  // Return the number of elements the channel has space for.
+  int capacity() const { return capacity_; }
+
  private:
   // Data for the channel.
   char *data_ = nullptr;
@@ -889,6 +1014,19 @@ class Instance {
   // Return cell for instance.
   const Cell *cell() const { return cell_; }
 
+  // NUMA node for instance. The instance runs the code for the cell that uses
+  // the constants replicated on this node. If the constants are replicated,
+  // this is initially the node of the thread creating the instance; otherwise
+  // it is node 0.
+  int node() const { return node_; }
+  void set_node(int node);
+
+  // Runtime size of the leading dimension of the dynamic tensors in the
+  // instance. This must not exceed the maximum size of the dynamic dimension.
+  // It is set to the maximum size when the instance is created or cleared.
+  inline int batch_size() const;
+  inline void set_batch_size(int size);
+
   // Return runtime for cell.
   inline Runtime *runtime() const;
 
@@ -910,11 +1048,152 @@ class Instance {
 
   // Cell for instance.
   const Cell *cell_;
+
+  // NUMA node and code for running cell computation on instance.
+  int node_;
+  const jit::Code *code_;
+};
+
+// An instance binding is a precompiled plan for running a cell repeatedly on
+// the same instance, e.g. one step per token in a recurrent network. Instead
+// of clearing the whole instance and setting each reference parameter with
+// Instance::Set() in every step, the binding links the reference parameters
+// to connector channels up front and then binds all of them in one pass from
+// an array of channel indices, or advances the indices by a fixed stride per
+// step. Reset() only clears the parameters that are not produced by any step
+// in the cell, i.e. the inputs, since all other parameters are overwritten by
+// the cell computation. This relies on the kernels writing all the elements of
+// their outputs, e.g. a lookup must clear its output before adding embedding
+// vectors to it. All reference parameters of the cell must be linked,
+// because the instance planner can reuse the memory of a reference parameter
+// for intermediates later in the computation.
+//
+//   InstanceBinding binding(cell);
+//   binding.Link(h_in, &hidden, 1);
+//   binding.Link(h_out, &hidden, 1);
+//   binding.Reset(&data);
+//   binding.Bind(&data, {0, 1});
+//   data.Compute();
+//   for (int i = 1; i < n; ++i) {
+//     binding.Reset(&data);
+//     binding.Advance(&data);
+//     data.Compute();
+//   }
+class InstanceBinding {
+ public:
+  // Compile binding plan for cell.
+  explicit InstanceBinding(const Cell *cell);
+
+  // Link reference parameter to channel. The channel index for the link is
+  // advanced by the stride in each call to Advance(). Returns the link number.
+  int Link(Tensor *param, Channel *channel, int stride = 0);
+
+  // Clear the input parameters in instance. The intermediate and output
+  // parameters, and the references, are left untouched.
+  void Reset(Instance *instance) const;
+
+  // Bind all linked reference parameters in instance to the channel elements
+  // with the indices for each link in link order. The first call checks that
+  // all reference parameters of the cell are linked.
+  void Bind(Instance *instance, const int *indices);
+  void Bind(Instance *instance, std::initializer_list<int> indices) {
+    DCHECK_EQ(indices.size(), links_.size());
+    Bind(instance, indices.begin());
+  }
+
+  // Advance channel indices by the link strides and bind the reference
+  // parameters to the new channel elements. The channels can be resized
+  // between steps.
+  void Advance(Instance *instance);
+
+  // Return current channel index for link.
+  int index(int link) const { return links_[link].index; }
+
+ private:
+  // Link from reference parameter to channel.
+  struct LinkInfo {
+    size_t offset;     // instance offset of reference parameter
+    Channel *channel;  // channel with elements for parameter
+    int stride;        // index increment per step
+    int index;         // current channel index
+  };
+
+  // Bind reference parameter in instance to current channel element for link.
+  static void Set(Instance *instance, const LinkInfo &link) {
+    *reinterpret_cast<char **>(instance->data() + link.offset) =
+        link.channel->at(link.index);
+  }
+
+  // Check that all reference parameters of the cell are linked.
+  void CheckLinks();
+
+  // Cell for binding.
+  const Cell *cell_;
+
+  // Links for reference parameters.
+  std::vector<LinkInfo> links_;
+
+  // Byte ranges in the instance data block cleared by Reset().
+  std::vector<std::pair<size_t, size_t>> clear_;
+
+  // Whether the links have been checked against the reference parameters.
+  bool checked_ = false;
+};
+
+// Batch of instances computed together by a cell compiled from a batched
+// function (see Flow::Batch). Each batch element is bound to an instance of
+// the original cell. Computing the batch copies the inputs from the bound
+// instances into the batch, runs the batched cell computation, and copies the
+// outputs back to the bound instances. This allows the weights to be streamed
+// from memory once per batch instead of once per instance. References in the
+// bound instances, e.g. links to connector channels, are followed when copying
+// inputs and outputs. If the batched cell has a dynamic batch size, only the
+// batch elements up to the last bound element are computed. A batch with a
+// single bound instance is computed by the original cell.
+class BatchInstance {
+ public:
+  // Create batch instance for batched cell with instances of the original
+  // cell as batch elements.
+  BatchInstance(const Cell *batched, const Cell *cell);
+
+  // Batch size.
+  int size() const { return elements_.size(); }
+
+  // Bind batch element to instance of the original cell.
+  void Bind(int index, Instance *instance) { elements_[index] = instance; }
+
+  // Remove all bindings.
+  void Clear();
+
+  // Run batched cell computation on the bound instances.
+  void Compute();
+
+  // Instance for batched cell.
+  Instance *batch() { return &batch_; }
+
+ private:
+  // Mapping between parameter in batched cell and original cell.
+  struct Binding {
+    Tensor *batched;  // parameter in batched cell
+    Tensor *param;    // parameter in original cell
+  };
+
+  // Instance for batched cell.
+  Instance batch_;
+
+  // Instances bound to batch elements.
+  std::vector<Instance *> elements_;
+
+  // Input and output parameter bindings.
+  std::vector<Binding> inputs_;
+  std::vector<Binding> outputs_;
 };
 
 // A cell contains generated code for executing computation of a function.
 class Cell {
  public:
+  ~Cell();
+
   // Cell name from flow function.
   const string &name() const { return name_; }
 
@@ -930,6 +1209,21 @@ class Cell {
   // Code object for compiled cell.
   const jit::Code &code() const { return code_; }
 
+  // Code object for cell with constants replicated on NUMA node. This is the
+  // main code object if the constants are not replicated.
+  const jit::Code &code(int node) const {
+    if (node < 0 || node >= replicas_.size()) return code_;
+    return *replicas_[node];
+  }
+
+  // Check if the code has been replicated on the NUMA nodes.
+  bool replicated() const { return !replicas_.empty(); }
+
+  // Positions of absolute addresses of constants and functions in the
+  // generated code, which need to be relocated when the code is linked
+  // ahead-of-time.
+  const std::vector<int> &externs() const { return externs_; }
+
   // Network that cell is part of.
   Network *network() const { return network_; }
 
@@ -958,9 +1252,45 @@ class Cell {
   // Start of data in instance block.
   size_t data_start() const { return data_start_; }
 
+  // Check if cell has tensors with dynamic leading dimension.
+  bool dynamic() const { return batch_offset_ != -1; }
+
+  // Maximum size of the dynamic leading dimension.
+  int max_batch_size() const { return max_batch_size_; }
+
+  // Offset in instance data block of the runtime size of the dynamic leading
+  // dimension, or -1 if the cell has no dynamic tensors.
+  int batch_offset() const { return batch_offset_; }
+
   // Tensor with profiling information.
   Tensor *profile() const { return profile_; }
 
+  // Tensor with event ring buffers for recording timing events.
+  Tensor *events() const { return events_; }
+
+  // Memory usage for instance data block.
+  struct MemoryUsage {
+    size_t instance;  // size of host instance data block
+    size_t peak;      // maximum size of the variables live at any step
+    size_t total;     // total size of all the variables
+  };
+
+  // Get memory usage for host instance data block. The peak usage is a lower
+  // bound for the instance size with any layout of the variables.
+  MemoryUsage GetMemoryUsage() const;
+
+  // Code size for cell.
+  struct CodeUsage {
+    size_t code;      // size of cell code block
+    size_t shared;    // size of shared code called from cell
+    size_t calls;     // number of steps calling shared code
+    size_t inlined;   // size of cell code block without code sharing
+  };
+
+  // Get code size for cell. This shows the effect of code sharing, where the
+  // code for steps that compile to identical code is only generated once.
+  CodeUsage GetCodeUsage() const;
+
   // Return cell in text format.
   string ToString() const;
 
@@ -994,6 +1324,12 @@ class Cell {
   // Code for running the cell computation.
   jit::Code code_;
 
+  // Positions of absolute addresses in the generated code.
+  std::vector<int> externs_;
+
+  // Code for each NUMA node with addresses relocated to replicated constants.
+  std::vector<jit::Code *> replicas_;
+
   // Size of data instance for cell.
   size_t instance_size_ = 0;
 
@@ -1003,6 +1339,10 @@ class Cell {
   // Start of data in instance block.
   size_t data_start_ = 0;
 
+  // Maximum and instance offset for runtime size of dynamic dimension.
+  int max_batch_size_ = 0;
+  int batch_offset_ = -1;
+
   // Instance alignment.
   int instance_alignment_ = kMinDataAlignment;
   int device_instance_alignment_ = kMinDataAlignment;
@@ -1010,9 +1350,13 @@ class Cell {
   // Tensor with profiling information.
   Tensor *profile_ = nullptr;
 
+  // Tensor with event ring buffers for recording timing events.
+  Tensor *events_ = nullptr;
+
   friend class Network;
   friend class Step;
   friend class InstanceAllocator;
+  friend class InstancePlanner;
 };
 
 // A network is a collection of cells and variables that are compiled as a unit.
@@ -1054,10 +1398,75 @@ class Network {
   // Enable profiling by instrumenting code with timestamp timing code.
   void set_profiling(bool profiling) { profiling_ = profiling; }
 
+  // Enable event recording where the start and end timestamps of each step
+  // are recorded in a ring buffer with room for the last capacity events for
+  // the main computation and each task. The capacity must be a power of two.
+  // This also enables profiling.
+  void set_event_recording(int capacity) {
+    event_capacity_ = capacity;
+    if (capacity > 0) profiling_ = true;
+  }
+
   // Enable dynamic instance allocation which allows instance variables to
   // overlap in the instance data block.
   void set_dynamic_allocation(bool dynamic) { dynamic_allocation_ = dynamic; }
 
+  // Enable memory planning which assigns instance offsets to variables from
+  // their live ranges using best-fit placement. This implies dynamic
+  // allocation and usually results in smaller instances than the greedy
+  // allocator.
+  void set_memory_planning(bool planning) { memory_planning_ = planning; }
+
+  // Automatically assign independent steps to parallel tasks. Only steps with
+  // an estimated complexity of at least 'threshold' operations are run in
+  // tasks, so the work outweighs the cost of starting the task. Cells with
+  // tasks assigned in the flow are not changed. Zero disables automatic
+  // parallelization. This requires a runtime that supports asynchronous
+  // execution.
+  void set_task_threshold(int64 threshold) { task_threshold_ = threshold; }
+
+  // Write symbols for generated code to /tmp/perf-<pid>.map, so the perf tool
+  // can resolve samples in the generated code to cells and kernels.
+  void set_perf_map(bool perf_map) { perf_map_ = perf_map; }
+
+  // Write generated code and symbols to /tmp/jit-<pid>.dump for
+  // 'perf inject --jit'.
+  void set_jitdump(bool jitdump) { jitdump_ = jitdump; }
+
+  // Set number of features ahead for which the embedding rows are prefetched
+  // in lookups. Zero disables prefetching.
+  void set_prefetch_distance(int distance) { prefetch_distance_ = distance; }
+
+  // Return prefetch distance for lookups in embedding matrix. This is zero if
+  // the rows should not be prefetched, e.g. because the matrix is small.
+  int prefetch_distance(const Tensor *embeddings) const {
+    if (embeddings->size() < kPrefetchMinSize) return 0;
+    return prefetch_distance_;
+  }
+
+  // Set precision of the approximations for transcendental functions in the
+  // generated code.
+  void set_precision(MathPrecision precision) { precision_ = precision; }
+  MathPrecision precision() const { return precision_; }
+
+  // Replicate constants on each NUMA node, so instances running on different
+  // sockets read the weights from local memory. The code for each cell is
+  // replicated with the constant addresses relocated to the local copies.
+  // Learnable tensors are not replicated, since they are updated in place.
+  // This has no effect on hosts with a single NUMA node.
+  void set_numa_replication(bool replicate) { numa_replication_ = replicate; }
+
+  // Share code between steps that compile to identical code, e.g. the steps
+  // in structurally identical cells that do not use constants. The code for
+  // these steps is only generated once in a shared code block, which is called
+  // from the cells. Only steps with at least 'min_size' bytes of code are
+  // shared, since each call adds some overhead. Zero disables code sharing.
+  // Code sharing is not used when profiling.
+  void set_code_sharing(int min_size) { code_sharing_ = min_size; }
+
+  // Code block with shared code for steps.
+  const jit::Code &shared_code() const { return shared_code_; }
+
   // Network cells.
   const std::vector<Cell *> cells() const { return cells_; }
 
@@ -1074,9 +1483,27 @@ class Network {
   // Compute live ranges for all the variables.
   void ComputeLiveRanges();
 
+  // Replicate constants on each NUMA node and generate code replicas for the
+  // cells that use the local copies of the constants.
+  void ReplicateConstants();
+
+  // Generate shared code for steps in the main tasks of the cells that
+  // compile to identical code.
+  void GenerateSharedCode();
+
+  // Assign independent steps in cell to parallel tasks and reorder the steps
+  // so the tasks are started as early as possible and waited for as late as
+  // possible.
+  void ParallelizeCell(Cell *cell);
+
   // Allocate aligned tensor from data in standard order.
   char *AllocateTensor(Tensor *tensor);
 
+  // Check if constant tensor can use the data in the memory-mapped flow file
+  // directly, i.e. the data is suitably aligned and already in the layout
+  // needed by the kernels.
+  bool UseMappedData(const Tensor *tensor) const;
+
   // Network cells.
   std::vector<Cell *> cells_;
 
@@ -1098,6 +1525,15 @@ class Network {
   // Memory blocks owned by network.
   std::vector<char *> memory_;
 
+  // Memory blocks with constants replicated on NUMA nodes.
+  std::vector<std::pair<char *, size_t>> replicas_;
+
+  // Shared code for steps that compile to identical code.
+  jit::Code shared_code_;
+
+  // Memory-mapped flow file with data for constants.
+  std::shared_ptr<FlowMapping> mapping_;
+
   // Runtime support.
   Runtime *runtime_;
 
@@ -1105,7 +1541,16 @@ class Network {
   Order parameter_element_order_ = ROW_MAJOR; // element order for parameters
   bool debug_ = false;                        // insert breakpoint in cell
   bool profiling_ = false;                    // enable profiling
+  int event_capacity_ = 0;                    // event ring buffer capacity
   bool dynamic_allocation_ = false;           // dynamic instance allocation
+  bool memory_planning_ = false;              // plan instance memory layout
+  int64 task_threshold_ = 0;                  // minimum complexity for tasks
+  bool perf_map_ = false;                     // write perf map symbols
+  bool jitdump_ = false;                      // write jitdump code records
+  int prefetch_distance_ = 0;                 // prefetch distance for lookups
+  MathPrecision precision_ = MATH_DEFAULT;    // precision of math functions
+  bool numa_replication_ = false;             // replicate constants per node
+  int code_sharing_ = 0;                      // minimum size of shared code
 
   friend class Instance;
 };
@@ -1160,7 +1605,19 @@ inline Runtime *Instance::runtime() const {
 }
 
 inline void Instance::Compute() {
-  cell_->code().Execute(data_);
+  code_->Execute(data_);
+}
+
+inline int Instance::batch_size() const {
+  DCHECK(cell_->dynamic()) << cell_->name();
+  return *reinterpret_cast<int64 *>(data_ + cell_->batch_offset());
+}
+
+inline void Instance::set_batch_size(int size) {
+  DCHECK(cell_->dynamic()) << cell_->name();
+  DCHECK_GE(size, 0);
+  DCHECK_LE(size, cell_->max_batch_size()) << cell_->name();
+  *reinterpret_cast<int64 *>(data_ + cell_->batch_offset()) = size;
 }
 
 inline int Instance::num_tasks() const {
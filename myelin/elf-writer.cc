@@ -0,0 +1,241 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "myelin/elf-writer.h"
+
+#include <string.h>
+
+#include "base/logging.h"
+#include "file/file.h"
+
+namespace sling {
+namespace myelin {
+
+// Add name to string table and return offset of name in table.
+static uint32 AddString(string *table, const string &str) {
+  if (str.empty()) return 0;
+  uint32 offset = table->size();
+  table->append(str);
+  table->push_back(0);
+  return offset;
+}
+
+// Pad string with zeros to alignment.
+static void Pad(string *str, int align) {
+  if (align > 1 && str->size() % align != 0) {
+    str->append(align - str->size() % align, 0);
+  }
+}
+
+Elf::Elf() {}
+
+Elf::~Elf() {
+  for (Section *section : sections_) delete section;
+  for (Symbol *symbol : symbols_) delete symbol;
+}
+
+Elf::Section *Elf::AddSection(const string &name, int type, int flags,
+                              int align) {
+  Section *section = new Section();
+  section->name = name;
+  section->index = sections_.size() + 1;
+  memset(&section->hdr, 0, sizeof(Elf64_Shdr));
+  section->hdr.sh_type = type;
+  section->hdr.sh_flags = flags;
+  section->hdr.sh_addralign = align;
+  sections_.push_back(section);
+
+  // Add section symbol for relocations relative to the section.
+  section->symbol = AddSymbol("", section, STT_SECTION, STB_LOCAL, 0, 0);
+  return section;
+}
+
+Elf::Symbol *Elf::AddSymbol(const string &name, Section *section,
+                            int type, int bind, uint64 offset, uint64 size) {
+  Symbol *symbol = new Symbol();
+  symbol->name = name;
+  memset(&symbol->sym, 0, sizeof(Elf64_Sym));
+  symbol->sym.st_info = ELF64_ST_INFO(bind, type);
+  symbol->sym.st_other = STV_DEFAULT;
+  symbol->sym.st_shndx = section != nullptr ? section->index : SHN_UNDEF;
+  symbol->sym.st_value = offset;
+  symbol->sym.st_size = size;
+  symbols_.push_back(symbol);
+  return symbol;
+}
+
+Elf::Symbol *Elf::FindSymbol(const string &name) const {
+  for (Symbol *symbol : symbols_) {
+    if (symbol->name == name) return symbol;
+  }
+  return nullptr;
+}
+
+uint64 Elf::AddData(Section *section, const void *data, uint64 size,
+                    int align) {
+  Pad(&section->content, align);
+  if (align > section->hdr.sh_addralign) section->hdr.sh_addralign = align;
+  uint64 offset = section->content.size();
+  section->content.append(static_cast<const char *>(data), size);
+  return offset;
+}
+
+void Elf::AddReloc(Section *section, uint64 offset, Symbol *symbol,
+                   int64 addend, int type) {
+  relocations_.push_back({section, offset, symbol, addend, type});
+}
+
+bool Elf::Write(const string &filename) {
+  // Assign symbol indices with the local symbols before the global symbols.
+  std::vector<Symbol *> symtab;
+  for (Symbol *symbol : symbols_) {
+    if (ELF64_ST_BIND(symbol->sym.st_info) == STB_LOCAL) {
+      symtab.push_back(symbol);
+    }
+  }
+  int first_global = symtab.size() + 1;
+  for (Symbol *symbol : symbols_) {
+    if (ELF64_ST_BIND(symbol->sym.st_info) != STB_LOCAL) {
+      symtab.push_back(symbol);
+    }
+  }
+  for (int i = 0; i < symtab.size(); ++i) symtab[i]->index = i + 1;
+
+  // Add relocation sections.
+  std::vector<Section *> sections = sections_;
+  std::vector<Section *> extra;
+  for (Section *section : sections_) {
+    string rela;
+    for (Relocation &r : relocations_) {
+      if (r.section != section) continue;
+      Elf64_Rela entry;
+      entry.r_offset = r.offset;
+      entry.r_info = ELF64_R_INFO(r.symbol->index, r.type);
+      entry.r_addend = r.addend;
+      rela.append(reinterpret_cast<char *>(&entry), sizeof(Elf64_Rela));
+    }
+    if (rela.empty()) continue;
+
+    Section *s = new Section();
+    s->name = ".rela" + section->name;
+    s->index = sections.size() + 1;
+    memset(&s->hdr, 0, sizeof(Elf64_Shdr));
+    s->hdr.sh_type = SHT_RELA;
+    s->hdr.sh_flags = SHF_INFO_LINK;
+    s->hdr.sh_addralign = 8;
+    s->hdr.sh_entsize = sizeof(Elf64_Rela);
+    s->hdr.sh_info = section->index;
+    s->content = rela;
+    sections.push_back(s);
+    extra.push_back(s);
+  }
+
+  // Add symbol table and string tables.
+  Section *symsec = new Section();
+  Section *strsec = new Section();
+  Section *shstrsec = new Section();
+  extra.push_back(symsec);
+  extra.push_back(strsec);
+  extra.push_back(shstrsec);
+  for (Section *s : {symsec, strsec, shstrsec}) {
+    s->index = sections.size() + 1;
+    memset(&s->hdr, 0, sizeof(Elf64_Shdr));
+    sections.push_back(s);
+  }
+  symsec->name = ".symtab";
+  symsec->hdr.sh_type = SHT_SYMTAB;
+  symsec->hdr.sh_addralign = 8;
+  symsec->hdr.sh_entsize = sizeof(Elf64_Sym);
+  symsec->hdr.sh_link = strsec->index;
+  symsec->hdr.sh_info = first_global;
+  strsec->name = ".strtab";
+  strsec->hdr.sh_type = SHT_STRTAB;
+  strsec->hdr.sh_addralign = 1;
+  shstrsec->name = ".shstrtab";
+  shstrsec->hdr.sh_type = SHT_STRTAB;
+  shstrsec->hdr.sh_addralign = 1;
+
+  // Relocation sections refer to the symbol table.
+  for (Section *s : extra) {
+    if (s->hdr.sh_type == SHT_RELA) s->hdr.sh_link = symsec->index;
+  }
+
+  // Build symbol table.
+  strsec->content.push_back(0);
+  Elf64_Sym null;
+  memset(&null, 0, sizeof(Elf64_Sym));
+  symsec->content.append(reinterpret_cast<char *>(&null), sizeof(Elf64_Sym));
+  for (Symbol *symbol : symtab) {
+    Elf64_Sym sym = symbol->sym;
+    sym.st_name = AddString(&strsec->content, symbol->name);
+    symsec->content.append(reinterpret_cast<char *>(&sym), sizeof(Elf64_Sym));
+  }
+
+  // Build section name table.
+  shstrsec->content.push_back(0);
+  for (Section *s : sections) {
+    s->hdr.sh_name = AddString(&shstrsec->content, s->name);
+  }
+
+  // Lay out section contents after the file header.
+  string image(sizeof(Elf64_Ehdr), 0);
+  for (Section *s : sections) {
+    if (s->hdr.sh_type != SHT_NOBITS) {
+      Pad(&image, s->hdr.sh_addralign);
+      s->hdr.sh_offset = image.size();
+      image.append(s->content);
+    }
+    s->hdr.sh_size = s->content.size();
+  }
+
+  // Add section header table.
+  Pad(&image, 8);
+  uint64 shoff = image.size();
+  Elf64_Shdr shdr;
+  memset(&shdr, 0, sizeof(Elf64_Shdr));
+  image.append(reinterpret_cast<char *>(&shdr), sizeof(Elf64_Shdr));
+  for (Section *s : sections) {
+    image.append(reinterpret_cast<char *>(&s->hdr), sizeof(Elf64_Shdr));
+  }
+
+  // Fill in file header.
+  Elf64_Ehdr *ehdr = reinterpret_cast<Elf64_Ehdr *>(&image[0]);
+  memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  ehdr->e_type = ET_REL;
+  ehdr->e_machine = EM_X86_64;
+  ehdr->e_version = EV_CURRENT;
+  ehdr->e_shoff = shoff;
+  ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+  ehdr->e_shentsize = sizeof(Elf64_Shdr);
+  ehdr->e_shnum = sections.size() + 1;
+  ehdr->e_shstrndx = shstrsec->index;
+
+  for (Section *s : extra) delete s;
+
+  // Write object file.
+  Status st = File::WriteContents(filename, image);
+  if (!st.ok()) {
+    LOG(ERROR) << "Cannot write object file " << filename << ": "
+               << st.ToString();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace myelin
+}  // namespace sling
@@ -0,0 +1,98 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MYELIN_ELF_WRITER_H_
+#define MYELIN_ELF_WRITER_H_
+
+#include <elf.h>
+#include <string>
+#include <vector>
+
+#include "base/types.h"
+
+namespace sling {
+namespace myelin {
+
+// Writer for x86-64 ELF relocatable object files. The object file has a
+// section header table, a symbol table, and relocation sections for the
+// sections with relocations. There is no program header table, since object
+// files are linked into executables by the linker.
+class Elf {
+ public:
+  struct Symbol;
+
+  // Section in object file.
+  struct Section {
+    string name;               // section name
+    int index;                 // section index
+    Elf64_Shdr hdr;            // section header
+    string content;            // section content
+    Symbol *symbol = nullptr;  // section symbol for relocations
+  };
+
+  // Symbol in symbol table.
+  struct Symbol {
+    string name;     // symbol name
+    int index = 0;   // symbol index assigned when writing
+    Elf64_Sym sym;   // symbol table entry
+  };
+
+  // Relocation of address in section.
+  struct Relocation {
+    Section *section;  // section with address to relocate
+    uint64 offset;     // offset of address in section
+    Symbol *symbol;    // symbol for address
+    int64 addend;      // offset from symbol
+    int type;          // relocation type
+  };
+
+  Elf();
+  ~Elf();
+
+  // Add section to object file.
+  Section *AddSection(const string &name, int type, int flags, int align);
+
+  // Add symbol to object file. If section is null, the symbol is an undefined
+  // external symbol that is resolved by the linker.
+  Symbol *AddSymbol(const string &name, Section *section,
+                    int type, int bind, uint64 offset, uint64 size);
+
+  // Find symbol by name. Returns null if the symbol is not found.
+  Symbol *FindSymbol(const string &name) const;
+
+  // Append data to section with alignment. Returns offset of data in section.
+  uint64 AddData(Section *section, const void *data, uint64 size, int align);
+
+  // Add relocation of address in section.
+  void AddReloc(Section *section, uint64 offset, Symbol *symbol, int64 addend,
+                int type = R_X86_64_64);
+
+  // Write object file.
+  bool Write(const string &filename);
+
+ private:
+  // Sections in object file.
+  std::vector<Section *> sections_;
+
+  // Symbols in object file.
+  std::vector<Symbol *> symbols_;
+
+  // Relocations in object file.
+  std::vector<Relocation> relocations_;
+};
+
+}  // namespace myelin
+}  // namespace sling
+
+#endif  // MYELIN_ELF_WRITER_H_
@@ -42,6 +42,7 @@ static std::map<string, Express::OpType> optypes = {
   {"LogSigmoid", Express::LOGSIGMOID},
   {"Reciprocal", Express::RECIPROCAL},
   {"Square", Express::SQUARE},
+  {"Sqrt", Express::SQRT},
   {"Log", Express::LOG},
   {"Exp", Express::EXP},
   {"Sigmoid", Express::SIGMOID},
@@ -65,6 +66,9 @@ static std::map<string, Express::OpType> optypes = {
   {"CvtFltInt", Express::CVTFLTINT},
   {"CvtIntFlt", Express::CVTINTFLT},
   {"SubInt", Express::SUBINT},
+  {"HSum", Express::HSUM},
+  {"HMin", Express::HMIN},
+  {"HMax", Express::HMAX},
 };
 
 static const string opname[] = {
@@ -72,7 +76,7 @@ static const string opname[] = {
   "Add", "Sub", "Mul", "Div",
   "Min", "Max",
   "Neg", "Abs", "Relu", "Softsign", "Softplus", "LogSigmoid",
-  "Reciprocal", "Square",
+  "Reciprocal", "Square", "Sqrt",
   "Log", "Exp", "Sigmoid", "Tanh",
   "MulAdd132", "MulAdd213", "MulAdd231",
   "MulSub132", "MulSub213", "MulSub231",
@@ -80,6 +84,7 @@ static const string opname[] = {
   "Shr23", "Shl23",
   "And", "Or", "AndNot",
   "Floor", "CvtFltInt", "CvtIntFlt", "SubInt",
+  "HSum", "HMin", "HMax",
   "???",
 };
 
@@ -275,6 +280,8 @@ class RecipeParser {
       type = Express::TEMP;
     } else if (is('_')) {
       type = Express::NUMBER;
+    } else if (is('&')) {
+      type = Express::SPILL;
     } else {
       Error("Unknown variable type in expression");
     }
@@ -394,6 +401,42 @@ Express::Constant Express::constants[Express::NUM_CONSTANTS] = {
   FLTCONST(1.18534705686654e-04),  // BETA_2
   FLTCONST(2.26843463243900e-03),  // BETA_4
   FLTCONST(4.89352518554385e-03),  // BETA_6
+
+  // Sign bit.
+  INTCONST(0x80000000, 0x8000000000000000LL),  // SIGN_MASK
+
+  // Split of ln(2) for range reduction in strict exponential function.
+  FLTCONST(0.693359375),           // CEPHES_EXP_C1
+  FLTCONST(-2.12194440E-4),        // CEPHES_EXP_C2
+
+  // Polynomial coefficients for strict hyperbolic tangent of small arguments.
+  FLTCONST(0.625),                 // TANH_SMALL
+  FLTCONST(-5.70498872745E-3),     // CEPHES_TANH_P0
+  FLTCONST(2.06390887954E-2),      // CEPHES_TANH_P1
+  FLTCONST(-5.37397155531E-2),     // CEPHES_TANH_P2
+  FLTCONST(1.33314422036E-1),      // CEPHES_TANH_P3
+  FLTCONST(-3.33332819422E-1),     // CEPHES_TANH_P4
+
+  // Minimax polynomial coefficients for fast natural logarithm.
+  FLTCONST(1.1781895824E-1),       // FAST_LOG_P0
+  FLTCONST(-1.8407189648E-1),      // FAST_LOG_P1
+  FLTCONST(2.0442188010E-1),       // FAST_LOG_P2
+  FLTCONST(-2.4943832748E-1),      // FAST_LOG_P3
+  FLTCONST(3.3320860875E-1),       // FAST_LOG_P4
+
+  // Minimax polynomial coefficients for fast exponential function.
+  FLTCONST(4.1277747091E-2),       // FAST_EXP_P0
+  FLTCONST(1.6753513931E-1),       // FAST_EXP_P1
+  FLTCONST(5.0005116027E-1),       // FAST_EXP_P2
+
+  // Coefficients of the 7/6-degree rational approximation for fast tanh.
+  FLTCONST(3.0232481436E-6),       // FAST_TANH_P0
+  FLTCONST(2.0666977754E-3),       // FAST_TANH_P1
+  FLTCONST(1.2058282749E-1),       // FAST_TANH_P2
+  FLTCONST(9.9999409981E-1),       // FAST_TANH_P3
+  FLTCONST(1.2037634743E-4),       // FAST_TANH_Q0
+  FLTCONST(2.0067507118E-2),       // FAST_TANH_Q1
+  FLTCONST(4.5387845931E-1),       // FAST_TANH_Q2
 };
 
 Express::OpType Express::Lookup(const string &opname) {
@@ -415,6 +458,14 @@ Express::~Express() {
   for (auto *o : ops_) delete o;
 }
 
+void Express::Clear() {
+  for (auto *v : vars_) delete v;
+  for (auto *o : ops_) delete o;
+  vars_.clear();
+  ops_.clear();
+  body_ = 0;
+}
+
 void Express::GetRecipe(string *recipe) const {
   bool first = true;
   for (Op *op : ops_) {
@@ -620,7 +671,11 @@ bool Express::TryToEliminateOps() {
       if (op1->EqualTo(op2)) {
         Var *v1 = op1->result;
         Var *v2 = op2->result;
-        if (v1->type == TEMP) {
+        if (v1->type == REGISTER || v2->type == REGISTER) {
+          // Register variables can be reassigned, so the ops are not
+          // necessarily computing the same value.
+          continue;
+        } else if (v1->type == TEMP) {
           // Eliminate ith operation.
           std::swap(ops_[i], ops_[j]);
           v1->Redirect(v2);
@@ -772,6 +827,73 @@ int Express::MaxActiveTemps() const {
   return max_active;
 }
 
+bool Express::SpillTemp() {
+  // Find the first and last usage of each temporary variable in the body.
+  // Temporary variables assigned before the body hold loop invariants and are
+  // not spilled.
+  std::map<Var *, int> first, last;
+  for (int i = body_; i < ops_.size(); ++i) {
+    Op *op = ops_[i];
+    if (op->result->type == TEMP && first.count(op->result) == 0) {
+      first[op->result] = i;
+    }
+    for (Var *arg : op->args) {
+      if (first.count(arg) > 0) last[arg] = i;
+    }
+  }
+
+  // Find the operation with the most live temporary variables.
+  int peak = -1;
+  int max_active = 0;
+  for (int i = body_; i < ops_.size(); ++i) {
+    int active = 0;
+    for (auto &it : first) {
+      if (it.second <= i && last[it.first] >= i) active++;
+    }
+    if (active > max_active) {
+      max_active = active;
+      peak = i;
+    }
+  }
+  if (peak == -1) return false;
+
+  // Select the live variable with the most distant next usage after the peak.
+  Var *victim = nullptr;
+  int victim_next = -1;
+  for (auto &it : first) {
+    Var *var = it.first;
+    if (it.second > peak || last[var] < peak) continue;
+    int next = last[var];
+    for (int i = peak; i < ops_.size(); ++i) {
+      Op *op = ops_[i];
+      if (std::find(op->args.begin(), op->args.end(), var) != op->args.end()) {
+        next = i;
+        break;
+      }
+    }
+    if (next > victim_next) {
+      victim = var;
+      victim_next = next;
+    }
+  }
+  if (victim == nullptr) return false;
+
+  Op *producer = victim->producer;
+  if (producer->type == MOV && producer->args[0]->type == INPUT) {
+    // Read cached input directly from memory instead of spilling it.
+    Var *input = producer->args[0];
+    victim->Redirect(input);
+    RemoveOp(producer);
+    RemoveVar(victim);
+  } else {
+    // Store variable in spill slot.
+    victim->type = SPILL;
+    victim->id = NumVars(SPILL) - 1;
+  }
+  CompactTempVars();
+  return true;
+}
+
 void Express::Copy(const Express &other) {
   // Expression must be empty.
   CHECK(vars_.empty());
@@ -931,6 +1053,17 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
   // Mapping from original variables to variables in rewritten expression.
   VariableMap varmap(rewritten);
 
+  // Add register variables in id order to the rewritten expression, so they
+  // keep their register assignment even if they are not used.
+  std::vector<Var *> registers;
+  for (Var *var : vars_) {
+    if (var->type == REGISTER) registers.push_back(var);
+  }
+  std::sort(registers.begin(), registers.end(), [](Var *a, Var *b) {
+    return a->id < b->id;
+  });
+  for (Var *var : registers) varmap[var];
+
   // Translate all ops to conform to target model.
   bool success = true;
   for (Op *op : ops_) {
@@ -953,10 +1086,12 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
         // Move operations.
         switch (result->type) {
           case TEMP:
+          case REGISTER:
             // Move value into register.
             switch (args[0]->type) {
               case INPUT:
               case OUTPUT:
+              case SPILL:
                 if (!model.mov_reg_mem) success = false;
                 break;
               case TEMP:
@@ -971,6 +1106,7 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
             break;
 
           case OUTPUT:
+          case SPILL:
             // Move value into output variable.
             switch (args[0]->type) {
               case INPUT:
@@ -978,6 +1114,7 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
                 source = rewritten->Temp();
                 break;
               case OUTPUT:
+              case SPILL:
                 // Add temp variable for output.
                 destination = rewritten->Temp();
                 break;
@@ -987,13 +1124,16 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
                 break;
               case CONST:
               case NUMBER:
-                if (!model.mov_mem_imm) success = false;
+                if (!model.mov_mem_imm) {
+                  // Add temp variable for constant.
+                  source = rewritten->Temp();
+                  if (!model.mov_mem_reg) success = false;
+                }
                 break;
             }
             break;
 
           case INPUT:
-          case REGISTER:
           case CONST:
           case NUMBER:
             // Assignment to inputs and constants not allowed.
@@ -1003,9 +1143,11 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
         // Unary operator.
         switch (result->type) {
           case TEMP:
+          case REGISTER:
             switch (args[0]->type) {
               case INPUT:
               case OUTPUT:
+              case SPILL:
                 if (!model.func_reg_mem) {
                   // Add temp variable for input.
                   source = rewritten->Temp();
@@ -1028,9 +1170,11 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
             break;
 
           case OUTPUT:
+          case SPILL:
             switch (args[0]->type) {
               case INPUT:
               case OUTPUT:
+              case SPILL:
                 if (model.func_reg_mem) {
                   // Add temp variable for output.
                   destination = rewritten->Temp();
@@ -1068,7 +1212,6 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
             break;
 
           case INPUT:
-          case REGISTER:
           case CONST:
           case NUMBER:
             // Assignment to inputs and constants not allowed.
@@ -1079,12 +1222,24 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
       // Binary operator.
       switch (result->type) {
         case TEMP:
+        case REGISTER:
         case OUTPUT:
+        case SPILL:
+          // Make the register variable being reassigned the first argument,
+          // so it is not overwritten before it is used.
+          if (result->type == REGISTER && args[1] == result) {
+            if (!op->commutative()) {
+              success = false;
+              break;
+            }
+            std::swap(args[0], args[1]);
+          }
+
           if (model.op_reg_reg_reg) {
             // Three-operand instruction. Try to put the memory operand last if
             // operation is commutative.
             if (model.op_reg_reg_mem && op->commutative() &&
-                args[0]->type != TEMP && args[1]->type == TEMP) {
+                !args[0]->IsRegister() && args[1]->IsRegister()) {
               std::swap(args[0], args[1]);
             }
 
@@ -1107,8 +1262,8 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
 
             // Put destination into a register if memory destinations are not
             // supported or if second argument is not in a register.
-            bool arg1_in_reg = args[1]->type == TEMP || source2 != nullptr;
-            if (result->type == OUTPUT &&
+            bool arg1_in_reg = args[1]->IsRegister() || source2 != nullptr;
+            if ((result->type == OUTPUT || result->type == SPILL) &&
                 (!arg1_in_reg || !model.op_mem_reg_reg)) {
               destination = rewritten->Temp();
             }
@@ -1121,14 +1276,15 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
 
             // Try to put the memory operand last if operation is commutative.
             if (model.op_reg_mem && op->commutative() &&
-                args[0]->type != TEMP && args[1]->type == TEMP) {
+                !args[0]->IsRegister() && args[1]->IsRegister()) {
               std::swap(args[0], args[1]);
             }
 
             // Put result and first argument in the same location.
-            if (result != args[0] || !model.op_mem_reg) {
+            if (result != args[0] ||
+                (!result->IsRegister() && !model.op_mem_reg)) {
               // Put result in temp register if result is an output.
-              if (result->type == OUTPUT) {
+              if (result->type == OUTPUT || result->type == SPILL) {
                 dest = destination = rewritten->Temp();
               }
 
@@ -1139,6 +1295,7 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
               switch (args[0]->type) {
                 case INPUT:
                 case OUTPUT:
+                case SPILL:
                   if (!model.mov_reg_mem) success = false;
                   break;
                 case TEMP:
@@ -1157,9 +1314,10 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
             switch (args[1]->type) {
               case INPUT:
               case OUTPUT:
+              case SPILL:
                 // Put second operand into register if memory operands are not
                 // supported.
-                if (dest->type != TEMP || !model.op_reg_mem) {
+                if (!dest->IsRegister() || !model.op_reg_mem) {
                   source2 = rewritten->Temp();
                 }
                 break;
@@ -1170,7 +1328,7 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
               case NUMBER:
                 // Put second operand into register if immediate operands are
                 // not supported.
-                if (dest->type == TEMP) {
+                if (dest->IsRegister()) {
                   if (!model.op_reg_imm) {
                     source2 = rewritten->Temp();
                   }
@@ -1187,7 +1345,6 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
           break;
 
         case INPUT:
-        case REGISTER:
         case CONST:
         case NUMBER:
           // Assignment to inputs and constants not allowed.
@@ -1198,6 +1355,14 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
       Var *dest = result;
       first_is_dest = true;
 
+      // A register variable being reassigned can only be the first argument,
+      // since the destination is overwritten before the other arguments are
+      // used.
+      if (result->type == REGISTER &&
+          (args[1] == result || args[2] == result) && args[0] != result) {
+        success = false;
+      }
+
       // Try to put memory operand last.
       if (model.fm_reg_reg_mem) {
         if (args[1]->type != TEMP && args[2]->type == TEMP) {
@@ -1212,7 +1377,7 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
             case MULSUB231: break;
             default: success = false;
           }
-        } else if (args[0]->type != TEMP && args[2]->type == TEMP) {
+        } else if (!args[0]->IsRegister() && args[2]->type == TEMP) {
           // Swap first and third argument.
           std::swap(args[0], args[2]);
           switch (type) {
@@ -1230,7 +1395,7 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
       // Put result and first argument in the same location.
       if (result != args[0]) {
         // Put result in temp register if result is an output.
-        if (result->type == OUTPUT) {
+        if (result->type == OUTPUT || result->type == SPILL) {
           dest = destination = rewritten->Temp();
         }
 
@@ -1241,6 +1406,7 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
         switch (args[0]->type) {
           case INPUT:
           case OUTPUT:
+          case SPILL:
             if (!model.mov_reg_mem) success = false;
             break;
           case TEMP:
@@ -1256,7 +1422,7 @@ bool Express::Rewrite(const Model &model, Express *rewritten) const {
       }
 
       // Make sure second operand is in register.
-      if (args[1]->type != TEMP) {
+      if (!args[1]->IsRegister()) {
         source2 = rewritten->Temp();
       }
 
@@ -1351,6 +1517,8 @@ int Express::AllocateRegisters() {
           op->dst = regs.Get(op->result);
         }
         CHECK(op->dst != -1);
+      } else if (op->result->type == REGISTER) {
+        op->dst = regs.Get(op->result);
       }
 
       // Get source register for move op.
@@ -1374,6 +1542,8 @@ int Express::AllocateRegisters() {
           op->dst = regs.Get(op->result);
         }
         CHECK(op->dst != -1);
+      } else if (op->result->type == REGISTER) {
+        op->dst = regs.Get(op->result);
       }
 
       // Get registers for source operands.
@@ -1448,16 +1618,26 @@ Express::Var *Express::Log(Var *x) {
   x = Add(x, tmp);
   Var *z = Mul(x, x);
 
-  // Part 3: Compute the polynomial approximation.
-  Var *y = Number(CEPHES_LOG_P0);
-  y = MulAdd(y, x, Number(CEPHES_LOG_P1));
-  y = MulAdd(y, x, Number(CEPHES_LOG_P2));
-  y = MulAdd(y, x, Number(CEPHES_LOG_P3));
-  y = MulAdd(y, x, Number(CEPHES_LOG_P4));
-  y = MulAdd(y, x, Number(CEPHES_LOG_P5));
-  y = MulAdd(y, x, Number(CEPHES_LOG_P6));
-  y = MulAdd(y, x, Number(CEPHES_LOG_P7));
-  y = MulAdd(y, x, Number(CEPHES_LOG_P8));
+  // Part 3: Compute the polynomial approximation. The fast approximation uses
+  // a lower-degree minimax polynomial.
+  Var *y;
+  if (precision_ == MATH_FAST) {
+    y = Number(FAST_LOG_P0);
+    y = MulAdd(y, x, Number(FAST_LOG_P1));
+    y = MulAdd(y, x, Number(FAST_LOG_P2));
+    y = MulAdd(y, x, Number(FAST_LOG_P3));
+    y = MulAdd(y, x, Number(FAST_LOG_P4));
+  } else {
+    y = Number(CEPHES_LOG_P0);
+    y = MulAdd(y, x, Number(CEPHES_LOG_P1));
+    y = MulAdd(y, x, Number(CEPHES_LOG_P2));
+    y = MulAdd(y, x, Number(CEPHES_LOG_P3));
+    y = MulAdd(y, x, Number(CEPHES_LOG_P4));
+    y = MulAdd(y, x, Number(CEPHES_LOG_P5));
+    y = MulAdd(y, x, Number(CEPHES_LOG_P6));
+    y = MulAdd(y, x, Number(CEPHES_LOG_P7));
+    y = MulAdd(y, x, Number(CEPHES_LOG_P8));
+  }
   y = Mul(y, x);
   y = Mul(y, z);
 
@@ -1488,19 +1668,35 @@ Express::Var *Express::Exp(Var *x) {
   // m = floor(x/ln(2) + 0.5).
   Var *m = Do(FLOOR, MulAdd(x, Number(CEPHES_LOG2EF), Number(HALF)));
 
-  // Compute r = x - m*ln(2).
-  Var *r = MulAdd(m, Number(NLN2), x);
+  // Compute r = x - m*ln(2). For strict precision, m*ln(2) is subtracted in
+  // two parts, m*C1+m*C2 = m*ln(2), where m*C1 is exact, to avoid the rounding
+  // error of ln(2) being scaled by m.
+  Var *r;
+  if (precision_ == MATH_STRICT) {
+    r = Sub(x, Mul(m, Number(CEPHES_EXP_C1)));
+    r = Sub(r, Mul(m, Number(CEPHES_EXP_C2)));
+  } else {
+    r = MulAdd(m, Number(NLN2), x);
+  }
 
   // Compute r^2.
   Var *r2 = Mul(r, r);
 
-  // Compute polynomial.
-  Var *y = Number(CEPHES_EXP_P0);
-  y = MulAdd(y, r, Number(CEPHES_EXP_P1));
-  y = MulAdd(y, r, Number(CEPHES_EXP_P2));
-  y = MulAdd(y, r, Number(CEPHES_EXP_P3));
-  y = MulAdd(y, r, Number(CEPHES_EXP_P4));
-  y = MulAdd(y, r, Number(CEPHES_EXP_P5));
+  // Compute polynomial. The fast approximation uses a lower-degree minimax
+  // polynomial.
+  Var *y;
+  if (precision_ == MATH_FAST) {
+    y = Number(FAST_EXP_P0);
+    y = MulAdd(y, r, Number(FAST_EXP_P1));
+    y = MulAdd(y, r, Number(FAST_EXP_P2));
+  } else {
+    y = Number(CEPHES_EXP_P0);
+    y = MulAdd(y, r, Number(CEPHES_EXP_P1));
+    y = MulAdd(y, r, Number(CEPHES_EXP_P2));
+    y = MulAdd(y, r, Number(CEPHES_EXP_P3));
+    y = MulAdd(y, r, Number(CEPHES_EXP_P4));
+    y = MulAdd(y, r, Number(CEPHES_EXP_P5));
+  }
   y = MulAdd(y, r2, r);
   y = Add(y, Number(ONE));
 
@@ -1515,7 +1711,31 @@ Express::Var *Express::Exp(Var *x) {
 // Compute 13/6-degree rational interpolant which is accurate up to a couple of
 // ulp in the range [-9, 9], outside of which the fl(tanh(x)) = +/-1.
 // See: https://git.io/vHyiz
+// The fast approximation uses a 7/6-degree rational interpolant. The strict
+// approximation computes tanh(x) = x + x^3*P(x^2) for |x| < 0.625 and
+// tanh(x) = sign(x) * (1 - 2/(exp(2|x|)+1)) otherwise, like Cephes tanhf.
 Express::Var *Express::Tanh(Var *x) {
+  if (precision_ == MATH_STRICT) {
+    // Compute polynomial for small arguments.
+    Var *z = Mul(x, x);
+    Var *p = Number(CEPHES_TANH_P0);
+    p = MulAdd(p, z, Number(CEPHES_TANH_P1));
+    p = MulAdd(p, z, Number(CEPHES_TANH_P2));
+    p = MulAdd(p, z, Number(CEPHES_TANH_P3));
+    p = MulAdd(p, z, Number(CEPHES_TANH_P4));
+    Var *small = MulAdd(Mul(p, z), x, x);
+
+    // Compute tanh from exponential function for large arguments.
+    Var *a = Abs(x);
+    Var *e = Exp(Add(a, a));
+    Var *large = Sub(One(), Div(Number(TWO), Add(e, One())));
+    large = Do(OR, large, Do(AND, x, Number(SIGN_MASK)));
+
+    // Select result based on magnitude of argument.
+    Var *mask = Do(CMPLTOQ, a, Number(TANH_SMALL));
+    return Do(OR, Do(AND, mask, small), Do(ANDNOT, mask, large));
+  }
+
   // Clamp the inputs to the range [-9, 9] since anything outside this range
   // is +/-1.0.
   x = Max(Min(x, Number(P9)), Number(N9));
@@ -1523,6 +1743,24 @@ Express::Var *Express::Tanh(Var *x) {
   // Since the polynomials are odd/even, we need x^2.
   Var *x2 = Mul(x, x);
 
+  if (precision_ == MATH_FAST) {
+    // Evaluate the numerator polynomial p.
+    Var *p = Number(FAST_TANH_P0);
+    p = MulAdd(x2, p, Number(FAST_TANH_P1));
+    p = MulAdd(x2, p, Number(FAST_TANH_P2));
+    p = MulAdd(x2, p, Number(FAST_TANH_P3));
+    p = Mul(x, p);
+
+    // Evaluate the denominator polynomial q.
+    Var *q = Number(FAST_TANH_Q0);
+    q = MulAdd(x2, q, Number(FAST_TANH_Q1));
+    q = MulAdd(x2, q, Number(FAST_TANH_Q2));
+    q = MulAdd(x2, q, One());
+
+    // Divide the numerator by the denominator.
+    return Div(p, q);
+  }
+
   // Evaluate the numerator polynomial p.
   Var *p = Number(ALPHA_1);
   p = MulAdd(x2, p, Number(ALPHA_3));
@@ -1562,6 +1800,7 @@ string Express::Var::AsString() const {
     case OUTPUT: return "@" + std::to_string(id);
     case TEMP:  return "$" + std::to_string(id);
     case NUMBER:  return "_" + std::to_string(id);
+    case SPILL:  return "&" + std::to_string(id);
   }
   return "???";
 }
@@ -1575,6 +1814,7 @@ void Express::Var::GetRecipe(string *recipe) const {
     case OUTPUT: ch = '@'; break;
     case TEMP: ch = '$'; break;
     case NUMBER: ch = '_'; break;
+    case SPILL: ch = '&'; break;
     default: ch = '?';
   }
   recipe->push_back(ch);
@@ -25,6 +25,13 @@
 namespace sling {
 namespace myelin {
 
+// Precision of the approximations used for the transcendental functions
+// (exp, log, sigmoid, tanh). The default approximations are accurate to a few
+// ulp. The strict approximations are accurate to about one ulp at a higher
+// cost, and the fast approximations use lower-degree polynomials with a
+// relative error of about 1e-5.
+enum MathPrecision {MATH_STRICT, MATH_DEFAULT, MATH_FAST};
+
 // Express is an intermediate representation (IR) of lists of expressions. An
 // expression is a computation of outputs from inputs using a fixed set of
 // functions. Express uses single static assignment (SSA) form to represent the
@@ -37,6 +44,7 @@ namespace myelin {
 //   @n: memory-based output variable
 //   $n: temporary register variable
 //   _n: number
+//   &n: temporary variable spilled to memory
 //
 // An Express recipe is a text format for representing computations over
 // inputs variables to produce the output variables. A recipe has the following
@@ -49,13 +57,15 @@ namespace myelin {
 //   <arg list> := <arg> | <arg> ',' <arg list>
 //   <arg> := <variable> | <expression>
 //   <variable> := <input variable> | <constant> | <register>
-//                 <output variable> | <temp variable> | <number>
+//                 <output variable> | <temp variable> | <number> |
+//                 <spill variable>
 //   <input variable> := '%' <integer>
 //   <constant> := '#' <integer>
 //   <register> := '!' <integer>
 //   <output variable> := '@' <integer>
 //   <temp variable> := '$' <integer>
 //   <number> := '_' <integer>
+//   <spill variable> := '&' <integer>
 //
 class Express {
  public:
@@ -63,7 +73,7 @@ class Express {
   struct Op;
 
   // Variable type.
-  enum VarType {INPUT, REGISTER, CONST, OUTPUT, TEMP, NUMBER};
+  enum VarType {INPUT, REGISTER, CONST, OUTPUT, TEMP, NUMBER, SPILL};
 
   // Operation type.
   enum OpType {
@@ -83,6 +93,7 @@ class Express {
     LOGSIGMOID,  // log sigmoid, r=log(1/(1+exp(-x)))=-softplus(-x))
     RECIPROCAL,  // reciprocal value, r=1/x
     SQUARE,      // square, r=x*x
+    SQRT,        // square root, r=sqrt(x)
 
     LOG,         // logarithm, r=log(a)
     EXP,         // exponential function, r=exp(a)
@@ -111,6 +122,10 @@ class Express {
     CVTINTFLT,   // integer to float conversion
     SUBINT,      // integer subtraction
 
+    HSUM,        // horizontal sum of vector elements, r=sum(a[i]) for all i
+    HMIN,        // horizontal minimum of vector elements, r=min(a[i]) for all i
+    HMAX,        // horizontal maximum of vector elements, r=max(a[i]) for all i
+
     INVALID,     // invalid operation
   };
 
@@ -127,6 +142,13 @@ class Express {
     CEPHES_EXP_P4, CEPHES_EXP_P5,
     ALPHA_1, ALPHA_3, ALPHA_5, ALPHA_7, ALPHA_9, ALPHA_11, ALPHA_13,
     BETA_0, BETA_2, BETA_4, BETA_6,
+    SIGN_MASK, CEPHES_EXP_C1, CEPHES_EXP_C2,
+    TANH_SMALL, CEPHES_TANH_P0, CEPHES_TANH_P1, CEPHES_TANH_P2,
+    CEPHES_TANH_P3, CEPHES_TANH_P4,
+    FAST_LOG_P0, FAST_LOG_P1, FAST_LOG_P2, FAST_LOG_P3, FAST_LOG_P4,
+    FAST_EXP_P0, FAST_EXP_P1, FAST_EXP_P2,
+    FAST_TANH_P0, FAST_TANH_P1, FAST_TANH_P2, FAST_TANH_P3,
+    FAST_TANH_Q0, FAST_TANH_Q1, FAST_TANH_Q2,
     NUM_CONSTANTS,
   };
 
@@ -249,6 +271,11 @@ class Express {
   // functions can be expanded into basic operations.
   void Parse(const string &recipe, bool expand = false);
 
+  // Precision of approximations for expanded intrinsic functions. This must
+  // be set before intrinsic functions are expanded.
+  MathPrecision precision() const { return precision_; }
+  void set_precision(MathPrecision precision) { precision_ = precision; }
+
   // Return recipe for expression.
   void GetRecipe(string *recipe) const;
   string AsRecipe() const {
@@ -304,9 +331,19 @@ class Express {
   // Return maximum number of active temp variables.
   int MaxActiveTemps() const;
 
+  // Spill a temporary variable to memory to reduce register pressure. The
+  // spilled variable is chosen among the temporary variables that are live at
+  // the point with the most live temporaries, picking the one whose next usage
+  // is farthest away. Cached inputs are turned back into inputs instead of
+  // being spilled. Returns false if there are no variables that can be spilled.
+  bool SpillTemp();
+
   // Copy operations and variables from another expression.
   void Copy(const Express &other);
 
+  // Remove all operations and variables from expression.
+  void Clear();
+
   // Merge variable and operations from another expression into this
   // expression. The variables are mapped through the mapping which maps
   // variables in the other expression to variables in this expression.
@@ -322,10 +359,14 @@ class Express {
   // architecture. The expression is assumed to be in static single assignment
   // form. The expression is rewritten by adding additional temporary variables
   // to the rewritten expression so only the supported instruction form are
-  // needed for evaluating the expression.
+  // needed for evaluating the expression. Register variables can be assigned
+  // like temporary variables, e.g. for accumulating values across expressions.
   bool Rewrite(const Model &model, Express *rewritten) const;
 
   // Allocate registers for operands. Return the number of registers used.
+  // Register variables are allocated first in id order, so register variable
+  // !n is assigned register n when the register variables are numbered
+  // consecutively.
   int AllocateRegisters();
 
   // Returns the number of register used by expression.
@@ -375,6 +416,7 @@ class Express {
   Var *Div(Var *x, Var *y) { return Do(DIV, x, y); }
   Var *Min(Var *x, Var *y) { return Do(MIN, x, y); }
   Var *Max(Var *x, Var *y) { return Do(MAX, x, y); }
+  Var *Sqrt(Var *x) { return Do(SQRT, x); }
   Var *Zero() { return Number(ZERO); }
   Var *One() { return Number(ONE); }
 
@@ -432,6 +474,9 @@ class Express {
   // body is 0 (the default), there are no loop invariant instructions.
   int body_ = 0;
 
+  // Precision of approximations for intrinsic functions.
+  MathPrecision precision_ = MATH_DEFAULT;
+
   // System-defined numeric constants.
   struct Constant { float flt; double dbl; };
   static Constant constants[NUM_CONSTANTS];
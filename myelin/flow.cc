@@ -14,6 +14,11 @@
 
 #include "myelin/flow.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <algorithm>
 #include <queue>
 #include <unordered_map>
@@ -180,7 +185,8 @@ Transformations::~Transformations() {
 class Parser {
  public:
   // Initialize parser with input buffer.
-  Parser(const char *ptr, const char *end) : ptr_(ptr), end_(end) {}
+  Parser(const char *ptr, const char *end)
+      : begin_(ptr), ptr_(ptr), end_(end) {}
 
   // Get data buffer from input and advance the current input pointer.
   const char *Get(int len) {
@@ -207,9 +213,17 @@ class Parser {
     return string(str, len);
   }
 
+  // Skip padding to align the current position relative to the beginning of
+  // the input.
+  void Align(int alignment) {
+    int misalignment = (ptr_ - begin_) % alignment;
+    if (misalignment != 0) Get(alignment - misalignment);
+  }
+
  private:
-  const char *ptr_;  // current position
-  const char *end_;  // end of input buffer
+  const char *begin_;  // beginning of input buffer
+  const char *ptr_;    // current position
+  const char *end_;    // end of input buffer
 };
 
 // Flow file writer.
@@ -228,6 +242,16 @@ class FlowFileWriter {
   // Write data to output file.
   void Write(const void *data, size_t size) {
     CHECK(file_->Write(data, size));
+    position_ += size;
+  }
+
+  // Write zero padding to align the current file position.
+  void Align(int alignment) {
+    int misalignment = position_ % alignment;
+    if (misalignment != 0) {
+      string padding(alignment - misalignment, 0);
+      Write(padding.data(), padding.size());
+    }
   }
 
   // Write integer to output file.
@@ -249,6 +273,9 @@ class FlowFileWriter {
  private:
   // Output file.
   File *file_;
+
+  // Current position in output file.
+  uint64 position_ = 0;
 };
 
 const string &Attributes::Get(const string &name) const {
@@ -579,13 +606,40 @@ Status Flow::Load(const string &filename) {
   return Status::OK;
 }
 
+Status Flow::Map(const string &filename) {
+  // Open flow file.
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) return Status(errno, "Cannot open flow file", filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return Status(errno, "Cannot stat flow file", filename);
+  }
+
+  // Map flow file into memory. The mapping is kept after closing the file.
+  size_t size = st.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return Status(errno, "Cannot map flow file", filename);
+  }
+  mapping_.reset(new FlowMapping(static_cast<const char *>(data), size));
+
+  Read(mapping_->data(), size);
+  return Status::OK;
+}
+
+FlowMapping::~FlowMapping() {
+  munmap(const_cast<char *>(data_), size_);
+}
+
 void Flow::Read(const char *data, size_t size) {
   // Read header.
   Parser parser(data, data + size);
   int magic = parser.GetInt();
   CHECK_EQ(magic, kMagic) << "not a flow file";
   int version = parser.GetInt();
-  CHECK(version >= 3 && version <= 4)
+  CHECK(version >= 3 && version <= 5)
       << "unsupported flow file version " << version;
 
   // Read variables.
@@ -627,7 +681,10 @@ void Flow::Read(const char *data, size_t size) {
 
     // Get optional variable constant.
     var->size = parser.GetLong();
-    if (var->size != 0) var->data = parser.Get(var->size);
+    if (var->size != 0) {
+      if (version >= 5) parser.Align(DataAlignment(var->size));
+      var->data = parser.Get(var->size);
+    }
   }
 
   // Read operations.
@@ -732,7 +789,10 @@ void Flow::Read(const char *data, size_t size) {
 
       // Get data.
       blob->size = parser.GetLong();
-      if (blob->size != 0) blob->data = parser.Get(blob->size);
+      if (blob->size != 0) {
+        if (version >= 5) parser.Align(DataAlignment(blob->size));
+        blob->data = parser.Get(blob->size);
+      }
     }
   }
 }
@@ -777,6 +837,9 @@ void Flow::Save(const string &filename, int version) const {
 
     // Write data.
     if (var->data != nullptr) {
+      if (version >= 5 && var->size != 0) {
+        file.Align(DataAlignment(var->size));
+      }
       file.Write(var->data, var->size);
     }
   }
@@ -843,6 +906,9 @@ void Flow::Save(const string &filename, int version) const {
       }
       file.WriteInt64(blob->size);
       if (blob->data != nullptr) {
+        if (version >= 5 && blob->size != 0) {
+          file.Align(DataAlignment(blob->size));
+        }
         file.Write(blob->data, blob->size);
       }
     }
@@ -867,6 +933,14 @@ void Flow::Analyze(const Transformations &transformations) {
     // Make sure ops are still sorted after second round of transformations.
     Sort();
   }
+
+  // Log statistics for transformation passes.
+  for (const PassStats &stats : pass_stats_) {
+    if (stats.applied == 0) continue;
+    VLOG(3) << "Pass " << stats.name << " applied " << stats.applied
+            << " times, removed " << stats.removed_ops << " ops and "
+            << stats.removed_vars << " vars";
+  }
 }
 
 void Flow::InferInputsAndOutputs() {
@@ -917,12 +991,25 @@ bool Flow::Transform(const Transformations &transformations) {
   // Keep transforming flow until no more transformations can be applied.
   bool again = true;
   bool transformed = false;
+  auto &transformers = transformations.transformers();
+  if (pass_stats_.size() != transformers.size()) {
+    pass_stats_.clear();
+    pass_stats_.resize(transformers.size());
+    for (int t = 0; t < transformers.size(); ++t) {
+      pass_stats_[t].name = transformers[t]->Name();
+    }
+  }
   while (again) {
     // Run flow transformers.
-    auto &transformers = transformations.transformers();
     again = false;
     for (int t = transformers.size() -1; t >= 0; --t) {
+      int num_ops = ops_.size();
+      int num_vars = vars_.size();
       if (transformers[t]->Transform(this)) {
+        PassStats &stats = pass_stats_[t];
+        stats.applied++;
+        stats.removed_ops += num_ops - ops_.size();
+        stats.removed_vars += num_vars - vars_.size();
         transformed = true;
         again = true;
       }
@@ -1178,6 +1265,7 @@ void Flow::Eliminate(Operation *op) {
     if (output->in) input->in = true;
     if (output->out) input->out = true;
     if (output->ref) input->ref = true;
+    if (output->dynamic) input->dynamic = true;
     for (Operation *target : ops_) {
       for (int i = 0; i < target->inputs.size(); ++i) {
         if (target->inputs[i] == output) {
@@ -1472,6 +1560,199 @@ Flow::Function *Flow::AddFunction(const string &name) {
   return func;
 }
 
+Flow::Function *Flow::Batch(Function *func,
+                            const string &name,
+                            int batch_size,
+                            bool dynamic) {
+  // Check that all the variables in the function have a batch dimension.
+  std::vector<Variable *> vars;
+  std::unordered_set<Variable *> seen;
+  for (Operation *op : func->ops) {
+    for (Variable *var : op->inputs) {
+      if (seen.insert(var).second) vars.push_back(var);
+    }
+    for (Variable *var : op->outputs) {
+      if (seen.insert(var).second) vars.push_back(var);
+    }
+  }
+  for (Variable *var : vars) {
+    if (var->constant() || var->learnable) continue;
+    if (var->rank() == 0 || var->dim(0) != 1) {
+      LOG(ERROR) << "Cannot batch " << func->name << " because "
+                 << var->name << " has shape " << var->shape.ToString();
+      return nullptr;
+    }
+  }
+
+  // Weight matrices for matrix multiplications get their own variables, since
+  // the batched matrix multiplication may need a different element order than
+  // the vector-matrix multiplication. These still share the data in the flow.
+  std::unordered_set<Variable *> weights;
+  for (Operation *op : func->ops) {
+    if (op->type.compare(0, 6, "MatMul") != 0) continue;
+    for (Variable *input : op->inputs) {
+      if (input->constant() && input->rank() == 2) weights.insert(input);
+    }
+  }
+
+  // Add batched variables.
+  std::unordered_map<Variable *, Variable *> batched;
+  for (Variable *var : vars) {
+    if (weights.count(var) > 0) {
+      Variable *v = AddVariable(name + "/" + var->name, var->type, var->shape);
+      v->SetData(var->data, var->size);
+      batched[var] = v;
+    } else if (var->constant() || var->learnable) {
+      batched[var] = var;
+    } else {
+      Shape shape = var->shape;
+      shape.set(0, batch_size);
+      Variable *v = AddVariable(name + "/" + var->name, var->type, shape);
+      v->in = var->in;
+      v->out = var->out;
+      v->dynamic = dynamic;
+      batched[var] = v;
+    }
+  }
+
+  // Add batched operations.
+  Function *batch = AddFunction(name);
+  for (Operation *op : func->ops) {
+    // Fused vector-matrix multiplications are split into a matrix
+    // multiplication followed by the fused operations, since the fused
+    // operations are only supported for vector inputs.
+    std::vector<string> stages;
+    if (op->type == "MatMulAdd") {
+      stages = {"MatMul", "Add"};
+    } else if (op->type == "MatMulRelu") {
+      stages = {"MatMul", "Relu"};
+    } else if (op->type == "MatMulAddRelu") {
+      stages = {"MatMul", "Add", "Relu"};
+    } else {
+      stages = {op->type};
+    }
+
+    string opname = name + "/" + op->name;
+    if (stages.size() == 1) {
+      Operation *o = AddOperation(batch, opname, op->type);
+      for (Variable *input : op->inputs) o->AddInput(batched[input]);
+      for (Variable *output : op->outputs) o->AddOutput(batched[output]);
+      o->attrs = op->attrs;
+      o->task = op->task;
+      continue;
+    }
+
+    CHECK_EQ(op->outdegree(), 1);
+    Variable *output = batched[op->outputs[0]];
+    Variable *x = batched[op->inputs[0]];
+    Variable *W = batched[op->inputs[1]];
+    Operation *matmul = AddOperation(batch, opname, "MatMul");
+    matmul->attrs = op->attrs;
+    matmul->task = op->task;
+    matmul->AddInput(x);
+    matmul->AddInput(W);
+    Operation *last = matmul;
+    for (int i = 1; i < stages.size(); ++i) {
+      Variable *v = AddVariable(opname + "/" + stages[i - 1],
+                                output->type, output->shape);
+      v->dynamic = dynamic;
+      last->AddOutput(v);
+      last = AddOperation(batch, opname + "/" + stages[i], stages[i]);
+      last->task = op->task;
+      last->AddInput(v);
+      if (stages[i] == "Add") last->AddInput(batched[op->inputs[2]]);
+    }
+    last->AddOutput(output);
+  }
+
+  // Sort the batched operations into the computation order.
+  Sort();
+
+  return batch;
+}
+
+// Convert float to bfloat16 with round-to-nearest-even.
+static uint16 FloatToBFloat16(float value) {
+  uint32 bits;
+  memcpy(&bits, &value, sizeof(float));
+  if ((bits & 0x7fffffff) > 0x7f800000) return (bits >> 16) | 0x40;
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return bits >> 16;
+}
+
+// Convert float to IEEE half precision with round-to-nearest-even.
+static uint16 FloatToHalf(float value) {
+  uint32 bits;
+  memcpy(&bits, &value, sizeof(float));
+  uint32 sign = (bits >> 16) & 0x8000;
+  uint32 mantissa = bits & 0x7fffff;
+  int exponent = ((bits >> 23) & 0xff) - 127 + 15;
+
+  // Infinity and NaN.
+  if (((bits >> 23) & 0xff) == 0xff) {
+    return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+  }
+
+  // Overflow to infinity.
+  if (exponent >= 31) return sign | 0x7c00;
+
+  // Subnormal numbers and underflow to zero.
+  if (exponent <= 0) {
+    if (exponent < -10) return sign;
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint32 half = mantissa >> shift;
+    uint32 rest = mantissa & ((1u << shift) - 1);
+    uint32 halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) half++;
+    return sign | half;
+  }
+
+  // Normal numbers. Rounding can carry into the exponent.
+  uint32 half = (exponent << 10) | (mantissa >> 13);
+  uint32 rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+  return sign | half;
+}
+
+int Flow::ConvertEmbeddings(Type type) {
+  CHECK(type == DT_BFLOAT16 || type == DT_HALF) << "Invalid embedding type";
+  int num_converted = 0;
+  for (Variable *var : vars_) {
+    // Only convert constant float matrices.
+    if (var->type != DT_FLOAT || var->rank() != 2) continue;
+    if (!var->constant() || var->consumers.empty()) continue;
+    if (var->size != var->elements() * sizeof(float)) continue;
+
+    // All uses must be embedding lookups.
+    bool embedding = true;
+    for (Operation *op : var->consumers) {
+      if (op->type == "Lookup") {
+        if (op->indegree() != 2 || op->inputs[1] != var) embedding = false;
+      } else if (op->type == "Gather") {
+        if (op->indegree() != 2 || op->inputs[0] != var) embedding = false;
+      } else {
+        embedding = false;
+      }
+    }
+    if (!embedding) continue;
+
+    // Convert embedding matrix to 16-bit floats.
+    int elements = var->elements();
+    const float *src = reinterpret_cast<const float *>(var->data);
+    uint16 *dst = reinterpret_cast<uint16 *>(
+        AllocateMemory(elements * sizeof(uint16)));
+    for (int i = 0; i < elements; ++i) {
+      dst[i] = type == DT_BFLOAT16 ? FloatToBFloat16(src[i])
+                                   : FloatToHalf(src[i]);
+    }
+    var->type = type;
+    var->SetData(dst, elements * sizeof(uint16));
+    num_converted++;
+  }
+  return num_converted;
+}
+
 Flow::Connector *Flow::AddConnector(const string &name) {
   Connector *cnx = new Connector;
   cnxs_.push_back(cnx);
@@ -1631,6 +1912,7 @@ string Flow::ToString() const {
                   var->TypeString().c_str());
     if (var->in) StringAppendF(&str, " in");
     if (var->out) StringAppendF(&str, " out");
+    if (var->learnable) StringAppendF(&str, " learnable");
     if (var->data != nullptr) {
       StringAppendF(&str, ", %lu bytes", var->size);
     }
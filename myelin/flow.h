@@ -15,6 +15,7 @@
 #ifndef MYELIN_FLOW_H_
 #define MYELIN_FLOW_H_
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -27,6 +28,8 @@ namespace myelin {
 
 class Typer;
 class Transformer;
+class Transformations;
+class Gradients;
 
 // Data types.
 enum Type {
@@ -103,39 +106,6 @@ TYPE_TRAIT(bool, DT_BOOL);
 
 #undef TYPE_TRAIT
 
-// Flow graph transformations.
-class Transformations {
- public:
-  ~Transformations();
-
-  // Register flow transformation component. Transfers ownership from caller.
-  void RegisterTransformer(Transformer *transformer) {
-    transformers_.emplace_back(transformer);
-  }
-
-  // Register type inference component. Transfers ownership from caller.
-  void RegisterTyper(Typer *typer) {
-    typers_.emplace_back(typer);
-  }
-
-  // Flow transformation components.
-  const std::vector<Transformer *> &transformers() const {
-    return transformers_;
-  }
-
-  // Type inference components.
-  const std::vector<Typer *> &typers() const {
-    return typers_;
-  }
-
- private:
-  // Flow transformation components.
-  std::vector<Transformer *> transformers_;
-
-  // Type inference components.
-  std::vector<Typer *> typers_;
-};
-
 // Tensor shape.
 class Shape {
  public:
@@ -264,6 +234,30 @@ class Attributes : public std::vector<Attribute> {
   void Set(const string &name, bool value);
 };
 
+// Read-only memory mapping of a flow file. Constants in a mapped flow point
+// directly into the mapping, so the physical memory for the constants is
+// shared between all processes mapping the same flow file. The mapping is
+// reference counted, so networks compiled from the flow can keep using the
+// constant data after the flow has been destroyed.
+class FlowMapping {
+ public:
+  FlowMapping(const char *data, size_t size) : data_(data), size_(size) {}
+  ~FlowMapping();
+
+  // Mapped flow file.
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Check if memory block is inside the mapping.
+  bool Contains(const char *ptr, size_t size) const {
+    return ptr >= data_ && ptr + size <= data_ + size_;
+  }
+
+ private:
+  const char *data_;
+  size_t size_;
+};
+
 // Flow graph for computation.
 class Flow {
  public:
@@ -271,9 +265,21 @@ class Flow {
   struct Function;
 
   // Flow file version
-  static const int kVersion = 4;
+  static const int kVersion = 5;
   static const int kMagic = 0x776f6c66;
 
+  // From version 5, the data for constants and blobs is aligned in the flow
+  // file, so it can be used directly from a memory-mapped flow file. Data
+  // blocks of at least a page are page aligned and smaller data blocks are
+  // cache line aligned.
+  static const int kPageAlignment = 4096;
+  static const int kDataAlignment = 64;
+
+  // Alignment of data block in flow file.
+  static int DataAlignment(size_t size) {
+    return size >= kPageAlignment ? kPageAlignment : kDataAlignment;
+  }
+
   // Flow variable.
   struct Variable {
     // Add alias for variable.
@@ -288,8 +294,10 @@ class Flow {
     // Return the number of elements in the variable tensor.
     int elements() const { return shape.elements(); }
 
-    // Check if variable is a constant.
-    bool constant() const { return data != nullptr; }
+    // Check if variable is a constant. Learnable variables have data with the
+    // initial value, but they are not constant since they are updated by
+    // training.
+    bool constant() const { return data != nullptr && !learnable; }
 
     // Return type as string.
     string TypeString() const;
@@ -316,6 +324,8 @@ class Flow {
     uint64_t size = 0;                   // size of data in bytes
     bool in = false;                     // is variable a function input?
     bool out = false;                    // is variable a function output?
+    bool dynamic = false;                // is leading dimension dynamic?
+    bool learnable = false;              // is variable a learnable parameter?
 
     Operation *producer = nullptr;       // operation producing variable
     std::vector<Operation *> consumers;  // list of consumers of variable
@@ -452,6 +462,13 @@ class Flow {
   // Load flow from file.
   Status Load(const string &filename);
 
+  // Memory-map flow file. The constants reference the data in the read-only
+  // mapping instead of being read into memory owned by the flow.
+  Status Map(const string &filename);
+
+  // Memory mapping for flow or null if the flow has not been mapped.
+  const std::shared_ptr<FlowMapping> &mapping() const { return mapping_; }
+
   // Read flow from buffer. This does not take ownership of the buffer and it
   // must outlive the flow.
   void Read(const char *data, size_t size);
@@ -459,9 +476,20 @@ class Flow {
   // Save flow to file.
   void Save(const string &filename, int version = kVersion) const;
 
+  // Statistics for flow transformation pass.
+  struct PassStats {
+    string name;            // transformer name
+    int applied = 0;        // number of times the pass changed the flow
+    int removed_ops = 0;    // net number of operations removed by the pass
+    int removed_vars = 0;   // net number of variables removed by the pass
+  };
+
   // Analyze flow.
   void Analyze(const Transformations &transformations);
 
+  // Statistics for the transformation passes run when analyzing the flow.
+  const std::vector<PassStats> &pass_stats() const { return pass_stats_; }
+
   // Add variable.
   Variable *AddVariable(const string &name,
                         Type type,
@@ -483,6 +511,30 @@ class Flow {
   // Add function.
   Function *AddFunction(const string &name);
 
+  // Add batched version of function for computing a batch of inputs at once.
+  // Each non-constant variable in the function must have a leading dimension
+  // of one, which is replaced by the batch size in the batched function, so
+  // vector-matrix products become matrix-matrix products over the batch. The
+  // variables and operations in the batched function are named
+  // <name>/<original name>, and references become regular variables since
+  // the batch elements are copied in and out of the batch. The constant data
+  // is shared with the original function. This should be called after the
+  // flow has been analyzed. Returns null if the function cannot be batched.
+  // If dynamic is true, the batch size is the maximum batch size, and the
+  // actual batch size can be set for each instance at runtime.
+  Function *Batch(Function *func, const string &name, int batch_size,
+                  bool dynamic = false);
+
+  // Convert embedding matrices to 16-bit floating point storage (DT_BFLOAT16
+  // or DT_HALF). Embedding matrices are constant float matrices that are only
+  // used for Lookup and Gather operations, and the kernels for these convert
+  // the embedding vectors back to single precision on the fly. This halves the
+  // size of the embeddings and the memory bandwidth for the lookups. The
+  // kernels for DT_HALF embeddings require a CPU with F16C support. This
+  // should be called after the flow has been analyzed. Returns the number of
+  // converted embedding matrices.
+  int ConvertEmbeddings(Type type);
+
   // Add connector.
   Connector *AddConnector(const string &name);
 
@@ -565,20 +617,20 @@ class Flow {
   // Check flow graph consistency.
   bool IsConsistent() const;
 
- private:
   // Infer which variables are inputs and outputs to functions.
   void InferInputsAndOutputs();
 
-  // Apply transformations to flow graph. Returns false if no transformations
-  // were applied.
-  bool Transform(const Transformations &transformations);
-
   // Sort operations in topological order of computation.
   void Sort();
 
   // Infer types of variables. Return false if some variables are unresolved.
   bool InferTypes(const Transformations &transformations);
 
+ private:
+  // Apply transformations to flow graph. Returns false if no transformations
+  // were applied.
+  bool Transform(const Transformations &transformations);
+
   // Variables.
   std::vector<Variable *> vars_;
 
@@ -597,8 +649,14 @@ class Flow {
   // Data areas owned by flow.
   std::vector<char *> memory_;
 
+  // Memory mapping for flow file.
+  std::shared_ptr<FlowMapping> mapping_;
+
   // Batch size.
   int batch_size_ = -1;
+
+  // Statistics for transformation passes.
+  std::vector<PassStats> pass_stats_;
 };
 
 // Component type for inferring types and shapes of operation outputs.
@@ -616,11 +674,66 @@ class Transformer {
  public:
   virtual ~Transformer() = default;
 
+  // Transformer name used in pass statistics.
+  virtual string Name() { return "Transformer"; }
+
   // Apply transformations to flow and return true is any transformations were
   // applied.
   virtual bool Transform(Flow *flow) = 0;
 };
 
+// Gradient function for adding the derivatives of the inputs of an operation
+// to the gradient computation, given the derivatives of its outputs.
+typedef void (GradientFunc)(Flow::Operation *op, Gradients *g);
+
+// Flow graph transformations.
+class Transformations {
+ public:
+  ~Transformations();
+
+  // Register flow transformation component. Transfers ownership from caller.
+  void RegisterTransformer(Transformer *transformer) {
+    transformers_.emplace_back(transformer);
+  }
+
+  // Register type inference component. Transfers ownership from caller.
+  void RegisterTyper(Typer *typer) {
+    typers_.emplace_back(typer);
+  }
+
+  // Flow transformation components.
+  const std::vector<Transformer *> &transformers() const {
+    return transformers_;
+  }
+
+  // Type inference components.
+  const std::vector<Typer *> &typers() const {
+    return typers_;
+  }
+
+  // Register gradient function for operation type.
+  void RegisterGradient(const string &op, GradientFunc *func) {
+    gradients_[op] = func;
+  }
+
+  // Return gradient function for operation type or null if the operation
+  // type has no registered gradient.
+  GradientFunc *GetGradient(const string &op) const {
+    auto f = gradients_.find(op);
+    return f == gradients_.end() ? nullptr : f->second;
+  }
+
+ private:
+  // Flow transformation components.
+  std::vector<Transformer *> transformers_;
+
+  // Type inference components.
+  std::vector<Typer *> typers_;
+
+  // Gradient functions for operation types.
+  std::unordered_map<string, GradientFunc *> gradients_;
+};
+
 }  // namespace myelin
 }  // namespace sling
 
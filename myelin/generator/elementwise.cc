@@ -40,6 +40,13 @@ ElementwiseIndexGenerator::ElementwiseIndexGenerator(
     CHECK(step->output(i)->shape() == step->output(0)->shape());
     CHECK(InitializeLocator(step->output(i), &output_[i]));
   }
+
+  // Get row size for dynamic output.
+  if (step->output(0)->dynamic()) {
+    dynamic_ = true;
+    row_size_ = element_size() * shape_.inner(1);
+    batch_offset_ = step->cell()->batch_offset();
+  }
 }
 
 ElementwiseIndexGenerator::~ElementwiseIndexGenerator() {
@@ -53,7 +60,8 @@ bool ElementwiseIndexGenerator::InitializeLocator(Tensor *var, Locator *loc) {
   // Determine iterator type for variable.
   if (var->elements() == 1) {
     // Variable only has one element; use a scalar/const iterator.
-    loc->iterator = NewIterator(var->IsConstant() ? CONST : SCALAR);
+    bool fixed = var->IsConstant() && !var->learnable();
+    loc->iterator = NewIterator(fixed ? CONST : SCALAR);
   } else if (var->shape() == shape_) {
     // Variable has same shape as output; use simple iterator.
     loc->iterator = NewIterator(SIMPLE);
@@ -104,6 +112,10 @@ bool ElementwiseIndexGenerator::InitializeLocator(Tensor *var, Locator *loc) {
 void ElementwiseIndexGenerator::Initialize(size_t vecsize) {
   vecsize_ = vecsize;
   single_ = shape_.elements() * element_size() == vecsize_;
+
+  // The loop can only stop at the end of a row if the row size is a multiple
+  // of the vector size.
+  if (single_ || row_size_ % vecsize_ != 0) dynamic_ = false;
 }
 
 bool ElementwiseIndexGenerator::AllocateRegisters() {
@@ -125,6 +137,13 @@ bool ElementwiseIndexGenerator::AllocateRegisters() {
     if (!AllocateLocatorRegisters(&loc)) return false;
   }
 
+  // Allocate register for the end of the dynamic output. All the rows are
+  // computed if there are no more registers.
+  if (dynamic_) {
+    limit_ = rr.try_alloc();
+    if (!limit_.is_valid()) dynamic_ = false;
+  }
+
   // Try to allocate extra base registers as an optimization.
   if (!single_) {
     for (auto &loc : input_) {
@@ -186,6 +205,9 @@ bool ElementwiseIndexGenerator::AllocateLocatorRegisters(Locator *loc) {
 }
 
 void ElementwiseIndexGenerator::BeginLoop() {
+  // Allocate stack space for spilled variables.
+  BeginSpillArea();
+
   // Load tensor addresses and initialize index registers.
   MacroAssembler *masm = masm_;
   for (auto &loc : input_) {
@@ -208,9 +230,20 @@ void ElementwiseIndexGenerator::BeginLoop() {
     }
   }
 
-  // Generate loop start, unless there is only one iteration.
+  // Compute end of output from the runtime batch size.
+  if (dynamic_) {
+    __ imulq(limit_, Operand(masm->instance(), batch_offset_),
+             Immediate(row_size_));
+  }
+
+  // Generate loop start, unless there is only one iteration. The loop is
+  // skipped if the runtime batch size is zero.
   if (!single_) {
     __ xorq(offset_, offset_);
+    if (dynamic_) {
+      __ cmpq(offset_, limit_);
+      __ j(greater_equal, &end_);
+    }
     __ bind(&begin_);
   }
 }
@@ -261,10 +294,18 @@ void ElementwiseIndexGenerator::EndLoop() {
     }
 
     // Check if we have reached the end of the output.
-    size_t size = element_size() * shape_.elements();
-    __ cmpq(offset_, Immediate(size));
+    if (dynamic_) {
+      __ cmpq(offset_, limit_);
+    } else {
+      size_t size = element_size() * shape_.elements();
+      __ cmpq(offset_, Immediate(size));
+    }
     __ j(less, &begin_);
+    if (dynamic_) __ bind(&end_);
   }
+
+  // Release stack space for spilled variables.
+  EndSpillArea();
 }
 
 Operand ElementwiseIndexGenerator::addr(Express::Var *var) {
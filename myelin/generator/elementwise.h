@@ -31,6 +31,8 @@ namespace myelin {
 //  - CONST (scalar constant input broadcast over all the elemements)
 //  - REPEAT (iterator repeated over all the elements)
 //  - BROADCAST (general broadcast iterator with one broadcast dimension)
+// If the output has a dynamic leading dimension, the loop only runs over the
+// rows up to the runtime batch size of the instance.
 class ElementwiseIndexGenerator : public IndexGenerator {
  public:
   // Create element-wise index generator for step.
@@ -115,8 +117,9 @@ class ElementwiseIndexGenerator : public IndexGenerator {
   // Vector size.
   size_t vecsize_ = 1;
 
-  // Loop begin label.
+  // Loop begin and end labels.
   jit::Label begin_;
+  jit::Label end_;
 
   // Output offset register.
   jit::Register offset_;
@@ -124,6 +127,12 @@ class ElementwiseIndexGenerator : public IndexGenerator {
   // Whether only one iteration is needed.
   bool single_ = false;
 
+  // Loop over the runtime extent of the dynamic leading dimension of output.
+  bool dynamic_ = false;
+  size_t row_size_ = 0;
+  int batch_offset_ = -1;
+  jit::Register limit_;
+
   // Input and output locators.
   std::vector<Locator> input_;
   std::vector<Locator> output_;
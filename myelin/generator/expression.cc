@@ -36,7 +36,8 @@ ExpressionGenerator *CreateVectorIntAVX256Generator();
 void ExpressionGenerator::Initalize(const Express &expression,
                                     Type type,
                                     int spare_regs,
-                                    IndexGenerator *index) {
+                                    IndexGenerator *index,
+                                    int max_regs) {
   // Copy expression.
   expression_.Copy(expression);
   type_ = type;
@@ -59,18 +60,30 @@ void ExpressionGenerator::Initalize(const Express &expression,
   // Cache inputs and results used in multiple ops in temporary variables.
   expression_.CacheResults();
 
-  // Convert expression to instructions using instruction model.
-  CHECK(expression_.Rewrite(model_, &instructions_));
+  for (;;) {
+    // Convert expression to instructions using instruction model.
+    CHECK(expression_.Rewrite(model_, &instructions_));
 
-  // Compute live ranges for all variables.
-  instructions_.ComputeLiveRanges();
+    // Compute live ranges for all variables.
+    instructions_.ComputeLiveRanges();
 
-  // Allocate registers for temporary variables.
-  instructions_.AllocateRegisters();
+    // Allocate registers for temporary variables.
+    int regs = instructions_.AllocateRegisters();
+
+    // Spill temporary variables to memory until the instructions fit in the
+    // available registers.
+    if (max_regs == 0 || regs <= max_regs) break;
+    if (!expression_.SpillTemp()) break;
+    instructions_.Clear();
+  }
 
   // Initialize index generator.
   index->Initialize(VectorSize());
 
+  // Reserve stack slots for spilled variables.
+  int spills = expression_.NumVars(Express::SPILL);
+  if (spills > 0) index->ReserveSpillSlots(spills, VectorSize());
+
   // Reserve registers.
   Reserve();
 }
@@ -489,7 +502,7 @@ void ExpressionGenerator::GenerateXMMFltOp(
     Express::Op *instr,
     OpXMMRegReg fltopreg, OpXMMRegReg dblopreg,
     OpXMMRegMem fltopmem, OpXMMRegMem dblopmem,
-    MacroAssembler *masm) {
+    MacroAssembler *masm, int argnum) {
   if (instr->dst != -1 && instr->src != -1) {
     // OP reg,reg
     switch (type_) {
@@ -505,10 +518,10 @@ void ExpressionGenerator::GenerateXMMFltOp(
     // OP reg,[mem]
     switch (type_) {
       case DT_FLOAT:
-        (masm->*fltopmem)(xmm(instr->dst), addr(instr->args[1]));
+        (masm->*fltopmem)(xmm(instr->dst), addr(instr->args[argnum]));
         break;
       case DT_DOUBLE:
-        (masm->*dblopmem)(xmm(instr->dst), addr(instr->args[1]));
+        (masm->*dblopmem)(xmm(instr->dst), addr(instr->args[argnum]));
         break;
       default: UNSUPPORTED;
     }
@@ -522,7 +535,7 @@ void ExpressionGenerator::GenerateXMMFltOp(
     OpXMMRegRegImm fltopreg, OpXMMRegRegImm dblopreg,
     OpXMMRegMemImm fltopmem, OpXMMRegMemImm dblopmem,
     int8 imm,
-    MacroAssembler *masm) {
+    MacroAssembler *masm, int argnum) {
   if (instr->dst != -1 && instr->src != -1) {
     // OP reg,reg
     switch (type_) {
@@ -538,10 +551,10 @@ void ExpressionGenerator::GenerateXMMFltOp(
     // OP reg,[mem]
     switch (type_) {
       case DT_FLOAT:
-        (masm->*fltopmem)(xmm(instr->dst), addr(instr->args[1]), imm);
+        (masm->*fltopmem)(xmm(instr->dst), addr(instr->args[argnum]), imm);
         break;
       case DT_DOUBLE:
-        (masm->*dblopmem)(xmm(instr->dst), addr(instr->args[1]), imm);
+        (masm->*dblopmem)(xmm(instr->dst), addr(instr->args[argnum]), imm);
         break;
       default: UNSUPPORTED;
     }
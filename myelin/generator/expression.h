@@ -55,11 +55,17 @@ class ExpressionGenerator {
   // Generate code for instruction.
   virtual void Generate(Express::Op *instr, MacroAssembler *masm) = 0;
 
-  // Initialize expression generator.
+  // Initialize expression generator. If max_regs is non-zero, temporary
+  // variables are spilled to memory until the expression can be computed
+  // using at most max_regs registers for temporary variables.
   void Initalize(const Express &expression,
                  Type type,
                  int spare_regs,
-                 IndexGenerator *index);
+                 IndexGenerator *index,
+                 int max_regs = 0);
+
+  // Return the number of registers used for temporary variables.
+  int RegisterUsage() const { return instructions_.NumRegs(); }
 
   // Generate code for loop-invariant part of expression.
   void GenerateInit(MacroAssembler *masm);
@@ -172,7 +178,10 @@ class ExpressionGenerator {
   }
 
   // Return operand for accessing memory variable.
-  Operand addr(Express::Var *var) { return index_->addr(var); }
+  Operand addr(Express::Var *var) {
+    if (var->type == Express::SPILL) return index_->spill(var->id);
+    return index_->addr(var);
+  }
 
   // Return pointer to constant data.
   const void *data(Express::Var *var) { return index_->data(var); }
@@ -227,7 +236,7 @@ class ExpressionGenerator {
     Express::Op *instr,
     OpXMMRegReg fltopreg, OpXMMRegReg dblopreg,
     OpXMMRegMem fltopmem, OpXMMRegMem dblopmem,
-    MacroAssembler *masm);
+    MacroAssembler *masm, int argnum = 1);
 
   // Generate two-operand XMM float op with immediate.
   void GenerateXMMFltOp(
@@ -235,7 +244,7 @@ class ExpressionGenerator {
     OpXMMRegRegImm fltopreg, OpXMMRegRegImm dblopreg,
     OpXMMRegMemImm fltopmem, OpXMMRegMemImm dblopmem,
     int8 imm,
-    MacroAssembler *masm);
+    MacroAssembler *masm, int argnum = 1);
 
   // Generate three-operand XMM float op.
   void GenerateXMMFltOp(
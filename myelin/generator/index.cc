@@ -51,35 +51,61 @@ bool IndexGenerator::AllocateRegisters() {
     if (m == -1) ok = false;
   }
 
+  // Allocate register for saving the stack pointer if there are spill slots.
+  if (spill_slots_ > 0) {
+    frame_ = masm_->rr().try_alloc();
+    if (!frame_.is_valid()) ok = false;
+  }
+
   return ok;
 }
 
+void IndexGenerator::ReserveSpillSlots(int count, int size) {
+  if (count > spill_slots_) spill_slots_ = count;
+  if (size > spill_size_) spill_size_ = size;
+}
+
+void IndexGenerator::BeginSpillArea() {
+  if (spill_slots_ == 0) return;
+  MacroAssembler *masm = masm_;
+
+  // Allocate spill area on the stack aligned to the slot size so aligned moves
+  // can be used for the spill slots.
+  int alignment = spill_size_ < 16 ? 16 : spill_size_;
+  __ movq(frame_, rsp);
+  __ subq(rsp, Immediate(spill_slots_ * spill_size_));
+  __ andq(rsp, Immediate(-alignment));
+}
+
+void IndexGenerator::EndSpillArea() {
+  if (spill_slots_ == 0) return;
+  MacroAssembler *masm = masm_;
+
+  // Restore stack pointer.
+  __ movq(rsp, frame_);
+}
+
 void IndexGenerator::ReserveFixedRegister(jit::Register reg) {
+  for (auto r : fixed_) {
+    if (r.is(reg)) return;
+  }
   fixed_.push_back(reg);
 }
 
 void IndexGenerator::ReserveRegisters(int count) {
-  for (int n = 0; n < count; ++n) {
-    regs_.push_back(no_reg);
-  }
+  while (regs_.size() < count) regs_.push_back(no_reg);
 }
 
 void IndexGenerator::ReserveAuxRegisters(int count) {
-  for (int n = 0; n < count; ++n) {
-    aux_.push_back(no_reg);
-  }
+  while (aux_.size() < count) aux_.push_back(no_reg);
 }
 
 void IndexGenerator::ReserveXMMRegisters(int count) {
-  for (int n = 0; n < count; ++n) {
-    mmregs_.push_back(-1);
-  }
+  while (mmregs_.size() < count) mmregs_.push_back(-1);
 }
 
 void IndexGenerator::ReserveAuxXMMRegisters(int count) {
-  for (int n = 0; n < count; ++n) {
-    mmaux_.push_back(-1);
-  }
+  while (mmaux_.size() < count) mmaux_.push_back(-1);
 }
 
 void IndexGenerator::ReserveYMMRegisters(int count) {
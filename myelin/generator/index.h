@@ -44,6 +44,11 @@ class IndexGenerator {
   // Return pointer to constant data.
   virtual const void *data(Express::Var *var) = 0;
 
+  // Return operand for accessing spill slot for spilled temporary variable.
+  jit::Operand spill(int slot) {
+    return jit::Operand(jit::rsp, slot * spill_size_);
+  }
+
   // Return register for accessing temporary variable.
   jit::Register reg(int idx) { return regs_[idx]; }
   jit::XMMRegister xmm(int idx) {
@@ -67,6 +72,9 @@ class IndexGenerator {
   void ReserveFixedRegister(jit::Register reg);
 
   // Reserve registers used for holding intermediate values in expressions.
+  // Expression generators that share an index generator also share these
+  // registers, so each call reserves at least the requested number of
+  // registers.
   void ReserveRegisters(int count);
   void ReserveXMMRegisters(int count);
   void ReserveAuxYMMRegisters(int count);
@@ -77,6 +85,16 @@ class IndexGenerator {
   void ReserveAuxXMMRegisters(int count);
   void ReserveYMMRegisters(int count);
 
+  // Reserve stack slots of the given size for temporary variables spilled to
+  // memory. The spill area is allocated on the stack by BeginSpillArea() and
+  // released again by EndSpillArea(), and the stack pointer is used as base
+  // register for the spill slots between these two calls.
+  void ReserveSpillSlots(int count, int size);
+
+  // Generate code for allocating and releasing the spill area.
+  void BeginSpillArea();
+  void EndSpillArea();
+
  protected:
   MacroAssembler *masm_;              // macro assembler for code generation
 
@@ -86,6 +104,10 @@ class IndexGenerator {
   std::vector<int> mmregs_;           // reserved SIMD registers (xmm/ymm)
   std::vector<jit::Register> aux_;    // reserved auxiliary registers
   std::vector<int> mmaux_;            // reserved auxiliary SIMD registers
+
+  int spill_slots_ = 0;               // number of spill slots
+  int spill_size_ = 0;                // size of each spill slot
+  jit::Register frame_ = jit::no_reg; // saved stack pointer for spill area
 };
 
 }  // namespace myelin
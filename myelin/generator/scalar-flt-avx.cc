@@ -55,7 +55,8 @@ class ScalarFltAVXGenerator : public ExpressionGenerator {
         instructions_.Has(Express::ANDNOT) ||
         instructions_.Has(Express::CVTFLTINT) ||
         instructions_.Has(Express::CVTINTFLT) ||
-        instructions_.Has(Express::SUBINT)) {
+        instructions_.Has(Express::SUBINT) ||
+        instructions_.Has(Express::SQRT)) {
       num_mm_aux = std::max(num_mm_aux, 1);
     }
 
@@ -118,6 +119,9 @@ class ScalarFltAVXGenerator : public ExpressionGenerator {
             &Assembler::vmaxss, &Assembler::vmaxsd,
             masm);
         break;
+      case Express::SQRT:
+        GenerateRegisterOp(instr, masm, true);
+        break;
       case Express::MULADD132:
         GenerateXMMFltOp(instr,
             &Assembler::vfmadd132ss, &Assembler::vfmadd132sd,
@@ -187,6 +191,12 @@ class ScalarFltAVXGenerator : public ExpressionGenerator {
       case Express::SUBINT:
         GenerateRegisterOp(instr, masm);
         break;
+      case Express::HSUM:
+      case Express::HMIN:
+      case Express::HMAX:
+        // Horizontal reduction of a single element is the element itself.
+        if (instr->dst != instr->src) GenerateXMMScalarFltMove(instr, masm);
+        break;
       default: UNSUPPORTED;
     }
   }
@@ -305,6 +315,7 @@ class ScalarFltAVXGenerator : public ExpressionGenerator {
           case Express::ANDNOT: __ vandnps(dst, src, src2); break;
           case Express::CVTFLTINT: __ vcvttps2dq(dst, src); break;
           case Express::CVTINTFLT: __ vcvtdq2ps(dst, src); break;
+          case Express::SQRT: __ vsqrtss(dst, src, src); break;
           case Express::SUBINT: __ vpsubd(dst, src, src2); break;
           default: UNSUPPORTED;
         }
@@ -321,6 +332,7 @@ class ScalarFltAVXGenerator : public ExpressionGenerator {
           case Express::ANDNOT: __ vandnpd(dst, src, src2); break;
           case Express::CVTFLTINT: __ vcvttpd2dq(dst, src); break;
           case Express::CVTINTFLT: __ vcvtdq2pd(dst, src); break;
+          case Express::SQRT: __ vsqrtsd(dst, src, src); break;
           case Express::SUBINT: __ vpsubq(dst, src, src2); break;
           default: UNSUPPORTED;
         }
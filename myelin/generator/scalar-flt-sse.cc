@@ -113,6 +113,12 @@ class ScalarFltSSEGenerator : public ExpressionGenerator {
             &Assembler::maxss, &Assembler::maxsd,
             masm);
         break;
+      case Express::SQRT:
+        GenerateXMMFltOp(instr,
+            &Assembler::sqrtss, &Assembler::sqrtsd,
+            &Assembler::sqrtss, &Assembler::sqrtsd,
+            masm, 0);
+        break;
       case Express::CMPEQOQ:
         GenerateCompare(instr, masm, CMP_EQ_OQ);
         break;
@@ -163,6 +169,12 @@ class ScalarFltSSEGenerator : public ExpressionGenerator {
       case Express::SUBINT:
         GenerateRegisterOp(instr, masm);
         break;
+      case Express::HSUM:
+      case Express::HMIN:
+      case Express::HMAX:
+        // Horizontal reduction of a single element is the element itself.
+        if (instr->dst != instr->src) GenerateXMMScalarFltMove(instr, masm);
+        break;
       default: UNSUPPORTED;
     }
   }
@@ -49,6 +49,15 @@ class VectorFltAVX128Generator : public ExpressionGenerator {
   void Reserve() override {
     // Reserve XMM registers.
     index_->ReserveXMMRegisters(instructions_.NumRegs());
+
+    // Allocate auxiliary registers.
+    int num_mm_aux = 0;
+    if (instructions_.Has(Express::HSUM) ||
+        instructions_.Has(Express::HMIN) ||
+        instructions_.Has(Express::HMAX)) {
+      num_mm_aux = std::max(num_mm_aux, 1);
+    }
+    index_->ReserveAuxXMMRegisters(num_mm_aux);
   }
 
   void Generate(Express::Op *instr, MacroAssembler *masm) override {
@@ -107,6 +116,14 @@ class VectorFltAVX128Generator : public ExpressionGenerator {
             &Assembler::vmaxps, &Assembler::vmaxpd,
             masm);
         break;
+      case Express::SQRT:
+        GenerateXMMFltOp(instr,
+            static_cast<OpXMMRegReg>(&Assembler::vsqrtps),
+            static_cast<OpXMMRegReg>(&Assembler::vsqrtpd),
+            static_cast<OpXMMRegMem>(&Assembler::vsqrtps),
+            static_cast<OpXMMRegMem>(&Assembler::vsqrtpd),
+            masm, 0);
+        break;
       case Express::MULADD132:
         GenerateXMMFltOp(instr,
             &Assembler::vfmadd132ps, &Assembler::vfmadd132pd,
@@ -203,6 +220,51 @@ class VectorFltAVX128Generator : public ExpressionGenerator {
             &Assembler::vpsubd, &Assembler::vpsubq,
             masm);
         break;
+      case Express::HSUM:
+        GenerateHorizontal(instr, masm,
+            &Assembler::vaddps, &Assembler::vaddpd);
+        break;
+      case Express::HMIN:
+        GenerateHorizontal(instr, masm,
+            &Assembler::vminps, &Assembler::vminpd);
+        break;
+      case Express::HMAX:
+        GenerateHorizontal(instr, masm,
+            &Assembler::vmaxps, &Assembler::vmaxpd);
+        break;
+      default: UNSUPPORTED;
+    }
+  }
+
+  // Generate horizontal reduction. The result is broadcast to all the elements
+  // of the destination register.
+  void GenerateHorizontal(Express::Op *instr, MacroAssembler *masm,
+                          OpXMMRegRegReg fltop, OpXMMRegRegReg dblop) {
+    // Move argument to destination register.
+    CHECK(instr->dst != -1);
+    XMMRegister acc = xmm(instr->dst);
+    XMMRegister aux = xmmaux(0);
+    switch (type_) {
+      case DT_FLOAT:
+        if (instr->src == -1) {
+          __ vmovaps(acc, addr(instr->args[0]));
+        } else if (instr->src != instr->dst) {
+          __ vmovaps(acc, xmm(instr->src));
+        }
+        __ vpermilps(aux, acc, 0x4E);
+        (masm->*fltop)(acc, acc, aux);
+        __ vpermilps(aux, acc, 0xB1);
+        (masm->*fltop)(acc, acc, aux);
+        break;
+      case DT_DOUBLE:
+        if (instr->src == -1) {
+          __ vmovapd(acc, addr(instr->args[0]));
+        } else if (instr->src != instr->dst) {
+          __ vmovapd(acc, xmm(instr->src));
+        }
+        __ vpermilpd(aux, acc, 1);
+        (masm->*dblop)(acc, acc, aux);
+        break;
       default: UNSUPPORTED;
     }
   }
@@ -61,6 +61,11 @@ class VectorFltAVX256Generator : public ExpressionGenerator {
         num_mm_aux = std::max(num_mm_aux, 3);
       }
     }
+    if (instructions_.Has(Express::HSUM) ||
+        instructions_.Has(Express::HMIN) ||
+        instructions_.Has(Express::HMAX)) {
+      num_mm_aux = std::max(num_mm_aux, 1);
+    }
     index_->ReserveAuxYMMRegisters(num_mm_aux);
   }
 
@@ -120,6 +125,14 @@ class VectorFltAVX256Generator : public ExpressionGenerator {
             &Assembler::vmaxps, &Assembler::vmaxpd,
             masm);
         break;
+      case Express::SQRT:
+        GenerateYMMFltOp(instr,
+            static_cast<OpYMMRegReg>(&Assembler::vsqrtps),
+            static_cast<OpYMMRegReg>(&Assembler::vsqrtpd),
+            static_cast<OpYMMRegMem>(&Assembler::vsqrtps),
+            static_cast<OpYMMRegMem>(&Assembler::vsqrtpd),
+            masm);
+        break;
       case Express::MULADD132:
         GenerateYMMFltOp(instr,
             &Assembler::vfmadd132ps, &Assembler::vfmadd132pd,
@@ -213,11 +226,57 @@ class VectorFltAVX256Generator : public ExpressionGenerator {
       case Express::SUBINT:
         GenerateIntegerSubtract(instr, masm);
         break;
+      case Express::HSUM:
+        GenerateHorizontal(instr, masm,
+            &Assembler::vaddps, &Assembler::vaddpd);
+        break;
+      case Express::HMIN:
+        GenerateHorizontal(instr, masm,
+            &Assembler::vminps, &Assembler::vminpd);
+        break;
+      case Express::HMAX:
+        GenerateHorizontal(instr, masm,
+            &Assembler::vmaxps, &Assembler::vmaxpd);
+        break;
       default:
         UNSUPPORTED;
     }
   }
 
+  // Generate horizontal reduction. The two 128-bit lanes are combined first
+  // and then the elements within the lane. The result is broadcast to all the
+  // elements of the destination register.
+  void GenerateHorizontal(Express::Op *instr, MacroAssembler *masm,
+                          OpYMMRegRegReg fltop, OpYMMRegRegReg dblop) {
+    // Move argument to destination register.
+    CHECK(instr->dst != -1);
+    YMMRegister acc = ymm(instr->dst);
+    YMMRegister aux = ymmaux(0);
+    if (instr->src == -1) {
+      GenerateYMMMoveMemToReg(acc, addr(instr->args[0]), masm);
+    } else if (instr->src != instr->dst) {
+      __ vmovaps(acc, ymm(instr->src));
+    }
+
+    // Reduce elements using butterfly permutations.
+    __ vperm2f128(aux, acc, acc, 1);
+    switch (type_) {
+      case DT_FLOAT:
+        (masm->*fltop)(acc, acc, aux);
+        __ vpermilps(aux, acc, 0x4E);
+        (masm->*fltop)(acc, acc, aux);
+        __ vpermilps(aux, acc, 0xB1);
+        (masm->*fltop)(acc, acc, aux);
+        break;
+      case DT_DOUBLE:
+        (masm->*dblop)(acc, acc, aux);
+        __ vpermilpd(aux, acc, 5);
+        (masm->*dblop)(acc, acc, aux);
+        break;
+      default: UNSUPPORTED;
+    }
+  }
+
   // Generate left/right shift.
   void GenerateShift(Express::Op *instr, MacroAssembler *masm,
                      bool left, int bits) {
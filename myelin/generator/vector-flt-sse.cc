@@ -44,6 +44,15 @@ class VectorFltSSEGenerator : public ExpressionGenerator {
   void Reserve() override {
     // Reserve XMM registers.
     index_->ReserveXMMRegisters(instructions_.NumRegs());
+
+    // Allocate auxiliary registers.
+    int num_mm_aux = 0;
+    if (instructions_.Has(Express::HSUM) ||
+        instructions_.Has(Express::HMIN) ||
+        instructions_.Has(Express::HMAX)) {
+      num_mm_aux = std::max(num_mm_aux, 1);
+    }
+    index_->ReserveAuxXMMRegisters(num_mm_aux);
   }
 
   void Generate(Express::Op *instr, MacroAssembler *masm) override {
@@ -102,6 +111,12 @@ class VectorFltSSEGenerator : public ExpressionGenerator {
             &Assembler::maxps, &Assembler::maxpd,
             masm);
         break;
+      case Express::SQRT:
+        GenerateXMMFltOp(instr,
+            &Assembler::sqrtps, &Assembler::sqrtpd,
+            &Assembler::sqrtps, &Assembler::sqrtpd,
+            masm, 0);
+        break;
       case Express::CMPEQOQ:
         GenerateCompare(instr, masm, CMP_EQ_OQ);
         break;
@@ -157,12 +172,54 @@ class VectorFltSSEGenerator : public ExpressionGenerator {
             &Assembler::psubd, &Assembler::psubq,
             masm);
         break;
+      case Express::HSUM:
+        GenerateHorizontal(instr, masm, &Assembler::addps, &Assembler::addpd);
+        break;
+      case Express::HMIN:
+        GenerateHorizontal(instr, masm, &Assembler::minps, &Assembler::minpd);
+        break;
+      case Express::HMAX:
+        GenerateHorizontal(instr, masm, &Assembler::maxps, &Assembler::maxpd);
+        break;
       default:
         LOG(INFO) << "Unsupported: " << instr->AsInstruction();
         UNSUPPORTED;
     }
   }
 
+  // Generate horizontal reduction. The result is broadcast to all the elements
+  // of the destination register.
+  void GenerateHorizontal(Express::Op *instr, MacroAssembler *masm,
+                          OpXMMRegReg fltop, OpXMMRegReg dblop) {
+    // Move argument to destination register.
+    CHECK(instr->dst != -1);
+    XMMRegister acc = xmm(instr->dst);
+    XMMRegister aux = xmmaux(0);
+    if (instr->src == -1) {
+      __ movaps(acc, addr(instr->args[0]));
+    } else if (instr->src != instr->dst) {
+      __ movaps(acc, xmm(instr->src));
+    }
+
+    // Swap the 64-bit halves and then the 32-bit elements within each half.
+    switch (type_) {
+      case DT_FLOAT:
+        __ movaps(aux, acc);
+        __ shufps(aux, aux, 0x4E);
+        (masm->*fltop)(acc, aux);
+        __ movaps(aux, acc);
+        __ shufps(aux, aux, 0xB1);
+        (masm->*fltop)(acc, aux);
+        break;
+      case DT_DOUBLE:
+        __ movaps(aux, acc);
+        __ shufps(aux, aux, 0x4E);
+        (masm->*dblop)(acc, aux);
+        break;
+      default: UNSUPPORTED;
+    }
+  }
+
   // Generate left/right shift.
   void GenerateShift(Express::Op *instr, MacroAssembler *masm,
                      bool left, int bits) {
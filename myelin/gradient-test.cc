@@ -0,0 +1,380 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks the gradient functions built by Gradient() against finite
+// differences, and checks single updates of the gradient descent and Adam
+// optimizers against a reference computation. The model uses embedding
+// lookups, gathering, concatenation, matrix multiplication, bias broadcasting,
+// and the element-wise operations with gradients. The loss is the squared
+// error between the model output and a random target.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "base/flags.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "myelin/builder.h"
+#include "myelin/compute.h"
+#include "myelin/flow.h"
+#include "myelin/gradient.h"
+#include "myelin/kernel/dragnn.h"
+#include "myelin/kernel/tensorflow.h"
+#include "myelin/learning.h"
+
+DEFINE_int32(samples, 3, "Number of samples for checking gradients");
+DEFINE_double(delta, 2e-3, "Step size for finite differences");
+DEFINE_double(tolerance, 2e-2, "Relative tolerance for gradients");
+
+using namespace sling;
+using namespace sling::myelin;
+
+// Model dimensions.
+static const int kVocab = 10;     // embedding vocabulary size
+static const int kDims = 5;       // embedding and input dimension
+static const int kFeatures = 3;   // number of features in embedding lookup
+static const int kGathered = 2;   // number of gathered embedding rows
+static const int kHidden = 7;     // hidden layer size
+static const int kOutputs = 3;    // output size
+
+// Learnable variables in the model.
+static const char *kLearnables[] = {"E", "G", "W1", "b1", "W2", "W3"};
+
+// Random value in [-1,1].
+static float Random() {
+  return (rand() % 2000) / 1000.0 - 1.0;
+}
+
+// Fill variable with random values.
+static void Randomize(Flow::Variable *var, float scale) {
+  float *data = reinterpret_cast<float *>(const_cast<char *>(var->data));
+  for (int i = 0; i < var->elements(); ++i) data[i] = Random() * scale;
+}
+
+// Return address of element in global tensor. The learnable tensors are
+// updated in place by the gradient and optimizer cells.
+static float *Element(const Tensor *tensor, int index) {
+  int cols = tensor->dim(tensor->rank() - 1);
+  int row = index / cols;
+  int col = index % cols;
+  size_t offset = col * sizeof(float);
+  if (tensor->rank() == 2) offset += row * tensor->stride(0);
+  return reinterpret_cast<float *>(const_cast<char *>(tensor->data()) + offset);
+}
+
+// Training sample.
+struct Sample {
+  int features[kFeatures];
+  int indices[kGathered];
+  float input[kDims];
+  float target[kOutputs];
+};
+
+// Make random sample. The last lookup feature is OOV.
+static Sample RandomSample() {
+  Sample s;
+  for (int i = 0; i < kFeatures; ++i) s.features[i] = rand() % kVocab;
+  s.features[kFeatures - 1] = -1;
+  for (int i = 0; i < kGathered; ++i) s.indices[i] = rand() % kVocab;
+  for (int i = 0; i < kDims; ++i) s.input[i] = Random();
+  for (int i = 0; i < kOutputs; ++i) s.target[i] = (Random() + 1.0) / 2.0;
+  return s;
+}
+
+// Model with gradient function and optimizer.
+class Model {
+ public:
+  explicit Model(Optimizer *optimizer) : optimizer_(optimizer) {
+    RegisterTensorflowLibrary(&library_);
+    RegisterDragnnLibrary(&library_);
+    RegisterStandardGradients(&library_);
+
+    Builder tf(&flow_, "f");
+    auto *E = tf.Learnable("E", DT_FLOAT, {kVocab + 1, kDims});
+    auto *G = tf.Learnable("G", DT_FLOAT, {kVocab, kDims});
+    auto *W1 = tf.Learnable("W1", DT_FLOAT, {(kGathered + 2) * kDims, kHidden});
+    auto *b1 = tf.Learnable("b1", DT_FLOAT, {kHidden});
+    auto *W2 = tf.Learnable("W2", DT_FLOAT, {kHidden, kOutputs});
+    auto *W3 = tf.Learnable("W3", DT_FLOAT, {kHidden, kOutputs});
+    for (auto *var : {E, G, W1, b1, W2, W3}) Randomize(var, 0.5);
+
+    auto *features = tf.Var("f/features", DT_INT32, {1, kFeatures});
+    auto *indices = tf.Var("f/indices", DT_INT32, {kGathered});
+    auto *input = tf.Var("f/input", DT_FLOAT, {1, kDims});
+    features->in = indices->in = input->in = true;
+
+    // Concatenate the summed embeddings, the gathered embeddings, and the
+    // input, and compute the hidden layer.
+    auto *e = tf.Op("Lookup", {features, E}, DT_FLOAT, {1, kDims});
+    auto *g = tf.Op("Gather", {G, indices}, DT_FLOAT, {kGathered, kDims});
+    std::vector<int> shape = {1, kGathered * kDims};
+    auto *r = tf.Reshape(g, tf.Constant(shape));
+    r->shape = Shape({1, kGathered * kDims});
+    auto *c = tf.Op("ConcatV2", {e, r, input, tf.Constant(1)}, DT_FLOAT,
+                    {1, (kGathered + 2) * kDims});
+    c->producer->SetAttr("N", 3);
+    auto *h = tf.Tanh(tf.Add(tf.MatMul(c, W1), b1));
+
+    // y = relu(a) * sigmoid(b) + log(sigmoid(b)) - exp(-a^2)
+    auto *a = tf.MatMul(h, W2);
+    auto *b = tf.MatMul(h, W3);
+    auto *s = tf.Sigmoid(b);
+    auto *y = tf.Add(tf.Mul(tf.Relu(a), s),
+                     tf.Sub(tf.Log(s), tf.Exp(tf.Negate(tf.Square(a)))));
+    y->AddAlias("f/y");
+    y->out = true;
+
+    Gradient(&flow_, tf.func(), library_);
+    optimizer_->Build(&flow_);
+    flow_.Analyze(library_);
+    CHECK(network_.Compile(flow_, library_));
+    optimizer_->Initialize(network_);
+
+    forward_ = new Instance(network_.GetCell("f"));
+    backward_ = new Instance(network_.GetCell("gradients/f"));
+  }
+
+  ~Model() {
+    delete forward_;
+    delete backward_;
+    delete optimizer_;
+  }
+
+  // Compute model output for sample.
+  void Forward(const Sample &s, float *y) {
+    forward_->Clear();
+    memcpy(forward_->Get<int>(Param("f/features")), s.features,
+           sizeof(s.features));
+    memcpy(forward_->Get<int>(Param("f/indices")), s.indices,
+           sizeof(s.indices));
+    memcpy(forward_->Get<float>(Param("f/input")), s.input, sizeof(s.input));
+    forward_->Compute();
+    memcpy(y, forward_->Get<float>(Param("f/y")), sizeof(float) * kOutputs);
+  }
+
+  // Compute loss for sample.
+  double Loss(const Sample &s) {
+    float y[kOutputs];
+    Forward(s, y);
+    double loss = 0.0;
+    for (int i = 0; i < kOutputs; ++i) {
+      loss += 0.5 * (y[i] - s.target[i]) * (y[i] - s.target[i]);
+    }
+    return loss;
+  }
+
+  // Compute gradient of the loss for sample and add it to the gradient
+  // accumulators.
+  void Backward(const Sample &s) {
+    float y[kOutputs];
+    Forward(s, y);
+    backward_->Clear();
+    backward_->SetReference(Param("gradients/f/primal"), forward_->data());
+    float *dy = backward_->Get<float>(Param("gradients/f/d_y"));
+    for (int i = 0; i < kOutputs; ++i) dy[i] = y[i] - s.target[i];
+    backward_->Compute();
+  }
+
+  // Return derivative of the loss with respect to the input.
+  const float *InputGradient() {
+    return backward_->Get<float>(Param("gradients/f/d_input"));
+  }
+
+  // Return parameter in network.
+  Tensor *Param(const string &name) {
+    Tensor *param = network_.GetParameter(name);
+    CHECK(param != nullptr) << name;
+    return param;
+  }
+
+  Optimizer *optimizer() const { return optimizer_; }
+
+ private:
+  Library library_;
+  Flow flow_;
+  Network network_;
+  Optimizer *optimizer_;
+  Instance *forward_ = nullptr;
+  Instance *backward_ = nullptr;
+};
+
+// Check that gradient matches numeric derivative.
+static bool Matches(double numeric, double gradient) {
+  double error = fabs(numeric - gradient);
+  return error <= FLAGS_delta + FLAGS_tolerance * fabs(numeric);
+}
+
+// Check the gradients of the loss against finite differences.
+static int CheckGradients() {
+  // Gradient descent with zero learning rate just clears the accumulators.
+  Model model(new GradientDescentOptimizer(0.0));
+  int checks = 0;
+  int errors = 0;
+  for (int n = 0; n < FLAGS_samples; ++n) {
+    Sample s = RandomSample();
+    model.Backward(s);
+
+    // Check derivative of input.
+    std::vector<float> dx(model.InputGradient(),
+                          model.InputGradient() + kDims);
+    for (int i = 0; i < kDims; ++i) {
+      Sample plus = s;
+      Sample minus = s;
+      plus.input[i] += FLAGS_delta;
+      minus.input[i] -= FLAGS_delta;
+      double numeric =
+          (model.Loss(plus) - model.Loss(minus)) / (2 * FLAGS_delta);
+      checks++;
+      if (!Matches(numeric, dx[i])) {
+        LOG(ERROR) << "d_input[" << i << "]: numeric " << numeric
+                   << " gradient " << dx[i];
+        errors++;
+      }
+    }
+
+    // Check gradients of learnable variables.
+    for (const char *name : kLearnables) {
+      Tensor *var = model.Param(name);
+      Tensor *dv = model.Param(string("gradients/") + name);
+      for (int i = 0; i < var->elements(); ++i) {
+        float *p = Element(var, i);
+        float value = *p;
+        *p = value + FLAGS_delta;
+        double plus = model.Loss(s);
+        *p = value - FLAGS_delta;
+        double minus = model.Loss(s);
+        *p = value;
+        double numeric = (plus - minus) / (2 * FLAGS_delta);
+        float gradient = *Element(dv, i);
+        checks++;
+        if (!Matches(numeric, gradient)) {
+          LOG(ERROR) << name << "[" << i << "]: numeric " << numeric
+                     << " gradient " << gradient;
+          errors++;
+        }
+      }
+    }
+
+    // Clear the gradient accumulators for the next sample.
+    model.optimizer()->Apply();
+  }
+  LOG(INFO) << "Checked " << checks << " gradients, " << errors << " errors";
+  return errors;
+}
+
+// Values of learnable variables and their gradients.
+struct Snapshot {
+  std::vector<std::vector<float>> values;
+  std::vector<std::vector<float>> gradients;
+};
+
+static Snapshot TakeSnapshot(Model *model) {
+  Snapshot snapshot;
+  for (const char *name : kLearnables) {
+    Tensor *var = model->Param(name);
+    Tensor *dv = model->Param(string("gradients/") + name);
+    snapshot.values.emplace_back();
+    snapshot.gradients.emplace_back();
+    for (int i = 0; i < var->elements(); ++i) {
+      snapshot.values.back().push_back(*Element(var, i));
+      snapshot.gradients.back().push_back(*Element(dv, i));
+    }
+  }
+  return snapshot;
+}
+
+// Check that the updated variables match the reference update and that the
+// gradient accumulators are cleared.
+template<typename F> static int CheckUpdate(Model *model, const char *optimizer,
+                                            const Snapshot &before, F update) {
+  int errors = 0;
+  for (int v = 0; v < sizeof(kLearnables) / sizeof(kLearnables[0]); ++v) {
+    const char *name = kLearnables[v];
+    Tensor *var = model->Param(name);
+    Tensor *dv = model->Param(string("gradients/") + name);
+    for (int i = 0; i < var->elements(); ++i) {
+      double expected = update(v, i, before.values[v][i],
+                               before.gradients[v][i]);
+      float actual = *Element(var, i);
+      if (fabs(actual - expected) > 1e-5 + 1e-4 * fabs(expected)) {
+        LOG(ERROR) << optimizer << " " << name << "[" << i << "]: expected "
+                   << expected << " got " << actual;
+        errors++;
+      }
+      if (*Element(dv, i) != 0.0) {
+        LOG(ERROR) << optimizer << " gradient for " << name << "[" << i
+                   << "] not cleared";
+        errors++;
+      }
+    }
+  }
+  return errors;
+}
+
+// Check one gradient descent update against the reference update.
+static int CheckGradientDescent() {
+  const float lr = 0.1;
+  Model model(new GradientDescentOptimizer(lr));
+  model.Backward(RandomSample());
+  model.Backward(RandomSample());
+  Snapshot before = TakeSnapshot(&model);
+  model.optimizer()->Apply();
+  return CheckUpdate(&model, "SGD", before,
+                     [&](int v, int i, double value, double gradient) {
+    return value - lr * gradient;
+  });
+}
+
+// Check two Adam updates against the reference update. The bias correction of
+// the moment estimates is folded into the step size.
+static int CheckAdam() {
+  const double lr = 0.01, beta1 = 0.8, beta2 = 0.9, epsilon = 1e-6;
+  Model model(new AdamOptimizer(lr, beta1, beta2, epsilon));
+  std::vector<std::vector<double>> m(sizeof(kLearnables) / sizeof(char *));
+  std::vector<std::vector<double>> v(m.size());
+  for (int i = 0; i < m.size(); ++i) {
+    int size = model.Param(kLearnables[i])->elements();
+    m[i].resize(size);
+    v[i].resize(size);
+  }
+  int errors = 0;
+  for (int t = 1; t <= 2; ++t) {
+    model.Backward(RandomSample());
+    Snapshot before = TakeSnapshot(&model);
+    model.optimizer()->Apply();
+    errors += CheckUpdate(&model, "Adam", before,
+                          [&](int k, int i, double value, double gradient) {
+      m[k][i] = beta1 * m[k][i] + (1 - beta1) * gradient;
+      v[k][i] = beta2 * v[k][i] + (1 - beta2) * gradient * gradient;
+      double alpha = lr * sqrt(1 - pow(beta2, t)) / (1 - pow(beta1, t));
+      return value - alpha * m[k][i] / (sqrt(v[k][i]) + epsilon);
+    });
+  }
+  return errors;
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  int errors = CheckGradients();
+  errors += CheckGradientDescent();
+  errors += CheckAdam();
+  CHECK_EQ(errors, 0) << "Gradient test failed";
+
+  LOG(INFO) << "PASS";
+  return 0;
+}
@@ -0,0 +1,408 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "myelin/gradient.h"
+
+#include "base/logging.h"
+
+namespace sling {
+namespace myelin {
+
+Gradients::Gradients(Flow *flow, Flow::Function *primal,
+                     const Transformations &library)
+    : Builder(flow, "gradients/" + primal->name),
+      primal_(primal),
+      library_(library) {
+  instance_ = Var(func()->name + "/primal", DT_RESOURCE, {});
+  instance_->ref = true;
+  instance_->in = true;
+}
+
+void Gradients::Build() {
+  // Find the inputs of the primal function that derivatives are computed for,
+  // i.e. the learnable variables and the float inputs, and all the variables
+  // that depend on these.
+  std::vector<Variable *> inputs;
+  for (Operation *op : primal_->ops) {
+    bool depends = false;
+    for (Variable *input : op->inputs) {
+      bool external = input->producer == nullptr ||
+                      input->producer->func != primal_;
+      if (external && !input->constant() && input->type == DT_FLOAT) {
+        if (active_.insert(input).second) inputs.push_back(input);
+      }
+      if (active(input)) depends = true;
+    }
+    if (depends) {
+      for (Variable *output : op->outputs) {
+        if (output->type == DT_FLOAT) active_.insert(output);
+      }
+    }
+  }
+
+  // Add derivatives of the primal outputs as inputs.
+  for (Operation *op : primal_->ops) {
+    for (Variable *output : op->outputs) {
+      if (!output->out || !active(output)) continue;
+      Variable *dy = Var(DerivativeName(output->name), output->type,
+                         output->shape);
+      for (const string &alias : output->aliases) {
+        dy->AddAlias(DerivativeName(alias));
+      }
+      dy->in = true;
+      terms_[output].push_back(dy);
+    }
+  }
+
+  // Add terms for the derivatives of the operation inputs in reverse order,
+  // so all terms for the outputs of an operation have been added before its
+  // gradient function is called.
+  for (int i = primal_->ops.size() - 1; i >= 0; --i) {
+    Operation *op = primal_->ops[i];
+    bool needed = false;
+    for (Variable *output : op->outputs) {
+      if (terms_.count(output) > 0) needed = true;
+    }
+    if (!needed) continue;
+
+    GradientFunc *gradient = library_.GetGradient(op->type);
+    CHECK(gradient != nullptr)
+        << "No gradient function for " << op->type << " in " << op->name;
+    gradient(op, this);
+  }
+
+  // Add the derivatives of the learnable variables to the accumulators and
+  // output the derivatives of the other inputs.
+  for (Variable *x : inputs) {
+    Variable *dx = d(x);
+    if (dx == nullptr) continue;
+    if (x->learnable) {
+      Variable *acc = accumulator(x);
+      RawOp("Assign", {acc, Add(acc, dx)});
+    } else {
+      dx->AddAlias(DerivativeName(x->name));
+      for (const string &alias : x->aliases) {
+        dx->AddAlias(DerivativeName(alias));
+      }
+      dx->out = true;
+    }
+  }
+  InferTypes();
+}
+
+void Gradients::InferTypes() {
+  auto &ops = func()->ops;
+  auto &typers = library_.typers();
+  for (; typed_ < ops.size(); ++typed_) {
+    Operation *op = ops[typed_];
+    bool infer = false;
+    for (Variable *output : op->outputs) {
+      if (output->type == DT_INVALID || output->shape.undefined()) {
+        infer = true;
+      }
+    }
+    if (!infer) continue;
+
+    for (int t = typers.size() - 1; t >= 0; --t) {
+      if (typers[t]->InferTypes(op)) break;
+    }
+    for (Variable *output : op->outputs) {
+      CHECK(output->type != DT_INVALID && !output->shape.undefined())
+          << "Cannot infer type for " << output->name;
+    }
+  }
+}
+
+Flow::Variable *Gradients::d(Variable *x) {
+  auto f = terms_.find(x);
+  if (f == terms_.end()) return nullptr;
+
+  // Sum the terms for the derivative.
+  std::vector<Variable *> &terms = f->second;
+  Variable *sum = terms[0];
+  for (int i = 1; i < terms.size(); ++i) sum = Add(sum, terms[i]);
+  terms.assign(1, sum);
+  InferTypes();
+  return sum;
+}
+
+Flow::Variable *Gradients::v(Variable *x) {
+  // Constants and learnable variables are global.
+  if (x->data != nullptr) return x;
+
+  // Other variables are read from the primal instance. These are marked as
+  // outputs so they are not overwritten in the primal instance.
+  auto f = values_.find(x);
+  if (f != values_.end()) return f->second;
+  Variable *value = Op("Reference", {instance_}, x->type, x->shape);
+  value->producer->SetAttr("var", x->name);
+  value->ref = true;
+  x->out = true;
+  values_[x] = value;
+  return value;
+}
+
+void Gradients::add(Variable *x, Variable *term) {
+  if (!active(x)) return;
+  InferTypes();
+  if (term->shape != x->shape) {
+    if (term->elements() == x->elements()) {
+      // Reshape term to the shape of the variable.
+      std::vector<int> dims;
+      for (int d = 0; d < x->rank(); ++d) dims.push_back(x->dim(d));
+      term = Op("Reshape", {term, Constant(dims)}, x->type, x->shape);
+    } else if (x->learnable && term->rank() == 2 &&
+               term->dim(1) == x->elements()) {
+      // Sum the terms for a broadcast vector over the batch by multiplying
+      // with a vector of ones.
+      int batch = term->dim(0);
+      std::vector<float> ones(batch, 1.0);
+      add_product(x, Constant(ones.data(), DT_FLOAT, {batch, 1}), term, true);
+      return;
+    } else {
+      LOG(FATAL) << "Cannot add term " << term->name << " with shape "
+                 << term->shape.ToString() << " to gradient for " << x->name
+                 << " with shape " << x->shape.ToString();
+    }
+  }
+  terms_[x].push_back(term);
+}
+
+void Gradients::add_product(Variable *x, Variable *a, Variable *b,
+                            bool transpose_a) {
+  if (!active(x)) return;
+  if (x->learnable) {
+    Operation *op = RawOp("AssignAddMatMul", {accumulator(x), a, b});
+    if (transpose_a) op->SetAttr("transpose_a", true);
+  } else {
+    Variable *term = Op("MatMul", {a, b});
+    if (transpose_a) term->producer->SetAttr("transpose_a", true);
+    add(x, term);
+  }
+}
+
+void Gradients::add_scatter(Variable *x, Variable *indices, Variable *value) {
+  if (!active(x)) return;
+  CHECK(x->learnable && x->rank() == 2)
+      << "Scattered gradients not supported for " << x->name;
+  InferTypes();
+  if (value->rank() != 2) {
+    std::vector<int> dims = {value->elements() / x->dim(1), x->dim(1)};
+    value = Op("Reshape", {value, Constant(dims)});
+  }
+  RawOp("ScatterAdd", {accumulator(x), indices, value});
+}
+
+Flow::Variable *Gradients::accumulator(Variable *x) {
+  string name = "gradients/" + x->name;
+  Variable *acc = flow()->Var(name);
+  if (acc == nullptr) acc = Learnable(name, x->type, x->shape);
+  return acc;
+}
+
+string Gradients::DerivativeName(const string &primal) const {
+  string name = primal;
+  string prefix = primal_->name + "/";
+  if (name.compare(0, prefix.size(), prefix) == 0) {
+    name = name.substr(prefix.size());
+  }
+  return func()->name + "/d_" + name;
+}
+
+Flow::Function *Gradient(Flow *flow, Flow::Function *func,
+                         const Transformations &library) {
+  // The primal function must be sorted and typed.
+  flow->InferInputsAndOutputs();
+  flow->Sort();
+  flow->InferTypes(library);
+
+  Gradients g(flow, func, library);
+  g.Build();
+  return g.func();
+}
+
+// y = x * W
+// dx = dy * W^T
+// dW = x^T * dy
+static void MatMulGrad(Flow::Operation *op, Gradients *g) {
+  CHECK(!op->GetAttr("transpose_a", false) &&
+        !op->GetAttr("transpose_b", false))
+      << "Gradient for transposed matrix multiplication not supported";
+  auto *x = op->inputs[0];
+  auto *W = op->inputs[1];
+  auto *dy = g->d(op->outputs[0]);
+  if (g->active(x)) {
+    auto *dx = g->Op("MatMul", {dy, g->v(W)});
+    dx->producer->SetAttr("transpose_b", true);
+    g->add(x, dx);
+  }
+  g->add_product(W, g->v(x), dy, true);
+}
+
+// y = a + b
+// da = dy
+// db = dy
+static void AddGrad(Flow::Operation *op, Gradients *g) {
+  auto *dy = g->d(op->outputs[0]);
+  g->add(op->inputs[0], dy);
+  g->add(op->inputs[1], dy);
+}
+
+// y = a - b
+// da = dy
+// db = -dy
+static void SubGrad(Flow::Operation *op, Gradients *g) {
+  auto *dy = g->d(op->outputs[0]);
+  g->add(op->inputs[0], dy);
+  if (g->active(op->inputs[1])) g->add(op->inputs[1], g->Negate(dy));
+}
+
+// y = a * b
+// da = dy * b
+// db = dy * a
+static void MulGrad(Flow::Operation *op, Gradients *g) {
+  auto *a = op->inputs[0];
+  auto *b = op->inputs[1];
+  auto *dy = g->d(op->outputs[0]);
+  if (g->active(a)) g->add(a, g->Mul(dy, g->v(b)));
+  if (g->active(b)) g->add(b, g->Mul(dy, g->v(a)));
+}
+
+// y = -x
+// dx = -dy
+static void NegateGrad(Flow::Operation *op, Gradients *g) {
+  auto *x = op->inputs[0];
+  if (g->active(x)) g->add(x, g->Negate(g->d(op->outputs[0])));
+}
+
+// y = x^2
+// dx = 2 * x * dy
+static void SquareGrad(Flow::Operation *op, Gradients *g) {
+  auto *x = op->inputs[0];
+  auto *dy = g->d(op->outputs[0]);
+  if (g->active(x)) {
+    g->add(x, g->Mul(dy, g->Mul(g->v(x), g->Constant(2.0f))));
+  }
+}
+
+// y = exp(x)
+// dx = dy * y
+static void ExpGrad(Flow::Operation *op, Gradients *g) {
+  auto *x = op->inputs[0];
+  auto *y = op->outputs[0];
+  if (g->active(x)) g->add(x, g->Mul(g->d(y), g->v(y)));
+}
+
+// y = log(x)
+// dx = dy / x
+static void LogGrad(Flow::Operation *op, Gradients *g) {
+  auto *x = op->inputs[0];
+  auto *dy = g->d(op->outputs[0]);
+  if (g->active(x)) g->add(x, g->Div(dy, g->v(x)));
+}
+
+// y = tanh(x)
+// dx = dy * (1 - y^2)
+static void TanhGrad(Flow::Operation *op, Gradients *g) {
+  auto *x = op->inputs[0];
+  auto *y = op->outputs[0];
+  if (g->active(x)) {
+    auto *one = g->Constant(1.0f);
+    g->add(x, g->Mul(g->d(y), g->Sub(one, g->Square(g->v(y)))));
+  }
+}
+
+// y = sigmoid(x)
+// dx = dy * y * (1 - y)
+static void SigmoidGrad(Flow::Operation *op, Gradients *g) {
+  auto *x = op->inputs[0];
+  auto *y = op->outputs[0];
+  if (g->active(x)) {
+    auto *one = g->Constant(1.0f);
+    auto *v = g->v(y);
+    g->add(x, g->Mul(g->d(y), g->Mul(v, g->Sub(one, v))));
+  }
+}
+
+// y = relu(x)
+// dx = dy if x > 0 else 0
+static void ReluGrad(Flow::Operation *op, Gradients *g) {
+  auto *x = op->inputs[0];
+  if (g->active(x)) {
+    auto *dx = g->Op("Calculate", {g->v(x), g->d(op->outputs[0])});
+    dx->producer->SetAttr("expr", "@0=And(CmpGtOQ(%0,_0),%1)");
+    g->add(x, dx);
+  }
+}
+
+// y = x
+// dx = dy
+static void IdentityGrad(Flow::Operation *op, Gradients *g) {
+  g->add(op->inputs[0], g->d(op->outputs[0]));
+}
+
+// y = concat(x_1, ..., x_n)
+// dx_1, ..., dx_n = split(dy)
+static void ConcatGrad(Flow::Operation *op, Gradients *g) {
+  int n = op->GetAttr("N", op->indegree() - 1);
+  auto *axis = op->inputs[n];
+  auto *dy = g->d(op->outputs[0]);
+  string name = g->OpName("Split");
+  std::vector<Flow::Variable *> parts;
+  for (int i = 0; i < n; ++i) {
+    auto *x = op->inputs[i];
+    parts.push_back(g->Var(name + ":" + std::to_string(i), x->type, x->shape));
+  }
+  g->flow()->AddOperation(g->func(), name, "Split", {axis, dy}, parts);
+  for (int i = 0; i < n; ++i) g->add(op->inputs[i], parts[i]);
+}
+
+// v = sum_i M[f_i]
+// dM[f_i] += dv
+static void LookupGrad(Flow::Operation *op, Gradients *g) {
+  auto *f = op->inputs[0];
+  auto *M = op->inputs[1];
+  g->add_scatter(M, g->v(f), g->d(op->outputs[0]));
+}
+
+// v_i = M[f_i]
+// dM[f_i] += dv_i
+static void GatherGrad(Flow::Operation *op, Gradients *g) {
+  auto *M = op->inputs[0];
+  auto *f = op->inputs[1];
+  g->add_scatter(M, g->v(f), g->d(op->outputs[0]));
+}
+
+void RegisterStandardGradients(Transformations *library) {
+  library->RegisterGradient("MatMul", MatMulGrad);
+  library->RegisterGradient("Add", AddGrad);
+  library->RegisterGradient("BiasAdd", AddGrad);
+  library->RegisterGradient("Sub", SubGrad);
+  library->RegisterGradient("Mul", MulGrad);
+  library->RegisterGradient("Negate", NegateGrad);
+  library->RegisterGradient("Square", SquareGrad);
+  library->RegisterGradient("Exp", ExpGrad);
+  library->RegisterGradient("Log", LogGrad);
+  library->RegisterGradient("Tanh", TanhGrad);
+  library->RegisterGradient("Sigmoid", SigmoidGrad);
+  library->RegisterGradient("Relu", ReluGrad);
+  library->RegisterGradient("Identity", IdentityGrad);
+  library->RegisterGradient("Reshape", IdentityGrad);
+  library->RegisterGradient("ConcatV2", ConcatGrad);
+  library->RegisterGradient("Lookup", LookupGrad);
+  library->RegisterGradient("Gather", GatherGrad);
+}
+
+}  // namespace myelin
+}  // namespace sling
@@ -0,0 +1,130 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MYELIN_GRADIENT_H_
+#define MYELIN_GRADIENT_H_
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "base/types.h"
+#include "myelin/builder.h"
+#include "myelin/flow.h"
+
+namespace sling {
+namespace myelin {
+
+// Build gradient function for a flow function. The gradient function
+// back-propagates the derivatives of the outputs of the function to its inputs
+// and learnable variables:
+//
+//   * The gradient function for f is named gradients/f.
+//   * The derivative of output y of f is an input named gradients/f/d_y.
+//   * The derivative of input x of f is an output named gradients/f/d_x.
+//   * The derivatives of the learnable variables are added to gradient
+//     accumulators, which are learnable variables named gradients/<var>.
+//   * The values computed by f are read from the instance of f, which is passed
+//     as a reference named gradients/f/primal.
+//
+// The variables in f used by the gradient function are marked as outputs, so
+// they are still available in the instance after f has been computed. The
+// accumulated gradients are applied by an optimizer (see learning.h), which
+// also clears the accumulators. Gradient cells that update the same
+// accumulators must not be computed concurrently.
+Flow::Function *Gradient(Flow *flow, Flow::Function *func,
+                         const Transformations &library);
+
+// Register gradient functions for standard operations.
+void RegisterStandardGradients(Transformations *library);
+
+// Builder for gradient function. The gradient functions for the operations
+// in the primal function are called in reverse order, and these add terms to
+// the derivatives of the inputs of the operations from the derivatives of
+// their outputs.
+class Gradients : public Builder {
+ public:
+  // Initialize gradient builder for primal function.
+  Gradients(Flow *flow, Flow::Function *primal,
+            const Transformations &library);
+
+  // Derivative of primal variable, i.e. the sum of the terms added to it. This
+  // returns null if no terms have been added for the variable.
+  Variable *d(Variable *x);
+
+  // Value of primal variable in the gradient function.
+  Variable *v(Variable *x);
+
+  // Check if derivative is computed for primal variable.
+  bool active(Variable *x) const { return active_.count(x) > 0; }
+
+  // Add term to derivative of primal variable. The term is reshaped to the
+  // shape of the variable, and terms for a learnable vector are summed over
+  // the batch.
+  void add(Variable *x, Variable *term);
+
+  // Add matrix product a * b, or a^T * b, to derivative of primal variable.
+  // This is added directly to the gradient accumulator for learnable
+  // variables.
+  void add_product(Variable *x, Variable *a, Variable *b, bool transpose_a);
+
+  // Add rows of value to the rows of the derivative of a learnable primal
+  // variable selected by the indices.
+  void add_scatter(Variable *x, Variable *indices, Variable *value);
+
+  // Primal function.
+  Function *primal() const { return primal_; }
+
+ private:
+  // Build gradient function.
+  void Build();
+
+  // Infer types for the operations added to the gradient function.
+  void InferTypes();
+
+  // Get gradient accumulator for learnable variable.
+  Variable *accumulator(Variable *x);
+
+  // Return name for derivative of primal variable name.
+  string DerivativeName(const string &primal) const;
+
+  // Primal function.
+  Function *primal_;
+
+  // Library with type inference and gradient functions.
+  const Transformations &library_;
+
+  // Reference to primal instance.
+  Variable *instance_;
+
+  // Primal variables that derivatives are computed for.
+  std::unordered_set<Variable *> active_;
+
+  // Terms for derivatives of primal variables.
+  std::unordered_map<Variable *, std::vector<Variable *>> terms_;
+
+  // Values of primal variables in gradient function.
+  std::unordered_map<Variable *, Variable *> values_;
+
+  // Number of operations in gradient function with inferred types.
+  int typed_ = 0;
+
+  friend Flow::Function *Gradient(Flow *flow, Flow::Function *func,
+                                  const Transformations &library);
+};
+
+}  // namespace myelin
+}  // namespace sling
+
+#endif  // MYELIN_GRADIENT_H_
@@ -0,0 +1,355 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmark for kernels. Flows with a single operation are built for a
+// grid of shapes and types, and each flow is compiled with every registered
+// kernel for the operation. The computations are profiled and the cycles,
+// GFLOPS, and bytes of input and output per cycle are reported for each
+// kernel. The results can be saved as JSON and used as a baseline for
+// detecting performance regressions in later runs.
+//
+// Sample usage:
+//   bazel-bin/myelin/kernel-benchmark --ops=MatMul,Tanh --output=/tmp/base.json
+//   bazel-bin/myelin/kernel-benchmark --baseline=/tmp/base.json
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/flags.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "file/file.h"
+#include "frame/object.h"
+#include "frame/serialization.h"
+#include "frame/store.h"
+#include "myelin/compute.h"
+#include "myelin/flow.h"
+#include "myelin/kernel/tensorflow.h"
+#include "myelin/profile.h"
+#include "string/printf.h"
+#include "string/strcat.h"
+
+DEFINE_string(ops, "", "Comma-separated list of operations to benchmark");
+DEFINE_int32(iterations, 1000, "Number of computations per kernel");
+DEFINE_int32(warmup, 100, "Number of computations before profiling");
+DEFINE_string(baseline, "", "JSON file with baseline results");
+DEFINE_string(output, "", "JSON file for writing results");
+DEFINE_double(threshold, 10.0, "Slowdown in percent reported as regression");
+
+using namespace sling;
+using namespace sling::myelin;
+
+// Benchmark configuration with operation, type, and shape.
+struct Benchmark {
+  const char *op;     // operation in flow
+  myelin::Type type;  // element type
+  int rows;           // number of rows in input, i.e. the batch size
+  int n;              // input dimension
+  int m;              // output dimension for matrix multiplications
+};
+
+// Result of running benchmark with a kernel.
+struct Result {
+  string name;             // benchmark name
+  string kernel;           // kernel name and variant
+  double cycles;           // cycles per computation
+  double gflops;           // giga floating-point operations per second
+  double bytes_per_cycle;  // bytes of input and output per cycle
+};
+
+// Elementwise operations with one and two arguments. The expansions of the
+// exponential functions manipulate the exponent bits of single precision
+// values, so these are only benchmarked for float.
+static const char *unary_ops[] = {"Relu", "Tanh"};
+static const char *float_ops[] = {"Sigmoid", "Exp"};
+static const char *binary_ops[] = {"Add", "Mul"};
+
+// Matrix multiplications with fused bias and activation. The bias and
+// activation are only fused for vector-matrix multiplications, so the batched
+// configurations are only benchmarked for plain matrix multiplication.
+static const char *matmul_ops[] = {"MatMul", "MatMulAdd", "MatMulAddRelu"};
+
+// Check if operation has been selected for benchmarking.
+static bool Selected(const char *op) {
+  if (FLAGS_ops.empty()) return true;
+  string ops = "," + FLAGS_ops + ",";
+  return ops.find(StrCat(",", op, ",")) != string::npos;
+}
+
+// Generate the grid of benchmark configurations.
+static std::vector<Benchmark> Grid() {
+  std::vector<Benchmark> grid;
+  for (const char *op : matmul_ops) {
+    for (int n : {64, 256, 1024}) {
+      for (int m : {64, 256, 1024}) grid.push_back({op, DT_FLOAT, 1, n, m});
+    }
+  }
+  for (int n : {64, 256, 1024}) {
+    for (int m : {64, 256, 1024}) {
+      grid.push_back({"MatMul", DT_FLOAT, 16, n, m});
+    }
+  }
+  for (const char *op : binary_ops) {
+    for (myelin::Type type : {DT_FLOAT, DT_DOUBLE}) {
+      for (int n : {64, 1024, 16384}) grid.push_back({op, type, 1, n, 0});
+    }
+  }
+  for (const char *op : unary_ops) {
+    for (myelin::Type type : {DT_FLOAT, DT_DOUBLE}) {
+      for (int n : {64, 1024, 16384}) grid.push_back({op, type, 1, n, 0});
+    }
+  }
+  for (const char *op : float_ops) {
+    for (int n : {64, 1024, 16384}) grid.push_back({op, DT_FLOAT, 1, n, 0});
+  }
+  return grid;
+}
+
+// Return name for benchmark configuration.
+static string BenchmarkName(const Benchmark &b) {
+  string name = StrCat(b.op, "/", TypeTraits::of(b.type).name(), "/");
+  if (b.m == 0) {
+    StrAppend(&name, b.n);
+  } else {
+    StrAppend(&name, b.rows, "x", b.n, "x", b.m);
+  }
+  return name;
+}
+
+// Set variable to constant with random data.
+static void SetRandom(Flow *flow, Flow::Variable *var) {
+  int size = var->shape.elements();
+  if (var->type == DT_DOUBLE) {
+    double *data = reinterpret_cast<double *>(
+        flow->AllocateMemory(size * sizeof(double)));
+    for (int i = 0; i < size; ++i) data[i] = 2.0 * drand48() - 1.0;
+    var->SetData(data, size * sizeof(double));
+  } else {
+    float *data = reinterpret_cast<float *>(
+        flow->AllocateMemory(size * sizeof(float)));
+    for (int i = 0; i < size; ++i) data[i] = 2.0 * drand48() - 1.0;
+    var->SetData(data, size * sizeof(float));
+  }
+}
+
+// Build flow with a single operation for benchmark configuration.
+static void BuildFlow(const Benchmark &b, Flow *flow) {
+  Flow::Function *func = flow->AddFunction("bench");
+  string op = b.op;
+  if (b.m == 0) {
+    // Elementwise operation. The inputs are marked as outputs, so they are not
+    // overwritten by in-place computation, which would change the input values
+    // between iterations, e.g. making repeated multiplication underflow.
+    Flow::Variable *x = flow->AddVariable("bench/x", b.type, {b.n});
+    Flow::Variable *z = flow->AddVariable("bench/z", b.type, {b.n});
+    x->out = true;
+    if (op == "Add" || op == "Mul") {
+      Flow::Variable *y = flow->AddVariable("bench/y", b.type, {b.n});
+      y->out = true;
+      flow->AddOperation(func, "bench/" + op, op, {x, y}, {z});
+    } else {
+      flow->AddOperation(func, "bench/" + op, op, {x}, {z});
+    }
+  } else {
+    // Matrix multiplication where the bias and activation are fused into the
+    // matrix multiplication by the flow analysis.
+    Flow::Variable *x = flow->AddVariable("bench/x", b.type, {b.rows, b.n});
+    Flow::Variable *w = flow->AddVariable("bench/w", b.type, {b.n, b.m});
+    Flow::Variable *y = flow->AddVariable("bench/y", b.type, {b.rows, b.m});
+    SetRandom(flow, w);
+    flow->AddOperation(func, "bench/MatMul", "MatMul", {x, w}, {y});
+    if (op == "MatMulAdd" || op == "MatMulAddRelu") {
+      Flow::Variable *bias = flow->AddVariable("bench/b", b.type, {b.m});
+      Flow::Variable *sum = flow->AddVariable("bench/s", b.type, {b.rows, b.m});
+      SetRandom(flow, bias);
+      flow->AddOperation(func, "bench/Add", "Add", {y, bias}, {sum});
+      y = sum;
+    }
+    if (op == "MatMulAddRelu") {
+      Flow::Variable *r = flow->AddVariable("bench/r", b.type, {b.rows, b.m});
+      flow->AddOperation(func, "bench/Relu", "Relu", {y}, {r});
+    }
+  }
+}
+
+// Fill input parameters with random values. The padding is filled as well,
+// since it is never used in the results.
+static void FillInputs(const Step *step, Instance *instance) {
+  for (Tensor *input : step->inputs()) {
+    if (input->IsConstant() || input->ref()) continue;
+    char *data = instance->GetAddress(input);
+    if (input->type() == DT_DOUBLE) {
+      double *values = reinterpret_cast<double *>(data);
+      int size = input->space() / sizeof(double);
+      for (int i = 0; i < size; ++i) values[i] = 2.0 * drand48() - 1.0;
+    } else if (input->type() == DT_FLOAT) {
+      float *values = reinterpret_cast<float *>(data);
+      int size = input->space() / sizeof(float);
+      for (int i = 0; i < size; ++i) values[i] = 2.0 * drand48() - 1.0;
+    }
+  }
+}
+
+// Run benchmark with each kernel for the operation.
+static void Run(const Library &library, const Benchmark &b,
+                std::vector<Result> *results) {
+  // Build and analyze flow. The flow analysis can change the operation type,
+  // e.g. when fusing operations, so the kernels are looked up for the
+  // operation in the analyzed flow.
+  Flow flow;
+  BuildFlow(b, &flow);
+  flow.Analyze(library);
+  CHECK_EQ(flow.ops().size(), 1) << BenchmarkName(b);
+  const string &type = flow.ops()[0]->type;
+
+  // Compile flow with all kernels to find the kernels supporting the step.
+  Network reference;
+  CHECK(reference.Compile(flow, library)) << BenchmarkName(b);
+  Step *supported = reference.GetCell("bench")->steps()[0];
+
+  for (Kernel *kernel : library.Lookup(type)) {
+    if (!kernel->Supports(supported)) continue;
+
+    // Compile flow with only this kernel.
+    Library singleton;
+    CHECK(library.Singleton(type, kernel->Name(), &singleton));
+    Network network;
+    network.set_profiling(true);
+    if (!network.Compile(flow, singleton)) {
+      LOG(WARNING) << kernel->Name() << " failed for " << BenchmarkName(b);
+      continue;
+    }
+    Cell *cell = network.GetCell("bench");
+    const Step *step = nullptr;
+    for (const Step *s : cell->steps()) {
+      if (s->kernel() == kernel) step = s;
+    }
+    if (step == nullptr) continue;
+
+    // Warm up caches and branch predictors before profiling. The profile is
+    // stored in the instance, so the instance is cleared after warm-up.
+    Instance instance(cell);
+    FillInputs(step, &instance);
+    for (int i = 0; i < FLAGS_warmup; ++i) instance.Compute();
+    instance.Clear();
+    FillInputs(step, &instance);
+    for (int i = 0; i < FLAGS_iterations; ++i) instance.Compute();
+
+    // Get profile for step.
+    Profile profile(&instance);
+    int idx = -1;
+    for (int i = 0; i < profile.steps(); ++i) {
+      if (profile.step(i) == step) idx = i;
+    }
+    CHECK_NE(idx, -1);
+
+    int64 bytes = 0;
+    for (const Tensor *t : step->inputs()) bytes += t->size();
+    for (const Tensor *t : step->outputs()) bytes += t->size();
+
+    Result result;
+    result.name = BenchmarkName(b);
+    result.kernel = kernel->Name();
+    if (!step->variant().empty()) result.kernel += "/" + step->variant();
+    result.cycles = profile.cycles(idx);
+    result.gflops = profile.gigaflops(idx);
+    result.bytes_per_cycle = result.cycles > 0 ? bytes / result.cycles : 0.0;
+    results->push_back(result);
+  }
+}
+
+// Read baseline cycles from JSON file. Returns map from benchmark and kernel
+// name to cycles.
+static std::unordered_map<string, double> ReadBaseline(const string &filename) {
+  std::unordered_map<string, double> baseline;
+  Store store;
+  FileReader reader(&store, filename);
+  reader.reader()->set_json(true);
+  Object obj = reader.Read();
+  CHECK(!reader.error()) << filename << ":" << reader.line() << ":"
+                         << reader.column() << ": "
+                         << reader.error_message();
+  CHECK(obj.IsArray()) << "Baseline must be a JSON array: " << filename;
+  Array results = obj.AsArray();
+  for (int i = 0; i < results.length(); ++i) {
+    Frame result(&store, results.get(i));
+    string key = result.GetString("benchmark") + " " +
+                 result.GetString("kernel");
+    baseline[key] = result.GetFloat("cycles");
+  }
+  return baseline;
+}
+
+// Write results to JSON file.
+static void WriteResults(const string &filename,
+                         const std::vector<Result> &results) {
+  string json = "[\n";
+  for (int i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    StringAppendF(&json,
+        "  {\"benchmark\": \"%s\", \"kernel\": \"%s\", \"cycles\": %.1f, "
+        "\"gflops\": %.3f, \"bytes_per_cycle\": %.3f}%s\n",
+        r.name.c_str(), r.kernel.c_str(), r.cycles, r.gflops,
+        r.bytes_per_cycle, i + 1 < results.size() ? "," : "");
+  }
+  json.append("]\n");
+  CHECK(File::WriteContents(filename, json));
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  Library library;
+  RegisterTensorflowLibrary(&library);
+
+  std::unordered_map<string, double> baseline;
+  if (!FLAGS_baseline.empty()) baseline = ReadBaseline(FLAGS_baseline);
+
+  printf("%-28s %-24s %12s %8s %11s %12s %8s\n",
+         "benchmark", "kernel", "cycles", "GFLOPS", "bytes/cycle",
+         "baseline", "change");
+  std::vector<Result> results;
+  int regressions = 0;
+  for (const Benchmark &b : Grid()) {
+    if (!Selected(b.op)) continue;
+    int start = results.size();
+    Run(library, b, &results);
+    for (int i = start; i < results.size(); ++i) {
+      const Result &r = results[i];
+      printf("%-28s %-24s %12.0f %8.2f %11.3f",
+             r.name.c_str(), r.kernel.c_str(), r.cycles, r.gflops,
+             r.bytes_per_cycle);
+      auto f = baseline.find(r.name + " " + r.kernel);
+      if (f != baseline.end() && f->second > 0) {
+        double change = (r.cycles - f->second) / f->second * 100.0;
+        bool regression = change > FLAGS_threshold;
+        if (regression) regressions++;
+        printf(" %12.0f %+7.1f%%%s", f->second, change,
+               regression ? "  REGRESSION" : "");
+      }
+      printf("\n");
+    }
+  }
+
+  if (!FLAGS_output.empty()) WriteResults(FLAGS_output, results);
+
+  if (regressions > 0) {
+    printf("%d regressions above %.1f%%\n", regressions, FLAGS_threshold);
+    return 1;
+  }
+  return 0;
+}
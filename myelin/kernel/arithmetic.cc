@@ -14,6 +14,7 @@
 
 #include "myelin/kernel/arithmetic.h"
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
@@ -27,6 +28,7 @@
 #include "myelin/macro-assembler.h"
 #include "myelin/generator/elementwise.h"
 #include "myelin/generator/expression.h"
+#include "myelin/generator/index.h"
 
 #define __ masm->
 
@@ -63,6 +65,7 @@ static Express::OpType OpType(const string &op) {
     {"LogSigmoid", Express::LOGSIGMOID},
     {"Reciprocal", Express::RECIPROCAL},
     {"Square", Express::SQUARE},
+    {"Sqrt", Express::SQRT},
   };
 
   auto f = ops.find(op);
@@ -124,6 +127,9 @@ static void InitExpression(Flow::Operation *op, Express *expr, bool expand) {
 
 // Initialize expression for step.
 static void InitExpression(const Step *step, Express *expr, bool expand) {
+  // Use math precision for network.
+  expr->set_precision(step->cell()->network()->precision());
+
   if (step->type() == "Calculate") {
     // Build expression from expression recipe attribute on op.
     const string &recipe = step->GetAttr("expr");
@@ -142,7 +148,9 @@ static void InitExpression(const Step *step, Express *expr, bool expand) {
 
   // Mark constant inputs.
   for (int i = 0; i < step->indegree(); ++i) {
-    if (step->input(i)->IsConstant() && step->input(i)->elements() == 1) {
+    Tensor *input = step->input(i);
+    if (input->IsConstant() && !input->learnable() &&
+        input->elements() == 1) {
       expr->Variable(Express::INPUT, i)->type = Express::CONST;
     }
   }
@@ -150,8 +158,10 @@ static void InitExpression(const Step *step, Express *expr, bool expand) {
 
 // Expression code generator for element-wise operations.
 struct Expression {
-  // Initialize expression.
-  Expression(const Step *step, MacroAssembler *masm, int spare_regs = 0)
+  // Initialize expression. Temporary variables are spilled to memory if the
+  // expression needs more than max_regs registers.
+  Expression(const Step *step, MacroAssembler *masm, int spare_regs = 0,
+             int max_regs = 0)
       : index(step, masm) {
     // Determine output type and shape from the first output.
     output = step->output(0);
@@ -166,6 +176,13 @@ struct Expression {
       if (common < elements) elements = common;
     }
 
+    // The loop over a dynamic output ends at a row boundary, so the vector
+    // size must also divide the row size.
+    if (output->dynamic() && output->rank() > 0) {
+      int row = output->shape().inner(1);
+      if (row < elements) elements = row;
+    }
+
     // Compile expression to be computed.
     InitExpression(step, &expr, true);
 
@@ -174,7 +191,7 @@ struct Expression {
     CHECK(generator != nullptr);
 
     // Initialize expression and index generators.
-    generator->Initalize(expr, type, spare_regs, &index);
+    generator->Initalize(expr, type, spare_regs, &index, max_regs);
   }
 
   ~Expression() { delete generator; }
@@ -214,6 +231,8 @@ struct Expression {
 // take advantage of mul being much faster than div.
 class DivToMulTransformer : public Transformer {
  public:
+  string Name() override { return "DivToMulTransformer"; }
+
   bool Transform(Flow *flow) override {
     int updates = 0;
     for (Flow::Operation *op : flow->ops()) {
@@ -241,6 +260,8 @@ class DivToMulTransformer : public Transformer {
 // Calculate kernel.
 class ExpressionTransformer : public Transformer {
  public:
+  string Name() override { return "ExpressionTransformer"; }
+
   bool Transform(Flow *flow) override {
     // Make list of ops that can potentially be included in Calculate ops.
     std::vector<Flow::Operation *> candidates;
@@ -460,37 +481,88 @@ class Calculate : public Kernel {
       output->RequireStandardOrder();
     }
 
+    // Update variables in place if an output is assigned to an input, e.g.
+    // when accumulating gradients or updating learnable parameters.
+    for (int j = 0; j < step->outdegree(); ++j) {
+      Tensor *output = step->output(j);
+      if (output->consumers().size() != 1) continue;
+      Step *assign = output->consumers()[0];
+      if (assign->type() != "Assign" || assign->input(1) != output) continue;
+      Tensor *var = assign->input(0);
+      if (var->shape() != output->shape()) continue;
+      for (int i = 0; i < step->indegree(); ++i) {
+        if (step->input(i) == var) {
+          CHECK(!ReadAfterWrite(expression.expr, i, j))
+              << "Variable " << var->name() << " cannot be updated in place "
+              << "in " << step->name();
+          step->AllowInPlace(i, j, true);
+          break;
+        }
+      }
+    }
+
     // Enable sharing of inputs and outputs.
     for (int i = 0; i < step->indegree(); ++i) {
       for (int j = 0; j < step->outdegree(); ++j) {
         if (step->input(i)->shape() == step->output(j)->shape()) {
+          if (ReadAfterWrite(expression.expr, i, j)) continue;
           if (step->AllowInPlace(i, j)) break;
         }
       }
     }
   }
 
+  // Check if an input is read after an output has been stored in the
+  // expression. The input and output cannot share memory in this case, since
+  // the output would overwrite the input before it is read.
+  static bool ReadAfterWrite(const Express &expr, int input, int output) {
+    bool written = false;
+    for (Express::Op *op : expr.ops()) {
+      if (written) {
+        for (Express::Var *arg : op->args) {
+          if (arg->type == Express::INPUT && arg->id == input) return true;
+        }
+      }
+      Express::Var *result = op->result;
+      if (result->type == Express::OUTPUT && result->id == output) {
+        written = true;
+      }
+    }
+    return false;
+  }
+
   void Generate(Step *step, MacroAssembler *masm) override {
     // Check how many spare register we have for hoisting constant out of the
     // loop body. This is only done for floating-point operations to avoid
     // register pressure on the regular x64 integer registers which are also
     // used for the loop indexing.
     int spare_regs = 0;
+    int max_regs = 0;
     Type type = step->output(0)->type();
     if (type == DT_FLOAT || type == DT_DOUBLE) {
-      // Perform dry-run to estimate the number of SIMD registers needed.
-      MacroAssembler dryrun_masm(nullptr, 0);
-      Expression dryrun_expr(step, &dryrun_masm, 0);
-      CHECK(dryrun_expr.AllocateRegisters()) << "Register overflow";
-
-      // Count the number of spare SIMD registers.
-      if (!dryrun_expr.index.single()) {
-        while (dryrun_masm.mm().try_alloc() != -1) spare_regs++;
+      for (;;) {
+        // Perform dry-run to estimate the number of SIMD registers needed.
+        MacroAssembler dryrun_masm(nullptr, 0);
+        Expression dryrun_expr(step, &dryrun_masm, 0, max_regs);
+        if (dryrun_expr.AllocateRegisters()) {
+          // Count the number of spare SIMD registers.
+          if (!dryrun_expr.index.single()) {
+            while (dryrun_masm.mm().try_alloc() != -1) spare_regs++;
+          }
+          break;
+        }
+
+        // Lower the register limit to spill more temporary variables to memory.
+        int usage = dryrun_expr.generator->RegisterUsage();
+        if (max_regs == 0 || usage < max_regs) max_regs = usage;
+        CHECK_GT(--max_regs, 0) << "Register overflow";
       }
     }
 
-    // Generate code for element-wise expression evaluation.
-    Expression expression(step, masm, spare_regs);
+    // Generate code for element-wise expression evaluation. Hoisted constants
+    // use the spare registers on top of the register limit.
+    if (max_regs > 0) max_regs += spare_regs;
+    Expression expression(step, masm, spare_regs, max_regs);
     CHECK(expression.AllocateRegisters()) << "Register overflow";
     expression.Generate(masm);
   }
@@ -506,6 +578,400 @@ class Calculate : public Kernel {
   int arity_;               // number of inputs
 };
 
+// Index generator for row-wise computations over the last dimension of a
+// tensor. The input and output are addressed through base registers pointing
+// to the current row and an offset register for the position within the row.
+// Input variable %0 is the input tensor and %1 reads back the output tensor.
+class RowIndexGenerator : public IndexGenerator {
+ public:
+  RowIndexGenerator(Type type, MacroAssembler *masm)
+      : IndexGenerator(masm), type_(type) {}
+
+  void Initialize(size_t vecsize) override {
+    vecsize_ = vecsize;
+  }
+
+  bool AllocateRegisters() override {
+    bool ok = IndexGenerator::AllocateRegisters();
+    input_ = masm_->rr().try_alloc();
+    output_ = masm_->rr().try_alloc();
+    offset_ = masm_->rr().try_alloc();
+    if (!input_.is_valid() || !output_.is_valid() || !offset_.is_valid()) {
+      ok = false;
+    }
+    return ok;
+  }
+
+  Operand addr(Express::Var *var) override {
+    switch (var->type) {
+      case Express::NUMBER:
+        // System-defined constant.
+        if (type_ == DT_DOUBLE) {
+          double number = Express::NumericFlt64(var->id);
+          int repeat = vecsize_ / sizeof(double);
+          return masm_->GetConstant(number, repeat)->address();
+        } else {
+          float number = Express::NumericFlt32(var->id);
+          int repeat = vecsize_ / sizeof(float);
+          return masm_->GetConstant(number, repeat)->address();
+        }
+      case Express::INPUT:
+        return Operand(var->id == 0 ? input_ : output_, offset_);
+      case Express::OUTPUT:
+        return Operand(output_, offset_);
+      default:
+        LOG(FATAL) << "Unsupported variable in row expression";
+        return Operand(rbp);
+    }
+  }
+
+  const void *data(Express::Var *var) override {
+    LOG(FATAL) << "Constants not supported in row expressions";
+    return nullptr;
+  }
+
+  // Registers for addressing the current row.
+  Register input() const { return input_; }
+  Register output() const { return output_; }
+  Register offset() const { return offset_; }
+
+  // Vector size in bytes.
+  int vecsize() const { return vecsize_; }
+
+ private:
+  Type type_;                  // element type
+  size_t vecsize_ = 1;         // vector size in bytes
+  Register input_ = no_reg;    // base register for input row
+  Register output_ = no_reg;   // base register for output row
+  Register offset_ = no_reg;   // offset of current element in row
+};
+
+// Kernel for reductions and normalizations over the last dimension of a
+// tensor. The computation for each row is a sequence of expressions which are
+// either evaluated once or looped over the elements in the row. Register
+// variables (!n) carry accumulators and other values between the expressions,
+// and horizontal reductions combine the vector elements of the accumulators.
+// Reductions (Sum, Max, Min, Mean, Norm) output one value per row, whereas
+// normalizations (Softmax, LogSoftmax) output a tensor with the same shape as
+// the input. Softmax subtracts the maximum of the row before exponentiation to
+// avoid overflow.
+class RowwiseExpr : public Kernel {
+ public:
+  RowwiseExpr(const string &name, const string &operation)
+      : name_(name), operation_(operation) {}
+
+  string Name() override { return name_; }
+  string Operation() override { return operation_; }
+
+  bool Supports(Step *step) override {
+    // Check inputs and outputs.
+    if (step->type() != operation_) return false;
+    if (step->indegree() < 1 || step->outdegree() != 1) return false;
+    Tensor *x = step->input(0);
+    Tensor *y = step->output(0);
+    Type type = x->type();
+    if (type != DT_FLOAT && type != DT_DOUBLE) return false;
+    if (y->type() != type) return false;
+    if (x->elements() == 0) return false;
+
+    if (reduction()) {
+      // Reduction must be over trailing dimensions of the input.
+      int rows = y->elements();
+      if (rows == 0 || x->elements() % rows != 0) return false;
+      int n = x->elements() / rows;
+      int trailing = x->rank();
+      int size = 1;
+      while (trailing > 0 && size < n) size *= x->dim(--trailing);
+      if (size != n) return false;
+
+      // Optional reduction axes must be constant and within the trailing
+      // dimensions.
+      if (step->indegree() > 2) return false;
+      if (step->indegree() == 2) {
+        Tensor *axes = step->input(1);
+        if (!axes->IsConstant() || axes->type() != DT_INT32) return false;
+        const int32 *axis = reinterpret_cast<const int32 *>(axes->data());
+        int reduced = 1;
+        for (int i = 0; i < axes->elements(); ++i) {
+          int a = axis[i] < 0 ? axis[i] + x->rank() : axis[i];
+          if (a < trailing || a >= x->rank()) return false;
+          reduced *= x->dim(a);
+        }
+        if (reduced != n) return false;
+      }
+    } else {
+      // Normalization over last dimension. The exponential and logarithm
+      // functions are only supported for single-precision floats.
+      if (type != DT_FLOAT) return false;
+      if (step->indegree() != 1) return false;
+      if (x->rank() < 1 || x->shape() != y->shape()) return false;
+    }
+
+    // Strict math not supported.
+    if (step->GetAttr("strict", false)) return false;
+
+    // Dense encoding required.
+    x->RequireDense();
+    y->RequireDense();
+
+    return true;
+  }
+
+  void Adjust(Step *step) override {
+    Tensor *x = step->input(0);
+    Tensor *y = step->output(0);
+    Computation comp(this, step, nullptr);
+    step->set_variant(comp.generators[0]->Name());
+
+    // Rows must be aligned to the vector size.
+    int alignment = comp.generators[0]->VectorSize();
+    x->SetMiniumAlignment(alignment);
+    x->RequireDense();
+    x->RequireStandardOrder();
+    y->RequireDense();
+    y->RequireStandardOrder();
+    if (!reduction()) {
+      y->SetMiniumAlignment(alignment);
+      step->AllowInPlace(0, 0);
+    }
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    Tensor *x = step->input(0);
+    Tensor *y = step->output(0);
+    Type type = x->type();
+    int size = x->element_size();
+    int rows = rows_of(step);
+    int rowsize = x->elements() / rows * size;
+
+    // Initialize expressions and allocate registers.
+    Computation comp(this, step, masm);
+    CHECK(comp.index.AllocateRegisters()) << "Register overflow";
+    Register input = comp.index.input();
+    Register output = comp.index.output();
+    Register offset = comp.index.offset();
+    Register row = masm->rr().alloc();
+    int vecsize = comp.index.vecsize();
+
+    // Loop over rows.
+    __ LoadTensorAddress(input, x);
+    __ LoadTensorAddress(output, y);
+    Label lr;
+    if (rows > 1) {
+      __ xorq(row, row);
+      __ bind(&lr);
+    }
+
+    // Compute row expressions.
+    bool reset = true;
+    for (int i = 0; i < comp.stages.size(); ++i) {
+      const Stage &stage = comp.stages[i];
+      ExpressionGenerator *generator = comp.generators[i];
+      if (reset && stage.memory()) {
+        __ xorq(offset, offset);
+        reset = false;
+      }
+      generator->GenerateInit(masm);
+      if (stage.loop && rowsize > vecsize) {
+        // Loop over the elements in the row.
+        Label le;
+        __ bind(&le);
+        generator->GenerateBody(masm);
+        __ addq(offset, Immediate(vecsize));
+        __ cmpq(offset, Immediate(rowsize));
+        __ j(less, &le);
+        reset = true;
+      } else {
+        generator->GenerateBody(masm);
+      }
+    }
+
+    if (reduction()) {
+      // Compute final value for reduction and store it in the output.
+      XMMRegister acc = comp.index.xmm(0);
+      bool avx = CPU::Enabled(AVX);
+      if (operation_ == "Mean") {
+        int n = rowsize / size;
+        if (type == DT_DOUBLE) {
+          auto *scale = masm->GetConstant<double>(1.0 / n);
+          if (avx) {
+            __ vmulsd(acc, acc, scale->address());
+          } else {
+            __ mulsd(acc, scale->address());
+          }
+        } else {
+          auto *scale = masm->GetConstant<float>(1.0f / n);
+          if (avx) {
+            __ vmulss(acc, acc, scale->address());
+          } else {
+            __ mulss(acc, scale->address());
+          }
+        }
+      } else if (operation_ == "Norm") {
+        if (type == DT_DOUBLE) {
+          if (avx) {
+            __ vsqrtsd(acc, acc, acc);
+          } else {
+            __ sqrtsd(acc, acc);
+          }
+        } else {
+          if (avx) {
+            __ vsqrtss(acc, acc, acc);
+          } else {
+            __ sqrtss(acc, acc);
+          }
+        }
+      }
+      if (type == DT_DOUBLE) {
+        if (avx) {
+          __ vmovsd(Operand(output), acc);
+        } else {
+          __ movsd(Operand(output), acc);
+        }
+      } else {
+        if (avx) {
+          __ vmovss(Operand(output), acc);
+        } else {
+          __ movss(Operand(output), acc);
+        }
+      }
+    }
+
+    // Next row.
+    if (rows > 1) {
+      __ addq(input, Immediate(rowsize));
+      __ addq(output, Immediate(reduction() ? size : rowsize));
+      __ incq(row);
+      __ cmpq(row, Immediate(rows));
+      __ j(less, &lr);
+    }
+  }
+
+  int64 Complexity(const Step *step) override {
+    int rows = rows_of(step);
+    int n = step->input(0)->elements() / rows;
+    std::vector<Stage> stages;
+    GetStages(&stages);
+    int64 ops = 0;
+    for (const Stage &stage : stages) {
+      Express expr;
+      expr.set_precision(step->cell()->network()->precision());
+      expr.Parse(stage.recipe, true);
+      ops += (stage.loop ? n : 1) * expr.Complexity();
+    }
+    return rows * ops;
+  }
+
+ private:
+  // Expression evaluated for each row.
+  struct Stage {
+    // Check if expression accesses the input or output.
+    bool memory() const {
+      return recipe.find_first_of("%@") != string::npos;
+    }
+
+    string recipe;  // expression recipe
+    bool loop;      // loop over all elements in row
+  };
+
+  // Expressions and generators for computing the rows.
+  struct Computation {
+    Computation(RowwiseExpr *kernel, const Step *step, MacroAssembler *masm)
+        : index(step->input(0)->type(), masm) {
+      Type type = step->input(0)->type();
+      int n = step->input(0)->elements() / kernel->rows_of(step);
+      kernel->GetStages(&stages);
+
+      // Register variables are shared by all the expressions, so all of them
+      // are declared in each expression to get the same register assignment.
+      int registers = 0;
+      for (const Stage &stage : stages) {
+        Express expr;
+        expr.Parse(stage.recipe);
+        registers = std::max(registers, expr.NumVars(Express::REGISTER));
+      }
+
+      // Initialize generators. All the expressions use the same generator
+      // type and share the index generator.
+      for (const Stage &stage : stages) {
+        Express expr;
+        for (int r = 0; r < registers; ++r) {
+          expr.Variable(Express::REGISTER, r);
+        }
+        expr.set_precision(step->cell()->network()->precision());
+        expr.Parse(stage.recipe, true);
+        ExpressionGenerator *generator =
+            ExpressionGenerator::Select(expr, type, n);
+        CHECK(generator != nullptr);
+        generator->Initalize(expr, type, 0, &index);
+        generators.push_back(generator);
+      }
+    }
+
+    ~Computation() {
+      for (auto *generator : generators) delete generator;
+    }
+
+    std::vector<Stage> stages;
+    RowIndexGenerator index;
+    std::vector<ExpressionGenerator *> generators;
+  };
+
+  // Check if operation is a reduction.
+  bool reduction() const {
+    return operation_ != "Softmax" && operation_ != "LogSoftmax";
+  }
+
+  // Number of rows in computation.
+  int rows_of(const Step *step) const {
+    const Tensor *x = step->input(0);
+    if (reduction()) return step->output(0)->elements();
+    return x->elements() / x->dim(x->rank() - 1);
+  }
+
+  // Get expressions for computing each row.
+  void GetStages(std::vector<Stage> *stages) const {
+    if (operation_ == "Sum" || operation_ == "Mean") {
+      stages->push_back({"!0=Id(_0)", false});
+      stages->push_back({"!0=Add(!0,%0)", true});
+      stages->push_back({"!0=HSum(!0)", false});
+    } else if (operation_ == "Norm") {
+      stages->push_back({"!0=Id(_0)", false});
+      stages->push_back({"!0=Add(!0,Mul(%0,%0))", true});
+      stages->push_back({"!0=HSum(!0)", false});
+    } else if (operation_ == "Max") {
+      stages->push_back({"!0=Id(%0)", false});
+      stages->push_back({"!0=Max(!0,%0)", true});
+      stages->push_back({"!0=HMax(!0)", false});
+    } else if (operation_ == "Min") {
+      stages->push_back({"!0=Id(%0)", false});
+      stages->push_back({"!0=Min(!0,%0)", true});
+      stages->push_back({"!0=HMin(!0)", false});
+    } else if (operation_ == "Softmax") {
+      // softmax(x) = exp(x - max(x)) / sum(exp(x - max(x)))
+      stages->push_back({"!0=Id(%0)", false});
+      stages->push_back({"!0=Max(!0,%0)", true});
+      stages->push_back({"!0=HMax(!0);!1=Id(_0)", false});
+      stages->push_back({"@0=Exp(Sub(%0,!0));!1=Add(!1,@0)", true});
+      stages->push_back({"!1=HSum(!1);!2=Div(_1,!1)", false});
+      stages->push_back({"@0=Mul(%1,!2)", true});
+    } else if (operation_ == "LogSoftmax") {
+      // logsoftmax(x) = x - max(x) - log(sum(exp(x - max(x))))
+      stages->push_back({"!0=Id(%0)", false});
+      stages->push_back({"!0=Max(!0,%0)", true});
+      stages->push_back({"!0=HMax(!0);!1=Id(_0)", false});
+      stages->push_back({"!1=Add(!1,Exp(Sub(%0,!0)))", true});
+      stages->push_back({"!1=HSum(!1);!0=Add(!0,Log(!1))", false});
+      stages->push_back({"@0=Sub(%0,!0)", true});
+    } else {
+      LOG(FATAL) << "Unsupported row operation: " << operation_;
+    }
+  }
+
+  const string name_;       // kernel name
+  const string operation_;  // kernel operation
+};
+
 // Register arithmetic library.
 void RegisterArithmeticLibrary(Library *library) {
   library->Register(new Calculate("AddExpr", "Add", 2));
@@ -529,6 +995,15 @@ void RegisterArithmeticLibrary(Library *library) {
   library->Register(new Calculate("LogSigmoidExpr", "LogSigmoid", 1));
   library->Register(new Calculate("ReciprocalExpr", "Reciprocal", 1));
   library->Register(new Calculate("SquareExpr", "Square", 1));
+  library->Register(new Calculate("SqrtExpr", "Sqrt", 1));
+
+  library->Register(new RowwiseExpr("SumExpr", "Sum"));
+  library->Register(new RowwiseExpr("MaxReduceExpr", "Max"));
+  library->Register(new RowwiseExpr("MinReduceExpr", "Min"));
+  library->Register(new RowwiseExpr("MeanExpr", "Mean"));
+  library->Register(new RowwiseExpr("NormExpr", "Norm"));
+  library->Register(new RowwiseExpr("SoftmaxExpr", "Softmax"));
+  library->Register(new RowwiseExpr("LogSoftmaxExpr", "LogSoftmax"));
 }
 
 // Register arithmetic transforms.
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include "myelin/compute.h"
 #include "myelin/macro-assembler.h"
 
@@ -264,6 +266,56 @@ class Unpack : public Kernel {
   }
 };
 
+// Copy block of memory from src+srcofs to dst+dstofs. Small blocks are copied
+// with moves through the accumulator, and larger blocks are copied with a
+// string move, so the caller must allocate the rsi, rdi, and rcx registers.
+static void CopyBlock(Register dst, int dstofs, Register src, int srcofs,
+                      int size, Register acc, MacroAssembler *masm) {
+  if (size > 0 && size < 16) {
+    int disp = 0;
+    int left = size;
+    while (left >= 8) {
+      __ movq(acc, Operand(src, srcofs + disp));
+      __ movq(Operand(dst, dstofs + disp), acc);
+      disp += 8;
+      left -= 8;
+    }
+    while (left >= 4) {
+      __ movl(acc, Operand(src, srcofs + disp));
+      __ movl(Operand(dst, dstofs + disp), acc);
+      disp += 4;
+      left -= 4;
+    }
+    while (left >= 2) {
+      __ movw(acc, Operand(src, srcofs + disp));
+      __ movw(Operand(dst, dstofs + disp), acc);
+      disp += 2;
+      left -= 2;
+    }
+    while (left >= 1) {
+      __ movb(acc, Operand(src, srcofs + disp));
+      __ movb(Operand(dst, dstofs + disp), acc);
+      disp += 1;
+      left -= 1;
+    }
+  } else {
+    __ leaq(rsi, Operand(src, srcofs));
+    __ leaq(rdi, Operand(dst, dstofs));
+    __ movq(rcx, Immediate(size));
+    __ repmovsb();
+  }
+}
+
+// Check if tensor is stored in place in another tensor at a byte offset.
+static bool StoredAt(const Tensor *tensor, const Tensor *other, size_t offset) {
+  size_t pos = 0;
+  for (const Tensor *t = tensor; t != nullptr; t = t->shared()) {
+    if (t == other) return pos == offset;
+    pos += t->shared_offset();
+  }
+  return false;
+}
+
 // Output concatenation of input tensors along first dimension.
 class BasicConcat : public Kernel {
  public:
@@ -286,6 +338,17 @@ class BasicConcat : public Kernel {
   }
 
   void Adjust(Step *step) override {
+    // Try to store the inputs in place in the output, so the producers of the
+    // inputs write their results directly into the output.
+    int n = step->GetAttr("N", step->indegree() - 1);
+    int axis = step->input(n)->value<int32>();
+    int start = 0;
+    for (int i = 0; i < n; ++i) {
+      Tensor *input = step->input(i);
+      if (input->rank() <= axis) break;
+      step->AllowInputSlice(i, 0, axis, start);
+      start += input->dim(axis);
+    }
   }
 
   void Generate(Step *step, MacroAssembler *masm) override {
@@ -293,53 +356,27 @@ class BasicConcat : public Kernel {
     int n = step->GetAttr("N", step->indegree() - 1);
 
     // Allocate registers.
-    Register src = masm->rr().alloc_fixed(rsi);
-    Register dst = masm->rr().alloc_fixed(rdi);
-    Register cnt = masm->rr().alloc_fixed(rcx);
+    masm->rr().alloc_fixed(rsi);
+    masm->rr().alloc_fixed(rdi);
+    masm->rr().alloc_fixed(rcx);
     Register acc = masm->rr().alloc_fixed(rax);
     Register in = masm->rr().alloc();
     Register out = masm->rr().alloc();
 
-    // Load output tensor.
-    __ LoadTensorAddress(out, step->output(0));
-
-    // Copy input tensors to output.
+    // Copy input tensors to output. Inputs stored in place in the output do
+    // not need to be copied.
+    bool loaded = false;
     int offset = 0;
     for (int i = 0; i < n; ++i) {
-      int size = step->input(i)->size();
-      if (size > 0 && size < 16) {
-        __ LoadTensorAddress(in, step->input(i));
-        int disp = offset;
-        int left = size;
-        while (left >= 8) {
-          __ movq(acc, Operand(in, disp));
-          __ movq(Operand(out, disp), acc);
-          disp += 8;
-          left -= 8;
-        }
-        while (left >= 4) {
-          __ movl(acc, Operand(in, disp));
-          __ movl(Operand(out, disp), acc);
-          disp += 4;
-          left -= 4;
-        }
-        while (left >= 2) {
-          __ movw(acc, Operand(in, disp));
-          __ movw(Operand(out, disp), acc);
-          disp += 2;
-          left -= 2;
-        }
-        while (left >= 1) {
-          __ movb(acc, Operand(in, disp));
-          __ movb(Operand(out, disp), acc);
-          disp += 1;
-          left -= 1;
+      Tensor *input = step->input(i);
+      int size = input->size();
+      if (!StoredAt(input, step->output(0), offset)) {
+        if (!loaded) {
+          __ LoadTensorAddress(out, step->output(0));
+          loaded = true;
         }
-      } else {
-        __ LoadTensorAddress(src, step->input(i));
-        __ leaq(dst, Operand(out, offset));
-        __ movq(cnt, Immediate(size));
-        __ repmovsb();
+        __ LoadTensorAddress(in, input);
+        CopyBlock(out, offset, in, 0, size, acc, masm);
       }
       offset += size;
     }
@@ -351,6 +388,81 @@ class BasicConcat : public Kernel {
   }
 };
 
+// Split input tensor into outputs along an axis with a singular prefix.
+class BasicSplit : public Kernel {
+ public:
+  string Name() override { return "BasicSplit"; }
+  string Operation() override { return "Split"; }
+
+  bool Supports(Step *step) override {
+    // Check inputs and outputs.
+    if (step->indegree() != 2 || step->outdegree() < 1) return false;
+
+    // Only splitting along a singular prefix supported.
+    Tensor *axis = step->input(0);
+    Tensor *input = step->input(1);
+    if (!axis->IsConstant()) return false;
+    int a = axis->value<int32>();
+    if (a < 0 || a >= input->rank()) return false;
+    if (input->shape().outer(a) != 1) return false;
+
+    // Check that the outputs cover the input.
+    int size = 0;
+    for (Tensor *output : step->outputs()) {
+      if (output->type() != input->type()) return false;
+      if (output->rank() != input->rank()) return false;
+      size += output->dim(a);
+    }
+    if (size != input->dim(a)) return false;
+
+    return true;
+  }
+
+  void Adjust(Step *step) override {
+    // Try to store the outputs in place in the input, so the consumers of the
+    // outputs read their inputs directly from the input.
+    int axis = step->input(0)->value<int32>();
+    int start = 0;
+    for (int i = 0; i < step->outdegree(); ++i) {
+      step->AllowOutputSlice(i, 1, axis, start);
+      start += step->output(i)->dim(axis);
+    }
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    // Allocate registers.
+    masm->rr().alloc_fixed(rsi);
+    masm->rr().alloc_fixed(rdi);
+    masm->rr().alloc_fixed(rcx);
+    Register acc = masm->rr().alloc_fixed(rax);
+    Register in = masm->rr().alloc();
+    Register out = masm->rr().alloc();
+
+    // Copy parts of input to outputs. Outputs stored in place in the input do
+    // not need to be copied.
+    bool loaded = false;
+    int offset = 0;
+    for (int i = 0; i < step->outdegree(); ++i) {
+      Tensor *output = step->output(i);
+      int size = output->size();
+      if (!StoredAt(output, step->input(1), offset)) {
+        if (!loaded) {
+          __ LoadTensorAddress(in, step->input(1));
+          loaded = true;
+        }
+        __ LoadTensorAddress(out, output);
+        CopyBlock(out, 0, in, offset, size, acc, masm);
+      }
+      offset += size;
+    }
+    CHECK_EQ(offset, step->input(1)->size());
+  }
+
+  int64 Complexity(const Step *step) override {
+    return 0;
+  }
+};
+
 // Output concatenation of input tensors along any axis.
 class GeneralConcat : public Kernel {
  public:
@@ -389,9 +501,9 @@ class GeneralConcat : public Kernel {
     int n = step->GetAttr("N", step->indegree() - 1);
 
     // Allocate registers.
-    Register src = masm->rr().alloc_fixed(rsi);
-    Register dst = masm->rr().alloc_fixed(rdi);
-    Register cnt = masm->rr().alloc_fixed(rcx);
+    masm->rr().alloc_fixed(rsi);
+    masm->rr().alloc_fixed(rdi);
+    masm->rr().alloc_fixed(rcx);
     Register acc = masm->rr().alloc_fixed(rax);
     Register out = masm->rr().alloc();
     Register idx = masm->rr().alloc();
@@ -413,45 +525,16 @@ class GeneralConcat : public Kernel {
     int prefix = step->output(0)->shape().outer(axis);
     __ bind(&l);
 
-    // Copy input tensors to output.
+    // Copy input tensors to output. Each input is copied to the position
+    // following the previous input in the output chunk.
     Tensor *output = step->output(0);
+    int offset = 0;
     for (int i = 0; i < n; ++i) {
       Tensor *input = step->input(i);
       int size = axis > 0 ? input->stride(axis - 1) : input->size();
-      if (size > 0 && size < 16) {
-        int disp = 0;
-        int left = size;
-        while (left >= 8) {
-          __ movq(acc, Operand(in[i], disp));
-          __ movq(Operand(out, disp), acc);
-          disp += 8;
-          left -= 8;
-        }
-        while (left >= 4) {
-          __ movl(acc, Operand(in[i], disp));
-          __ movl(Operand(out, disp), acc);
-          disp += 4;
-          left -= 4;
-        }
-        while (left >= 2) {
-          __ movw(acc, Operand(in[i], disp));
-          __ movw(Operand(out, disp), acc);
-          disp += 2;
-          left -= 2;
-        }
-        while (left >= 1) {
-          __ movb(acc, Operand(in[i], disp));
-          __ movb(Operand(out, disp), acc);
-          disp += 1;
-          left -= 1;
-        }
-      } else {
-        __ movq(src, in[i]);
-        __ movq(dst, out);
-        __ movq(cnt, Immediate(size));
-        __ repmovsb();
-      }
+      CopyBlock(out, offset, in[i], 0, size, acc, masm);
       __ addq(in[i], Immediate(size));
+      offset += size;
     }
 
     // Next chunk.
@@ -582,17 +665,27 @@ class MultiGather : public Kernel {
     Register index = masm->rr().alloc();
     Register input = masm->rr().alloc();
     Register embeddings = masm->rr().alloc();
+    Register next = masm->rr().alloc();
 
     // Load tensor locations.
     __ LoadTensorAddress(embeddings, M);
     __ LoadTensorAddress(input, f);
     __ LoadTensorAddress(dst, v);
 
+    // Prefetch embeddings for the first features.
+    int n = f->elements();
+    int distance = __ PrefetchFirstEmbeddings(step, input, next, no_reg,
+                                              embeddings, M, n);
+
     // Loop over all feature indices.
     Label l;
     __ xorq(index, index);
     __ bind(&l);
 
+    // Prefetch embedding for upcoming feature.
+    __ PrefetchNextEmbedding(distance, input, index, next, no_reg, embeddings,
+                             M, n);
+
     // Get feature index.
     __ movsxlq(acc, Operand(input, index, times_4));
 
@@ -616,6 +709,371 @@ class MultiGather : public Kernel {
   }
 };
 
+// Look up features in embedding stored in half precision. The embedding
+// vectors are converted to single precision when copied to the output.
+class HalfGather : public Kernel {
+ public:
+  string Name() override { return "HalfGather"; }
+  string Operation() override { return "Gather"; }
+
+  bool Supports(Step *step) override {
+    // Check inputs and outputs.
+    if (step->indegree() != 2 || step->outdegree() != 1) return false;
+
+    // Check types.
+    Tensor *M = step->input(0);
+    Tensor *f = step->input(1);
+    Tensor *v = step->output(0);
+    int r = f->rank();
+    int n = f->elements();
+    if (f->type() != DT_INT32) return false;
+    if (!MacroAssembler::SupportsHalf(M->type(), false)) return false;
+    if (M->rank() != 2) return false;
+    if (v->type() != DT_FLOAT || v->rank() != r + 1) return false;
+    if (v->shape().outer(r) != n || v->dim(r) != M->dim(1)) return false;
+
+    return true;
+  }
+
+  void Adjust(Step *step) override {
+    // Embedding matrix must be row-major.
+    step->input(0)->SetRequiredOrder(ROW_MAJOR);
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    // Get inputs and outputs.
+    Tensor *M = step->input(0);
+    Tensor *f = step->input(1);
+    Tensor *v = step->output(0);
+    CHECK(f->IsLocal());
+    CHECK(v->IsLocal());
+    int r = f->rank();
+    int dims = M->dim(1);
+
+    // Convert eight elements at a time if possible.
+    bool vector = dims % 8 == 0 &&
+                  MacroAssembler::SupportsHalf(M->type(), true);
+
+    // Allocate registers.
+    Register src = masm->rr().alloc();
+    Register dst = masm->rr().alloc();
+    Register acc = masm->rr().alloc();
+    Register col = masm->rr().alloc();
+    Register index = masm->rr().alloc();
+    Register input = masm->rr().alloc();
+    Register embeddings = masm->rr().alloc();
+    Register tmp = masm->rr().alloc();
+    Register next = masm->rr().alloc();
+    int elem = masm->mm().alloc();
+
+    // Load tensor locations.
+    __ LoadTensorAddress(embeddings, M);
+    __ LoadTensorAddress(input, f);
+    __ LoadTensorAddress(dst, v);
+
+    // Prefetch embeddings for the first features.
+    int n = f->elements();
+    int distance = __ PrefetchFirstEmbeddings(step, input, next, no_reg,
+                                              embeddings, M, n);
+
+    // Loop over all feature indices.
+    Label l1, l2;
+    __ xorq(index, index);
+    __ LoopStart(&l1);
+
+    // Prefetch embedding for upcoming feature.
+    __ PrefetchNextEmbedding(distance, input, index, next, no_reg, embeddings,
+                             M, n);
+
+    // Get feature index.
+    __ movsxlq(acc, Operand(input, index, times_4));
+
+    // Compute address in embedding.
+    __ Multiply(acc, M->stride(0));
+    __ leaq(src, Operand(embeddings, acc));
+
+    // Convert embedding vector to single precision and copy it to output.
+    __ xorq(col, col);
+    __ LoopStart(&l2);
+    if (vector) {
+      YMMRegister y = YMMRegister::from_code(elem);
+      __ LoadHalf(y, Operand(src, col, times_2), M->type());
+      __ vmovups(Operand(dst, col, times_4), y);
+      __ addq(col, Immediate(8));
+    } else {
+      XMMRegister x = XMMRegister::from_code(elem);
+      __ LoadHalf(x, Operand(src, col, times_2), tmp, M->type());
+      __ movss(Operand(dst, col, times_4), x);
+      __ incq(col);
+    }
+    __ cmpq(col, Immediate(dims));
+    __ j(less, &l2);
+
+    // Next feature index.
+    if (r > 0) __ addq(dst, Immediate(v->stride(r - 1)));
+    __ incq(index);
+    __ cmpq(index, Immediate(f->elements()));
+    __ j(less, &l1);
+  }
+
+  int64 Complexity(const Step *step) override {
+    return 0;
+  }
+};
+
+// Add values to rows of a variable selected by feature indices, i.e. the
+// inverse of a lookup. If the value has a single row, it is added to all the
+// selected rows. Otherwise, the value has a row for each feature. Feature -1
+// selects the last (OOV) row and other negative features are skipped.
+class ScatterAdd : public Kernel {
+ public:
+  string Name() override { return "ScatterAdd"; }
+  string Operation() override { return "ScatterAdd"; }
+
+  bool Supports(Step *step) override {
+    // Check inputs and outputs.
+    if (step->indegree() != 3 || step->outdegree() != 0) return false;
+
+    // Check types.
+    Tensor *var = step->input(0);
+    Tensor *f = step->input(1);
+    Tensor *value = step->input(2);
+    if (var->type() != DT_FLOAT || var->rank() != 2) return false;
+    if (f->type() != DT_INT32) return false;
+    if (value->type() != DT_FLOAT || value->rank() != 2) return false;
+    if (value->dim(1) != var->dim(1)) return false;
+    if (value->dim(0) != 1 && value->dim(0) != f->elements()) return false;
+
+    return true;
+  }
+
+  void Adjust(Step *step) override {
+    step->input(0)->SetRequiredOrder(ROW_MAJOR);
+    step->input(1)->RequireDense();
+    step->input(1)->RequireStandardOrder();
+    step->input(2)->SetRequiredOrder(ROW_MAJOR);
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    Label l1, l2, l3, l4;
+
+    // Get inputs.
+    Tensor *var = step->input(0);
+    Tensor *f = step->input(1);
+    Tensor *value = step->input(2);
+    bool single = value->dim(0) == 1;
+    int num_features = f->elements();
+    int dims = var->dim(1);
+
+    // Allocate registers.
+    Register acc = masm->rr().alloc();
+    Register input = masm->rr().alloc();
+    Register rows = masm->rr().alloc();
+    Register src = masm->rr().alloc();
+    Register col = masm->rr().alloc();
+    Register index = masm->rr().alloc();
+    XMMRegister elem = masm->mm().allocx();
+
+    // Load tensor locations.
+    __ LoadTensorAddress(input, f);
+    __ LoadTensorAddress(rows, var);
+    __ LoadTensorAddress(src, value);
+
+    // Loop over input features.
+    __ xorq(index, index);
+    __ LoopStart(&l1);
+
+    // Get next feature index.
+    __ movsxlq(acc, Operand(input, index, times_4));
+
+    // Use OOV for if feature is -1, otherwise skip feature if it is negative.
+    __ testq(acc, acc);
+    __ j(positive, &l2);
+    __ cmpq(acc, Immediate(-1));
+    __ j(not_equal, &l4);
+    __ movq(acc, Immediate(var->dim(0) - 1));
+
+    // Compute address of row in variable.
+    __ bind(&l2);
+    __ Multiply(acc, var->stride(0));
+    __ addq(acc, rows);
+
+    // Add value to row.
+    __ xorq(col, col);
+    __ LoopStart(&l3);
+    __ movss(elem, Operand(acc, col, times_4));
+    __ addss(elem, Operand(src, col, times_4));
+    __ movss(Operand(acc, col, times_4), elem);
+    __ incq(col);
+    __ cmpq(col, Immediate(dims));
+    __ j(not_equal, &l3);
+
+    // Next feature.
+    __ bind(&l4);
+    if (!single) __ addq(src, Immediate(value->stride(0)));
+    __ incq(index);
+    __ cmpq(index, Immediate(num_features));
+    __ j(not_equal, &l1);
+  }
+
+  int64 Complexity(const Step *step) override {
+    return step->input(1)->elements() * step->input(0)->dim(1);
+  }
+};
+
+// Output reference to a variable in the instance of another cell. The input is
+// a reference to the instance data block of the other cell, and the name of
+// the variable is in the "var" attribute.
+class Reference : public Kernel {
+ public:
+  string Name() override { return "Reference"; }
+  string Operation() override { return "Reference"; }
+
+  bool Supports(Step *step) override {
+    // Check inputs and outputs.
+    if (step->indegree() != 1 || step->outdegree() != 1) return false;
+    if (!step->input(0)->ref()) return false;
+
+    // Check that variable has the same type and shape as the output.
+    Tensor *var = Variable(step);
+    if (var == nullptr) return false;
+    if (var->IsConstant()) return false;
+    if (var->type() != step->output(0)->type()) return false;
+    if (var->shape() != step->output(0)->shape()) return false;
+
+    return true;
+  }
+
+  void Adjust(Step *step) override {
+    // Output is a reference to the variable in the other instance, so it must
+    // have the same layout as the variable.
+    step->output(0)->set_ref(true);
+    step->output(0)->set_link(Variable(step));
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    // Get inputs and outputs.
+    Tensor *instance = step->input(0);
+    Tensor *var = Variable(step);
+    Tensor *ref = step->output(0);
+    CHECK(instance->IsLocal());
+    CHECK(var->IsLocal());
+    CHECK(ref->IsLocal());
+
+    // Compute address of variable in other instance.
+    Register addr = masm->rr().alloc();
+    __ movq(addr, Operand(masm->instance(), instance->offset()));
+    if (var->ref()) {
+      __ movq(addr, Operand(addr, var->offset()));
+    } else if (var->offset() != 0) {
+      __ addq(addr, Immediate(var->offset()));
+    }
+
+    // Save reference to variable.
+    __ movq(Operand(masm->instance(), ref->offset()), addr);
+  }
+
+  int64 Complexity(const Step *step) override {
+    return 0;
+  }
+
+ private:
+  // Get referenced variable.
+  static Tensor *Variable(Step *step) {
+    const string &name = step->GetAttr("var");
+    if (name.empty()) return nullptr;
+    return step->cell()->network()->GetParameter(name);
+  }
+};
+
+// Assign value to variable. The variable can be a global, e.g. a learnable
+// parameter, which is then updated in place. The value is normally computed
+// directly into the variable by its producer, so no copying is needed. A
+// scalar value is assigned to all the elements of the variable.
+class Assign : public Kernel {
+ public:
+  string Name() override { return "Assign"; }
+  string Operation() override { return "Assign"; }
+
+  bool Supports(Step *step) override {
+    // Check inputs and outputs.
+    if (step->indegree() != 2 || step->outdegree() != 0) return false;
+    Tensor *var = step->input(0);
+    Tensor *value = step->input(1);
+    if (var->type() != value->type()) return false;
+    if (var->ref() || value->ref()) return false;
+
+    // Scalar values must fit in a register.
+    if (value->elements() == var->elements()) return true;
+    if (value->elements() != 1) return false;
+    int size = value->element_size();
+    return size == sizeof(int32) || size == sizeof(int64);
+  }
+
+  void Adjust(Step *step) override {
+    Tensor *var = step->input(0);
+    Tensor *value = step->input(1);
+    if (value->elements() == var->elements()) {
+      // Copy value to variable with the same layout.
+      if (value->link() == nullptr) value->set_link(var);
+    } else {
+      var->RequireDense();
+    }
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    Tensor *var = step->input(0);
+    Tensor *value = step->input(1);
+
+    // Nothing to do if the value was computed in place.
+    if (value->SharedWith(var)) return;
+
+    // Allocate registers.
+    masm->rr().alloc_fixed(rsi);
+    masm->rr().alloc_fixed(rdi);
+    masm->rr().alloc_fixed(rcx);
+    Register acc = masm->rr().alloc_fixed(rax);
+    Register src = masm->rr().alloc();
+    Register dst = masm->rr().alloc();
+
+    __ LoadTensorAddress(dst, var);
+    if (value->elements() == var->elements()) {
+      // Copy value to variable.
+      CHECK_EQ(value->size(), var->size());
+      __ LoadTensorAddress(src, value);
+      CopyBlock(dst, 0, src, 0, var->size(), acc, masm);
+    } else {
+      // Fill variable with scalar value.
+      int size = value->element_size();
+      if (value->IsConstant() && !value->learnable()) {
+        if (size == sizeof(int32)) {
+          __ movl(acc, Immediate(value->value<int32>()));
+        } else {
+          __ movq(acc, static_cast<int64_t>(value->value<int64>()));
+        }
+      } else {
+        __ LoadTensorAddress(src, value);
+        if (size == sizeof(int32)) {
+          __ movl(acc, Operand(src));
+        } else {
+          __ movq(acc, Operand(src));
+        }
+      }
+      __ movq(rdi, dst);
+      __ movq(rcx, Immediate(var->size() / size));
+      if (size == sizeof(int32)) {
+        __ repstosl();
+      } else {
+        __ repstosq();
+      }
+    }
+  }
+
+  int64 Complexity(const Step *step) override {
+    return 0;
+  }
+};
+
 // Register array kernels.
 void RegisterArrayKernels(Library *library) {
   library->Register(new Reshape());
@@ -627,8 +1085,13 @@ void RegisterArrayKernels(Library *library) {
   library->Register(new Unpack());
   library->Register(new GeneralConcat());
   library->Register(new BasicConcat());
+  library->Register(new BasicSplit());
+  library->Register(new HalfGather());
   library->Register(new MultiGather());
   library->Register(new SingleGather());
+  library->Register(new ScatterAdd());
+  library->Register(new Reference());
+  library->Register(new Assign());
 }
 
 }  // namespace myelin
@@ -35,6 +35,8 @@ struct TanhConstants {
   FloatVec8 minus_9;
   FloatVec8 alpha[7];
   FloatVec8 beta[4];
+  FloatVec8 fast_alpha[4];
+  FloatVec8 fast_beta[4];
 };
 
 TanhConstants tanh_const = {
@@ -60,6 +62,20 @@ TanhConstants tanh_const = {
     CONST8(2.26843463243900e-03f),
     CONST8(4.89352518554385e-03f),
   },
+
+  // The coefficients of the 7/6-degree rational approximation for fast math.
+  {
+    CONST8(3.0232481436e-06f),
+    CONST8(2.0666977754e-03f),
+    CONST8(1.2058282749e-01f),
+    CONST8(9.9999409981e-01f),
+  },
+  {
+    CONST8(1.2037634743e-04f),
+    CONST8(2.0067507118e-02f),
+    CONST8(4.5387845931e-01f),
+    CONST8(1.0f),
+  },
 };
 
 struct ExpConstants {
@@ -78,6 +94,8 @@ struct ExpConstants {
   FloatVec8 cephes_exp[6];
   FloatVec8 cephes_exp_c1;
   FloatVec8 cephes_exp_c2;
+
+  FloatVec8 fast_exp[3];
 } __attribute__ ((aligned (64)));
 
 ExpConstants exp_const = {
@@ -104,12 +122,32 @@ ExpConstants exp_const = {
 
   CONST8(0.693359375f),
   CONST8(-2.12194440e-4f),
+
+  {
+    CONST8(4.1277747091e-2f),
+    CONST8(1.6753513931e-1f),
+    CONST8(5.0005116027e-1f),
+  },
 };
 
+// Get data block with constant table in the generated code. The table is
+// copied into the code block, so the generated code does not refer to any
+// data outside the code block.
+StaticData *ConstantTable(MacroAssembler *masm, const void *table, int size) {
+  StaticData *data = masm->FindDataBlock(table, size, 1);
+  if (data == nullptr) {
+    data = masm->CreateDataBlock(64);
+    data->AddData(table, size);
+  }
+  return data;
+}
+
 }  // namespace
 
 // Compute element-wise hyperbolic tangent for a tensor using AVX.
-// This implementation is derived from the Eigen library.
+// This implementation is derived from the Eigen library. For fast math, a
+// lower-degree rational approximation is used. Strict math precision is left
+// to the expression kernels.
 class AVXFltTanh : public Kernel {
  public:
   string Name() override { return "AVXFltTanh"; }
@@ -134,6 +172,7 @@ class AVXFltTanh : public Kernel {
 
     // Strict math not supported.
     if (step->GetAttr("strict", false)) return false;
+    if (step->cell()->network()->precision() == MATH_STRICT) return false;
 
     return true;
   }
@@ -165,6 +204,16 @@ class AVXFltTanh : public Kernel {
     YMMRegister p = mm.allocy();
     YMMRegister q = mm.allocy();
 
+    // Select coefficients for precision.
+    bool fast = step->cell()->network()->precision() == MATH_FAST;
+    int alpha = fast ? offsetof(TanhConstants, fast_alpha)
+                     : offsetof(TanhConstants, alpha);
+    int beta = fast ? offsetof(TanhConstants, fast_beta)
+                    : offsetof(TanhConstants, beta);
+    int num_alpha = fast ? 4 : 7;
+    int num_beta = 4;
+    if (fast) step->set_variant("fast");
+
     // Load tensor and constant locations.
     __ LoadTensorAddress(input, step->input(0));
     if (step->output(0)->SharedWith(step->input(0))) {
@@ -172,7 +221,8 @@ class AVXFltTanh : public Kernel {
     } else {
       __ LoadTensorAddress(output, step->output(0));
     }
-    __ movp(consts, static_cast<void *>(&tanh_const));
+    StaticData *table = ConstantTable(masm, &tanh_const, sizeof(tanh_const));
+    __ leaq(consts, table->address());
     __ xorq(ofs, ofs);
 
     // Loop over elements in tensor, eight floats at a time.
@@ -191,10 +241,10 @@ class AVXFltTanh : public Kernel {
 
     // Compute the numerator polynomial.
     // p = alpha_0
-    __ vmovaps(p, Operand(consts, offsetof(TanhConstants, alpha)));
-    for (int i = 1; i < 7; ++i) {
+    __ vmovaps(p, Operand(consts, alpha));
+    for (int i = 1; i < num_alpha; ++i) {
       // p = p * x^2 + alpha_i
-      int disp = offsetof(TanhConstants, alpha) + i * sizeof(float) * 8;
+      int disp = alpha + i * sizeof(float) * 8;
       if (masm->Enabled(FMA3)) {
         __ vfmadd213ps(p, x2, Operand(consts, disp));
       } else {
@@ -207,10 +257,10 @@ class AVXFltTanh : public Kernel {
 
     // Compute the denominator polynomial.
     // q = beta_0
-    __ vmovaps(q, Operand(consts, offsetof(TanhConstants, beta)));
-    for (int i = 1; i < 4; ++i) {
-      // p = p * x^2 + alpha_i
-      int disp = offsetof(TanhConstants, beta) + i * sizeof(float) * 8;
+    __ vmovaps(q, Operand(consts, beta));
+    for (int i = 1; i < num_beta; ++i) {
+      // q = q * x^2 + beta_i
+      int disp = beta + i * sizeof(float) * 8;
       if (masm->Enabled(FMA3)) {
         __ vfmadd213ps(q, x2, Operand(consts, disp));
       } else {
@@ -240,7 +290,8 @@ class AVXFltTanh : public Kernel {
 // This implementation is derived from the Eigen library.
 // Works by writing x = m*log(2) + r, where m = floor(x/log(2)+1/2)  and  r is
 // the remainder. The result is then exp(x) = 2^m*exp(r), where exp(r) is in the
-// range [-1,1).
+// range [-1,1). For fast math, exp(r) is computed with a lower-degree
+// polynomial.
 class AVXFltExpBase : public Kernel {
  public:
   AVXFltExpBase(bool sigmoid) : sigmoid_(sigmoid) {}
@@ -300,6 +351,16 @@ class AVXFltExpBase : public Kernel {
     YMMRegister emm0 = mm.allocy();
     XMMRegister hi = mm.allocx();
 
+    // Select range reduction and polynomial for precision.
+    MathPrecision precision = step->cell()->network()->precision();
+    bool fma = masm->Enabled(FMA3);
+    bool split = !fma || precision == MATH_STRICT;
+    int poly = precision == MATH_FAST ? offsetof(ExpConstants, fast_exp)
+                                      : offsetof(ExpConstants, cephes_exp);
+    int terms = precision == MATH_FAST ? 3 : 6;
+    if (precision == MATH_STRICT) step->set_variant("strict");
+    if (precision == MATH_FAST) step->set_variant("fast");
+
     YMMRegister zero = sigmoid_ ? mm.allocy() : no_ymm_reg;
     YMMRegister one = mm.allocy();
     YMMRegister half = mm.allocy();
@@ -316,7 +377,8 @@ class AVXFltExpBase : public Kernel {
     } else {
       __ LoadTensorAddress(output, step->output(0));
     }
-    __ movp(consts, static_cast<void *>(&exp_const));
+    StaticData *table = ConstantTable(masm, &exp_const, sizeof(exp_const));
+    __ leaq(consts, table->address());
     __ xorq(ofs, ofs);
 
     // Initialize constants.
@@ -348,7 +410,7 @@ class AVXFltExpBase : public Kernel {
 
     // Express exp(x) as exp(m*ln(2) + r), start by extracting
     // m = floor(x/ln(2) + 0.5).
-    if (masm->Enabled(FMA3)) {
+    if (fma) {
       __ vmovaps(m, log2ef);
       __ vfmadd213ps(m, x, half);
     } else {
@@ -357,10 +419,10 @@ class AVXFltExpBase : public Kernel {
     }
     __ vroundps(m, m, kRoundDown);
 
-    // Get r = x - m*ln(2). If no FMA instructions are available, m*ln(2) is
-    // subtracted out in two parts, m*C1+m*C2 = m*ln(2), to avoid accumulating
-    // truncation errors.
-    if (masm->Enabled(FMA3)) {
+    // Get r = x - m*ln(2). If no FMA instructions are available or for strict
+    // math, m*ln(2) is subtracted out in two parts, m*C1+m*C2 = m*ln(2), to
+    // avoid accumulating truncation errors.
+    if (!split) {
       __ vmovaps(r, nln2);
       __ vfmadd213ps(r, m, x);
     } else {
@@ -374,11 +436,11 @@ class AVXFltExpBase : public Kernel {
     __ vmulps(r2, r, r);
 
     // Compute polynomial.
-    __ vmovaps(y, Operand(consts, offsetof(ExpConstants, cephes_exp)));
-    for (int i = 1; i < 6; ++i) {
-      // y = y * r + cephes_exp_i
-      int disp = offsetof(ExpConstants, cephes_exp) + i * sizeof(float) * 8;
-      if (masm->Enabled(FMA3)) {
+    __ vmovaps(y, Operand(consts, poly));
+    for (int i = 1; i < terms; ++i) {
+      // y = y * r + p_i
+      int disp = poly + i * sizeof(float) * 8;
+      if (fma) {
         __ vfmadd213ps(y, r, Operand(consts, disp));
       } else {
         __ vmulps(y, y, r);
@@ -387,7 +449,7 @@ class AVXFltExpBase : public Kernel {
     }
 
     // y = y * r2 + r
-    if (masm->Enabled(FMA3)) {
+    if (fma) {
       __ vfmadd213ps(y, r2, r);
     } else {
       __ vmulps(y, y, r2);
@@ -14,7 +14,9 @@
 
 #include "myelin/kernel/avx.h"
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "myelin/compute.h"
 #include "myelin/macro-assembler.h"
@@ -88,6 +90,59 @@ class AVXVecMatMulBase : public Kernel {
   Type otype_;   // output type
 };
 
+// Packs a float matrix into column panels for vertical vector-matrix
+// multiplication. The main columns are split into panels with a fixed number
+// of columns and the rows of each panel are stored consecutively, so the
+// kernel can traverse a panel with contiguous aligned loads. The remaining
+// columns are stored in a final panel padded to eight columns.
+class AVXFltPanelPacker : public TensorPacker {
+ public:
+  AVXFltPanelPacker(int panel) : panel_(panel) {}
+
+  string Layout() override { return LayoutName(panel_); }
+
+  // Return layout name for panel size.
+  static string LayoutName(int panel) {
+    return "AVXFltPanel" + std::to_string(panel);
+  }
+
+  size_t PackedSize(const Tensor *tensor) override {
+    int rows = tensor->dim(0);
+    int cols = tensor->dim(1);
+    int main_cols = (cols / 8) * 8;
+    int tail_cols = main_cols < cols ? 8 : 0;
+    return rows * (main_cols + tail_cols) * sizeof(float);
+  }
+
+  void Pack(const Tensor *tensor, const char *src, char *dst) override {
+    int rows = tensor->dim(0);
+    int cols = tensor->dim(1);
+    int main_cols = (cols / 8) * 8;
+    const float *matrix = reinterpret_cast<const float *>(src);
+    float *packed = reinterpret_cast<float *>(dst);
+
+    // Copy main column panels.
+    for (int col = 0; col < main_cols; col += panel_) {
+      for (int row = 0; row < rows; ++row) {
+        const float *from = matrix + row * cols + col;
+        for (int i = 0; i < panel_; ++i) *packed++ = from[i];
+      }
+    }
+
+    // Copy remaining columns padded to eight columns.
+    if (main_cols < cols) {
+      for (int row = 0; row < rows; ++row) {
+        const float *from = matrix + row * cols + main_cols;
+        for (int i = 0; i < cols - main_cols; ++i) packed[i] = from[i];
+        packed += 8;
+      }
+    }
+  }
+
+ private:
+  int panel_;  // number of columns in each main panel
+};
+
 // Vertical float vector-matrix multiplication for CPUs with AVX.
 class AVXFltVecMatMulVBase : public AVXVecMatMulBase {
  public:
@@ -97,6 +152,23 @@ class AVXFltVecMatMulVBase : public AVXVecMatMulBase {
   AVXFltVecMatMulVBase(bool bias, bool relu)
       : AVXVecMatMulBase(bias, relu, ROW_MAJOR, DT_FLOAT, DT_FLOAT) {}
 
+  bool Supports(Step *step) override {
+    if (!AVXVecMatMulBase::Supports(step)) return false;
+
+    // The rows of the matrix must be padded to ymm boundaries.
+    return step->input(1)->SupportsAlignment({8, 1});
+  }
+
+  // Compute the number of unrolls for the main columns.
+  static int Unrolls(int main_cols) {
+    int unrolls = 0;
+    for (int i = 1; i <= kMaxUnrolls; ++i) {
+      int batch_size = i * 8;
+      if (main_cols >= batch_size && main_cols % batch_size == 0) unrolls = i;
+    }
+    return unrolls;
+  }
+
   void Adjust(Step *step) override {
     // Get input and output tensors.
     Tensor *x = step->input(0);
@@ -114,6 +186,16 @@ class AVXFltVecMatMulVBase : public AVXVecMatMulBase {
     // Rows must be aligned to ymm boundaries to support aligned loads.
     W->MinAlign({8, 1});
     W->SetRequiredOrder(ROW_MAJOR);
+
+    // Request packing of constant matrix.
+    if (W->IsConstant() && W->dim(0) > 1) PackMatrix(W);
+  }
+
+  // Pack constant matrix into column panels to avoid striding through the
+  // rows of the matrix in the inner loop.
+  virtual void PackMatrix(Tensor *W) {
+    int unrolls = Unrolls((W->dim(1) / 8) * 8);
+    W->RequestPacking(new AVXFltPanelPacker(unrolls * 8));
   }
 
   void Generate(Step *step, MacroAssembler *masm) override {
@@ -142,14 +224,17 @@ class AVXFltVecMatMulVBase : public AVXVecMatMulBase {
     int remaining_cols = cols - main_cols;
 
     // Compute the number of unrolls.
-    int unrolls = 0;
-    for (int i = 1; i <= kMaxUnrolls; ++i) {
-      int batch_size = i * 8;
-      if (main_cols >= batch_size && main_cols % batch_size == 0) unrolls = i;
-    }
+    int unrolls = Unrolls(main_cols);
+
+    // Rows in packed panels are stored consecutively.
+    bool packed = W->packed(AVXFltPanelPacker::LayoutName(unrolls * 8));
+    int main_stride = packed ? unrolls * 32 : W->stride(0);
+    int panel_size = packed ? rows * unrolls * 32 : unrolls * 32;
+    int tail_stride = packed ? 32 : W->stride(0);
     if (step->variant().empty()) {
       string variant = "U" + std::to_string(unrolls);
       if (remaining_cols > 0) variant += "R" + std::to_string(remaining_cols);
+      if (packed) variant += "P";
       step->set_variant(variant);
     }
 
@@ -222,7 +307,7 @@ class AVXFltVecMatMulVBase : public AVXVecMatMulBase {
 
       // Next row.
       if (rows > 1) {
-        __ addq(m, Immediate(W->stride(0)));
+        __ addq(m, Immediate(main_stride));
         __ addq(rowofs, Immediate(sizeof(float)));
         __ cmpq(rowofs, Immediate(rows * sizeof(float)));
         __ j(less, &l2);
@@ -244,7 +329,7 @@ class AVXFltVecMatMulVBase : public AVXVecMatMulBase {
 
       // Next matrix column block.
       if (main_cols > unrolls * 8 || remaining_cols > 0) {
-        __ addq(matrix, Immediate(unrolls * 32));
+        __ addq(matrix, Immediate(panel_size));
       }
       if (main_cols > unrolls * 8) {
         __ addq(colofs, Immediate(unrolls * 32));
@@ -318,7 +403,7 @@ class AVXFltVecMatMulVBase : public AVXVecMatMulBase {
 
       // Next row.
       if (rows > 1) {
-        __ addq(m, Immediate(W->stride(0)));
+        __ addq(m, Immediate(tail_stride));
         __ addq(rowofs, Immediate(sizeof(float)));
         __ cmpq(rowofs, Immediate(rows * sizeof(float)));
         __ j(less, &l3);
@@ -383,6 +468,354 @@ class AVXFltVecMatMulAddReluV : public AVXFltVecMatMulVBase {
   string Operation() override { return "MatMulAddRelu"; }
 };
 
+// Packs a sparse float matrix into blocks of eight consecutive elements in a
+// row. Only the blocks with non-zero elements are stored. The blocks are
+// ordered by column block and row, and the blocks for each column block are
+// padded with zero blocks to a multiple of four, so the kernel can process
+// four blocks in each iteration. The block values are followed by an index
+// with the number of block groups for each column block and the byte offsets
+// in the input vector for the rows of the blocks.
+class AVXFltSparsePacker : public TensorPacker {
+ public:
+  // Number of blocks processed in each iteration.
+  static const int kBlockGroup = 4;
+
+  string Layout() override { return LayoutName(); }
+
+  // Return layout name for sparse matrix.
+  static string LayoutName() { return "AVXFltSparse"; }
+
+  size_t PackedSize(const Tensor *tensor) override {
+    Analyze(tensor);
+    return values_size() + index_size();
+  }
+
+  void Pack(const Tensor *tensor, const char *src, char *dst) override {
+    Analyze(tensor);
+    int cols = tensor->dim(1);
+    const float *matrix = reinterpret_cast<const float *>(src);
+    float *values = reinterpret_cast<float *>(dst);
+    int32 *index = reinterpret_cast<int32 *>(dst + values_size());
+    for (int block = 0; block < rows_.size(); ++block) {
+      int col = block * 8;
+      int width = std::min(8, cols - col);
+      *index++ = rows_[block].size() / kBlockGroup;
+      for (int row : rows_[block]) {
+        // Padding blocks are zero and use the first element of the input.
+        if (row != -1) {
+          const float *from = matrix + row * cols + col;
+          for (int i = 0; i < width; ++i) values[i] = from[i];
+        }
+        *index++ = row == -1 ? 0 : row * sizeof(float);
+        values += 8;
+      }
+    }
+  }
+
+  // Compute the rows of the non-zero blocks in each column block of a dense
+  // row-major matrix. The rows are padded with -1 to a multiple of the block
+  // group size. Returns the number of blocks including padding.
+  static int Structure(const float *matrix, int rows, int cols,
+                       std::vector<std::vector<int>> *structure) {
+    int blocks = 0;
+    structure->clear();
+    for (int col = 0; col < cols; col += 8) {
+      int width = std::min(8, cols - col);
+      structure->emplace_back();
+      std::vector<int> &nonzero = structure->back();
+      for (int row = 0; row < rows; ++row) {
+        const float *block = matrix + row * cols + col;
+        for (int i = 0; i < width; ++i) {
+          if (block[i] != 0.0) {
+            nonzero.push_back(row);
+            break;
+          }
+        }
+      }
+      while (nonzero.size() % kBlockGroup != 0) nonzero.push_back(-1);
+      blocks += nonzero.size();
+    }
+    return blocks;
+  }
+
+  // Number of stored blocks including padding.
+  int blocks() const { return blocks_; }
+
+  // Size of block values and index in bytes.
+  int values_size() const { return blocks_ * 8 * sizeof(float); }
+  int index_size() const { return (rows_.size() + blocks_) * sizeof(int32); }
+
+ private:
+  // Compute block structure for matrix.
+  void Analyze(const Tensor *tensor) {
+    if (analyzed_) return;
+    const float *matrix = reinterpret_cast<const float *>(tensor->data());
+    blocks_ = Structure(matrix, tensor->dim(0), tensor->dim(1), &rows_);
+    analyzed_ = true;
+  }
+
+  bool analyzed_ = false;                // block structure has been computed
+  std::vector<std::vector<int>> rows_;   // rows of blocks for column blocks
+  int blocks_ = 0;                       // number of stored blocks
+};
+
+// Sparse float vector-matrix multiplication for CPUs with AVX. The matrix is
+// packed in the sparse block layout and only the non-zero blocks are
+// multiplied with the input. If the matrix cannot be packed, e.g. because it
+// is shared with other kernels, the dense vertical kernel is used instead.
+class AVXFltSparseVecMatMulBase : public AVXFltVecMatMulVBase {
+ public:
+  AVXFltSparseVecMatMulBase(bool bias, bool relu)
+      : AVXFltVecMatMulVBase(bias, relu) {}
+
+  bool Supports(Step *step) override {
+    if (!AVXFltVecMatMulVBase::Supports(step)) return false;
+
+    // Only constant matrices selected for sparse computation are supported.
+    if (!step->GetAttr("sparse", false)) return false;
+    if (step->GetAttr("strict", false)) return false;
+    return step->input(1)->IsConstant();
+  }
+
+  void PackMatrix(Tensor *W) override {
+    W->RequestPacking(new AVXFltSparsePacker());
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    // Use dense kernel if the matrix is not packed.
+    Tensor *W = step->input(1);
+    if (!W->packed(AVXFltSparsePacker::LayoutName())) {
+      AVXFltVecMatMulVBase::Generate(step, masm);
+      return;
+    }
+    auto *packer = static_cast<AVXFltSparsePacker *>(W->packer());
+
+    Registers &rr = masm->rr();
+    SIMDRegisters &mm = masm->mm();
+    const int group = AVXFltSparsePacker::kBlockGroup;
+
+    // Get input and output tensors.
+    Tensor *x = step->input(0);
+    Tensor *b = bias_ ? step->input(2) : nullptr;
+    Tensor *y = step->output(0);
+    bool fma = masm->Enabled(FMA3);
+
+    // Get matrix dimensions.
+    int cols = W->dim(1);
+    int main_cols = (cols  / 8) * 8;
+    int remaining_cols = cols - main_cols;
+    string variant = "S";
+    if (remaining_cols > 0) variant += "R" + std::to_string(remaining_cols);
+    step->set_variant(variant);
+
+    // Allocate general registers.
+    Register matrix = rr.alloc();
+    Register index = rr.alloc();
+    Register count = rr.alloc();
+    Register rowofs = rr.alloc();
+    Register colofs = rr.alloc();
+    Register input = rr.alloc();
+    Register output = rr.alloc();
+    Register vector = bias_ ? rr.alloc() : no_reg;
+
+    // Allocate SIMD registers.
+    std::vector<YMMRegister> sum;
+    std::vector<YMMRegister> elem;
+    for (int i = 0; i < group; ++i) {
+      sum.push_back(mm.allocy());
+      elem.push_back(mm.allocy());
+    }
+    YMMRegister zero = relu_ ? mm.allocy() : no_ymm_reg;
+    YMMRegister mask = remaining_cols > 0 ? mm.allocy() : no_ymm_reg;
+
+    // Load tensor locations. The block index follows the block values.
+    __ LoadTensorAddress(input, x);
+    __ LoadTensorAddress(matrix, W);
+    __ leaq(index, Operand(matrix, packer->values_size()));
+    if (bias_) {
+      __ LoadTensorAddress(vector, b);
+    }
+    __ LoadTensorAddress(output, y);
+
+    // Initialize SIMD register to zero for relu.
+    if (relu_) {
+      __ vxorps(zero, zero, zero);
+    }
+
+    // Compute column block. The blocks for the column block are multiplied
+    // with the input elements for the rows of the blocks and added to
+    // separate sums for each block in the group.
+    auto column_block = [&](const Operand &out, const Operand &bias,
+                            bool tail) {
+      Label l2, l3;
+      for (int i = 0; i < group; ++i) {
+        __ vxorps(sum[i], sum[i], sum[i]);
+      }
+      __ movl(count, Operand(index));
+      __ addq(index, Immediate(sizeof(int32)));
+      __ testq(count, count);
+      __ j(equal, &l3);
+
+      // Loop over groups of non-zero blocks.
+      __ LoopStart(&l2);
+      for (int i = 0; i < group; ++i) {
+        __ movl(rowofs, Operand(index, i * sizeof(int32)));
+        __ vbroadcastss(elem[i], Operand(input, rowofs));
+        if (fma) {
+          __ vfmadd231ps(sum[i], elem[i], Operand(matrix, i * 32));
+        } else {
+          __ vmulps(elem[i], elem[i], Operand(matrix, i * 32));
+          __ vaddps(sum[i], sum[i], elem[i]);
+        }
+      }
+      __ addq(matrix, Immediate(group * 32));
+      __ addq(index, Immediate(group * sizeof(int32)));
+      __ decq(count);
+      __ j(not_zero, &l2);
+      __ bind(&l3);
+
+      // Add sums for the blocks.
+      for (int n = group / 2; n > 0; n /= 2) {
+        for (int i = 0; i < n; ++i) {
+          __ vaddps(sum[i], sum[i], sum[i + n]);
+        }
+      }
+
+      // Add bias and compute relu.
+      if (bias_) {
+        if (tail) {
+          __ vmaskmovps(elem[0], mask, bias);
+          __ vaddps(sum[0], sum[0], elem[0]);
+        } else {
+          __ vaddps(sum[0], sum[0], bias);
+        }
+      }
+      if (relu_) {
+        __ vmaxps(sum[0], sum[0], zero);
+      }
+
+      // Save to y[col:col+8].
+      if (tail) {
+        __ vmaskmovps(out, mask, sum[0]);
+      } else {
+        __ vmovaps(out, sum[0]);
+      }
+    };
+
+    // Compute main columns.
+    if (main_cols > 0) {
+      Label l1;
+      __ xorq(colofs, colofs);
+      __ LoopStart(&l1);
+      Operand out(output, colofs);
+      column_block(out, bias_ ? Operand(vector, colofs) : out, false);
+      if (main_cols > 8) {
+        __ addq(colofs, Immediate(8 * sizeof(float)));
+        __ cmpq(colofs, Immediate(main_cols * sizeof(float)));
+        __ j(less, &l1);
+      }
+    }
+
+    // Compute remaining columns using masked loads and stores.
+    if (remaining_cols > 0) {
+      int32 bits[8];
+      for (int i = 0; i < 8; ++i) bits[i] = i < remaining_cols ? -1 : 0;
+      __ vmovaps(mask, masm->GetData(bits, sizeof(bits))->address());
+      int coldisp = main_cols * sizeof(float);
+      Operand out(output, coldisp);
+      column_block(out, bias_ ? Operand(vector, coldisp) : out, true);
+    }
+  }
+};
+
+class AVXFltSparseVecMatMul : public AVXFltSparseVecMatMulBase {
+ public:
+  AVXFltSparseVecMatMul() : AVXFltSparseVecMatMulBase(false, false) {}
+
+  string Name() override { return "AVXFltSparseVecMatMul"; }
+  string Operation() override { return "MatMul"; }
+};
+
+class AVXFltSparseVecMatMulAdd : public AVXFltSparseVecMatMulBase {
+ public:
+  AVXFltSparseVecMatMulAdd() : AVXFltSparseVecMatMulBase(true, false) {}
+
+  string Name() override { return "AVXFltSparseVecMatMulAdd"; }
+  string Operation() override { return "MatMulAdd"; }
+};
+
+class AVXFltSparseVecMatMulRelu : public AVXFltSparseVecMatMulBase {
+ public:
+  AVXFltSparseVecMatMulRelu() : AVXFltSparseVecMatMulBase(false, true) {}
+
+  string Name() override { return "AVXFltSparseVecMatMulRelu"; }
+  string Operation() override { return "MatMulRelu"; }
+};
+
+class AVXFltSparseVecMatMulAddRelu : public AVXFltSparseVecMatMulBase {
+ public:
+  AVXFltSparseVecMatMulAddRelu() : AVXFltSparseVecMatMulBase(true, true) {}
+
+  string Name() override { return "AVXFltSparseVecMatMulAddRelu"; }
+  string Operation() override { return "MatMulAddRelu"; }
+};
+
+// Select sparse vector-matrix multiplication for constant matrices where most
+// of the blocks are zero, e.g. in pruned models. The density of a matrix is
+// the number of blocks in the sparse layout relative to the number of blocks
+// in the dense matrix. The matrix multiplications are marked with a sparse
+// attribute, so each matrix is only measured once. The choice can be
+// overridden by setting the attribute in the flow.
+class SparseMatMulTransformer : public Transformer {
+ public:
+  // The sparse kernel needs an index lookup and a broadcast for each block,
+  // so it is only faster than the dense kernel when most blocks are skipped.
+  explicit SparseMatMulTransformer(float max_density = 0.4)
+      : max_density_(max_density) {}
+
+  string Name() override { return "SparseMatMulTransformer"; }
+
+  bool Transform(Flow *flow) override {
+    int updates = 0;
+    for (Flow::Operation *op : flow->ops()) {
+      if (op->type != "MatMul" &&
+          op->type != "MatMulAdd" &&
+          op->type != "MatMulRelu" &&
+          op->type != "MatMulAddRelu") {
+        continue;
+      }
+      if (op->HasAttr("sparse") || op->indegree() < 2) continue;
+      if (op->GetAttr("transpose_a", false)) continue;
+      if (op->GetAttr("transpose_b", false)) continue;
+
+      // Only vector-matrix multiplication with constant matrix.
+      Flow::Variable *x = op->inputs[0];
+      Flow::Variable *W = op->inputs[1];
+      if (x->rank() != 2 || x->dim(0) != 1) continue;
+      if (W->type != DT_FLOAT || W->rank() != 2) continue;
+      if (!W->constant() || W->data == nullptr) continue;
+      if (W->size != W->elements() * sizeof(float)) continue;
+
+      // Measure density of matrix.
+      int rows = W->dim(0);
+      int cols = W->dim(1);
+      std::vector<std::vector<int>> structure;
+      int blocks = AVXFltSparsePacker::Structure(
+          reinterpret_cast<const float *>(W->data), rows, cols, &structure);
+      float density = static_cast<float>(blocks) / (rows * structure.size());
+      bool sparse = density <= max_density_;
+      VLOG(3) << "Matrix " << W->name << " has density " << density
+              << (sparse ? ", using sparse kernel" : "");
+      op->SetAttr("sparse", sparse);
+      updates++;
+    }
+    return updates > 0;
+  }
+
+ private:
+  float max_density_;  // maximum density for sparse computation
+};
+
 // Horizontal float vector-matrix multiplication for CPUs with AVX.
 class AVXFltVecMatMulHBase : public AVXVecMatMulBase {
  public:
@@ -792,11 +1225,22 @@ class AVXFltMatMatMul : public Kernel {
     __ LoadTensorAddress(b, B);
     __ LoadTensorAddress(c, C);
 
-    // Compute end of B and C.
+    // Compute end of B and C. For dynamic output, only the rows up to the
+    // runtime batch size are computed.
+    Label done;
     __ movq(b_end, b);
     __ addq(b_end, Immediate(B->size()));
-    __ movq(c_end, c);
-    __ addq(c_end, Immediate(C->size()));
+    if (C->dynamic()) {
+      int batch = step->cell()->batch_offset();
+      __ imulq(c_end, Operand(masm->instance(), batch),
+               Immediate(C->stride(0)));
+      __ addq(c_end, c);
+      __ cmpq(c, c_end);
+      __ j(greater_equal, &done);
+    } else {
+      __ movq(c_end, c);
+      __ addq(c_end, Immediate(C->size()));
+    }
 
     // Loop over all rows in C.
     __ LoopStart(&l1);
@@ -869,6 +1313,7 @@ class AVXFltMatMatMul : public Kernel {
     }
     __ cmpq(c, c_end);
     __ j(less, &l1);
+    __ bind(&done);
   }
 
   int64 Complexity(const Step *step) override {
@@ -876,6 +1321,148 @@ class AVXFltMatMatMul : public Kernel {
   }
 };
 
+// Float matrix multiplication added to a variable, C += A * B, for CPUs with
+// AVX. Each row of C is updated with the rows of B scaled by the elements of
+// the corresponding row in A.
+class AVXFltAssignAddMatMul : public Kernel {
+ public:
+  string Name() override { return "AVXFltAssignAddMatMul"; }
+  string Operation() override { return "AssignAddMatMul"; }
+
+  bool Supports(Step *step) override {
+    // Requires CPU with AVX support.
+    if (!CPU::Enabled(AVX)) return false;
+
+    // Float variable and two float 2D tensor inputs.
+    if (step->indegree() != 3) return false;
+    if (step->outdegree() != 0) return false;
+    Tensor *C = step->input(0);
+    Tensor *A = step->input(1);
+    Tensor *B = step->input(2);
+    if (C->type() != DT_FLOAT || C->rank() > 2) return false;
+    if (A->rank() != 2 || A->type() != DT_FLOAT) return false;
+    if (B->rank() != 2 || B->type() != DT_FLOAT) return false;
+
+    // Check shape.
+    if (step->GetAttr("transpose_b", false)) return false;
+    Shape a = A->shape();
+    if (step->GetAttr("transpose_a", false)) a.transpose();
+    if (a.dim(1) != B->dim(0)) return false;
+    if (C->rank() == 2) {
+      if (C->dim(0) != a.dim(0) || C->dim(1) != B->dim(1)) return false;
+    } else {
+      if (a.dim(0) != 1 || C->elements() != B->dim(1)) return false;
+    }
+
+    // Check order.
+    if (!A->SupportsOrder(ROW_MAJOR)) return false;
+    if (!B->SupportsOrder(ROW_MAJOR)) return false;
+    if (!C->SupportsOrder(ROW_MAJOR)) return false;
+
+    return true;
+  }
+
+  void Adjust(Step *step) override {
+    for (Tensor *input : step->inputs()) input->SetRequiredOrder(ROW_MAJOR);
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    Label l1, l2, l3;
+
+    // Get inputs.
+    Tensor *C = step->input(0);
+    Tensor *A = step->input(1);
+    Tensor *B = step->input(2);
+
+    // Get dimensions for matrices. The step sizes for A are for moving to the
+    // next row in C and the next row in B, respectively.
+    bool transpose_a = step->GetAttr("transpose_a", false);
+    int rows = A->dim(transpose_a ? 1 : 0);
+    int depth = B->dim(0);
+    int cols = B->dim(1);
+    int main = (cols / 8) * 8;
+    int a_row = transpose_a ? sizeof(float) : A->stride(0);
+    int a_col = transpose_a ? A->stride(0) : sizeof(float);
+    int c_row = C->rank() == 2 ? C->stride(0) : 0;
+    bool fma = masm->Enabled(FMA3);
+
+    // Allocate registers.
+    Register a = masm->rr().alloc();
+    Register a_ptr = masm->rr().alloc();
+    Register b = masm->rr().alloc();
+    Register b_ptr = masm->rr().alloc();
+    Register c = masm->rr().alloc();
+    Register row = masm->rr().alloc();
+    Register k = masm->rr().alloc();
+    Register col = masm->rr().alloc();
+    YMMRegister scale = masm->mm().allocy();
+    YMMRegister elem = masm->mm().allocy();
+    YMMRegister prod = masm->mm().allocy();
+
+    // Load tensor addresses.
+    __ LoadTensorAddress(c, C);
+    __ LoadTensorAddress(a, A);
+    __ LoadTensorAddress(b, B);
+
+    // Loop over all rows in C.
+    __ xorq(row, row);
+    __ LoopStart(&l1);
+    __ movq(a_ptr, a);
+    __ movq(b_ptr, b);
+    __ xorq(k, k);
+
+    // Add scaled rows of B to row in C, C[i,j] += sum_k A[i,k] * B[k,j].
+    __ LoopStart(&l2);
+    __ vbroadcastss(scale, Operand(a_ptr));
+    if (main > 0) {
+      __ xorq(col, col);
+      __ LoopStart(&l3);
+      __ vmovups(elem, Operand(c, col));
+      if (fma) {
+        __ vfmadd231ps(elem, scale, Operand(b_ptr, col));
+      } else {
+        __ vmulps(prod, scale, Operand(b_ptr, col));
+        __ vaddps(elem, elem, prod);
+      }
+      __ vmovups(Operand(c, col), elem);
+      __ addq(col, Immediate(8 * sizeof(float)));
+      __ cmpq(col, Immediate(main * sizeof(float)));
+      __ j(less, &l3);
+    }
+
+    // Update residual columns.
+    for (int i = main; i < cols; ++i) {
+      int disp = i * sizeof(float);
+      __ vmovss(elem.xmm(), Operand(c, disp));
+      if (fma) {
+        __ vfmadd231ss(elem.xmm(), scale.xmm(), Operand(b_ptr, disp));
+      } else {
+        __ vmulss(prod.xmm(), scale.xmm(), Operand(b_ptr, disp));
+        __ vaddss(elem.xmm(), elem.xmm(), prod.xmm());
+      }
+      __ vmovss(Operand(c, disp), elem.xmm());
+    }
+
+    // Move to next row in B.
+    __ addq(a_ptr, Immediate(a_col));
+    __ addq(b_ptr, Immediate(B->stride(0)));
+    __ incq(k);
+    __ cmpq(k, Immediate(depth));
+    __ j(not_equal, &l2);
+
+    // Move to next row in C.
+    __ addq(a, Immediate(a_row));
+    if (c_row != 0) __ addq(c, Immediate(c_row));
+    __ incq(row);
+    __ cmpq(row, Immediate(rows));
+    __ j(not_equal, &l1);
+  }
+
+  int64 Complexity(const Step *step) override {
+    return step->input(0)->elements() * step->input(2)->dim(0) * 2;
+  }
+};
+
 // Horizontal integer vector-matrix multiplication for CPUs with AVX2.
 class AVXIntVecMatMulHBase : public AVXVecMatMulBase {
  public:
@@ -1089,6 +1676,14 @@ void RegisterAVXMatMul(Library *library) {
   // Supports  : FMA3
   library->Register(new AVXFltMatMatMul());
 
+  // Computes  : C += A * B
+  // Input     : C: float32[k,m] row-major
+  //             A: float32[k,n] row-major
+  //             B: float32[n,m] row-major
+  // Requires  : AVX
+  // Supports  : FMA3, transpose_a
+  library->Register(new AVXFltAssignAddMatMul());
+
   // Computes  : y = x * W
   // Input     : x: float32[1,n]
   //             W: float32[n,m] column-major
@@ -1153,6 +1748,43 @@ void RegisterAVXMatMul(Library *library) {
   // Requires  : AVX
   library->Register(new AVXFltVecMatMulAddReluV());
 
+  // Computes  : y = x * W
+  // Input     : x: float32[1,n]
+  //             W: float32[n,m] sparse constant
+  // Output    : y: float32[1,m]
+  // Requires  : AVX
+  // Supports  : FMA3
+  library->Register(new AVXFltSparseVecMatMul());
+
+  // Computes  : y = x * W + b
+  // Input     : x: float32[1,n]
+  //             W: float32[n,m] sparse constant
+  //             b: float32[1,m]
+  // Output    : y: float32[1,m]
+  // Requires  : AVX
+  // Supports  : FMA3
+  library->Register(new AVXFltSparseVecMatMulAdd());
+
+  // Computes  : y = max(0, x * W)
+  // Input     : x: float32[1,n]
+  //             W: float32[n,m] sparse constant
+  // Output    : y: float32[1,m]
+  // Requires  : AVX
+  // Supports  : FMA3
+  library->Register(new AVXFltSparseVecMatMulRelu());
+
+  // Computes  : y = max(0, x * W + b)
+  // Input     : x: float32[1,n]
+  //             W: float32[n,m] sparse constant
+  //             b: float32[1,m]
+  // Output    : y: float32[1,m]
+  // Requires  : AVX
+  // Supports  : FMA3
+  library->Register(new AVXFltSparseVecMatMulAddRelu());
+
+  // Select sparse kernels for matrices with few non-zero blocks.
+  library->RegisterTransformer(new SparseMatMulTransformer());
+
   // Computes  : y = x * W
   // Input     : x: int8[1,n]
   //             W: int8[n,m] column-major
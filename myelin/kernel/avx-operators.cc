@@ -14,6 +14,7 @@
 
 #include "myelin/kernel/avx.h"
 
+#include <math.h>
 #include <string>
 
 #include "myelin/compute.h"
@@ -325,6 +326,7 @@ class AVXFltConstSub : public Kernel {
 
     // Check shapes.
     if (c->shape().elements() != 1 || !c->IsConstant()) return false;
+    if (c->learnable()) return false;
     if (x->shape().elements() != y->shape().elements()) return false;
 
     return true;
@@ -484,6 +486,170 @@ class AVXFltMulTwoAdd : public Kernel {
   }
 };
 
+// Compute the index of the maximum element using AVX. If a bitmask is given as
+// the second input, only the elements with their bit set in the mask are
+// considered. The output is -1 if no element qualifies. Ties are resolved in
+// favor of the lowest index.
+class AVXFltArgMax : public Kernel {
+ public:
+  string Name() override { return "AVXFltArgMax"; }
+  string Operation() override { return "ArgMax"; }
+
+  bool Supports(Step *step) override {
+    // Requires CPU with AVX support.
+    if (!CPU::Enabled(AVX)) return false;
+
+    // Check inputs and outputs.
+    if (step->indegree() != 1 && step->indegree() != 2) return false;
+    if (step->outdegree() != 1) return false;
+    Tensor *x = step->input(0);
+    Tensor *y = step->output(0);
+
+    // Check types and shapes. The input must be a vector or a single row,
+    // since padding of the last dimension would leave gaps between rows.
+    // Indices are tracked as floats, so the number of elements must be
+    // exactly representable.
+    if (x->type() != DT_FLOAT) return false;
+    if (y->type() != DT_INT32 || y->elements() != 1) return false;
+    if (x->rank() != 1 && (x->rank() != 2 || x->dim(0) != 1)) return false;
+    if (x->elements() == 0 || x->elements() > (1 << 24)) return false;
+
+    // Masking requires AVX2 for the integer bit tests.
+    if (step->indegree() == 2) {
+      if (!CPU::Enabled(AVX2)) return false;
+      Tensor *mask = step->input(1);
+      if (mask->type() != DT_INT32) return false;
+      if (mask->elements() * 32 < x->elements()) return false;
+    }
+
+    return true;
+  }
+
+  void Adjust(Step *step) override {
+    step->input(0)->MinAlignLast(8);
+    step->input(0)->SetMiniumAlignment(8 * sizeof(float));
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    Registers &rr = masm->rr();
+    SIMDRegisters &mm = masm->mm();
+    Label l;
+
+    Tensor *x = step->input(0);
+    Tensor *mask = step->indegree() == 2 ? step->input(1) : nullptr;
+    Tensor *y = step->output(0);
+    int n = x->elements();
+    int blocks = n / 8;
+    int tail = n % 8;
+
+    Register ofs = rr.alloc();
+    Register input = rr.alloc();
+    Register bits = rr.alloc();
+    Register tmp = rr.alloc();
+    YMMRegister elem = mm.allocy();
+    YMMRegister best = mm.allocy();
+    YMMRegister best_index = mm.allocy();
+    YMMRegister index = mm.allocy();
+    YMMRegister cond = mm.allocy();
+    YMMRegister t1 = mm.allocy();
+    YMMRegister t2 = mm.allocy();
+
+    // Static data for lane indices, bit selectors, and tail mask.
+    StaticData *lanes = masm->CreateDataBlock(8 * sizeof(float));
+    StaticData *selectors = masm->CreateDataBlock(8 * sizeof(int32));
+    StaticData *trailing = masm->CreateDataBlock(8 * sizeof(int32));
+    for (int i = 0; i < 8; ++i) {
+      lanes->Add<float>(i);
+      selectors->Add<int32>(1 << i);
+      trailing->Add<int32>(i < tail ? -1 : 0);
+    }
+    StaticData *eight = masm->GetConstant<float>(8.0, 8);
+    StaticData *neginf = masm->GetConstant<float>(-INFINITY, 8);
+    StaticData *posinf = masm->GetConstant<float>(INFINITY, 8);
+    StaticData *minusone = masm->GetConstant<float>(-1.0, 8);
+
+    // Initialize best element and index.
+    __ LoadTensorAddress(input, x);
+    if (mask != nullptr) __ LoadTensorAddress(bits, mask);
+    __ vmovaps(best, neginf->address());
+    __ vmovaps(best_index, minusone->address());
+    __ vmovaps(index, lanes->address());
+
+    // Compare the next block of eight elements with the best elements so far.
+    // Elements that are not allowed by the mask are replaced with -inf.
+    auto compare = [&](Operand src, bool last) {
+      __ vmovaps(elem, src);
+      if (mask != nullptr) {
+        __ movzxbl(tmp, Operand(bits));
+        __ vmovd(XMMRegister::from_code(cond.code()), tmp);
+        __ vbroadcastss(cond, cond);
+        __ vpand(cond, cond, selectors->address());
+        __ vpcmpeqd(cond, cond, selectors->address());
+        __ vandps(elem, elem, cond);
+        __ vandnps(cond, cond, neginf->address());
+        __ vorps(elem, elem, cond);
+      }
+      if (last) {
+        __ vandps(elem, elem, trailing->address());
+        __ vmovaps(cond, trailing->address());
+        __ vandnps(cond, cond, neginf->address());
+        __ vorps(elem, elem, cond);
+      }
+      __ vcmpltps(cond, best, elem);
+      __ vmaxps(best, best, elem);
+      __ vandps(t1, cond, index);
+      __ vandnps(t2, cond, best_index);
+      __ vorps(best_index, t1, t2);
+    };
+
+    // Loop over all the full blocks.
+    if (blocks > 0) {
+      __ xorq(ofs, ofs);
+      __ LoopStart(&l);
+      compare(Operand(input, ofs), false);
+      __ vaddps(index, index, eight->address());
+      if (mask != nullptr) __ incq(bits);
+      __ addq(ofs, Immediate(8 * sizeof(float)));
+      __ cmpq(ofs, Immediate(blocks * 8 * sizeof(float)));
+      __ j(less, &l);
+    }
+
+    // Compare remaining elements in the last partial block.
+    if (tail > 0) {
+      compare(Operand(input, blocks * 8 * sizeof(float)), true);
+    }
+
+    // Find the maximum across the lanes.
+    __ vperm2f128(t1, best, best, 1);
+    __ vmaxps(t1, t1, best);
+    __ vpermilps(t2, t1, 0x4E);
+    __ vmaxps(t1, t1, t2);
+    __ vpermilps(t2, t1, 0xB1);
+    __ vmaxps(t1, t1, t2);
+
+    // Find the lowest index among the lanes with the maximum element.
+    __ vcmpeqps(cond, best, t1);
+    __ vandps(best_index, best_index, cond);
+    __ vandnps(cond, cond, posinf->address());
+    __ vorps(best_index, best_index, cond);
+    __ vperm2f128(t1, best_index, best_index, 1);
+    __ vminps(t1, t1, best_index);
+    __ vpermilps(t2, t1, 0x4E);
+    __ vminps(t1, t1, t2);
+    __ vpermilps(t2, t1, 0xB1);
+    __ vminps(t1, t1, t2);
+
+    // Store index of maximum element.
+    __ vcvttss2si(tmp, XMMRegister::from_code(t1.code()));
+    __ LoadTensorAddress(input, y);
+    __ movl(Operand(input), tmp);
+  }
+
+  int64 Complexity(const Step *step) override {
+    return step->input(0)->elements() * 2;
+  }
+};
+
 void RegisterAVXOperators(Library *library) {
   // Computes  : c = a + b element-wise
   // Input     : a: float32[d1,...,dn]
@@ -535,6 +701,13 @@ void RegisterAVXOperators(Library *library) {
   // Output    : c: int8/16/32/64[d1,...,dn]
   // Requires  : AVX
   library->Register(new AVXIntSub());
+
+  // Computes  : y = argmax(x) over elements with bit set in mask
+  // Input     : x: float32[d1,...,dn]
+  //             mask: int32[m] optional, m >= (d1*...*dn)/32
+  // Output    : y: int32[1]
+  // Requires  : AVX, AVX2 if masked
+  library->Register(new AVXFltArgMax());
 }
 
 }  // namespace myelin
@@ -14,6 +14,8 @@
 
 #include "myelin/kernel/dragnn.h"
 
+#include <algorithm>
+
 #include "myelin/compute.h"
 #include "myelin/macro-assembler.h"
 
@@ -24,6 +26,14 @@ namespace myelin {
 
 using namespace jit;
 
+// Check if embedding matrix type is supported by lookup kernels. Embeddings
+// can be stored as 16-bit floats, which are converted to single precision on
+// the fly.
+static bool SupportedEmbeddingType(Type type, bool vector) {
+  if (type == DT_FLOAT) return true;
+  return MacroAssembler::SupportsHalf(type, vector);
+}
+
 // Stub for Dragnn initializer.
 class DragnnInitializer : public Kernel {
  public:
@@ -83,6 +93,19 @@ class DragnnCollect : public Kernel {
     // Get number input features.
     int num_features = f->dim(1);
 
+    // Clear output, since only the activations for valid features and the OOV
+    // indicators for OOV features are written below.
+    Register dst = rr.alloc_fixed(rdi);
+    Register cnt = rr.alloc_fixed(rcx);
+    Register zero = rr.alloc_fixed(rax);
+    __ LoadTensorAddress(dst, R);
+    __ xorq(zero, zero);
+    __ movq(cnt, Immediate(R->size()));
+    __ repstosb();
+    rr.release(dst);
+    rr.release(cnt);
+    rr.release(zero);
+
     // Allocate registers.
     rr.use(rsi);
     rr.use(rdi);
@@ -148,7 +171,7 @@ class DragnnCollect : public Kernel {
 };
 
 // Dragnn feature lookup operation for fixed features mapped through an
-// embedding matrix.
+// embedding matrix. The embedding matrix can be stored in half precision.
 class DragnnLookup : public Kernel {
  public:
   string Name() override { return "DragnnLookup"; }
@@ -163,7 +186,8 @@ class DragnnLookup : public Kernel {
     Tensor *M = step->input(1);
     Tensor *v = step->output(0);
     if (f->type() != DT_INT32) return false;
-    if (M->type() != DT_FLOAT || M->rank() != 2) return false;
+    if (!SupportedEmbeddingType(M->type(), false)) return false;
+    if (M->rank() != 2) return false;
     if (v->type() != DT_FLOAT || v->rank() != 2) return false;
     if (v->dim(0) != 1 || v->dim(1) != M->dim(1)) return false;
 
@@ -178,7 +202,7 @@ class DragnnLookup : public Kernel {
   void Generate(Step *step, MacroAssembler *masm) override {
     Registers &rr = masm->rr();
     SIMDRegisters &mm = masm->mm();
-    Label l1, l2, l3, l4;
+    Label l0, l1, l2, l3, l4;
 
     // Get inputs and outputs.
     Tensor *f = step->input(0);
@@ -201,17 +225,37 @@ class DragnnLookup : public Kernel {
     Register row = rr.alloc();
     Register oov = rr.alloc();
     XMMRegister elem = mm.allocx();
+    bool half = M->type() != DT_FLOAT;
+    Register tmp = half ? rr.alloc() : no_reg;
+    Register next = rr.alloc();
 
     // Load tensor locations.
     __ LoadTensorAddress(input, f);
     __ LoadTensorAddress(embeddings, M);
     __ LoadTensorAddress(output, v);
 
-    // Loop over input features.
+    // Prefetch embeddings for the first features.
     __ movq(oov, Immediate(embedding_size));
+    int distance = __ PrefetchFirstEmbeddings(step, input, next, oov,
+                                              embeddings, M, num_features);
+
+    // Clear output vector.
+    __ xorps(elem, elem);
+    __ xorq(row, row);
+    __ LoopStart(&l0);
+    __ movss(Operand(output, row, times_4), elem);
+    __ incq(row);
+    __ cmpq(row, Immediate(embedding_dims));
+    __ j(not_equal, &l0);
+
+    // Loop over input features.
     __ xorq(col, col);
     __ LoopStart(&l1);
 
+    // Prefetch embedding for upcoming feature.
+    __ PrefetchNextEmbedding(distance, input, col, next, oov, embeddings,
+                             M, num_features);
+
     // Get next feature index.
     __ movsxlq(acc, Operand(input, col, times_4));
 
@@ -230,8 +274,13 @@ class DragnnLookup : public Kernel {
     // Add embedding vector to output.
     __ xorq(row, row);
     __ LoopStart(&l3);
-    __ movss(elem, Operand(output, row, times_4));
-    __ addss(elem, Operand(acc, row, times_4));
+    if (half) {
+      __ LoadHalf(elem, Operand(acc, row, times_2), tmp, M->type());
+      __ addss(elem, Operand(output, row, times_4));
+    } else {
+      __ movss(elem, Operand(output, row, times_4));
+      __ addss(elem, Operand(acc, row, times_4));
+    }
     __ movss(Operand(output, row, times_4), elem);
     __ incq(row);
     __ cmpq(row, Immediate(embedding_dims));
@@ -323,7 +372,8 @@ class DragnnLookupSingle : public Kernel {
 
 // Dragnn feature lookup operation for fixed features mapped through an
 // embedding matrix. This can be used when the size of the embedding is small
-// enough to fit into registers.
+// enough to fit into registers. Embeddings stored in half precision need one
+// extra register for the conversion.
 class DragnnLookupUnrolled : public Kernel {
  public:
   string Name() override { return "DragnnLookupUnrolled"; }
@@ -344,13 +394,16 @@ class DragnnLookupUnrolled : public Kernel {
     Tensor *M = step->input(1);
     Tensor *v = step->output(0);
     if (f->type() != DT_INT32) return false;
-    if (M->type() != DT_FLOAT || M->rank() != 2) return false;
+    if (!SupportedEmbeddingType(M->type(), true)) return false;
+    if (M->rank() != 2) return false;
     if (v->type() != DT_FLOAT || v->rank() != 2) return false;
     if (v->dim(0) != 1 || v->dim(1) != M->dim(1)) return false;
 
     // Check if embedding dimension allows us to unroll.
     int embedding_dims = M->dim(1);
-    if (embedding_dims > kMaxEmbeddingDim) return false;
+    int max_dims = kMaxEmbeddingDim;
+    if (M->type() != DT_FLOAT) max_dims -= kBlockSize;
+    if (embedding_dims > max_dims) return false;
     if (embedding_dims % kBlockSize != 0) return false;
 
     return true;
@@ -360,7 +413,8 @@ class DragnnLookupUnrolled : public Kernel {
     // Align embeddings and output.
     int align = kBlockSize * sizeof(float);
     step->input(1)->MinAlign({1, kBlockSize});
-    step->input(1)->SetMiniumAlignment(align);
+    step->input(1)->SetMiniumAlignment(
+        kBlockSize * step->input(1)->element_size());
     step->output(0)->MinAlign({1, kBlockSize});
     step->output(0)->SetMiniumAlignment(align);
 
@@ -397,22 +451,34 @@ class DragnnLookupUnrolled : public Kernel {
     std::vector<YMMRegister> sum;
     int blocks = embedding_dims / kBlockSize;
     for (int i = 0; i < blocks; ++i) sum.push_back(mm.allocy());
+    bool half = M->type() != DT_FLOAT;
+    YMMRegister elem = half ? mm.allocy() : no_ymm_reg;
+
+    Register next = rr.alloc();
 
     // Load tensor locations.
     __ LoadTensorAddress(input, f);
     __ LoadTensorAddress(embeddings, M);
     __ LoadTensorAddress(output, v);
 
+    // Prefetch embeddings for the first features.
+    __ movq(oov, Immediate(embedding_size));
+    int distance = __ PrefetchFirstEmbeddings(step, input, next, oov,
+                                              embeddings, M, num_features);
+
     // Clear output vector.
     for (int i = 0; i < blocks; ++i) {
       __ vxorps(sum[i], sum[i], sum[i]);
     }
 
     // Loop over input features.
-    __ movq(oov, Immediate(embedding_size));
     __ xorq(col, col);
     __ LoopStart(&l1);
 
+    // Prefetch embedding for upcoming feature.
+    __ PrefetchNextEmbedding(distance, input, col, next, oov, embeddings,
+                             M, num_features);
+
     // Get next feature index.
     __ movsxlq(acc, Operand(input, col, times_4));
 
@@ -430,7 +496,13 @@ class DragnnLookupUnrolled : public Kernel {
 
     // Add embedding vector to sum.
     for (int i = 0; i < blocks; ++i) {
-      __ vaddps(sum[i], sum[i], Operand(acc, i * kBlockSize * sizeof(float)));
+      int disp = i * kBlockSize * M->element_size();
+      if (half) {
+        __ LoadHalf(elem, Operand(acc, disp), M->type());
+        __ vaddps(sum[i], sum[i], elem);
+      } else {
+        __ vaddps(sum[i], sum[i], Operand(acc, disp));
+      }
     }
 
     // Next feature.
@@ -495,6 +567,8 @@ class DragnnTyper : public Typer {
 // Flow transformations for Dragnn ops.
 class DragnnTransformer : public Transformer {
  public:
+  string Name() override { return "DragnnTransformer"; }
+
   bool Transform(Flow *flow) override {
     std::vector<Flow::Operation *> noops;
     for (Flow::Operation *op : flow->ops()) {
@@ -514,6 +588,8 @@ class DragnnTransformer : public Transformer {
 // Precompute embeddings with a linear transform.
 class PrecomputedEmbeddings : public Transformer {
  public:
+  string Name() override { return "PrecomputedEmbeddings"; }
+
   bool Transform(Flow *flow) override {
     int num_precompute = 0;
     for (auto *op : flow->Find({"Lookup", "Reshape", "MatMul"})) {
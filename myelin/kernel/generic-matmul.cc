@@ -53,8 +53,10 @@ class GenericFltVecMatMulBase : public Kernel {
     if (x->dim(0) != 1 || x->dim(1) != W->dim(0)) return false;
     if (y->dim(0) != x->dim(0) || y->dim(1) != W->dim(1)) return false;
 
-    // The matrix must support column-major order.
-    if (!W->SupportsOrder(COLUMN_MAJOR)) return false;
+    // The matrix must be in column-major or row-major order.
+    if (!W->SupportsOrder(COLUMN_MAJOR) && !W->SupportsOrder(ROW_MAJOR)) {
+      return false;
+    }
 
     // Check bias vector.
     if (bias_) {
@@ -73,7 +75,11 @@ class GenericFltVecMatMulBase : public Kernel {
   }
 
   void Adjust(Step *step) override {
-    step->input(1)->SetRequiredOrder(COLUMN_MAJOR);
+    // Column-major order is preferred, but row-major order is used for
+    // matrices that are required to be in standard order, e.g. learnable
+    // variables.
+    Tensor *W = step->input(1);
+    if (W->SupportsOrder(COLUMN_MAJOR)) W->SetRequiredOrder(COLUMN_MAJOR);
   }
 
   void Generate(Step *step, MacroAssembler *masm) override {
@@ -89,10 +95,12 @@ class GenericFltVecMatMulBase : public Kernel {
     int rows = W->dim(0);
     int cols = W->dim(1);
     int row_size = W->stride(1);
+    bool strided = W->stride(0) != sizeof(float);
 
     Register row = rr.alloc();
     Register col = rr.alloc();
     Register matrix = rr.alloc();
+    Register element = strided ? rr.alloc() : no_reg;
     Register input = rr.alloc();
     Register output = rr.alloc();
     Register vector = bias_ ? rr.alloc() : no_reg;
@@ -122,10 +130,16 @@ class GenericFltVecMatMulBase : public Kernel {
       __ xorps(sum, sum);
     }
     __ xorq(row, row);
+    if (strided) __ movq(element, matrix);
 
     __ LoopStart(&l2);
     __ movss(elem, Operand(input, row, times_4));
-    __ mulss(elem, Operand(matrix, row, times_4));
+    if (strided) {
+      __ mulss(elem, Operand(element));
+      __ addq(element, Immediate(W->stride(0)));
+    } else {
+      __ mulss(elem, Operand(matrix, row, times_4));
+    }
     __ addq(row, Immediate(1));
     __ cmpq(row, Immediate(rows));
     __ addss(sum, elem);
@@ -323,6 +337,128 @@ class GenericFltMatMatMul : public Kernel {
   }
 };
 
+// Generic float matrix multiplication added to a variable, C += A * B. The
+// variable is updated in place, e.g. for accumulating gradients for a weight
+// matrix. The variable can be a vector if the product has a single row.
+class GenericFltAssignAddMatMul : public Kernel {
+ public:
+  string Name() override { return "GenFltAssignAddMatMul"; }
+  string Operation() override { return "AssignAddMatMul"; }
+
+  bool Supports(Step *step) override {
+    // Requires CPU with SSE support.
+    if (!CPU::Enabled(SSE)) return false;
+
+    // Float variable and two float 2D tensor inputs.
+    if (step->indegree() != 3) return false;
+    if (step->outdegree() != 0) return false;
+    Tensor *C = step->input(0);
+    Tensor *A = step->input(1);
+    Tensor *B = step->input(2);
+    if (C->type() != DT_FLOAT || C->rank() > 2) return false;
+    if (A->rank() != 2 || A->type() != DT_FLOAT) return false;
+    if (B->rank() != 2 || B->type() != DT_FLOAT) return false;
+
+    // Check shape.
+    if (step->GetAttr("transpose_b", false)) return false;
+    Shape a = A->shape();
+    if (step->GetAttr("transpose_a", false)) a.transpose();
+    if (a.dim(1) != B->dim(0)) return false;
+    if (C->rank() == 2) {
+      if (C->dim(0) != a.dim(0) || C->dim(1) != B->dim(1)) return false;
+    } else {
+      if (a.dim(0) != 1 || C->elements() != B->dim(1)) return false;
+    }
+
+    // Check order.
+    if (!A->SupportsOrder(ROW_MAJOR)) return false;
+    if (!B->SupportsOrder(ROW_MAJOR)) return false;
+    if (!C->SupportsOrder(ROW_MAJOR)) return false;
+
+    return true;
+  }
+
+  void Adjust(Step *step) override {
+    for (Tensor *input : step->inputs()) input->SetRequiredOrder(ROW_MAJOR);
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    Registers &rr = masm->rr();
+    SIMDRegisters &mm = masm->mm();
+    Label l1, l2, l3;
+
+    // Get inputs.
+    Tensor *C = step->input(0);
+    Tensor *A = step->input(1);
+    Tensor *B = step->input(2);
+
+    // Get dimensions for matrices. The step sizes for A are for moving to the
+    // next row in C and the next row in B, respectively.
+    bool transpose_a = step->GetAttr("transpose_a", false);
+    int rows = A->dim(transpose_a ? 1 : 0);
+    int depth = B->dim(0);
+    int cols = B->dim(1);
+    int a_row = transpose_a ? sizeof(float) : A->stride(0);
+    int a_col = transpose_a ? A->stride(0) : sizeof(float);
+    int c_row = C->rank() == 2 ? C->stride(0) : 0;
+
+    // Allocate registers.
+    Register a = rr.alloc();
+    Register a_ptr = rr.alloc();
+    Register b = rr.alloc();
+    Register b_ptr = rr.alloc();
+    Register c = rr.alloc();
+    Register row = rr.alloc();
+    Register k = rr.alloc();
+    Register col = rr.alloc();
+    XMMRegister scale = mm.allocx();
+    XMMRegister elem = mm.allocx();
+
+    // Load tensor addresses.
+    __ LoadTensorAddress(c, C);
+    __ LoadTensorAddress(a, A);
+    __ LoadTensorAddress(b, B);
+
+    // Loop over all rows in C.
+    __ xorq(row, row);
+    __ LoopStart(&l1);
+    __ movq(a_ptr, a);
+    __ movq(b_ptr, b);
+    __ xorq(k, k);
+
+    // Add scaled rows of B to row in C, C[i,j] += sum_k A[i,k] * B[k,j].
+    __ LoopStart(&l2);
+    __ movss(scale, Operand(a_ptr));
+    __ xorq(col, col);
+    __ LoopStart(&l3);
+    __ movss(elem, Operand(b_ptr, col, times_4));
+    __ mulss(elem, scale);
+    __ addss(elem, Operand(c, col, times_4));
+    __ movss(Operand(c, col, times_4), elem);
+    __ incq(col);
+    __ cmpq(col, Immediate(cols));
+    __ j(not_equal, &l3);
+
+    // Move to next row in B.
+    __ addq(a_ptr, Immediate(a_col));
+    __ addq(b_ptr, Immediate(B->stride(0)));
+    __ incq(k);
+    __ cmpq(k, Immediate(depth));
+    __ j(not_equal, &l2);
+
+    // Move to next row in C.
+    __ addq(a, Immediate(a_row));
+    if (c_row != 0) __ addq(c, Immediate(c_row));
+    __ incq(row);
+    __ cmpq(row, Immediate(rows));
+    __ j(not_equal, &l1);
+  }
+
+  int64 Complexity(const Step *step) override {
+    return step->input(0)->elements() * step->input(2)->dim(0) * 2;
+  }
+};
+
 // Generic integer vector matrix multiplication, y = Relu(x * W + b).
 class GenericIntVecMatMulBase : public Kernel {
  public:
@@ -525,6 +661,13 @@ void RegisterGenericMatMul(Library *library) {
   // Output    : C: float32[k,m] row-major
   library->Register(new GenericFltMatMatMul());
 
+  // Computes  : C += A * B
+  // Input     : C: float32[k,m] row-major
+  //             A: float32[k,n] row-major
+  //             B: float32[n,m] row-major
+  // Supports  : transpose_a
+  library->Register(new GenericFltAssignAddMatMul());
+
   // Computes  : y = x * W
   // Input     : x: float32[1,n]
   //             W: float32[n,m] column-major
@@ -14,6 +14,7 @@
 
 #include "myelin/kernel/generic.h"
 
+#include <math.h>
 #include <string>
 
 #include "myelin/compute.h"
@@ -286,6 +287,7 @@ class GenericFltConstSub : public Kernel {
 
     // Check shapes.
     if (c->shape().elements() != 1 || !c->IsConstant()) return false;
+    if (c->learnable()) return false;
     if (x->shape().elements() != y->shape().elements()) return false;
 
     return true;
@@ -421,6 +423,95 @@ class GenericFltMulTwoAdd : public Kernel {
   }
 };
 
+// Compute the index of the maximum element. If a bitmask is given as the
+// second input, only the elements with their bit set in the mask are
+// considered. The output is -1 if no element qualifies.
+class GenericFltArgMax : public Kernel {
+ public:
+  string Name() override { return "GenFltArgMax"; }
+  string Operation() override { return "ArgMax"; }
+
+  bool Supports(Step *step) override {
+    // Requires CPU with SSE support.
+    if (!CPU::Enabled(SSE)) return false;
+
+    // Check inputs and outputs.
+    if (step->indegree() != 1 && step->indegree() != 2) return false;
+    if (step->outdegree() != 1) return false;
+    Tensor *x = step->input(0);
+    Tensor *y = step->output(0);
+
+    // Check types and shapes.
+    if (x->type() != DT_FLOAT) return false;
+    if (y->type() != DT_INT32 || y->elements() != 1) return false;
+    if (step->indegree() == 2) {
+      Tensor *mask = step->input(1);
+      if (mask->type() != DT_INT32) return false;
+      if (mask->elements() * 32 < x->elements()) return false;
+    }
+
+    return true;
+  }
+
+  void Generate(Step *step, MacroAssembler *masm) override {
+    Registers &rr = masm->rr();
+    SIMDRegisters &mm = masm->mm();
+    Label l, skip;
+
+    Tensor *x = step->input(0);
+    Tensor *mask = step->indegree() == 2 ? step->input(1) : nullptr;
+    Tensor *y = step->output(0);
+
+    Register idx = rr.alloc();
+    Register input = rr.alloc();
+    Register bits = rr.alloc();
+    Register result = rr.alloc();
+    XMMRegister elem = mm.allocx();
+    XMMRegister best = mm.allocx();
+
+    // Load tensor locations.
+    __ LoadTensorAddress(input, x);
+    if (mask != nullptr) __ LoadTensorAddress(bits, mask);
+
+    // Initialize best element and index.
+    __ movss(best, masm->GetConstant<float>(-INFINITY)->address());
+    __ movq(result, Immediate(-1));
+
+    // Loop over elements in input tensor.
+    __ xorq(idx, idx);
+    __ LoopStart(&l);
+
+    // Skip element unless it is larger than the best element so far.
+    __ movss(elem, Operand(input, idx, times_4));
+    __ ucomiss(elem, best);
+    __ j(below_equal, &skip);
+
+    // Skip element if it is not allowed by the mask.
+    if (mask != nullptr) {
+      __ bt(Operand(bits), idx);
+      __ j(not_carry, &skip);
+    }
+
+    // Update best element.
+    __ movss(best, elem);
+    __ movq(result, idx);
+    __ bind(&skip);
+
+    // Next element.
+    __ incq(idx);
+    __ cmpq(idx, Immediate(x->elements()));
+    __ j(less, &l);
+
+    // Store index of maximum element.
+    __ LoadTensorAddress(input, y);
+    __ movl(Operand(input), result);
+  }
+
+  int64 Complexity(const Step *step) override {
+    return step->input(0)->elements() * 2;
+  }
+};
+
 void RegisterGenericOperators(Library *library) {
   // Computes  : c = a + b element-wise
   // Input     : a: float32[d1,...,dn]
@@ -471,6 +562,12 @@ void RegisterGenericOperators(Library *library) {
   //             b: int8/16/32/64[d1,...,dn]
   // Output    : c: int8/16/32/64[d1,...,dn]
   library->Register(new GenericIntMul());
+
+  // Computes  : y = argmax(x) over elements with bit set in mask
+  // Input     : x: float32[d1,...,dn]
+  //             mask: int32[m] optional, m >= (d1*...*dn)/32
+  // Output    : y: int32[1]
+  library->Register(new GenericFltArgMax());
 }
 
 }  // namespace myelin
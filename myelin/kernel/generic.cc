@@ -58,6 +58,8 @@ static bool TryGetInt32Data(const Flow::Variable &variable,
 // Rename operations with aliases.
 class RenameTransformer : public Transformer {
  public:
+  string Name() override { return "RenameTransformer"; }
+
   bool Transform(Flow *flow) override {
     // Rename BiasAdd to Add.
     int renames = 0;
@@ -75,6 +77,8 @@ class RenameTransformer : public Transformer {
 // Remove identity ops.
 class IdentityTransformer : public Transformer {
  public:
+  string Name() override { return "IdentityTransformer"; }
+
   bool Transform(Flow *flow) override {
     // Eliminate no-ops.
     std::vector<Flow::Operation *> noops;
@@ -122,6 +126,8 @@ class IdentityTransformer : public Transformer {
 // Combine ops.
 class CombineTransformer : public Transformer {
  public:
+  string Name() override { return "CombineTransformer"; }
+
   bool Transform(Flow *flow) override {
     int combines = 0;
     while (Combine(flow, "MatMul", "Add", "MatMulAdd") ||
@@ -145,6 +151,8 @@ class CombineTransformer : public Transformer {
       if (var->consumers[0]->task != op->task) continue;
       if (var->out) continue;
       if (var->shape.undefined()) continue;
+      if (op->GetAttr("transpose_a", false)) continue;
+      if (op->GetAttr("transpose_b", false)) continue;
       if (op->indegree() >= 1) {
         // Only combine for vector inputs.
         Flow::Variable *input = op->inputs[0];
@@ -162,6 +170,8 @@ class CombineTransformer : public Transformer {
 // tf.concat([a, tf.concat([b, c], 1), d], 1) = tf.concat([a, b, c, d], 1)
 class FlattenConcatTransformer : public Transformer {
  public:
+  string Name() override { return "FlattenConcatTransformer"; }
+
   bool Transform(Flow *flow) override {
     bool transformed = false;
     while (TryFlattenOnce(flow)) transformed = true;
@@ -271,9 +281,15 @@ class StandardTyper : public Typer {
         if (c->type == DT_INVALID) c->type = a->type;
 
         // Matrix multiplied by matrix.
-        if (a->rank() == 2 && b->rank() == 2 && a->dim(1) == b->dim(0)) {
-          c->shape.assign(a->dim(0), b->dim(1));
-          return true;
+        if (a->rank() == 2 && b->rank() == 2) {
+          Shape sa = a->shape;
+          Shape sb = b->shape;
+          if (op->GetAttr("transpose_a", false)) sa.transpose();
+          if (op->GetAttr("transpose_b", false)) sb.transpose();
+          if (sa.dim(1) == sb.dim(0)) {
+            c->shape.assign(sa.dim(0), sb.dim(1));
+            return true;
+          }
         }
       }
     }
@@ -283,6 +299,16 @@ class StandardTyper : public Typer {
         op->type == "BiasAdd" ||
         op->type == "Mul" ||
         op->type == "Sub" ||
+        op->type == "Div" ||
+        op->type == "Maximum" ||
+        op->type == "Minimum" ||
+        op->type == "Negate" ||
+        op->type == "Abs" ||
+        op->type == "Square" ||
+        op->type == "Sqrt" ||
+        op->type == "Reciprocal" ||
+        op->type == "Exp" ||
+        op->type == "Log" ||
         op->type == "Tanh" ||
         op->type == "Sigmoid" ||
         op->type == "Relu" ||
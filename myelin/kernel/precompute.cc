@@ -14,6 +14,10 @@
 
 #include "myelin/kernel/precompute.h"
 
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "base/logging.h"
@@ -115,6 +119,8 @@ class ConstantFolding : public Transformer {
        .Output(0, DT_FLOAT);
   }
 
+  string Name() override { return "ConstantFolding"; }
+
   bool Transform(Flow *flow) override {
     // Find constant ops and replace them with constant variables.
     std::vector<Flow::Operation *> remove;
@@ -262,6 +268,8 @@ class ConstantFolding : public Transformer {
 // Remove unused variables.
 class RemoveUnusedVariables : public Transformer {
  public:
+  string Name() override { return "RemoveUnusedVariables"; }
+
   bool Transform(Flow *flow) override {
     // Find intermediate variables with no producers or consumers.
     std::vector<Flow::Variable *> remove;
@@ -280,10 +288,176 @@ class RemoveUnusedVariables : public Transformer {
   }
 };
 
+// Common subexpression elimination. Operations in the same function with the
+// same type, attributes, and inputs compute the same values, so all but the
+// first of these operations can be removed. Small constant inputs are compared
+// by value, so duplicate constants, e.g. shapes for reshaping, do not prevent
+// the elimination. Duplicates in different functions are not merged, since
+// each function is compiled into a cell with its own instance data, so the
+// output of an operation in one cell cannot be read by another cell.
+class CommonSubexpressionElimination : public Transformer {
+ public:
+  // Maximum size of constants that are compared by value.
+  static const int kMaxConstantSize = 1024;
+
+  string Name() override { return "CommonSubexpressionElimination"; }
+
+  bool Transform(Flow *flow) override {
+    // Eliminating duplicates can make their consumers duplicates, so keep
+    // eliminating until there are no more duplicates. This needs to be done
+    // before other transformations fuse the consumers.
+    int num_eliminated = 0;
+    while (int n = Eliminate(flow)) num_eliminated += n;
+    return num_eliminated > 0;
+  }
+
+ private:
+  // Eliminate duplicate operations. Returns the number of eliminated
+  // operations.
+  static int Eliminate(Flow *flow) {
+    // Find duplicate operations.
+    std::unordered_map<string, Flow::Operation *> signatures;
+    std::vector<std::pair<Flow::Operation *, Flow::Operation *>> duplicates;
+    for (Flow::Operation *op : flow->ops()) {
+      if (!Eligible(op)) continue;
+      string signature = Signature(op);
+      auto f = signatures.find(signature);
+      if (f == signatures.end()) {
+        signatures[signature] = op;
+      } else if (SameOutputs(f->second, op)) {
+        duplicates.emplace_back(f->second, op);
+      }
+    }
+
+    // Replace the outputs of the duplicates with the outputs of the originals.
+    for (auto &d : duplicates) {
+      Flow::Operation *original = d.first;
+      Flow::Operation *duplicate = d.second;
+      std::vector<Flow::Variable *> outputs = duplicate->outputs;
+      for (int i = 0; i < outputs.size(); ++i) {
+        Flow::Variable *var = original->outputs[i];
+        Flow::Variable *dup = outputs[i];
+        while (!dup->consumers.empty()) {
+          dup->consumers.front()->ReplaceInput(dup, var);
+        }
+        if (dup->out) var->out = true;
+        if (dup->ref) var->ref = true;
+        var->AddAlias(dup->name);
+        for (const string &alias : dup->aliases) var->AddAlias(alias);
+      }
+      flow->RemoveOperation(duplicate);
+      for (Flow::Variable *dup : outputs) flow->DeleteVariable(dup);
+    }
+
+    return duplicates.size();
+  }
+
+  // Check if operation can be eliminated if it is a duplicate.
+  static bool Eligible(Flow::Operation *op) {
+    // Operations without inputs or outputs can have side effects.
+    if (op->inputs.empty() || op->outputs.empty()) return false;
+
+    // Input variables and connector links must be kept.
+    for (Flow::Variable *output : op->outputs) {
+      if (output->in) return false;
+    }
+    return true;
+  }
+
+  // Compute signature for operation from the function, type, attributes, and
+  // inputs.
+  static string Signature(Flow::Operation *op) {
+    string signature = op->type;
+    signature.append("|");
+    signature.append(std::to_string(reinterpret_cast<uint64>(op->func)));
+    signature.append("|");
+    signature.append(std::to_string(op->task));
+
+    // Attributes are compared independent of their order.
+    std::vector<std::pair<string, string>> attrs;
+    for (const Attribute &attr : op->attrs) {
+      attrs.emplace_back(attr.name, attr.value);
+    }
+    std::sort(attrs.begin(), attrs.end());
+    for (auto &attr : attrs) {
+      signature.append("|");
+      signature.append(attr.first);
+      signature.append("=");
+      signature.append(attr.second);
+    }
+
+    // Small constants are compared by value and other inputs by identity.
+    for (Flow::Variable *input : op->inputs) {
+      signature.append("|");
+      if (input->constant() && input->size <= kMaxConstantSize) {
+        signature.append(input->TypeString());
+        signature.append(":");
+        signature.append(input->data, input->size);
+      } else {
+        signature.append(std::to_string(reinterpret_cast<uint64>(input)));
+      }
+    }
+    return signature;
+  }
+
+  // Check that the outputs of two operations have the same types and shapes.
+  static bool SameOutputs(Flow::Operation *op1, Flow::Operation *op2) {
+    if (op1->outdegree() != op2->outdegree()) return false;
+    for (int i = 0; i < op1->outdegree(); ++i) {
+      Flow::Variable *v1 = op1->outputs[i];
+      Flow::Variable *v2 = op2->outputs[i];
+      if (v1->type != v2->type || v1->shape != v2->shape) return false;
+    }
+    return true;
+  }
+};
+
+// Dead code elimination. Operations where none of the outputs are used are
+// removed together with their outputs. This is repeated until all chains of
+// dead operations have been removed.
+class DeadCodeElimination : public Transformer {
+ public:
+  string Name() override { return "DeadCodeElimination"; }
+
+  bool Transform(Flow *flow) override {
+    int num_eliminated = 0;
+    for (;;) {
+      // Find operations with unused outputs.
+      std::vector<Flow::Operation *> dead;
+      for (Flow::Operation *op : flow->ops()) {
+        if (Dead(op)) dead.push_back(op);
+      }
+      if (dead.empty()) break;
+
+      // Remove dead operations and their outputs.
+      for (Flow::Operation *op : dead) {
+        std::vector<Flow::Variable *> outputs = op->outputs;
+        flow->RemoveOperation(op);
+        for (Flow::Variable *var : outputs) flow->DeleteVariable(var);
+        num_eliminated++;
+      }
+    }
+    return num_eliminated > 0;
+  }
+
+ private:
+  // Check if all outputs of operation are unused.
+  static bool Dead(Flow::Operation *op) {
+    if (op->outputs.empty()) return false;
+    for (Flow::Variable *output : op->outputs) {
+      if (output->in || output->out) return false;
+      if (!output->consumers.empty()) return false;
+    }
+    return true;
+  }
+};
+
 // Register precompute library.
 void RegisterPrecomputeLibrary(Library *library) {
   library->RegisterTransformer(new ConstantFolding());
   library->RegisterTransformer(new RemoveUnusedVariables());
+  library->RegisterTransformer(new DeadCodeElimination());
+  library->RegisterTransformer(new CommonSubexpressionElimination());
 }
 
 }  // namespace myelin
@@ -0,0 +1,121 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "myelin/learning.h"
+
+#include <math.h>
+
+#include "base/logging.h"
+
+namespace sling {
+namespace myelin {
+
+void Optimizer::Build(Flow *flow) {
+  // Find learnable variables with gradient accumulators.
+  std::vector<std::pair<Variable *, Variable *>> updates;
+  for (Variable *var : flow->vars()) {
+    if (!var->learnable) continue;
+    Variable *dv = flow->Var("gradients/" + var->name);
+    if (dv != nullptr) updates.emplace_back(var, dv);
+  }
+  CHECK(!updates.empty()) << "No learnable variables with gradients in flow";
+
+  // Build update function.
+  Builder update(flow, name_);
+  Variable *alpha = update.Var(name_ + "/alpha", DT_FLOAT, {});
+  alpha->in = true;
+  for (auto &u : updates) BuildUpdate(&update, u.first, u.second, alpha);
+}
+
+void Optimizer::Initialize(const Network &network) {
+  cell_ = network.GetCell(name_);
+  alpha_ = network.GetParameter(name_ + "/alpha");
+  data_ = new Instance(cell_);
+}
+
+void Optimizer::Apply() {
+  *data_->Get<float>(alpha_) = StepSize();
+  data_->Compute();
+}
+
+void Optimizer::Update(Builder *update, const string &recipe,
+                       const std::vector<Variable *> &vars,
+                       const std::vector<Variable *> &args) {
+  // Compute the updated variables in a single expression, so the variables
+  // are updated in place.
+  string name = update->OpName("Calculate");
+  std::vector<Variable *> inputs = vars;
+  inputs.insert(inputs.end(), args.begin(), args.end());
+  std::vector<Variable *> outputs;
+  for (int i = 0; i < vars.size(); ++i) {
+    Variable *var = vars[i];
+    outputs.push_back(update->Var(name + ":" + std::to_string(i),
+                                  var->type, var->shape));
+  }
+  Flow::Operation *op = update->flow()->AddOperation(
+      update->func(), name, "Calculate", inputs, outputs);
+  op->SetAttr("expr", recipe);
+
+  // Assign the results to the variables.
+  for (int i = 0; i < vars.size(); ++i) {
+    update->RawOp("Assign", {vars[i], outputs[i]});
+  }
+}
+
+void GradientDescentOptimizer::BuildUpdate(Builder *update, Variable *var,
+                                           Variable *dv, Variable *alpha) {
+  // v = v - alpha * dv; dv = 0
+  Update(update, "@0=Sub(%0,Mul(%2,%1));@1=Id(_0)", {var, dv}, {alpha});
+}
+
+void AdamOptimizer::BuildUpdate(Builder *update, Variable *var, Variable *dv,
+                                Variable *alpha) {
+  // Add variables for the first and second moment estimates.
+  Variable *m = update->Learnable(update->func()->name + "/m/" + var->name,
+                                  var->type, var->shape);
+  Variable *v = update->Learnable(update->func()->name + "/v/" + var->name,
+                                  var->type, var->shape);
+
+  // m = beta1 * m + (1 - beta1) * dv
+  // v = beta2 * v + (1 - beta2) * dv^2
+  // var = var - alpha * m / (sqrt(v) + epsilon)
+  // dv = 0
+  std::vector<Variable *> args = {
+    alpha,
+    update->Constant(beta1_),
+    update->Constant(1.0f - beta1_),
+    update->Constant(beta2_),
+    update->Constant(1.0f - beta2_),
+    update->Constant(epsilon_),
+  };
+  Update(update,
+         "$0=Add(Mul(%2,%5),Mul(%1,%6));"
+         "$1=Add(Mul(%3,%7),Mul(Square(%1),%8));"
+         "@0=Sub(%0,Mul(%4,Div($0,Add(Sqrt($1),%9))));"
+         "@2=Id($0);"
+         "@3=Id($1);"
+         "@1=Id(_0)",
+         {var, dv, m, v}, args);
+}
+
+float AdamOptimizer::StepSize() {
+  // The bias correction for the moment estimates is folded into the step size.
+  steps_++;
+  double correction1 = 1.0 - pow(beta1_, steps_);
+  double correction2 = 1.0 - pow(beta2_, steps_);
+  return learning_rate_ * sqrt(correction2) / correction1;
+}
+
+}  // namespace myelin
+}  // namespace sling
@@ -0,0 +1,140 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MYELIN_LEARNING_H_
+#define MYELIN_LEARNING_H_
+
+#include <string>
+#include <vector>
+
+#include "base/types.h"
+#include "myelin/builder.h"
+#include "myelin/compute.h"
+#include "myelin/flow.h"
+
+namespace sling {
+namespace myelin {
+
+// An optimizer updates the learnable variables in a flow from the gradients
+// accumulated by the gradient functions (see gradient.h). The optimizer adds
+// an update function to the flow, which applies the accumulated gradients to
+// the learnable variables and clears the gradient accumulators, e.g.:
+//
+//   Gradient(&flow, func, library);
+//   GradientDescentOptimizer optimizer(0.01);
+//   optimizer.Build(&flow);
+//   flow.Analyze(library);
+//   network.Compile(flow, library);
+//   optimizer.Initialize(network);
+//   for (each batch) {
+//     for (each example) { compute forward and gradient cells }
+//     optimizer.Apply();
+//   }
+class Optimizer {
+ public:
+  typedef Flow::Variable Variable;
+
+  Optimizer(const string &name = "optimizer") : name_(name) {}
+  virtual ~Optimizer() { delete data_; }
+
+  // Build update function for the learnable variables in the flow which have
+  // gradient accumulators.
+  void Build(Flow *flow);
+
+  // Initialize optimizer after the network has been compiled.
+  void Initialize(const Network &network);
+
+  // Apply the accumulated gradients to the learnable variables and clear the
+  // gradient accumulators.
+  void Apply();
+
+ protected:
+  // Build update for learnable variable from its gradient accumulator. The
+  // update is scaled by the step size alpha, which is an input to the update
+  // function.
+  virtual void BuildUpdate(Builder *update, Variable *var, Variable *dv,
+                           Variable *alpha) = 0;
+
+  // Return step size for the next update.
+  virtual float StepSize() = 0;
+
+  // Add element-wise update of variables computed by the expression recipe.
+  // The variables are the first inputs to the expression followed by the
+  // arguments, and output i of the expression is assigned to variable i.
+  static void Update(Builder *update, const string &recipe,
+                     const std::vector<Variable *> &vars,
+                     const std::vector<Variable *> &args);
+
+ private:
+  // Name of update function.
+  string name_;
+
+  // Update cell and step size.
+  Cell *cell_ = nullptr;
+  Tensor *alpha_ = nullptr;
+
+  // Instance for computing updates.
+  Instance *data_ = nullptr;
+};
+
+// Stochastic gradient descent optimizer, v = v - alpha * dv.
+class GradientDescentOptimizer : public Optimizer {
+ public:
+  explicit GradientDescentOptimizer(float learning_rate)
+      : learning_rate_(learning_rate) {}
+
+  // Learning rate for the next updates.
+  float learning_rate() const { return learning_rate_; }
+  void set_learning_rate(float learning_rate) {
+    learning_rate_ = learning_rate;
+  }
+
+ protected:
+  void BuildUpdate(Builder *update, Variable *var, Variable *dv,
+                   Variable *alpha) override;
+  float StepSize() override { return learning_rate_; }
+
+ private:
+  float learning_rate_;
+};
+
+// Adam optimizer with moment estimates for each learnable variable. The bias
+// correction of the moments is folded into the step size.
+class AdamOptimizer : public Optimizer {
+ public:
+  AdamOptimizer(float learning_rate = 0.001,
+                float beta1 = 0.9, float beta2 = 0.999,
+                float epsilon = 1e-8)
+      : learning_rate_(learning_rate),
+        beta1_(beta1), beta2_(beta2), epsilon_(epsilon) {}
+
+ protected:
+  void BuildUpdate(Builder *update, Variable *var, Variable *dv,
+                   Variable *alpha) override;
+  float StepSize() override;
+
+ private:
+  float learning_rate_;
+  float beta1_;
+  float beta2_;
+  float epsilon_;
+
+  // Number of updates.
+  int steps_ = 0;
+};
+
+}  // namespace myelin
+}  // namespace sling
+
+#endif  // MYELIN_LEARNING_H_
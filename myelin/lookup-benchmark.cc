@@ -0,0 +1,127 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark for embedding lookups. This measures the number of embedding
+// lookups per second for increasing vocabulary sizes, with and without
+// prefetching of the embedding rows.
+//
+// Sample usage:
+//   bazel-bin/myelin/lookup-benchmark --op=Lookup --dims=64 --features=32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "base/clock.h"
+#include "base/flags.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "myelin/compute.h"
+#include "myelin/flow.h"
+#include "myelin/kernel/dragnn.h"
+#include "myelin/kernel/tensorflow.h"
+
+DEFINE_string(op, "Lookup", "Lookup operation (Lookup or Gather)");
+DEFINE_int32(dims, 64, "Embedding dimension");
+DEFINE_int32(features, 32, "Number of features per lookup");
+DEFINE_int32(min_vocabulary, 1 << 10, "Minimum vocabulary size");
+DEFINE_int32(max_vocabulary, 1 << 20, "Maximum vocabulary size");
+DEFINE_int32(prefetch_distance, 4, "Prefetch distance for lookups");
+DEFINE_int32(iterations, 100000, "Number of lookup operations per run");
+
+using namespace sling;
+using namespace sling::myelin;
+
+// Measure lookups per second for vocabulary size and prefetch distance.
+double Benchmark(const Library &library, const std::vector<float> &data,
+                 int vocabulary, int distance) {
+  // Build flow with a single lookup operation.
+  int dims = FLAGS_dims;
+  int features = FLAGS_features;
+  Flow flow;
+  Flow::Function *func = flow.AddFunction("lookup");
+  Flow::Variable *embeddings =
+      flow.AddVariable("lookup/embeddings", DT_FLOAT, {vocabulary, dims});
+  embeddings->SetData(data.data(), vocabulary * dims * sizeof(float));
+  Flow::Variable *output;
+  Flow::Variable *input;
+  if (FLAGS_op == "Gather") {
+    input = flow.AddVariable("lookup/features", DT_INT32, {features});
+    output = flow.AddVariable("lookup/output", DT_FLOAT, {features, dims});
+    flow.AddOperation(func, "lookup/gather", "Gather",
+                      {embeddings, input}, {output});
+  } else {
+    input = flow.AddVariable("lookup/features", DT_INT32, {1, features});
+    output = flow.AddVariable("lookup/output", DT_FLOAT, {1, dims});
+    flow.AddOperation(func, "lookup/lookup", "Lookup",
+                      {input, embeddings}, {output});
+  }
+  flow.Analyze(library);
+
+  // Compile lookup.
+  Network network;
+  network.set_prefetch_distance(distance);
+  CHECK(network.Compile(flow, library));
+  Cell *cell = network.GetCell("lookup");
+  Tensor *feature_tensor = network.GetParameter("lookup/features");
+
+  // Generate random feature ids.
+  const int kBatches = 1024;
+  std::vector<int> ids(kBatches * features);
+  for (int &id : ids) id = rand() % vocabulary;
+
+  // Run lookups.
+  Instance instance(cell);
+  int *f = instance.Get<int>(feature_tensor);
+  Clock clock;
+  clock.start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    const int *batch = ids.data() + (i % kBatches) * features;
+    for (int j = 0; j < features; ++j) f[j] = batch[j];
+    instance.Compute();
+  }
+  clock.stop();
+
+  return static_cast<double>(FLAGS_iterations) * features / clock.secs();
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  Library library;
+  RegisterTensorflowLibrary(&library);
+  RegisterDragnnLibrary(&library);
+
+  // Initialize embeddings for largest vocabulary.
+  std::vector<float> data(static_cast<size_t>(FLAGS_max_vocabulary) *
+                          FLAGS_dims);
+  for (float &value : data) value = rand() / static_cast<float>(RAND_MAX);
+
+  printf("%s: %d features, %d dims\n",
+         FLAGS_op.c_str(), FLAGS_features, FLAGS_dims);
+  printf("%12s %16s %16s %8s\n",
+         "vocabulary", "lookups/s", "prefetch", "speedup");
+  for (int vocabulary = FLAGS_min_vocabulary;
+       vocabulary <= FLAGS_max_vocabulary;
+       vocabulary *= 4) {
+    double base = Benchmark(library, data, vocabulary, 0);
+    double prefetch =
+        Benchmark(library, data, vocabulary, FLAGS_prefetch_distance);
+    printf("%12d %16.0f %16.0f %7.2fx\n",
+           vocabulary, base, prefetch, prefetch / base);
+  }
+
+  return 0;
+}
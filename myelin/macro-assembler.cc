@@ -15,6 +15,7 @@
 #include "myelin/macro-assembler.h"
 
 #include <stddef.h>
+#include <algorithm>
 
 #include "base/logging.h"
 #include "base/macros.h"
@@ -404,6 +405,108 @@ void MacroAssembler::StoreInteger(jit::Register base, jit::Register index,
   }
 }
 
+bool MacroAssembler::SupportsHalf(Type type, bool vector) {
+  switch (type) {
+    case DT_BFLOAT16:
+      return !vector || CPU::Enabled(AVX2);
+    case DT_HALF:
+      return CPU::Enabled(AVX) && CPU::Enabled(F16C);
+    default:
+      return false;
+  }
+}
+
+void MacroAssembler::LoadHalf(jit::XMMRegister dst, const jit::Operand &src,
+                              jit::Register tmp, Type type) {
+  movzxwl(tmp, src);
+  switch (type) {
+    case DT_BFLOAT16:
+      // A bfloat16 is the upper half of a float32.
+      shll(tmp, Immediate(16));
+      movd(dst, tmp);
+      break;
+
+    case DT_HALF:
+      vmovd(dst, tmp);
+      vcvtph2ps(dst, dst);
+      break;
+
+    default:
+      LOG(FATAL) << "Invalid half-precision type: " << type;
+  }
+}
+
+void MacroAssembler::LoadHalf(jit::YMMRegister dst, const jit::Operand &src,
+                              Type type) {
+  switch (type) {
+    case DT_BFLOAT16:
+      vpmovzxwd(dst, src);
+      vpslld(dst, dst, 16);
+      break;
+
+    case DT_HALF:
+      vcvtph2ps(dst, src);
+      break;
+
+    default:
+      LOG(FATAL) << "Invalid half-precision type: " << type;
+  }
+}
+
+void MacroAssembler::Prefetch(jit::Register addr, int size) {
+  int line = CPU::CacheLineSize();
+  if (line <= 0) line = 64;
+  for (int offset = 0; offset < size; offset += line) {
+    prefetcht0(Operand(addr, offset));
+  }
+
+  // An unaligned block can straddle one more cache line.
+  if (size % line != 0) prefetcht0(Operand(addr, size - 1));
+}
+
+// Prefetch embedding row for the feature index in the addr register.
+static void PrefetchEmbedding(MacroAssembler *masm, jit::Register addr,
+                              jit::Register oov, jit::Register embeddings,
+                              Tensor *M) {
+  if (oov.is_valid()) {
+    masm->testq(addr, addr);
+    masm->cmovq(negative, addr, oov);
+  }
+  masm->Multiply(addr, M->stride(0));
+  masm->addq(addr, embeddings);
+  masm->Prefetch(addr, M->dim(1) * M->element_size());
+}
+
+int MacroAssembler::PrefetchFirstEmbeddings(const Step *step,
+                                            jit::Register input,
+                                            jit::Register addr,
+                                            jit::Register oov,
+                                            jit::Register embeddings,
+                                            Tensor *M, int num_features) {
+  int distance = step->cell()->network()->prefetch_distance(M);
+  distance = std::min(distance, num_features);
+  for (int i = 0; i < distance; ++i) {
+    movsxlq(addr, Operand(input, i * sizeof(int32)));
+    PrefetchEmbedding(this, addr, oov, embeddings, M);
+  }
+  return distance;
+}
+
+void MacroAssembler::PrefetchNextEmbedding(int distance, jit::Register input,
+                                           jit::Register col,
+                                           jit::Register addr,
+                                           jit::Register oov,
+                                           jit::Register embeddings,
+                                           Tensor *M, int num_features) {
+  if (distance == 0 || distance >= num_features) return;
+  Label skip;
+  cmpq(col, Immediate(num_features - distance));
+  j(greater_equal, &skip);
+  movsxlq(addr, Operand(input, col, times_4, distance * sizeof(int32)));
+  PrefetchEmbedding(this, addr, oov, embeddings, M);
+  bind(&skip);
+}
+
 void MacroAssembler::Multiply(jit::Register reg, int64 scalar) {
   if (scalar == 0) {
     xorq(reg, reg);
@@ -492,6 +595,29 @@ void MacroAssembler::TimeStep(int offset) {
   // Add elapsed time to timing block.
   addq(Operand(datareg, offset), rdx);
 
+  // Record event in ring buffer. The first 32 bytes of the ring holds the
+  // event counter and the events are stored after it.
+  if (event_ring_ != -1) {
+    // Get next event slot (rdx) and update event counter.
+    movq(rdx, Operand(datareg, event_ring_));
+    incq(Operand(datareg, event_ring_));
+    andq(rdx, Immediate(event_capacity_ - 1));
+    shlq(rdx, Immediate(5));
+    leaq(rdx, Operand(datareg, rdx, times_1, event_ring_ + 32));
+
+    // Store timing slot and start and end timestamps in event.
+    int slot = (offset - event_timing_) / sizeof(int64);
+    movq(Operand(rdx, 0), Immediate(slot));
+    movq(Operand(rdx, 16), tsreg);
+    movq(Operand(rdx, 24), rax);
+    movq(tsreg, rax);
+
+    // Store invocation number in event.
+    movq(rax, Operand(datareg, event_timing_));
+    movq(Operand(rdx, 8), rax);
+    return;
+  }
+
   // Store new timestamp.
   movq(tsreg, rax);
 }
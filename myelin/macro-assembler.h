@@ -267,6 +267,39 @@ class MacroAssembler : public jit::Assembler {
   void StoreInteger(jit::Register base, jit::Register index, jit::Register src,
                     Type type);
 
+  // Check if the CPU supports loading 16-bit floats (DT_BFLOAT16 or DT_HALF)
+  // into single precision registers. Vector loads convert eight elements at a
+  // time.
+  static bool SupportsHalf(Type type, bool vector);
+
+  // Load 16-bit float from memory and convert it to single precision. The
+  // temporary register is clobbered.
+  void LoadHalf(jit::XMMRegister dst, const jit::Operand &src,
+                jit::Register tmp, Type type);
+
+  // Load eight 16-bit floats from memory and convert them to single precision.
+  void LoadHalf(jit::YMMRegister dst, const jit::Operand &src, Type type);
+
+  // Prefetch memory block into the cache with one prefetch per cache line.
+  void Prefetch(jit::Register addr, int size);
+
+  // Prefetch embedding rows for the first features of an embedding lookup and
+  // return the prefetch distance for the feature loop. The features are 32-bit
+  // row indices at the input address. If the oov register is valid, negative
+  // indices are mapped to the OOV row. The addr register is clobbered.
+  int PrefetchFirstEmbeddings(const Step *step, jit::Register input,
+                              jit::Register addr, jit::Register oov,
+                              jit::Register embeddings, Tensor *M,
+                              int num_features);
+
+  // Prefetch embedding row for the feature a distance ahead of the current
+  // feature in the feature loop. The col register holds the current feature
+  // number. The addr register is clobbered.
+  void PrefetchNextEmbedding(int distance, jit::Register input,
+                             jit::Register col, jit::Register addr,
+                             jit::Register oov, jit::Register embeddings,
+                             Tensor *M, int num_features);
+
   // Multiply register with constant.
   void Multiply(jit::Register reg, int64 scalar);
 
@@ -279,7 +312,9 @@ class MacroAssembler : public jit::Assembler {
   // Increment invocation counter.
   void IncrementInvocations(int offset);
 
-  // Generate timing for step and update instance block.
+  // Generate timing for step and update instance block. If an event ring is
+  // set, the start and end timestamps for the step are also recorded as an
+  // event in the ring buffer.
   void TimeStep(int offset);
 
   // Start task.
@@ -304,6 +339,17 @@ class MacroAssembler : public jit::Assembler {
   bool timing() const { return timing_; }
   void set_timing(bool timing) { timing_ = timing; }
 
+  // Set event ring buffer for recording timing events. The ring buffer is
+  // located at offset in the instance block and has room for capacity events,
+  // which must be a power of two. The timing block with the invocation counter
+  // is at timing. Each event has four int64 fields: timing slot, invocation,
+  // start timestamp, and end timestamp. The ring is disabled if offset is -1.
+  void SetEventRing(int offset, int capacity, int timing) {
+    event_ring_ = offset;
+    event_capacity_ = capacity;
+    event_timing_ = timing;
+  }
+
   // Runtime support functions.
   Runtime *runtime() const { return runtime_; }
   void set_runtime(Runtime *runtime) { runtime_ = runtime; }
@@ -319,6 +365,11 @@ class MacroAssembler : public jit::Assembler {
   // Timing measurements using timestamp counter.
   bool timing_ = false;
 
+  // Event ring buffer for recording timing events.
+  int event_ring_ = -1;
+  int event_capacity_ = 0;
+  int event_timing_ = 0;
+
   // Runtime support functions.
   Runtime *runtime_ = nullptr;
 };
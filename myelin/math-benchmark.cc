@@ -0,0 +1,154 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Accuracy and throughput of the transcendental functions for each math
+// precision. The generated code for each function is compared to the double
+// precision C library functions over an input range, and the maximum error is
+// reported in units in the last place (ulp) of the single precision result.
+//
+// Sample usage:
+//   bazel-bin/myelin/math-benchmark --size=4096 --samples=1048576
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "base/clock.h"
+#include "base/flags.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "myelin/compute.h"
+#include "myelin/flow.h"
+#include "myelin/kernel/tensorflow.h"
+#include "string/printf.h"
+
+DEFINE_int32(size, 4096, "Number of elements in input vector");
+DEFINE_int32(samples, 1 << 20, "Number of input values for accuracy test");
+DEFINE_int32(iterations, 10000, "Number of computations for throughput test");
+
+using namespace sling;
+using namespace sling::myelin;
+
+// Reference implementations.
+static double Sigmoid(double x) { return 1.0 / (1.0 + exp(-x)); }
+
+// Function with input range for benchmark.
+struct Function {
+  const char *op;              // operation name
+  double (*reference)(double);  // reference implementation
+  double low;                  // start of input range
+  double high;                 // end of input range
+  bool logscale;               // inputs are spaced logarithmically
+};
+
+static const Function functions[] = {
+  {"Exp", exp, -87.0, 88.0, false},
+  {"Log", log, 1e-30, 1e30, true},
+  {"Sigmoid", Sigmoid, -20.0, 20.0, false},
+  {"Tanh", tanh, -10.0, 10.0, false},
+  {"Tanh", tanh, 1e-6, 1.0, true},
+};
+
+// Return the size of one ulp of the single precision value nearest to x.
+static double Ulp(double x) {
+  float f = fabsf(static_cast<float>(x));
+  return nextafterf(f, INFINITY) - f;
+}
+
+// Benchmark function for precision and print the results.
+static void Benchmark(const Library &library, const Function &f,
+                      MathPrecision precision, const char *mode) {
+  // Build flow with a single operation.
+  int n = FLAGS_size;
+  Flow flow;
+  Flow::Function *func = flow.AddFunction("math");
+  Flow::Variable *x = flow.AddVariable("math/x", DT_FLOAT, {n});
+  Flow::Variable *y = flow.AddVariable("math/y", DT_FLOAT, {n});
+  flow.AddOperation(func, "math/op", f.op, {x}, {y});
+  flow.Analyze(library);
+
+  // Compile function with precision.
+  Network network;
+  network.set_precision(precision);
+  CHECK(network.Compile(flow, library));
+  Cell *cell = network.GetCell("math");
+  Instance instance(cell);
+  float *input = instance.Get<float>(network.GetParameter("math/x"));
+  float *output = instance.Get<float>(network.GetParameter("math/y"));
+
+  // Compute maximum error over the input range. The output can share memory
+  // with the input, so the inputs are kept in a separate buffer.
+  std::vector<float> values(n);
+  double max_ulp = 0.0;
+  double max_rel = 0.0;
+  float worst = 0.0;
+  for (int start = 0; start < FLAGS_samples; start += n) {
+    for (int i = 0; i < n; ++i) {
+      double t = static_cast<double>(start + i) / FLAGS_samples;
+      if (f.logscale) {
+        values[i] = exp(log(f.low) + t * (log(f.high) - log(f.low)));
+      } else {
+        values[i] = f.low + t * (f.high - f.low);
+      }
+      input[i] = values[i];
+    }
+    instance.Compute();
+    for (int i = 0; i < n; ++i) {
+      double expected = f.reference(values[i]);
+      double error = fabs(output[i] - expected);
+      if (error / Ulp(expected) > max_ulp) {
+        max_ulp = error / Ulp(expected);
+        worst = values[i];
+      }
+      if (expected != 0.0 && error / fabs(expected) > max_rel) {
+        max_rel = error / fabs(expected);
+      }
+    }
+  }
+
+  // Measure throughput.
+  Clock clock;
+  clock.start();
+  for (int i = 0; i < FLAGS_iterations; ++i) instance.Compute();
+  clock.stop();
+  double ns = clock.ns() / (static_cast<double>(FLAGS_iterations) * n);
+
+  string range = StringPrintf("[%g,%g]", f.low, f.high);
+  string kernel = cell->steps()[0]->kernel()->Name();
+  if (!cell->steps()[0]->variant().empty()) {
+    kernel += "/" + cell->steps()[0]->variant();
+  }
+  printf("%-8s %-16s %-8s %-22s %12.1f %10.2e %12g %8.3f\n",
+         f.op, range.c_str(), mode, kernel.c_str(),
+         max_ulp, max_rel, worst, ns);
+}
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+
+  Library library;
+  RegisterTensorflowLibrary(&library);
+
+  printf("%-8s %-16s %-8s %-22s %12s %10s %12s %8s\n",
+         "function", "range", "mode", "kernel",
+         "max ulp", "max rel", "at", "ns/elem");
+  for (const Function &f : functions) {
+    Benchmark(library, f, MATH_STRICT, "strict");
+    Benchmark(library, f, MATH_DEFAULT, "default");
+    Benchmark(library, f, MATH_FAST, "fast");
+  }
+
+  return 0;
+}
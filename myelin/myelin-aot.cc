@@ -0,0 +1,67 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Ahead-of-time compiler for Myelin flows. This compiles the cells in a flow
+// file and writes the generated code to an ELF object file with a C++ header
+// for calling the cells. See myelin/aot.bzl for the Bazel rule.
+//
+// Sample usage:
+//   bazel-bin/myelin/myelin-aot --flow=parser.flow --name=parser
+//     --object=parser.o --header=parser.h
+
+#include <string>
+
+#include "base/flags.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "myelin/aot.h"
+#include "myelin/compute.h"
+#include "myelin/kernel/dragnn.h"
+#include "myelin/kernel/tensorflow.h"
+
+DEFINE_string(flow, "", "Flow file to compile");
+DEFINE_string(name, "", "C++ namespace and symbol prefix for cells");
+DEFINE_string(object, "", "Output ELF object file");
+DEFINE_string(header, "", "Output C++ header file");
+DEFINE_bool(memory_planning, true, "Plan instance memory layout");
+
+using namespace sling;
+using namespace sling::myelin;
+
+int main(int argc, char *argv[]) {
+  InitProgram(&argc, &argv);
+  CHECK(!FLAGS_flow.empty()) << "No flow file";
+  CHECK(!FLAGS_name.empty()) << "No name";
+
+  // Set up kernel library.
+  Library library;
+  RegisterTensorflowLibrary(&library);
+  RegisterDragnnLibrary(&library);
+
+  // Compile flow.
+  Network network;
+  if (FLAGS_memory_planning) {
+    network.set_dynamic_allocation(true);
+    network.set_memory_planning(true);
+  }
+  CHECK(network.Compile(FLAGS_flow, library));
+
+  // Write object file and header.
+  AotWriter writer(FLAGS_name);
+  CHECK(writer.AddNetwork(network));
+  if (!FLAGS_object.empty()) CHECK(writer.WriteObjectFile(FLAGS_object));
+  if (!FLAGS_header.empty()) CHECK(writer.WriteHeader(FLAGS_header));
+
+  return 0;
+}
@@ -0,0 +1,198 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "myelin/perf-symbols.h"
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+
+#include "base/logging.h"
+
+namespace sling {
+namespace myelin {
+
+// Constants for the jitdump format. See the jitdump specification in the
+// Linux kernel source tree (tools/perf/Documentation/jitdump-specification.txt)
+// for details.
+static const uint32 kJitDumpMagic = 0x4A695444;
+static const uint32 kJitDumpVersion = 1;
+static const uint32 kJitCodeLoad = 0;
+static const uint32 kElfMachX86_64 = 62;
+
+// Header at the beginning of the jitdump file.
+struct JitHeader {
+  uint32 magic;       // magic number identifying jitdump file
+  uint32 version;     // jitdump file format version
+  uint32 total_size;  // size of file header
+  uint32 elf_mach;    // ELF machine architecture
+  uint32 pad1;        // padding
+  uint32 pid;         // process id of JIT runtime
+  uint64 timestamp;   // time of file creation
+  uint64 flags;       // flags
+};
+
+// Record for loading code. The record is followed by the null-terminated
+// symbol name and the code bytes.
+struct JitCodeLoad {
+  uint32 id;          // record type
+  uint32 total_size;  // size of record including name and code
+  uint64 timestamp;   // time of record creation
+  uint32 pid;         // process id of JIT runtime
+  uint32 tid;         // thread id of JIT runtime
+  uint64 vma;         // virtual address of code
+  uint64 code_addr;   // address of code
+  uint64 code_size;   // size of code in bytes
+  uint64 code_index;  // unique index for code load
+};
+
+// Lock for serializing symbol output from networks compiled in parallel.
+static std::mutex mu;
+
+// Jitdump file. This is opened on first use and kept open for the lifetime of
+// the process.
+static FILE *jitdump = nullptr;
+
+// Next code index for jitdump records.
+static uint64 next_code_index = 0;
+
+// Return timestamp for jitdump records. This must use the same clock as perf,
+// i.e. 'perf record -k mono'.
+static uint64 Timestamp() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Open jitdump file and write file header.
+static bool OpenJitDump() {
+  if (jitdump != nullptr) return true;
+  string filename = "/tmp/jit-" + std::to_string(getpid()) + ".dump";
+  jitdump = fopen(filename.c_str(), "w+");
+  if (jitdump == nullptr) {
+    LOG(ERROR) << "Cannot create jitdump file " << filename;
+    return false;
+  }
+
+  // Write file header.
+  JitHeader header;
+  header.magic = kJitDumpMagic;
+  header.version = kJitDumpVersion;
+  header.total_size = sizeof(JitHeader);
+  header.elf_mach = kElfMachX86_64;
+  header.pad1 = 0;
+  header.pid = getpid();
+  header.timestamp = Timestamp();
+  header.flags = 0;
+  fwrite(&header, sizeof(JitHeader), 1, jitdump);
+  fflush(jitdump);
+
+  // The perf tool finds the jitdump file through an executable mapping of the
+  // file, so the file is mapped and the mapping is never released.
+  void *marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE, fileno(jitdump), 0);
+  if (marker == MAP_FAILED) {
+    LOG(ERROR) << "Cannot map jitdump file " << filename;
+    fclose(jitdump);
+    jitdump = nullptr;
+    return false;
+  }
+
+  return true;
+}
+
+void PerfSymbols::GetSymbols(const Cell *cell, std::vector<Symbol> *symbols) {
+  // Get symbols for the code generated by each step.
+  std::vector<Symbol> steps;
+  for (const Step *step : cell->steps()) {
+    if (step->code_offset() == -1 || step->code_size() == 0) continue;
+    string name = step->name() + ":" + step->kernel()->Name();
+    steps.push_back({name, step->code_offset(), step->code_size()});
+  }
+  std::sort(steps.begin(), steps.end(), [](const Symbol &a, const Symbol &b) {
+    return a.offset < b.offset;
+  });
+
+  // Cover the code between the steps with symbols for the cell.
+  int pos = 0;
+  for (const Symbol &step : steps) {
+    if (step.offset > pos) {
+      symbols->push_back({cell->name(), pos, step.offset - pos});
+    }
+    symbols->push_back(step);
+    pos = step.offset + step.size;
+  }
+  int end = cell->code().size();
+  if (pos < end) symbols->push_back({cell->name(), pos, end - pos});
+}
+
+void PerfSymbols::WritePerfMap(const Cell *cell) {
+  std::vector<Symbol> symbols;
+  GetSymbols(cell, &symbols);
+  WritePerfMap(cell->code().begin(), symbols);
+}
+
+void PerfSymbols::WriteJitDump(const Cell *cell) {
+  std::vector<Symbol> symbols;
+  GetSymbols(cell, &symbols);
+  WriteJitDump(cell->code().begin(), symbols);
+}
+
+void PerfSymbols::WritePerfMap(const jit::byte *code,
+                               const std::vector<Symbol> &symbols) {
+  std::lock_guard<std::mutex> lock(mu);
+  string filename = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+  FILE *f = fopen(filename.c_str(), "a");
+  if (f == nullptr) {
+    LOG(ERROR) << "Cannot write perf map " << filename;
+    return;
+  }
+  for (const Symbol &symbol : symbols) {
+    fprintf(f, "%lx %x %s\n",
+            reinterpret_cast<unsigned long>(code + symbol.offset),
+            symbol.size, symbol.name.c_str());
+  }
+  fclose(f);
+}
+
+void PerfSymbols::WriteJitDump(const jit::byte *code,
+                               const std::vector<Symbol> &symbols) {
+  std::lock_guard<std::mutex> lock(mu);
+  if (!OpenJitDump()) return;
+  for (const Symbol &symbol : symbols) {
+    const jit::byte *addr = code + symbol.offset;
+    JitCodeLoad record;
+    record.id = kJitCodeLoad;
+    record.total_size = sizeof(JitCodeLoad) + symbol.name.size() + 1 +
+                        symbol.size;
+    record.timestamp = Timestamp();
+    record.pid = getpid();
+    record.tid = syscall(SYS_gettid);
+    record.vma = reinterpret_cast<uint64>(addr);
+    record.code_addr = reinterpret_cast<uint64>(addr);
+    record.code_size = symbol.size;
+    record.code_index = next_code_index++;
+    fwrite(&record, sizeof(JitCodeLoad), 1, jitdump);
+    fwrite(symbol.name.c_str(), symbol.name.size() + 1, 1, jitdump);
+    fwrite(addr, symbol.size, 1, jitdump);
+  }
+  fflush(jitdump);
+}
+
+}  // namespace myelin
+}  // namespace sling
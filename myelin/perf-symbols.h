@@ -0,0 +1,71 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MYELIN_PERF_SYMBOLS_H_
+#define MYELIN_PERF_SYMBOLS_H_
+
+#include <string>
+#include <vector>
+
+#include "base/types.h"
+#include "myelin/compute.h"
+
+namespace sling {
+namespace myelin {
+
+// Symbol output for the Linux perf tool, so samples in generated code are
+// attributed to cells and kernels instead of showing up as unknown addresses.
+// Each step gets a symbol named <step>:<kernel> covering the code generated by
+// the kernel, and the remaining code in the cell (prologue, epilogue, task
+// management, and data blocks) is covered by symbols named after the cell.
+//
+// Two formats are supported:
+//  - perf map: text file /tmp/perf-<pid>.map with one line per symbol. This
+//    is picked up directly by 'perf report'.
+//  - jitdump: binary file /tmp/jit-<pid>.dump with code load records that
+//    also contain the generated code, so 'perf inject --jit' can build
+//    shared objects for annotating the generated code. The process must be
+//    recorded with 'perf record -k mono' for the timestamps to match.
+class PerfSymbols {
+ public:
+  // Symbol for a code range in cell.
+  struct Symbol {
+    string name;  // symbol name
+    int offset;   // offset of code in cell code block
+    int size;     // size of code in bytes
+  };
+
+  // Get non-overlapping symbols covering the code for cell in address order.
+  static void GetSymbols(const Cell *cell, std::vector<Symbol> *symbols);
+
+  // Append symbols for cell to perf map file.
+  static void WritePerfMap(const Cell *cell);
+
+  // Append code load records for cell to jitdump file.
+  static void WriteJitDump(const Cell *cell);
+
+  // Append symbols for code block to perf map file. The symbol offsets are
+  // relative to the start of the code block.
+  static void WritePerfMap(const jit::byte *code,
+                           const std::vector<Symbol> &symbols);
+
+  // Append code load records for symbols in code block to jitdump file.
+  static void WriteJitDump(const jit::byte *code,
+                           const std::vector<Symbol> &symbols);
+};
+
+}  // namespace myelin
+}  // namespace sling
+
+#endif  // MYELIN_PERF_SYMBOLS_H_
@@ -223,6 +223,111 @@ string Profile::ASCIIReport() const {
   return report;
 }
 
+void Profile::GetEvents(std::vector<Event> *events,
+                        std::vector<int> *threads) const {
+  Tensor *tensor = cell()->events();
+  if (tensor == nullptr) return;
+
+  // Each ring buffer starts with the event counter followed by the events.
+  int rings = tensor->dim(0);
+  int capacity = tensor->dim(1) / 4 - 1;
+  std::vector<std::pair<Event, int>> recorded;
+  for (int r = 0; r < rings; ++r) {
+    int64 *ring = instance_->Get<int64>(tensor, r);
+    int64 counter = ring[0];
+    Event *buffer = reinterpret_cast<Event *>(ring + 4);
+    int64 first = counter > capacity ? counter - capacity : 0;
+    for (int64 i = first; i < counter; ++i) {
+      recorded.emplace_back(buffer[i & (capacity - 1)], r);
+    }
+  }
+
+  // Sort events by start time.
+  std::sort(recorded.begin(), recorded.end(),
+            [](const std::pair<Event, int> &a, const std::pair<Event, int> &b) {
+              return a.first.start < b.first.start;
+            });
+  for (auto &e : recorded) {
+    events->push_back(e.first);
+    threads->push_back(e.second);
+  }
+}
+
+static string JSONEscape(const string &str) {
+  string escaped;
+  for (char ch : str) {
+    switch (ch) {
+      case '"': escaped.append("\\\""); break;
+      case '\\': escaped.append("\\\\"); break;
+      case '\n': escaped.append("\\n"); break;
+      default:
+        if (static_cast<unsigned char>(ch) < 0x20) {
+          StringAppendF(&escaped, "\\u%04x", ch);
+        } else {
+          escaped.push_back(ch);
+        }
+    }
+  }
+  return escaped;
+}
+
+string Profile::ChromeTrace() const {
+  std::vector<Event> events;
+  std::vector<int> threads;
+  GetEvents(&events, &threads);
+
+  // Output thread names for main computation and tasks.
+  string trace = "{\"traceEvents\":[\n";
+  string cellname = JSONEscape(cell()->name());
+  StringAppendF(&trace,
+      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+      "\"args\":{\"name\":\"%s\"}}", cellname.c_str());
+  for (int t = 0; t <= cell()->num_tasks(); ++t) {
+    string name = "main";
+    if (t > 0) name = StringPrintf("task %d", cell()->task(t - 1));
+    StringAppendF(&trace,
+        ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+        "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", t, name.c_str());
+  }
+
+  // Output complete event for each recorded event.
+  int steps = cell()->steps().size();
+  int64 base = events.empty() ? 0 : events[0].start;
+  double mhz = Clock::mhz();
+  for (int i = 0; i < events.size(); ++i) {
+    const Event &e = events[i];
+    string name;
+    string category;
+    string args;
+    if (e.slot >= 1 && e.slot <= steps) {
+      const Step *step = cell()->steps()[e.slot - 1];
+      name = step->name();
+      category = step->kernel()->Name();
+      if (!step->variant().empty()) {
+        category.push_back('[');
+        category.append(step->variant());
+        category.push_back(']');
+      }
+      args = ",\"type\":\"" + JSONEscape(step->type()) + "\"";
+    } else {
+      int t = e.slot - 1 - steps;
+      bool wait = t % 2 == 1;
+      name = StringPrintf("%s task %d", wait ? "wait" : "start",
+                          cell()->task(t / 2));
+      category = "task";
+    }
+    StringAppendF(&trace,
+        ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,"
+        "\"args\":{\"invocation\":%lld%s}}",
+        JSONEscape(name).c_str(), JSONEscape(category).c_str(),
+        (e.start - base) / mhz, (e.end - e.start) / mhz, threads[i],
+        e.invocation, args.c_str());
+  }
+  trace.append("\n]}\n");
+  return trace;
+}
+
 int64 Profile::Complexity(const Step *step) {
   // Check if the kernel can compute the number of operations for step.
   int64 ops = step->complexity();
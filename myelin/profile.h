@@ -122,6 +122,24 @@ class Profile {
   // Timing profile report in ASCII format.
   string ASCIIReport() const;
 
+  // Timing event recorded in event ring buffer.
+  struct Event {
+    int64 slot;        // timing slot for step or task start/wait
+    int64 invocation;  // invocation number
+    int64 start;       // start timestamp in CPU cycles
+    int64 end;         // end timestamp in CPU cycles
+  };
+
+  // Get the events still in the ring buffers ordered by start time. The
+  // thread for each event is 0 for the main computation and i+1 for task i.
+  void GetEvents(std::vector<Event> *events, std::vector<int> *threads) const;
+
+  // Recorded timing events in Chrome trace event format, which can be loaded
+  // into chrome://tracing or Perfetto. Each task is shown as a separate
+  // thread with timestamps in microseconds relative to the first event.
+  // Requires event recording to be enabled for the network.
+  string ChromeTrace() const;
+
   // Estimate the number of operations performed by step.
   static int64 Complexity(const Step *step);
 
@@ -0,0 +1,285 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "myelin/work-stealing.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace sling {
+namespace myelin {
+
+// The completion status of a task is kept in the lower 32 bits of the state
+// field in the task structure, so waiting threads can park on it with a futex.
+enum TaskStatus {TASK_DONE = 0, TASK_QUEUED = 1, TASK_PARKED = 2};
+
+// Default number of spin iterations before parking a thread.
+static int spin_count = 4096;
+
+// Requested number of worker threads. Zero means one per CPU core.
+static int requested_pool_size = 0;
+
+static int *StatusWord(Task *task) {
+  return reinterpret_cast<int *>(&task->state);
+}
+
+static void FutexWait(int *addr, int value) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+}
+
+static void FutexWake(int *addr, int waiters) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, waiters, nullptr, nullptr, 0);
+}
+
+static inline void CPUPause() {
+  __builtin_ia32_pause();
+}
+
+// Queue of tasks waiting to be executed by a worker.
+class TaskQueue {
+ public:
+  // Add task to queue.
+  void Push(Task *task) {
+    std::lock_guard<std::mutex> lock(mu_);
+    tasks_.push_back(task);
+  }
+
+  // Remove the oldest task from the queue. Returns null if queue is empty.
+  Task *Pop() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (tasks_.empty()) return nullptr;
+    Task *task = tasks_.front();
+    tasks_.pop_front();
+    return task;
+  }
+
+  // Remove task from queue. Returns false if the task is not in the queue.
+  bool Remove(Task *task) {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = std::find(tasks_.begin(), tasks_.end(), task);
+    if (it == tasks_.end()) return false;
+    tasks_.erase(it);
+    return true;
+  }
+
+ private:
+  std::mutex mu_;
+  std::deque<Task *> tasks_;
+};
+
+// Process-wide pool of worker threads with one task queue per worker.
+class WorkerPool {
+ public:
+  // Return the shared worker pool. The pool is created on first use and is
+  // never destroyed, since instances can outlive static destructors.
+  static WorkerPool *Get() {
+    static WorkerPool *pool = new WorkerPool(requested_pool_size);
+    return pool;
+  }
+
+  // Check if the shared pool has been created.
+  static bool created() { return created_; }
+
+  // Number of worker threads.
+  int size() const { return queues_.size(); }
+
+  // Queue task for execution.
+  void Start(Task *task) {
+    __atomic_store_n(StatusWord(task), TASK_QUEUED, __ATOMIC_RELEASE);
+    queues_[Home(task)]->Push(task);
+    __atomic_add_fetch(&queued_, 1, __ATOMIC_SEQ_CST);
+
+    // Wake up an idle worker.
+    __atomic_add_fetch(&signal_, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&idle_, __ATOMIC_SEQ_CST) > 0) FutexWake(&signal_, 1);
+  }
+
+  // Wait for task to complete.
+  void Wait(Task *task) {
+    int *status = StatusWord(task);
+    if (__atomic_load_n(status, __ATOMIC_ACQUIRE) == TASK_DONE) return;
+
+    // Run task in the waiting thread if no worker has picked it up yet.
+    if (queues_[Home(task)]->Remove(task)) {
+      __atomic_sub_fetch(&queued_, 1, __ATOMIC_SEQ_CST);
+      task->func(task->arg);
+      __atomic_store_n(status, TASK_DONE, __ATOMIC_RELEASE);
+      return;
+    }
+
+    // Spin waiting for the worker to complete the task.
+    for (int i = 0; i < spin_count; ++i) {
+      if (__atomic_load_n(status, __ATOMIC_ACQUIRE) == TASK_DONE) return;
+      CPUPause();
+    }
+
+    // Park until the worker signals completion of the task.
+    int expected = TASK_QUEUED;
+    __atomic_compare_exchange_n(status, &expected, TASK_PARKED, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    while (__atomic_load_n(status, __ATOMIC_ACQUIRE) != TASK_DONE) {
+      FutexWait(status, TASK_PARKED);
+    }
+  }
+
+ private:
+  WorkerPool(int workers) {
+    if (workers <= 0) workers = std::thread::hardware_concurrency();
+    if (workers <= 0) workers = 1;
+
+    // Spinning only wastes cycles if there is just one CPU.
+    if (std::thread::hardware_concurrency() <= 1) spin_count = 0;
+    for (int i = 0; i < workers; ++i) queues_.push_back(new TaskQueue());
+    for (int i = 0; i < workers; ++i) {
+      threads_.emplace_back(&WorkerPool::Run, this, i);
+    }
+    created_ = true;
+    VLOG(3) << "Work-stealing pool with " << workers << " workers";
+  }
+
+  // Home queue for task based on the task id affinity hint.
+  int Home(Task *task) const {
+    return static_cast<unsigned>(task->id) % queues_.size();
+  }
+
+  // Get next task for worker, first from its own queue and then by stealing
+  // from the other queues.
+  Task *Next(int worker) {
+    if (__atomic_load_n(&queued_, __ATOMIC_SEQ_CST) == 0) return nullptr;
+    int n = queues_.size();
+    for (int i = 0; i < n; ++i) {
+      Task *task = queues_[(worker + i) % n]->Pop();
+      if (task != nullptr) {
+        __atomic_sub_fetch(&queued_, 1, __ATOMIC_SEQ_CST);
+        return task;
+      }
+    }
+    return nullptr;
+  }
+
+  // Run task and signal completion to a parked waiter.
+  static void Execute(Task *task) {
+    task->func(task->arg);
+    int *status = StatusWord(task);
+    int prev = __atomic_exchange_n(status, TASK_DONE, __ATOMIC_ACQ_REL);
+    if (prev == TASK_PARKED) FutexWake(status, INT_MAX);
+  }
+
+  // Worker thread.
+  void Run(int worker) {
+    for (;;) {
+      // Run tasks while there is work available.
+      Task *task = Next(worker);
+      if (task != nullptr) {
+        Execute(task);
+        continue;
+      }
+
+      // Spin waiting for new tasks.
+      for (int i = 0; i < spin_count; ++i) {
+        if (__atomic_load_n(&queued_, __ATOMIC_RELAXED) > 0) break;
+        CPUPause();
+      }
+
+      // Park worker until new tasks are queued.
+      __atomic_add_fetch(&idle_, 1, __ATOMIC_SEQ_CST);
+      int signal = __atomic_load_n(&signal_, __ATOMIC_SEQ_CST);
+      task = Next(worker);
+      if (task == nullptr) FutexWait(&signal_, signal);
+      __atomic_sub_fetch(&idle_, 1, __ATOMIC_SEQ_CST);
+      if (task != nullptr) Execute(task);
+    }
+  }
+
+  // Task queue for each worker.
+  std::vector<TaskQueue *> queues_;
+
+  // Worker threads.
+  std::vector<std::thread> threads_;
+
+  // Number of tasks in all the queues.
+  int queued_ = 0;
+
+  // Number of parked workers.
+  int idle_ = 0;
+
+  // Wake-up signal for parked workers.
+  int signal_ = 0;
+
+  // Whether the shared pool has been created.
+  static bool created_;
+};
+
+bool WorkerPool::created_ = false;
+
+static void StartTask(Task *task) {
+  WorkerPool::Get()->Start(task);
+}
+
+static void WaitTask(Task *task) {
+  WorkerPool::Get()->Wait(task);
+}
+
+void WorkStealingRuntime::AllocateInstance(Instance *instance) {
+  void *data;
+  int rc = posix_memalign(&data, instance->alignment(), instance->size());
+  CHECK_EQ(rc, 0);
+  memset(data, 0, instance->size());
+  instance->set_data(reinterpret_cast<char *>(data));
+}
+
+void WorkStealingRuntime::FreeInstance(Instance *instance) {
+  free(instance->data());
+}
+
+void WorkStealingRuntime::ClearInstance(Instance *instance) {
+  // Do not clear task data at the start of the instance block.
+  memset(instance->data() + instance->cell()->data_start(), 0,
+         instance->size() - instance->cell()->data_start());
+}
+
+Runtime::TaskFunc WorkStealingRuntime::StartTaskFunc() {
+  return StartTask;
+}
+
+Runtime::TaskFunc WorkStealingRuntime::WaitTaskFunc() {
+  return WaitTask;
+}
+
+void WorkStealingRuntime::SetPoolSize(int workers) {
+  CHECK(!WorkerPool::created()) << "Worker pool already started";
+  requested_pool_size = workers;
+}
+
+void WorkStealingRuntime::SetSpinCount(int spins) {
+  spin_count = spins;
+}
+
+int WorkStealingRuntime::PoolSize() {
+  return WorkerPool::Get()->size();
+}
+
+}  // namespace myelin
+}  // namespace sling
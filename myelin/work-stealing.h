@@ -0,0 +1,60 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MYELIN_WORK_STEALING_H_
+#define MYELIN_WORK_STEALING_H_
+
+#include "myelin/compute.h"
+
+namespace sling {
+namespace myelin {
+
+// Myelin runtime for executing parallel tasks on a process-wide pool of worker
+// threads. Unlike the multi-processor runtime, no threads are bound to
+// instances, so any number of instances can run parallel cells without
+// oversubscribing the machine. Each worker has its own task queue and idle
+// workers steal tasks from the other queues. The flow task id is used as an
+// affinity hint for selecting the queue for a task. Waiting for a task runs it
+// inline if no worker has picked it up yet; otherwise the waiting thread spins
+// for a while and then parks on a futex until the task completes.
+class WorkStealingRuntime : public Runtime {
+ public:
+  string Description() override { return "Work-stealing"; }
+
+  // Instance data allocation.
+  void AllocateInstance(Instance *instance) override;
+  void FreeInstance(Instance *instance) override;
+  void ClearInstance(Instance *instance) override;
+
+  // Work-stealing runtime support.
+  bool SupportsAsync() override { return true; }
+  TaskFunc StartTaskFunc() override;
+  TaskFunc WaitTaskFunc() override;
+
+  // Set the number of worker threads in the shared pool. This must be called
+  // before the first task is started. By default the pool has one worker for
+  // each CPU core.
+  static void SetPoolSize(int workers);
+
+  // Number of spin iterations before parking a waiting thread.
+  static void SetSpinCount(int spins);
+
+  // Return the number of worker threads in the shared pool.
+  static int PoolSize();
+};
+
+}  // namespace myelin
+}  // namespace sling
+
+#endif  // MYELIN_WORK_STEALING_H_
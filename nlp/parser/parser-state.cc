@@ -30,7 +30,8 @@ ParserState::ParserState(Store *store, int begin, int end)
       current_(begin),
       done_(false),
       frames_(store),
-      nesting_(begin) {}
+      nesting_(begin),
+      output_(store) {}
 
 ParserState::ParserState(const ParserState &other)
     : store_(other.store_),
@@ -42,10 +43,31 @@ ParserState::ParserState(const ParserState &other)
       mentions_(other.mentions_),
       frame_to_mention_(other.frame_to_mention_),
       attention_(other.attention_),
-      nesting_(other.nesting_) {
+      nesting_(other.nesting_),
+      output_(other.store_) {
   frames_.assign(other.frames_.begin(), other.frames_.end());
 }
 
+void ParserState::Reset(Store *store, int begin, int end) {
+  frames_.clear();
+  output_.clear();
+  if (store != store_) {
+    frames_.Relink(store);
+    output_.Relink(store);
+    store_ = store;
+  }
+  begin_ = begin;
+  end_ = end;
+  current_ = begin;
+  done_ = false;
+  mentions_.clear();
+  frame_to_mention_.clear();
+  attention_.clear();
+  nesting_.Reset(begin);
+  embed_.clear();
+  elaborate_.clear();
+}
+
 int ParserState::MaxEvokeLength(int max_length) const {
   if (current_ == end_) return 0;
   int end = max_length + current_;
@@ -413,22 +435,21 @@ void ParserState::AddParseToDocument(Document *document) {
   CHECK(document->store() == store_);
 
   // Get frames generated by parse.
-  Handles frames(store_);
-  GetFrames(&frames);
-  std::vector<bool> evoked(frames.size());
+  GetFrames(&output_);
+  evoked_.assign(output_.size(), false);
 
   // Add mentions to document document.
   for (Mention &m : mentions_) {
     Span *span = document->AddSpan(m.begin, m.end);
     if (span != nullptr) {
-      span->Evoke(frames[m.frame]);
-      evoked[m.frame] = true;
+      span->Evoke(output_[m.frame]);
+      evoked_[m.frame] = true;
     }
   }
 
   // Add frames to document that are not evoked by a phrase as thematic frames.
-  for (int i = 0; i < frames.size(); ++i) {
-    if (!evoked[i]) document->AddTheme(frames[i]);
+  for (int i = 0; i < output_.size(); ++i) {
+    if (!evoked_[i]) document->AddTheme(output_[i]);
   }
 }
 
@@ -36,6 +36,12 @@ class ParserState {
   // Clones parse state.
   ParserState(const ParserState &other);
 
+  // Reinitializes parse state for parsing another token range, possibly in
+  // another store. The buffers keep their capacity, so a reused parse state
+  // does not need to allocate memory for sentences that fit in the buffers.
+  // A null store unlinks the frame buffer from the current store.
+  void Reset(Store *store, int begin, int end);
+
   // Returns first token to be parsed.
   int begin() const { return begin_; }
 
@@ -163,6 +169,12 @@ class ParserState {
     // Current input buffer position.
     int current = 0;
 
+    // Clears the nesting and sets the current position.
+    void Reset(int begin) {
+      spans.clear();
+      current = begin;
+    }
+
     // Moves the current position ahead and pops relevant nesting information.
     void Advance() {
       current++;
@@ -239,6 +251,11 @@ class ParserState {
   // at the current position. This is cleared once the position advances.
   std::vector<std::pair<int, Handle>> embed_;
   std::vector<std::pair<int, Handle>> elaborate_;
+
+  // Final frames and evocation flags for adding the parse to the document.
+  // These are kept in the parse state so their buffers are reused.
+  Handles output_;
+  std::vector<bool> evoked_;
 };
 
 }  // namespace nlp
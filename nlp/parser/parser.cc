@@ -14,6 +14,9 @@
 
 #include "nlp/parser/parser.h"
 
+#include <string.h>
+#include <algorithm>
+
 #include "frame/serialization.h"
 #include "myelin/kernel/dragnn.h"
 #include "myelin/kernel/tensorflow.h"
@@ -21,14 +24,21 @@
 namespace sling {
 namespace nlp {
 
+Parser::~Parser() {
+  for (ParserInstance *instance : pool_) delete instance;
+}
+
 void Parser::Load(Store *store, const string &model) {
   // Register kernels for implementing parser ops.
   RegisterTensorflowLibrary(&library_);
   RegisterDragnnLibrary(&library_);
 
-  // Load and analyze parser flow file.
+  // Map and analyze parser flow file. The compiled network keeps a reference
+  // to the mapping, so the constants can be used in place from the mapping
+  // for the lifetime of the network.
   myelin::Flow flow;
-  CHECK(flow.Load(model));
+  CHECK(flow.Map(model));
+  AddActionSelection(&flow);
   flow.Analyze(library_);
 
   // Compile parser flow.
@@ -74,6 +84,8 @@ void Parser::Load(Store *store, const string &model) {
   ff_steps_ = GetParam("ff/steps");
   ff_hidden_ = GetParam("ff/hidden");
   ff_output_ = GetParam("ff/output");
+  ff_mask_ = GetParam("ff/mask");
+  ff_prediction_ = GetParam("ff/prediction");
 
   // Get attention depth.
   attention_depth_ = ff_feature_lr_attention_->elements();
@@ -111,6 +123,8 @@ void Parser::Load(Store *store, const string &model) {
   actions_.Init(store);
   num_actions_ = actions_.NumActions();
   CHECK_GT(num_actions_, 0);
+  CHECK_LE(num_actions_, ff_output_->elements());
+  BuildActionMasks();
 
   // Get the set of roles that connect two frames.
   for (int i = 0; i < num_actions_; ++i) {
@@ -135,6 +149,83 @@ void Parser::Load(Store *store, const string &model) {
   labeled_link_offset_ = unlabeled_link_offset_ + frame_limit_ * frame_limit_;
 }
 
+void Parser::AddActionSelection(myelin::Flow *flow) {
+  // The action with the highest score among the allowed actions is selected by
+  // an argmax over the logits in the FF cell. The mask has one bit for each
+  // action.
+  myelin::Flow::Function *ff = flow->Func("ff");
+  myelin::Flow::Variable *logits = flow->Var("ff/output");
+  CHECK(ff != nullptr);
+  CHECK(logits != nullptr);
+  int words = (logits->elements() + 31) / 32;
+  auto *mask = flow->AddVariable("ff/mask", myelin::DT_INT32, {words});
+  auto *prediction = flow->AddVariable("ff/prediction", myelin::DT_INT32, {1});
+  flow->AddOperation(ff, "ff/ArgMax", "ArgMax", {logits, mask}, {prediction});
+
+  // The logits are still needed for selecting an action if the predicted
+  // action cannot be applied.
+  logits->out = true;
+}
+
+void Parser::BuildActionMasks() {
+  // Find the attention buffer size and the number of remaining tokens needed
+  // for each action.
+  std::vector<int> attention(num_actions_);
+  std::vector<int> length(num_actions_);
+  for (int i = 0; i < num_actions_; ++i) {
+    const ParserAction &action = actions_.Action(i);
+    int a = 0;
+    int l = 0;
+    switch (action.type) {
+      case ParserAction::SHIFT:
+        l = 1;
+        break;
+      case ParserAction::STOP:
+        break;
+      case ParserAction::EVOKE:
+        l = action.length;
+        break;
+      case ParserAction::REFER:
+        l = action.length;
+        a = action.target + 1;
+        break;
+      case ParserAction::CONNECT:
+        a = std::max(action.source, action.target) + 1;
+        break;
+      case ParserAction::ASSIGN:
+      case ParserAction::ELABORATE:
+        a = action.source + 1;
+        break;
+      case ParserAction::EMBED:
+        a = action.target + 1;
+        break;
+    }
+    attention[i] = std::max(a, 0);
+    length[i] = std::max(l, 0);
+    max_attention_required_ = std::max(max_attention_required_, attention[i]);
+    max_length_required_ = std::max(max_length_required_, length[i]);
+  }
+
+  // Build the mask for each combination of attention buffer size and number
+  // of remaining tokens.
+  mask_words_ = (num_actions_ + 31) / 32;
+  int rows = max_attention_required_ + 1;
+  int cols = max_length_required_ + 1;
+  action_masks_.clear();
+  action_masks_.resize(rows * cols * mask_words_);
+  for (int a = 0; a < rows; ++a) {
+    for (int l = 0; l < cols; ++l) {
+      uint32 *mask = &action_masks_[(a * cols + l) * mask_words_];
+      for (int i = 0; i < num_actions_; ++i) {
+        if (actions_.Action(i).type == ParserAction::STOP) continue;
+        if (attention[i] <= a && length[i] <= l) {
+          mask[i >> 5] |= 1u << (i & 31);
+        }
+      }
+    }
+  }
+}
+
 int Parser::LookupWord(const string &word) const {
   // Lookup word in vocabulary.
   int id = lexicon_.Lookup(word);
@@ -156,46 +247,47 @@ int Parser::LookupWord(const string &word) const {
 }
 
 void Parser::Parse(Document *document) const {
+  // Get parser instance from the pool.
+  ParserInstance *data = AcquireInstance();
+
   // Parse each sentence of the document.
   for (SentenceIterator s(document); s.more(); s.next()) {
-    // Initialize parser model instance data.
-    ParserInstance data(this, document, s.begin(), s.end());
-    ParserState &state = data.state;
+    // Initialize parser instance for sentence.
+    data->Reset(document->store(), s.begin(), s.end());
+    ParserState &state = data->state;
 
     // Look up words in vocabulary.
     for (int i = s.begin(); i < s.end(); ++i) {
       int word = LookupWord(document->token(i).text());
-      data.words[i - s.begin()] = word;
+      data->words[i - s.begin()] = word;
     }
 
     // Compute left-to-right LSTM.
     for (int i = 0; i < s.length(); ++i) {
       // Attach hidden and control layers.
-      data.lr.Clear();
       int in = i > 0 ? i - 1 : s.length();
       int out = i;
-      data.AttachLR(in, out);
+      data->AttachLR(i, in, out);
 
       // Extract features.
-      data.ExtractFeaturesLR(out);
+      data->ExtractFeaturesLR(out);
 
       // Compute LSTM cell.
-      data.lr.Compute();
+      data->lr.Compute();
     }
 
     // Compute right-to-left LSTM.
     for (int i = 0; i < s.length(); ++i) {
       // Attach hidden and control layers.
-      data.rl.Clear();
       int in = s.length() - i;
       int out = in - 1;
-      data.AttachRL(in, out);
+      data->AttachRL(i, in, out);
 
       // Extract features.
-      data.ExtractFeaturesRL(out);
+      data->ExtractFeaturesRL(out);
 
       // Compute LSTM cell.
-      data.rl.Compute();
+      data->rl.Compute();
     }
 
     // Run FF to predict transitions.
@@ -204,28 +296,28 @@ void Parser::Parse(Document *document) const {
     int step = 0;
     while (!done) {
       // Allocate space for next step.
-      data.ff_step.push();
+      if (data->ff_step.size() == data->ff_step.capacity()) {
+        data->allocations++;
+      }
+      data->ff_step.push();
 
       // Attach instance to recurrent layers.
-      data.ff.Clear();
-      data.AttachFF(step);
+      data->AttachFF(step);
 
       // Extract features.
-      data.ExtractFeaturesFF(step);
-
-      // Predict next action.
-      data.ff.Compute();
-      float *output = data.ff.Get<float>(ff_output_);
-      int prediction = 0;
-      float max_score = -INFINITY;
-      for (int a = 0; a < num_actions_; ++a) {
-        if (output[a] > max_score) {
-          const ParserAction &action = actions_.Action(a);
-          if (state.CanApply(action)) {
-            prediction = a;
-            max_score = output[a];
-          }
-        }
+      data->ExtractFeaturesFF(step);
+
+      // Compute mask for actions that can possibly be applied.
+      data->ComputeActionMaskFF();
+
+      // Predict next action. The FF cell selects the highest scoring action
+      // allowed by the mask, but the mask does not cover all the constraints
+      // on the actions, so the prediction still needs to be checked.
+      data->ff.Compute();
+      int prediction = *data->ff.Get<int>(ff_prediction_);
+      if (prediction < 0 || prediction >= num_actions_ ||
+          !state.CanApply(actions_.Action(prediction))) {
+        prediction = data->SelectActionFF();
       }
 
       // Apply action to parser state.
@@ -251,14 +343,14 @@ void Parser::Parse(Document *document) const {
           steps_since_shift++;
           if (state.AttentionSize() > 0) {
             int focus = state.Attention(0);
-            if (data.create_step.size() < focus + 1) {
-              data.create_step.resize(focus + 1);
-              data.create_step[focus] = step;
+            if (data->create_step.size() < focus + 1) {
+              data->Resize(&data->create_step, focus + 1);
+              data->create_step[focus] = step;
             }
-            if (data.focus_step.size() < focus + 1) {
-              data.focus_step.resize(focus + 1);
+            if (data->focus_step.size() < focus + 1) {
+              data->Resize(&data->focus_step, focus + 1);
             }
-            data.focus_step[focus] = step;
+            data->focus_step[focus] = step;
           }
       }
 
@@ -269,6 +361,32 @@ void Parser::Parse(Document *document) const {
     // Add frames for sentence to the document.
     state.AddParseToDocument(document);
   }
+
+  // Return parser instance to the pool.
+  ReleaseInstance(data);
+}
+
+ParserInstance *Parser::AcquireInstance() const {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!pool_.empty()) {
+      ParserInstance *instance = pool_.back();
+      pool_.pop_back();
+      return instance;
+    }
+  }
+
+  // Each new parser instance allocates instance data blocks for the cells.
+  allocations_ += 3;
+  return new ParserInstance(this);
+}
+
+void Parser::ReleaseInstance(ParserInstance *instance) const {
+  allocations_ += instance->allocations;
+  instance->allocations = 0;
+  instance->state.Reset(nullptr, 0, 0);
+  std::lock_guard<std::mutex> lock(mu_);
+  pool_.push_back(instance);
 }
 
 myelin::Cell *Parser::GetCell(const string &name) {
@@ -295,10 +413,8 @@ myelin::Tensor *Parser::GetParam(const string &name) {
   return param;
 }
 
-ParserInstance::ParserInstance(const Parser *parser, Document *document,
-                               int begin, int end)
+ParserInstance::ParserInstance(const Parser *parser)
     : parser(parser),
-      state(document->store(), begin, end),
       lr(parser->lr_),
       rl(parser->rl_),
       ff(parser->ff_),
@@ -306,40 +422,119 @@ ParserInstance::ParserInstance(const Parser *parser, Document *document,
       lr_h(parser->lr_hidden_),
       rl_c(parser->rl_control_),
       rl_h(parser->rl_hidden_),
-      ff_step(parser->ff_step_) {
+      ff_step(parser->ff_step_),
+      lr_binding(parser->lr_),
+      rl_binding(parser->rl_),
+      ff_binding(parser->ff_) {
+  lr_binding.Link(parser->lr_c_in_, &lr_c, 1);
+  lr_binding.Link(parser->lr_c_out_, &lr_c, 1);
+  lr_binding.Link(parser->lr_h_in_, &lr_h, 1);
+  lr_binding.Link(parser->lr_h_out_, &lr_h, 1);
+
+  rl_binding.Link(parser->rl_c_in_, &rl_c, -1);
+  rl_binding.Link(parser->rl_c_out_, &rl_c, -1);
+  rl_binding.Link(parser->rl_h_in_, &rl_h, -1);
+  rl_binding.Link(parser->rl_h_out_, &rl_h, -1);
+
+  ff_binding.Link(parser->ff_lr_lstm_, &lr_h);
+  ff_binding.Link(parser->ff_rl_lstm_, &rl_h);
+  ff_binding.Link(parser->ff_steps_, &ff_step);
+  ff_binding.Link(parser->ff_hidden_, &ff_step, 1);
+}
+
+void ParserInstance::Reset(Store *store, int begin, int end) {
+  state.Reset(store, begin, end);
+
   // Allocate space for word ids.
   int length = end - begin;
-  words.resize(length);
-
-  // Add one extra element to LSTM activations for boundary element.
-  lr_c.resize(length + 1);
-  lr_h.resize(length + 1);
-  rl_c.resize(length + 1);
-  rl_h.resize(length + 1);
+  Resize(&words, length);
+  create_step.clear();
+  focus_step.clear();
+
+  // Add one extra element to LSTM activations for boundary element. The
+  // channels are cleared first, so all the elements are zeroed.
+  lr_c.clear();
+  lr_h.clear();
+  rl_c.clear();
+  rl_h.clear();
+  Resize(&lr_c, length + 1);
+  Resize(&lr_h, length + 1);
+  Resize(&rl_c, length + 1);
+  Resize(&rl_h, length + 1);
 
   // Reserve two transitions per token.
-  ff_step.reserve(length * 2);
+  ff_step.clear();
+  if (length * 2 > ff_step.capacity()) {
+    allocations++;
+    ff_step.reserve(length * 2);
+  }
+}
+
+void ParserInstance::Resize(myelin::Channel *channel, int n) {
+  if (n > channel->capacity()) allocations++;
+  channel->resize(n);
+}
+
+void ParserInstance::Resize(std::vector<int> *vector, int n) {
+  if (n > vector->capacity()) allocations++;
+  vector->resize(n);
 }
 
-void ParserInstance::AttachLR(int input, int output) {
-  lr.Set(parser->lr_c_in_, &lr_c, input);
-  lr.Set(parser->lr_c_out_, &lr_c, output);
-  lr.Set(parser->lr_h_in_, &lr_h, input);
-  lr.Set(parser->lr_h_out_, &lr_h, output);
+void ParserInstance::AttachLR(int step, int input, int output) {
+  if (!parser->use_bindings_) {
+    lr.Clear();
+    lr.Set(parser->lr_c_in_, &lr_c, input);
+    lr.Set(parser->lr_c_out_, &lr_c, output);
+    lr.Set(parser->lr_h_in_, &lr_h, input);
+    lr.Set(parser->lr_h_out_, &lr_h, output);
+    return;
+  }
+
+  // After the boundary element, the links just advance to the next token.
+  lr_binding.Reset(&lr);
+  if (step < 2) {
+    lr_binding.Bind(&lr, {input, output, input, output});
+  } else {
+    lr_binding.Advance(&lr);
+  }
 }
 
-void ParserInstance::AttachRL(int input, int output) {
-  rl.Set(parser->rl_c_in_, &rl_c, input);
-  rl.Set(parser->rl_c_out_, &rl_c, output);
-  rl.Set(parser->rl_h_in_, &rl_h, input);
-  rl.Set(parser->rl_h_out_, &rl_h, output);
+void ParserInstance::AttachRL(int step, int input, int output) {
+  if (!parser->use_bindings_) {
+    rl.Clear();
+    rl.Set(parser->rl_c_in_, &rl_c, input);
+    rl.Set(parser->rl_c_out_, &rl_c, output);
+    rl.Set(parser->rl_h_in_, &rl_h, input);
+    rl.Set(parser->rl_h_out_, &rl_h, output);
+    return;
+  }
+
+  rl_binding.Reset(&rl);
+  if (step == 0) {
+    rl_binding.Bind(&rl, {input, output, input, output});
+  } else {
+    rl_binding.Advance(&rl);
+  }
 }
 
-void ParserInstance::AttachFF(int output) {
-  ff.Set(parser->ff_lr_lstm_, &lr_h);
-  ff.Set(parser->ff_rl_lstm_, &rl_h);
-  ff.Set(parser->ff_steps_, &ff_step);
-  ff.Set(parser->ff_hidden_, &ff_step, output);
+void ParserInstance::AttachFF(int step) {
+  if (!parser->use_bindings_) {
+    ff.Clear();
+    ff.Set(parser->ff_lr_lstm_, &lr_h);
+    ff.Set(parser->ff_rl_lstm_, &rl_h);
+    ff.Set(parser->ff_steps_, &ff_step);
+    ff.Set(parser->ff_hidden_, &ff_step, step);
+    return;
+  }
+
+  // The links are rebound to the channel elements in each step, since the FF
+  // step channel can grow.
+  ff_binding.Reset(&ff);
+  if (step == 0) {
+    ff_binding.Bind(&ff, {0, 0, 0, step});
+  } else {
+    ff_binding.Advance(&ff);
+  }
 }
 
 void ParserInstance::ExtractFeaturesLR(int current) {
@@ -352,6 +547,51 @@ void ParserInstance::ExtractFeaturesRL(int current) {
   *rl.Get<int>(parser->rl_feature_words_) = word;
 }
 
+void ParserInstance::ComputeActionMaskFF() {
+  // Look up the mask for the attention buffer size and the number of remaining
+  // tokens.
+  int attention = state.AttentionSize();
+  if (attention > parser->max_attention_required_) {
+    attention = parser->max_attention_required_;
+  }
+  int remaining = state.end() - state.current();
+  if (remaining > parser->max_length_required_) {
+    remaining = parser->max_length_required_;
+  }
+  int cols = parser->max_length_required_ + 1;
+  int words = parser->mask_words_;
+  const uint32 *allowed =
+      &parser->action_masks_[(attention * cols + remaining) * words];
+
+  // Copy mask to FF cell. Stop is only allowed at the end of the input. The
+  // mask tensor is an int32 tensor holding the mask bits.
+  uint32 *mask = reinterpret_cast<uint32 *>(ff.Get<int32>(parser->ff_mask_));
+  memcpy(mask, allowed, words * sizeof(uint32));
+  if (remaining == 0) {
+    int stop = parser->actions_.StopIndex();
+    mask[stop >> 5] |= 1u << (stop & 31);
+  }
+}
+
+int ParserInstance::SelectActionFF() {
+  const uint32 *mask =
+      reinterpret_cast<const uint32 *>(ff.Get<int32>(parser->ff_mask_));
+  const float *output = ff.Get<float>(parser->ff_output_);
+  int prediction = 0;
+  float max_score = -INFINITY;
+  for (int a = 0; a < parser->num_actions_; ++a) {
+    if ((mask[a >> 5] & (1u << (a & 31))) == 0) continue;
+    if (output[a] > max_score) {
+      const ParserAction &action = parser->actions_.Action(a);
+      if (state.CanApply(action)) {
+        prediction = a;
+        max_score = output[a];
+      }
+    }
+  }
+  return prediction;
+}
+
 void ParserInstance::ExtractFeaturesFF(int step) {
   // Compute LSTM focus features.
   int current = state.current() - state.begin();
@@ -397,26 +637,22 @@ void ParserInstance::ExtractFeaturesFF(int step) {
   while (h < parser->history_size_ && s >= 0) history[h++] = s--;
   while (h < parser->history_size_) history[h++] = -2;
 
-  // Construct a mapping from absolute frame index -> attention index.
-  std::unordered_map<int, int> frame_to_attention;
-  for (int i = 0; i < parser->frame_limit_; ++i) {
-    if (i < state.AttentionSize()) {
-      frame_to_attention[state.Attention(i)] = i;
-    } else {
-      break;
-    }
-  }
+  // Only the frames in the first part of the attention buffer are used for
+  // the role features. The attention index of a frame is found by scanning
+  // this part of the attention buffer, which is short, so no mapping from
+  // frame index to attention index needs to be built for each step.
+  int frames = std::min(parser->frame_limit_, state.AttentionSize());
 
-  // Compute role features.
+  // Compute role features. The source frames are visited in attention order
+  // like in the trainer, so the same features are dropped when there are more
+  // than max_roles_.
   int *roles = ff.Get<int>(parser->ff_feature_roles_);
   int r = 0;
-  for (const auto &kv : frame_to_attention) {
-    // Attention index of the source frame.
-    int source = kv.second;
+  for (int source = 0; source < frames; ++source) {
     int outlink_base = parser->outlink_offset_ + source * parser->roles_.size();
 
     // Go over each slot of the source frame.
-    Handle handle = state.frame(kv.first);
+    Handle handle = state.frame(state.Attention(source));
     const FrameDatum *frame = state.store()->GetFrame(handle);
     for (const Slot *slot = frame->begin(); slot < frame->end(); ++slot) {
       const auto &it = parser->roles_.find(slot->name);
@@ -428,10 +664,11 @@ void ParserInstance::ExtractFeaturesFF(int step) {
         roles[r++] = outlink_base + role;
       }
       if (slot->value.IsIndex()) {
-        const auto &it2 = frame_to_attention.find(slot->value.AsIndex());
-        if (it2 != frame_to_attention.end()) {
-          // Attention index of the target frame.
-          int target = it2->second;
+        // Attention index of the target frame.
+        int target = 0;
+        int index = slot->value.AsIndex();
+        while (target < frames && state.Attention(target) != index) target++;
+        if (target < frames) {
           if (r < parser->max_roles_) {
             // (role, target)
             roles[r++] = parser->inlink_offset_ +
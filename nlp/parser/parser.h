@@ -15,7 +15,9 @@
 #ifndef NLP_PARSER_PARSER_H_
 #define NLP_PARSER_PARSER_H_
 
+#include <atomic>
 #include <limits>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -39,13 +41,34 @@ class ParserInstance;
 // Frame semantics parser model.
 class Parser {
  public:
+  ~Parser();
+
   // Load and initialize parser model.
   void Load(Store *store, const string &filename);
 
   // Parse document.
   void Parse(Document *document) const;
 
+  // Number of heap allocations for parser instances and their buffers. The
+  // parser instances are pooled and reused across sentences and documents, so
+  // this stops increasing once the pooled instances have grown to fit the
+  // longest sentences.
+  int64 allocations() const { return allocations_; }
+
+  // Step the network cells with instance bindings. Otherwise, the instances are
+  // cleared and the channel references are set in each step. This is slower
+  // but does not depend on the kernels writing all their outputs, so it can be
+  // used for checking the bindings.
+  bool use_bindings() const { return use_bindings_; }
+  void set_use_bindings(bool use_bindings) { use_bindings_ = use_bindings; }
+
  private:
+  // Get parser instance from the pool or create a new one.
+  ParserInstance *AcquireInstance() const;
+
+  // Return parser instance to the pool.
+  void ReleaseInstance(ParserInstance *instance) const;
+
   // Lookup cells, connectors, and parameters.
   myelin::Cell *GetCell(const string &name);
   myelin::Connector *GetConnector(const string &name);
@@ -54,6 +77,13 @@ class Parser {
   // Look up word in vocabulary. Return OOV for unknown words.
   int LookupWord(const string &word) const;
 
+  // Add masked argmax over the logits to the FF cell.
+  void AddActionSelection(myelin::Flow *flow);
+
+  // Build bitmasks for the actions that are applicable in principle for each
+  // combination of attention buffer size and remaining input tokens.
+  void BuildActionMasks();
+
   // Parser network.
   myelin::Library library_;
   myelin::Network network_;
@@ -102,6 +132,8 @@ class Parser {
   myelin::Tensor *ff_steps_;                 // link to FF step hidden layer
   myelin::Tensor *ff_hidden_;                // link to FF hidden layer output
   myelin::Tensor *ff_output_;                // link to FF logit layer output
+  myelin::Tensor *ff_mask_;                  // mask for allowed actions
+  myelin::Tensor *ff_prediction_;            // highest scoring allowed action
 
   // Number of attention features.
   int attention_depth_;
@@ -115,11 +147,22 @@ class Parser {
   // Number of output actions.
   int num_actions_;
 
+  // Action masks indexed by attention buffer size and number of remaining
+  // tokens, both capped at the maximum required by any action. Each mask has
+  // one bit per action. The STOP action is not included in the masks.
+  std::vector<uint32> action_masks_;
+  int mask_words_ = 0;
+  int max_attention_required_ = 0;
+  int max_length_required_ = 0;
+
   // Lexicon.
   myelin::Dictionary lexicon_;
   bool normalize_digits_ = false;
   int oov_ = -1;
 
+  // Step the cells with instance bindings.
+  bool use_bindings_ = true;
+
   // Global store for parser.
   Store *store_ = nullptr;
 
@@ -150,22 +193,36 @@ class Parser {
   Name n_token_text_{names_, "/s/token/text"};
   Name n_token_break_{names_, "/s/token/break"};
 
+  // Pool of parser instances for reuse.
+  mutable std::mutex mu_;
+  mutable std::vector<ParserInstance *> pool_;
+
+  // Number of heap allocations for parser instances.
+  mutable std::atomic<int64> allocations_{0};
+
   friend class ParserInstance;
 };
 
-// Parser state for running an instance of the parser on a document.
+// Parser state for running an instance of the parser on a document. Parser
+// instances are pooled by the parser and reused across sentences, so the
+// instance data blocks and channel buffers are only allocated when a sentence
+// needs more space than the previous sentences.
 class ParserInstance {
  public:
-  ParserInstance(const Parser *parser, Document *document, int begin, int end);
+  explicit ParserInstance(const Parser *parser);
 
-  // Attach connectors for LR LSTM.
-  void AttachLR(int input, int output);
+  // Prepare instance for parsing the tokens in [begin, end) of a document in
+  // a store.
+  void Reset(Store *store, int begin, int end);
 
-  // Attach connectors for RL LSTM.
-  void AttachRL(int input, int output);
+  // Prepare LR LSTM instance and attach connectors for a step.
+  void AttachLR(int step, int input, int output);
 
-  // Attach connectors for FF.
-  void AttachFF(int output);
+  // Prepare RL LSTM instance and attach connectors for a step.
+  void AttachRL(int step, int input, int output);
+
+  // Prepare FF instance and attach connectors for a step.
+  void AttachFF(int step);
 
   // Extract features for LR LSTM.
   void ExtractFeaturesLR(int current);
@@ -176,12 +233,27 @@ class ParserInstance {
   // Extract features for FF.
   void ExtractFeaturesFF(int step);
 
+  // Compute mask for the actions that can possibly be applied in the current
+  // parser state.
+  void ComputeActionMaskFF();
+
+  // Select the highest scoring applicable action among the actions allowed
+  // by the mask. This is used when the action predicted by the FF cell cannot
+  // be applied.
+  int SelectActionFF();
+
  private:
+  // Resize channel or vector and count the allocations needed for growing it.
+  void Resize(myelin::Channel *channel, int n);
+  void Resize(std::vector<int> *vector, int n);
+
   // Parser model.
   const Parser *parser;
 
-  // Parser transition state.
-  ParserState state;
+  // Parser transition state. This is reset for each sentence, and it is
+  // unlinked from the document store when the instance is returned to the
+  // pool.
+  ParserState state{nullptr, 0, 0};
 
   // Instances for network computations.
   myelin::Instance lr;
@@ -195,6 +267,13 @@ class ParserInstance {
   myelin::Channel rl_h;
   myelin::Channel ff_step;
 
+  // Bindings of instance references to channels. The LR and RL LSTM links
+  // advance one token forward and backward per step, and the FF hidden layer
+  // link advances one element per step.
+  myelin::InstanceBinding lr_binding;
+  myelin::InstanceBinding rl_binding;
+  myelin::InstanceBinding ff_binding;
+
   // Word ids.
   std::vector<int> words;
 
@@ -202,6 +281,9 @@ class ParserInstance {
   std::vector<int> create_step;
   std::vector<int> focus_step;
 
+  // Number of heap allocations since the instance was acquired from the pool.
+  int64 allocations = 0;
+
   friend class Parser;
 };
 
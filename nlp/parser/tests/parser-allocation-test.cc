@@ -0,0 +1,160 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks that the parser does not allocate heap memory per sentence once the
+// pooled parser instance has grown to fit the input. All calls to operator new
+// are counted while parsing. The document annotations added by the parser
+// need to be allocated, so the allocations made by adding the same annotations
+// to a fresh copy of the document are subtracted from the count.
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <string>
+
+#include "base/flags.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "frame/object.h"
+#include "frame/serialization.h"
+#include "frame/store.h"
+#include "nlp/document/document.h"
+#include "nlp/document/token-breaks.h"
+#include "nlp/parser/parser.h"
+
+DEFINE_string(parser, "", "Parser model flow file");
+DEFINE_string(commons, "", "Commons store with parser schemas");
+DEFINE_string(text,
+              "John Smith was born in London . "
+              "He moved to Paris with his wife in 1980 . "
+              "They lived there for ten years .",
+              "Tokenized text with sentences separated by periods");
+DEFINE_int32(repeat, 10, "Number of times to parse the document");
+
+using sling::Handle;
+using sling::Slot;
+using sling::Store;
+using sling::nlp::Document;
+using sling::nlp::Parser;
+using sling::nlp::Span;
+
+// Number of calls to operator new while counting is enabled.
+static std::atomic<int64> allocations{0};
+static std::atomic<bool> counting{false};
+
+void *operator new(size_t size) {
+  if (counting) allocations++;
+  void *ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+// Count the allocations made by a function.
+template<typename F> int64 CountAllocations(F f) {
+  allocations = 0;
+  counting = true;
+  f();
+  counting = false;
+  return allocations;
+}
+
+// Make document with tokens from text. A period ends a sentence.
+Document *MakeDocument(Store *store, const string &text) {
+  Document *document = new Document(store);
+  bool sentence_start = true;
+  size_t begin = 0;
+  while (begin < text.size()) {
+    size_t end = text.find(' ', begin);
+    if (end == string::npos) end = text.size();
+    if (end > begin) {
+      string token = text.substr(begin, end - begin);
+      sling::nlp::BreakType brk = sling::nlp::SPACE_BREAK;
+      if (begin == 0) {
+        brk = sling::nlp::NO_BREAK;
+      } else if (sentence_start) {
+        brk = sling::nlp::SENTENCE_BREAK;
+      }
+      document->AddToken(begin, end, token, brk);
+      sentence_start = token == ".";
+    }
+    begin = end + 1;
+  }
+  document->Update();
+  return document;
+}
+
+// Add the spans and thematic frames of a parsed document to another document.
+void CopyAnnotations(const Document &source, Document *target) {
+  Handle n_evokes = target->store()->Lookup("/s/phrase/evokes");
+  for (int i = 0; i < source.num_spans(); ++i) {
+    Span *span = source.span(i);
+    if (span->deleted()) continue;
+    Span *copy = target->AddSpan(span->begin(), span->end());
+    const sling::FrameDatum *mention = span->mention().store()->GetFrame(
+        span->mention().handle());
+    for (const Slot *slot = mention->begin(); slot < mention->end(); ++slot) {
+      if (slot->name == n_evokes) copy->Evoke(slot->value);
+    }
+  }
+  for (Handle theme : source.themes()) target->AddTheme(theme);
+}
+
+int main(int argc, char *argv[]) {
+  sling::InitProgram(&argc, &argv);
+  CHECK(!FLAGS_parser.empty()) << "No parser model";
+
+  // Use a large initial heap so the stores do not need to grow while parsing.
+  Store::Options options;
+  options.initial_heap_size = 64 * (1 << 20);
+  Store commons(&options);
+  if (!FLAGS_commons.empty()) sling::LoadStore(FLAGS_commons, &commons);
+  Parser parser;
+  parser.Load(&commons, FLAGS_parser);
+  commons.Freeze();
+
+  int sentences = 0;
+  int64 overhead = 0;
+  for (int i = 0; i < FLAGS_repeat; ++i) {
+    Store store(&commons);
+    Document *document = MakeDocument(&store, FLAGS_text);
+    Document *copy = MakeDocument(&store, FLAGS_text);
+    for (sling::nlp::SentenceIterator s(document); s.more(); s.next()) {
+      if (i == 0) sentences++;
+    }
+
+    int64 parse = CountAllocations([&]() { parser.Parse(document); });
+    int64 output = CountAllocations([&]() {
+      CopyAnnotations(*document, copy);
+    });
+    LOG(INFO) << "Parse " << i << ": " << parse << " allocations, "
+              << output << " for annotations";
+
+    // The first parse grows the parser instance to fit the input.
+    if (i > 0) overhead += parse - output;
+    delete document;
+    delete copy;
+  }
+
+  // Check that the parser did not allocate memory for its own state after the
+  // first parse.
+  LOG(INFO) << sentences << " sentences, " << overhead
+            << " parser allocations after warm-up";
+  CHECK_LE(overhead, 0) << "Parser allocates memory in steady state";
+  LOG(INFO) << "PASS";
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks that stepping the parser cells with instance bindings gives the same
+// annotations as clearing the instances and setting the channel references in
+// each step. The bindings only clear the cell inputs, so this catches kernels
+// that do not write all their outputs.
+
+#include <string>
+
+#include "base/flags.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "frame/serialization.h"
+#include "frame/store.h"
+#include "nlp/document/document.h"
+#include "nlp/document/token-breaks.h"
+#include "nlp/parser/parser.h"
+
+DEFINE_string(parser, "", "Parser model flow file");
+DEFINE_string(commons, "", "Commons store with parser schemas");
+DEFINE_string(text,
+              "John Smith was born in London . "
+              "He moved to Paris with his wife in 1980 . "
+              "They lived there for ten years .",
+              "Tokenized text with sentences separated by periods");
+
+using sling::Store;
+using sling::nlp::Document;
+using sling::nlp::Parser;
+
+// Make document with tokens from text. A period ends a sentence.
+Document *MakeDocument(Store *store, const string &text) {
+  Document *document = new Document(store);
+  bool sentence_start = true;
+  size_t begin = 0;
+  while (begin < text.size()) {
+    size_t end = text.find(' ', begin);
+    if (end == string::npos) end = text.size();
+    if (end > begin) {
+      string token = text.substr(begin, end - begin);
+      sling::nlp::BreakType brk = sling::nlp::SPACE_BREAK;
+      if (begin == 0) {
+        brk = sling::nlp::NO_BREAK;
+      } else if (sentence_start) {
+        brk = sling::nlp::SENTENCE_BREAK;
+      }
+      document->AddToken(begin, end, token, brk);
+      sentence_start = token == ".";
+    }
+    begin = end + 1;
+  }
+  document->Update();
+  return document;
+}
+
+// Parse text and return the annotated document in text format.
+string Annotate(const Parser &parser, Store *commons, const string &text) {
+  Store store(commons);
+  Document *document = MakeDocument(&store, text);
+  parser.Parse(document);
+  document->Update();
+  string annotations = sling::ToText(document->top(), 2);
+  delete document;
+  return annotations;
+}
+
+int main(int argc, char *argv[]) {
+  sling::InitProgram(&argc, &argv);
+  CHECK(!FLAGS_parser.empty()) << "No parser model";
+
+  Store commons;
+  if (!FLAGS_commons.empty()) sling::LoadStore(FLAGS_commons, &commons);
+  Parser parser;
+  parser.Load(&commons, FLAGS_parser);
+  commons.Freeze();
+
+  // Parse the text twice with each method, so the pooled instances are reused
+  // with data left over from the previous document.
+  string expected;
+  for (bool bindings : {false, true, false, true}) {
+    parser.set_use_bindings(bindings);
+    string annotations = Annotate(parser, &commons, FLAGS_text);
+    if (expected.empty()) {
+      expected = annotations;
+      LOG(INFO) << "Annotations:\n" << expected;
+    }
+    CHECK_EQ(annotations, expected)
+        << "Annotations differ with bindings " << (bindings ? "on" : "off");
+  }
+
+  LOG(INFO) << "PASS";
+  return 0;
+}
@@ -14,6 +14,9 @@
 
 #include "nlp/parser/trainer/feature.h"
 
+#include <algorithm>
+#include <unordered_map>
+
 #include "file/file.h"
 #include "stream/file-input.h"
 #include "string/strcat.h"
@@ -590,23 +593,20 @@ class FrameRolesFeature : public SemparFeature {
     const ParserState *s = args->parser_state();
 
     // Construct a mapping from absolute frame index -> attention index.
+    int frames = std::min(frame_limit_, s->AttentionSize());
     std::unordered_map<int, int> frame_to_attention;
-    for (int i = 0; i < frame_limit_; ++i) {
-      if (i < s->AttentionSize()) {
-        frame_to_attention[s->Attention(i)] = i;
-      } else {
-        break;
-      }
+    for (int i = 0; i < frames; ++i) {
+      frame_to_attention[s->Attention(i)] = i;
     }
 
-    // Output features.
-    for (const auto &kv : frame_to_attention) {
-      // Attention index of the source frame.
-      int source = kv.second;
+    // Output features with the source frames in attention order. This is the
+    // same order as in the runtime parser, which truncates the role features
+    // to the feature size.
+    for (int source = 0; source < frames; ++source) {
       int outlink_base = outlink_offset_ + source * roles_.size();
 
       // Go over each slot of the source frame.
-      Handle handle = s->frame(kv.first);
+      Handle handle = s->frame(s->Attention(source));
       const sling::FrameDatum *frame = s->store()->GetFrame(handle);
       for (const Slot *slot = frame->begin(); slot < frame->end(); ++slot) {
         const auto &it = roles_.find(slot->name);
@@ -78,16 +78,27 @@ class File:
       self.write_int(len(s))
       self.f.write(s)
 
+  def align(self, size):
+    """Write padding to align data block in flow file."""
+    alignment = 4096 if size >= 4096 else 64
+    misalignment = self.f.tell() % alignment
+    if misalignment != 0: self.f.write('\0' * (alignment - misalignment))
+
   def write_array(self, a):
-    """Write array to flow file."""
+    """Write array to flow file. The data is aligned so it can be used
+    directly from a memory-mapped flow file."""
     if a is None:
       self.write_long(0)
     elif isinstance(a, str):
       self.write_long(len(a))
-      self.f.write(a)
+      if len(a) > 0:
+        self.align(len(a))
+        self.f.write(a)
     else:
       self.write_long(a.nbytes)
-      a.tofile(self.f)
+      if a.nbytes > 0:
+        self.align(a.nbytes)
+        a.tofile(self.f)
 
 
 class Variable:
@@ -249,7 +260,7 @@ class Flow:
     # Write flow file header
     f = File(filename)
     f.write('flow')
-    f.write_int(4)
+    f.write_int(5)
 
     # Write variables.
     f.write_int(len(self.vars))
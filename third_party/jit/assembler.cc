@@ -1027,10 +1027,12 @@ void Assembler::load_rax(const void *value) {
   if (kPointerSize == kInt64Size) {
     emit(0x48);  // REX.W
     emit(0xA1);
+    externs_.push_back(pc_offset());
     emitp(value);
   } else {
     DCHECK(kPointerSize == kInt32Size);
     emit(0xA1);
+    externs_.push_back(pc_offset());
     emitp(value);
     // In 64-bit mode, need to zero extend the operand to 8 bytes.
     // See 2.2.1.4 in Intel64 and IA32 Architectures Software
@@ -1173,6 +1175,7 @@ void Assembler::movp(Register dst, const void *value) {
   EnsureSpace ensure_space(this);
   emit_rex(dst, kPointerSize);
   emit(0xB8 | dst.low_bits());
+  externs_.push_back(pc_offset());
   emitp(value);
 }
 
@@ -1671,10 +1674,12 @@ void Assembler::store_rax(const void *dst) {
   if (kPointerSize == kInt64Size) {
     emit(0x48);  // REX.W
     emit(0xA3);
+    externs_.push_back(pc_offset());
     emitp(dst);
   } else {
     DCHECK(kPointerSize == kInt32Size);
     emit(0xA3);
+    externs_.push_back(pc_offset());
     emitp(dst);
     // In 64-bit mode, need to zero extend the operand to 8 bytes.
     // See 2.2.1.4 in Intel64 and IA32 Architectures Software
@@ -3735,6 +3740,26 @@ void Assembler::sqrtsd(XMMRegister dst, const Operand &src) {
   emit_sse_operand(dst, src);
 }
 
+void Assembler::sqrtpd(XMMRegister dst, XMMRegister src) {
+  DCHECK(Enabled(SSE2));
+  EnsureSpace ensure_space(this);
+  emit(0x66);
+  emit_optional_rex_32(dst, src);
+  emit(0x0F);
+  emit(0x51);
+  emit_sse_operand(dst, src);
+}
+
+void Assembler::sqrtpd(XMMRegister dst, const Operand &src) {
+  DCHECK(Enabled(SSE2));
+  EnsureSpace ensure_space(this);
+  emit(0x66);
+  emit_optional_rex_32(dst, src);
+  emit(0x0F);
+  emit(0x51);
+  emit_sse_operand(dst, src);
+}
+
 void Assembler::ucomisd(XMMRegister dst, XMMRegister src) {
   DCHECK(Enabled(MMX));
   EnsureSpace ensure_space(this);
@@ -4019,7 +4044,7 @@ void Assembler::vfmad(byte op, YMMRegister dst, YMMRegister src1,
                       YMMRegister src2) {
   DCHECK(Enabled(FMA3));
   EnsureSpace ensure_space(this);
-  emit_vex_prefix(dst.xmm(), src1.xmm(), src2.xmm(), kLIG, k66, k0F38, kW1);
+  emit_vex_prefix(dst.xmm(), src1.xmm(), src2.xmm(), kL256, k66, k0F38, kW1);
   emit(op);
   emit_sse_operand(dst.xmm(), src2.xmm());
 }
@@ -4028,7 +4053,7 @@ void Assembler::vfmad(byte op, YMMRegister dst, YMMRegister src1,
                       const Operand &src2) {
   DCHECK(Enabled(FMA3));
   EnsureSpace ensure_space(this);
-  emit_vex_prefix(dst.xmm(), src1.xmm(), src2, kLIG, k66, k0F38, kW1);
+  emit_vex_prefix(dst.xmm(), src1.xmm(), src2, kL256, k66, k0F38, kW1);
   emit(op);
   emit_sse_operand(dst.xmm(), src2);
 }
@@ -1044,6 +1044,8 @@ class Assembler : public CodeGenerator {
 
   void sqrtsd(XMMRegister dst, XMMRegister src);
   void sqrtsd(XMMRegister dst, const Operand &src);
+  void sqrtpd(XMMRegister dst, XMMRegister src);
+  void sqrtpd(XMMRegister dst, const Operand &src);
 
   void ucomisd(XMMRegister dst, XMMRegister src);
   void ucomisd(XMMRegister dst, const Operand &src);
@@ -1828,6 +1830,40 @@ class Assembler : public CodeGenerator {
     vinstr(0x1a, dst, ymm0, src, k66, k0F38, kW0);
   }
 
+  void vcvtph2ps(XMMRegister dst, XMMRegister src) {
+    DCHECK(Enabled(F16C));
+    vinstr(0x13, dst, xmm0, src, k66, k0F38, kW0);
+  }
+  void vcvtph2ps(XMMRegister dst, const Operand &src) {
+    DCHECK(Enabled(F16C));
+    vinstr(0x13, dst, xmm0, src, k66, k0F38, kW0);
+  }
+  void vcvtph2ps(YMMRegister dst, XMMRegister src) {
+    DCHECK(Enabled(F16C));
+    YMMRegister isrc = {src.code()};
+    vinstr(0x13, dst, ymm0, isrc, k66, k0F38, kW0);
+  }
+  void vcvtph2ps(YMMRegister dst, const Operand &src) {
+    DCHECK(Enabled(F16C));
+    vinstr(0x13, dst, ymm0, src, k66, k0F38, kW0);
+  }
+
+  void vpmovzxwd(XMMRegister dst, XMMRegister src) {
+    vinstr(0x33, dst, xmm0, src, k66, k0F38, kWIG);
+  }
+  void vpmovzxwd(XMMRegister dst, const Operand &src) {
+    vinstr(0x33, dst, xmm0, src, k66, k0F38, kWIG);
+  }
+  void vpmovzxwd(YMMRegister dst, XMMRegister src) {
+    DCHECK(Enabled(AVX2));
+    YMMRegister isrc = {src.code()};
+    vinstr(0x33, dst, ymm0, isrc, k66, k0F38, kWIG);
+  }
+  void vpmovzxwd(YMMRegister dst, const Operand &src) {
+    DCHECK(Enabled(AVX2));
+    vinstr(0x33, dst, ymm0, src, k66, k0F38, kWIG);
+  }
+
   void vinsertf128(YMMRegister dst, YMMRegister src1, XMMRegister src2,
                    int8_t imm8) {
     YMMRegister isrc = {src2.code()};
@@ -2034,6 +2070,32 @@ class Assembler : public CodeGenerator {
     vinstr(0x5b, dst, ymm0, src, kNone, k0F, kWIG);
   }
 
+  void vsqrtps(XMMRegister dst, XMMRegister src) {
+    vinstr(0x51, dst, xmm0, src, kNone, k0F, kWIG);
+  }
+  void vsqrtps(XMMRegister dst, const Operand &src) {
+    vinstr(0x51, dst, xmm0, src, kNone, k0F, kWIG);
+  }
+  void vsqrtps(YMMRegister dst, YMMRegister src) {
+    vinstr(0x51, dst, ymm0, src, kNone, k0F, kWIG);
+  }
+  void vsqrtps(YMMRegister dst, const Operand &src) {
+    vinstr(0x51, dst, ymm0, src, kNone, k0F, kWIG);
+  }
+
+  void vsqrtpd(XMMRegister dst, XMMRegister src) {
+    vinstr(0x51, dst, xmm0, src, k66, k0F, kWIG);
+  }
+  void vsqrtpd(XMMRegister dst, const Operand &src) {
+    vinstr(0x51, dst, xmm0, src, k66, k0F, kWIG);
+  }
+  void vsqrtpd(YMMRegister dst, YMMRegister src) {
+    vinstr(0x51, dst, ymm0, src, k66, k0F, kWIG);
+  }
+  void vsqrtpd(YMMRegister dst, const Operand &src) {
+    vinstr(0x51, dst, ymm0, src, k66, k0F, kWIG);
+  }
+
   void vzeroall();
   void vzeroupper();
 
@@ -37,6 +37,7 @@
 #define JIT_CODE_H_
 
 #include <deque>
+#include <vector>
 
 #include "base/logging.h"
 #include "third_party/jit/memory.h"
@@ -162,6 +163,10 @@ class CodeGenerator {
     *reinterpret_cast<uint32_t *>(addr_at(pos)) = x;
   }
 
+  // Positions of absolute addresses of code and data outside the code buffer.
+  // These need to be relocated if the code is linked into another program.
+  const std::vector<int> &externs() const { return externs_; }
+
   static const int kMinimalBufferSize = 4096;
   static const int kMaximumInstructionSize = 32;
 
@@ -179,6 +184,9 @@ class CodeGenerator {
   // GrowBuffer(); contains only those internal references whose labels
   // are already bound.
   std::deque<int> refs_;
+
+  // Positions of absolute addresses outside the code buffer.
+  std::vector<int> externs_;
 };
 
 // Helper class that ensures that there is enough space for generating
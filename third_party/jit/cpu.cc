@@ -98,6 +98,7 @@ ProcessorInformation::ProcessorInformation() {
     has_osxsave_ = (cpu_info[2] & 0x08000000) != 0;
     has_avx_ = (cpu_info[2] & 0x10000000) != 0;
     has_fma3_ = (cpu_info[2] & 0x00001000) != 0;
+    has_f16c_ = (cpu_info[2] & 0x20000000) != 0;
   }
 
   // There are separate feature flags for VEX-encoded GPR instructions.
@@ -234,6 +235,7 @@ void CPU::Initialize() {
   if (cpu.has_osxsave() && os_has_avx_support()) {
     features |= 1u << AVX;
     if (cpu.has_fma3()) features |= 1u << FMA3;
+    if (cpu.has_f16c()) features |= 1u << F16C;
     if (cpu.has_avx2()) features |= 1u << AVX2;
   }
 
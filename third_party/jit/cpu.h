@@ -74,6 +74,7 @@ class ProcessorInformation {
   bool has_avx() const { return has_avx_; }
   bool has_avx2() const { return has_avx2_; }
   bool has_fma3() const { return has_fma3_; }
+  bool has_f16c() const { return has_f16c_; }
   bool has_bmi1() const { return has_bmi1_; }
   bool has_bmi2() const { return has_bmi2_; }
   bool has_lzcnt() const { return has_lzcnt_; }
@@ -105,6 +106,7 @@ class ProcessorInformation {
   bool has_avx_ = false;
   bool has_avx2_ = false;
   bool has_fma3_ = false;
+  bool has_f16c_ = false;
   bool has_bmi1_ = false;
   bool has_bmi2_ = false;
   bool has_lzcnt_ = false;
@@ -125,6 +127,7 @@ enum CpuFeature {
   AVX,
   AVX2,
   FMA3,
+  F16C,
   SAHF,
   BMI1,
   BMI2,